@@ -9,8 +9,18 @@
 
 #include "../scene.h"
 #include "model.h"
+#include "texture_cache.h"
+#include "texture_streamer.h"
+#include "vertex_format.h"
+#include "meshlet.h"
+#include "bounding_volume.h"
+#include "software_occlusion.h"
+#include "frame_ring_buffer.h"
+#include "draw_list.h"
+#include "upload_batch.h"
 #include "raii.h"
 #include "../util.h"
+#include "../thread_pool.h"
 #include "vulkan_util.h"
 #include "context.h"
 
@@ -27,6 +37,10 @@
 #include <algorithm>
 #include <fstream>
 #include <chrono>
+#include <iostream>
+#include <cmath>
+#include <limits>
+#include <cstddef>
 
 using util::Vertex;
 
@@ -36,6 +50,28 @@ const int MAX_POINT_LIGHT_PER_TILE = 1023;
 // const int TILE_SIZE = 16;
 const int TILE_SIZE = 16;
 
+const float CAMERA_NEAR_PLANE = 0.5f;
+const float CAMERA_FAR_PLANE = 100.0f;
+
+// frames in flight: the CPU prepares a frame while the GPU renders the previous one
+const uint32_t FRAME_COUNT = 2;
+
+// ranges of each frame's region of the frame ring buffer
+enum FrameRange : uint32_t
+{
+	FRAME_RANGE_CAMERA = 0,
+	FRAME_RANGE_LIGHTS,
+	FRAME_RANGE_MESHLET_DRAWS,
+	FRAME_RANGE_DEPTH_MESHLET_DRAWS,  // the same draws, with vertex offsets into the depth geometry pool
+	FRAME_RANGE_CULLING,  // CullingParameters, then a PartCullState per mesh part
+	FRAME_RANGE_DRAW_COUNTS,  // DrawCountsHeader, then the draw count of each mesh part, written by meshlet culling
+	FRAME_RANGE_INSTANCES,  // InstanceData of every live instance, packed
+	FRAME_RANGE_COUNT
+};
+
+// instances of the model a frame can draw
+const uint32_t MAX_INSTANCE_COUNT = 1024;
+
 struct PointLight
 {
 public:
@@ -52,11 +88,14 @@ public:
 };
 
 
-// uniform buffer object for model transformation
-struct SceneObjectUbo
+// a copy of the model as read by the vertex shaders through gl_InstanceIndex, std430, see instances.glsl
+struct InstanceData
 {
 	glm::mat4 model;
+	glm::mat4 normal; // transpose(inverse(model)), so the vertex shaders need no inverse
+	glm::mat4 mvp;
 };
+static_assert(sizeof(InstanceData) == 192, "unexpected padding in InstanceData");
 
 // uniform buffer object for camera
 struct CameraUbo
@@ -67,11 +106,84 @@ struct CameraUbo
 	glm::vec3 cam_pos;
 };
 
+// a meshlet as read by meshlet_culling.comp, std430
+struct MeshletCullRecord
+{
+	glm::vec4 sphere; // model space center and radius
+	glm::vec4 cone; // axis and cutoff
+	glm::vec4 box_min; // model space bounds of the vertices, tighter than the sphere for occlusion tests
+	glm::vec4 box_max;
+	uint32_t first_index; // in the index section of the part
+	uint32_t index_count;
+	int32_t vertex_offset; // in the geometry pool
+	int32_t position_offset; // in the depth geometry pool
+	uint32_t part;
+	uint32_t meshlet; // in the part
+	uint32_t padding[2];
+};
+static_assert(sizeof(MeshletCullRecord) == 96, "unexpected padding in MeshletCullRecord");
+
+// level of detail and frustum test of a mesh part, picked by the CPU every frame
+struct PartCullState
+{
+	glm::vec4 box_min; // model space, for occlusion culling
+	glm::vec4 box_max;
+	uint32_t first_meshlet;
+	uint32_t meshlet_count;
+	uint32_t visibility; // FrustumTest, or PART_OCCLUDED
+	uint32_t first_draw;
+};
+
+// PartCullState::visibility of a part hidden by software occlusion, or by the depth pyramid in the part pass of meshlet culling
+const uint32_t PART_OCCLUDED = 3;
+
+struct CullingParameters
+{
+	glm::vec4 viewer_position; // model space of the only instance, w is 0 to skip cone culling
+	glm::mat4 pyramid_projview; // model space to the clip space of the frame depth_pyramid was built from
+	glm::ivec4 pyramid; // depth image size, depth pyramid level count, and 0 to skip occlusion culling
+	glm::uvec4 instances; // x: instance count, written into every draw; y: frustums to test meshlets against, 0 to draw every meshlet of the picked levels
+	Frustum frustums[MAX_INSTANCE_COUNT]; // model space, of each instance
+};
+static_assert(sizeof(CullingParameters) == 112 + sizeof(Frustum) * MAX_INSTANCE_COUNT, "unexpected padding in CullingParameters");
+
+// counters of meshlet culling, before the draw count of each part
+struct DrawCountsHeader
+{
+	uint32_t visible_meshlets;
+	uint32_t visible_triangles;
+	uint32_t occluded_parts;
+	uint32_t occluded_triangles;
+};
+
+struct MeshletCullingPushConstants
+{
+	uint32_t count; // of mesh parts in the part pass, of meshlets otherwise
+	uint32_t compact_draws; // with draw counts, see meshlet_culling.comp
+	uint32_t part_pass;
+};
+
+struct DepthPyramidPushConstants
+{
+	glm::ivec2 source_size;
+	glm::ivec2 size;
+};
+
+const uint32_t MESHLET_CULLING_GROUP_SIZE = 64;
+const uint32_t DEPTH_PYRAMID_GROUP_SIZE = 8;
+const uint32_t MAX_DEPTH_PYRAMID_LEVELS = 16;
+const uint32_t SOFTWARE_OCCLUSION_WIDTH = 320; // pixels, the height follows the aspect ratio of the swap chain
+
+// pipelines in the sort keys of draw lists
+const uint32_t DRAW_PIPELINE_DEPTH = 0;
+const uint32_t DRAW_PIPELINE_FORWARD = 1;
+
 struct PushConstantObject
 {
 	glm::ivec2 viewport_size;
 	glm::ivec2 tile_nums;
 	int debugview_index; // TODO: separate this and only have it in debug mode?
+	int material_index = 0; // into the bindless materials, pushed again for each mesh part
 
 	PushConstantObject(int viewport_size_x, int viewport_size_y, int tile_num_x, int tile_num_y, int debugview_index = 0)
 		: viewport_size(viewport_size_x, viewport_size_y),
@@ -79,6 +191,7 @@ struct PushConstantObject
 		debugview_index(debugview_index)
 	{}
 };
+static_assert(sizeof(PushConstantObject) <= VERTEX_PUSH_CONSTANT_OFFSET, "fragment push constants overlap vertex push constants");
 
 
 
@@ -93,12 +206,20 @@ public:
 
 	void setCamera(const glm::mat4 & view, const glm::vec3 campos);
 
+	uint32_t addInstance(const glm::mat4& transform);
+	void setInstanceTransform(uint32_t instance, const glm::mat4& transform);
+	void removeInstance(uint32_t instance);
 
 	int getDebugViewIndex() const
 	{
 		return debug_view_index;
 	}
 
+	CullingStatistics getCullingStatistics() const
+	{
+		return culling_statistics;
+	}
+
 	/**
 	*  0: render 1: heat map with render 2: heat map 3: depth 4: normal
 	*/
@@ -148,60 +269,121 @@ private:
 	VRaii<vk::DescriptorSetLayout> intermediate_descriptor_set_layout; // which is exclusive to compute queue
 	VRaii<VkPipelineLayout> compute_pipeline_layout;
 	VRaii<VkPipeline> compute_pipeline;
-	vk::CommandBuffer light_culling_command_buffer = {};
+	VRaii<vk::DescriptorSetLayout> meshlet_culling_descriptor_set_layout;
+	VRaii<VkPipelineLayout> meshlet_culling_pipeline_layout;
+	VRaii<VkPipeline> meshlet_culling_pipeline;
+	VRaii<vk::DescriptorSetLayout> depth_pyramid_descriptor_set_layout;
+	VRaii<VkPipelineLayout> depth_pyramid_pipeline_layout;
+	VRaii<VkPipeline> depth_pyramid_pipeline;
 	//VRaii<vk::PipelineLayout> compute_pipeline_layout;
 	//VRaii<vk::Pipeline> compute_pipeline;
 
-	std::vector<VkCommandBuffer> command_buffers; // buffers will be released when pool destroyed
-	vk::CommandBuffer depth_prepass_command_buffer;
-
-	VRaii<vk::Semaphore> image_available_semaphore;
-	VRaii<vk::Semaphore> render_finished_semaphore;
-	VRaii<vk::Semaphore> lightculling_completed_semaphore;
-	VRaii<vk::Semaphore> depth_prepass_finished_semaphore;
+	// command buffers and synchronization of a frame in flight, which reads its own region of frame_ring_buffer
+	struct FrameResources
+	{
+		vk::CommandBuffer depth_prepass_command_buffer;
+		vk::CommandBuffer light_culling_command_buffer;
+		std::vector<VkCommandBuffer> command_buffers; // one per swap chain image, released when pool destroyed
+
+		VRaii<vk::Semaphore> image_available_semaphore;
+		VRaii<vk::Semaphore> render_finished_semaphore;
+		VRaii<vk::Semaphore> lightculling_completed_semaphore;
+		VRaii<vk::Semaphore> depth_prepass_finished_semaphore;
+		VRaii<vk::Semaphore> frame_finished_semaphore; // waited by the next frame, which reuses the depth and light visibility buffers
+		VRaii<VkFence> fence; // signaled when the GPU is done with the frame
+
+		bool timestamps_pending = false; // written by the frame and not read back yet
+		// culling statistics known to the CPU, until the counters of meshlet culling are read back
+		CullingStatistics pending_culling_statistics;
+		bool culling_statistics_pending = false;
+		DrawList depth_draw_list; // front to back from the camera of the last recording of depth_prepass_command_buffer
+	};
+	std::array<FrameResources, FRAME_COUNT> frames;
+	uint32_t frame_index = 0;
+	DrawList shading_draw_list; // by material, the same for all frames
+	vk::Semaphore previous_frame_semaphore; // frame_finished_semaphore of the last submitted frame
 
 	// for depth
 	VRaii<VkImage> depth_image;
-	VRaii<VkDeviceMemory> depth_image_memory;
+	VMemoryAllocation depth_image_memory;
 	VRaii<VkImageView> depth_image_view;
 
+	// farthest depth of the last depth prepass, level 0 at half its resolution, rebuilt after every depth prepass
+	VRaii<VkImage> depth_pyramid;
+	VMemoryAllocation depth_pyramid_memory;
+	VRaii<VkImageView> depth_pyramid_view; // every level, read by meshlet culling
+	std::vector<VRaii<VkImageView>> depth_pyramid_level_views;
+	std::vector<glm::ivec2> depth_pyramid_level_sizes;
+	VRaii<VkSampler> depth_pyramid_sampler;
+	std::array<vk::DescriptorSet, MAX_DEPTH_PYRAMID_LEVELS> depth_pyramid_descriptor_sets; // reduction into each level
+	glm::mat4 depth_pyramid_projview; // of the frame the pyramid is built from, model space to clip space
+	bool depth_pyramid_valid = false; // built from the depth of the current swap chain extent
+
+	// mesh parts hidden behind the model's occluders, rasterized on worker threads while the GPU works on the previous frame
+	SoftwareOcclusionBuffer software_occlusion_buffer;
+	std::unique_ptr<util::ThreadPool> software_occlusion_threads;
+
 	// texture image
 	VRaii<VkImage> texture_image;
-	VRaii<VkDeviceMemory> texture_image_memory;
+	VMemoryAllocation texture_image_memory;
 	VRaii<VkImageView> texture_image_view;
 	VRaii<VkImage> normalmap_image;
-	VRaii<VkDeviceMemory> normalmap_image_memory;
+	VMemoryAllocation normalmap_image_memory;
 	VRaii<VkImageView> normalmap_image_view;
 	VRaii<VkSampler> texture_sampler;
 
-	// uniform buffers
-	VRaii<VkBuffer> object_staging_buffer;
-	VRaii<VkDeviceMemory> object_staging_buffer_memory;
-	VRaii<VkBuffer> object_uniform_buffer;
-	VRaii<VkDeviceMemory> object_uniform_buffer_memory;
-	VRaii<VkBuffer> camera_staging_buffer;
-	VRaii<VkDeviceMemory> camera_staging_buffer_memory;
-	VRaii<VkBuffer> camera_uniform_buffer;
-	VRaii<VkDeviceMemory> camera_uniform_buffer_memory;
+	// model to world transforms of the copies of the model, by instance id; ids of removed instances are reused
+	struct InstanceSlot
+	{
+		glm::mat4 transform;
+		bool alive = false;
+	};
+	std::vector<InstanceSlot> instance_slots;
+	std::vector<uint32_t> free_instance_ids;
+
+	// camera, lights, instances and culling input written by the CPU every frame, and meshlet draws written by the GPU, one copy per frame in flight
+	VFrameRingBuffer frame_ring_buffer;
 
 	VRaii<VkDescriptorPool> descriptor_pool;
 	VkDescriptorSet object_descriptor_set;
 	vk::DescriptorSet camera_descriptor_set;
 	VkDescriptorSet light_culling_descriptor_set;
 	vk::DescriptorSet intermediate_descriptor_set;
+	vk::DescriptorSet meshlet_culling_descriptor_set;
 
 	// vertex buffer
+	VTextureCache texture_cache;
 	VModel model;
+	VTextureStreamer texture_streamer; // mip levels of the model's textures, under texture_budget_mb
 	//VRaii<VkBuffer> vertex_buffer;
 	//VRaii<VkDeviceMemory> vertex_buffer_memory;
 	//VRaii<VkBuffer> index_buffer;
 	//VRaii<VkDeviceMemory> index_buffer_memory;
 
-	VRaii<VkBuffer> pointlight_buffer;
-	VRaii<VkDeviceMemory> pointlight_buffer_memory;
-	VRaii<VkBuffer> lights_staging_buffer;
-	VRaii<VkDeviceMemory> lights_staging_buffer_memory;
-	VkDeviceSize pointlight_buffer_size;
+	// one indexed indirect draw per meshlet in FRAME_RANGE_MESHLET_DRAWS and FRAME_RANGE_DEPTH_MESHLET_DRAWS, contiguous per mesh part;
+	// written by the meshlet culling compute pass at the start of each frame
+	std::vector<uint32_t> meshlet_draw_offsets; // first draw of each mesh part, plus the total count at the end
+	VRaii<VkBuffer> meshlet_cull_record_buffer; // a MeshletCullRecord per draw
+	VMemoryAllocation meshlet_cull_record_buffer_memory;
+	bool compact_meshlet_draws = false; // visible draws are packed and drawn with vkCmdDrawIndexedIndirectCountKHR
+	std::vector<FrustumTest> part_visibility; // of each mesh part in the last culled frame
+	CullingStatistics culling_statistics; // of the last culled frame read back from the GPU
+	uint64_t culling_frame_count = 0;
+	uint64_t culled_parts_total = 0; // over culling_frame_count frames, of visible_parts_total + culled_parts_total
+	uint64_t visible_parts_total = 0;
+	uint64_t culled_meshlets_total = 0;
+	uint64_t visible_meshlets_total = 0;
+	uint64_t occluded_parts_total = 0;
+	uint64_t culled_triangles_total = 0; // of visible_triangles_total + culled_triangles_total, occluded_triangles_total included
+	uint64_t visible_triangles_total = 0;
+	uint64_t occluded_triangles_total = 0;
+
+	// GPU timestamps at the start of the depth prepass and the end of the forward pass, two per frame in flight, averaged over the run
+	VRaii<VkQueryPool> timestamp_query_pool;
+	double gpu_frame_time_total_ms = 0.0;
+	uint64_t gpu_frame_time_count = 0;
+
+	VkDeviceSize pointlight_buffer_size; // of FRAME_RANGE_LIGHTS
 
 	std::vector<util::Vertex> vertices;
 	std::vector<uint32_t> vertex_indices;
@@ -212,7 +394,7 @@ private:
 	// which is output from the light culling compute shader
 	// max MAX_POINT_LIGHT_PER_TILE point lights per tile
 	VRaii<VkBuffer> light_visibility_buffer;
-	VRaii<VkDeviceMemory> light_visibility_buffer_memory;
+	VMemoryAllocation light_visibility_buffer_memory;
 	VkDeviceSize light_visibility_buffer_size = 0;
 
 	int window_framebuffer_width;
@@ -232,23 +414,42 @@ private:
 		createDescriptorSetLayouts();
 		createGraphicsPipelines();
 		createComputePipeline();
+		createMeshletCullingPipeline();
+		createDepthPyramidPipeline();
 		createDepthResources();
+		createDepthPyramid();
 		createFrameBuffers();
 		createTextureSampler();
-		createUniformBuffers();
 		createLights();
 		createDescriptorPool();
-		model = VModel::loadModelFromFile(vulkan_context, getGlobalTestSceneConfiguration().model_file, texture_sampler.get(), descriptor_pool.get(), material_descriptor_set_layout.get());
+		MeshLoadOptions load_options;
+		load_options.thread_count = getGlobalTestSceneConfiguration().loader_thread_count;
+		load_options.vertex_format = getGlobalTestSceneConfiguration().vertex_format;
+		load_options.optimize_meshes = getGlobalTestSceneConfiguration().optimize_meshes;
+		load_options.generate_lods = getGlobalTestSceneConfiguration().generate_lods;
+		load_options.occluder_triangle_budget = getGlobalTestSceneConfiguration().software_occlusion ? getGlobalTestSceneConfiguration().occluder_triangle_budget : 0;
+		model = VModel::loadModelFromFile(vulkan_context, getGlobalTestSceneConfiguration().model_file, texture_sampler.get(), descriptor_pool.get(), material_descriptor_set_layout.get(), texture_cache, load_options);
+		texture_streamer.addTextures(model.getTextures());
+		vulkan_context.getMemoryAllocator().printStatistics(std::cout);
+		createInstances();
+		createSoftwareOcclusionBuffer();
+		createMeshletDrawOffsets();
+		createMeshletCullRecordBuffer();
+		createFrameRingBuffer();
+		createMeshletCullingDescriptorSet();
+		createDepthPyramidDescriptorSets();
+		updateDepthPyramidDescriptorSets();
 		createSceneObjectDescriptorSet();
 		createCameraDescriptorSet();
 		createIntermediateDescriptorSet();
 		updateIntermediateDescriptorSet();
 		createLigutCullingDescriptorSet();
 		createLightVisibilityBuffer(); // create a light visiblity buffer and update descriptor sets, need to rerun after changing size
+		createTimestampQueryPool();
 		createGraphicsCommandBuffers();
 		createLightCullingCommandBuffer();
 		createDepthPrePassCommandBuffer();
-		createSemaphores();
+		createSyncObjects();
 	}
 
 	void recreateSwapChain()
@@ -260,9 +461,12 @@ private:
 		createRenderPasses();
 		createGraphicsPipelines();
 		createDepthResources();
+		createDepthPyramid();
+		createSoftwareOcclusionBuffer();
 		createFrameBuffers();
 		createLightVisibilityBuffer(); // since it's size will scale with window;
 		updateIntermediateDescriptorSet();
+		updateDepthPyramidDescriptorSets();
 		createGraphicsCommandBuffers();
 		createLightCullingCommandBuffer(); // it needs light_visibility_buffer_size, which is changed on resize
 		createDepthPrePassCommandBuffer();
@@ -276,7 +480,6 @@ private:
 	void createDepthResources();
 	void createFrameBuffers();
 	void createTextureSampler();
-	void createUniformBuffers();
 	void createLights();
 	void createDescriptorPool();
 	void createSceneObjectDescriptorSet();
@@ -284,7 +487,7 @@ private:
 	void createIntermediateDescriptorSet();
 	void updateIntermediateDescriptorSet();
 	void createGraphicsCommandBuffers();
-	void createSemaphores();
+	void createSyncObjects();
 
 	void createComputePipeline();
 	void createLigutCullingDescriptorSet();
@@ -292,8 +495,32 @@ private:
 	void createLightCullingCommandBuffer();
 
 	void createDepthPrePassCommandBuffer();
-
+	void recordDepthPrePassCommandBuffer(uint32_t frame);
+	bool sortDepthDraws(const glm::vec3& camera_position, uint32_t frame);
+	void createTimestampQueryPool();
+	void readTimestamps(uint32_t frame);
+
+	void createMeshletDrawOffsets();
+	void createMeshletCullingPipeline();
+	void createMeshletCullRecordBuffer();
+	void createFrameRingBuffer();
+	void createMeshletCullingDescriptorSet();
+	void recordMeshletCulling(VkCommandBuffer command_buffer, uint32_t frame);
+	void createDepthPyramidPipeline();
+	void createDepthPyramid();
+	void createDepthPyramidDescriptorSets();
+	void updateDepthPyramidDescriptorSets();
+	void recordDepthPyramid(VkCommandBuffer command_buffer);
+	void createSoftwareOcclusionBuffer();
+	void createInstances();
+	std::vector<glm::mat4> getInstanceTransforms() const;
+	void recordMeshletDraws(VkCommandBuffer command_buffer, uint32_t frame, DrawPass pass, const DrawList& draw_list);
+
+	void waitForFrames();
 	void updateUniformBuffers(float deltatime);
+	void updateMeshletCulling(const CameraUbo* camera, uint32_t frame);
+	void readCullingStatistics(uint32_t frame);
+	void updateTextureStreaming(const CameraUbo& camera);
 	void drawFrame();
 
 	VRaii<VkShaderModule> createShaderModule(const std::vector<char>& code);
@@ -301,8 +528,39 @@ private:
 
 
 
+namespace
+{
+	TextureLoadOptions getTextureLoadOptions()
+	{
+		TextureLoadOptions options;
+		options.generate_mipmaps = getGlobalTestSceneConfiguration().generate_mipmaps;
+		options.compress = getGlobalTestSceneConfiguration().compress_textures;
+		options.streaming = getGlobalTestSceneConfiguration().texture_budget_mb > 0;
+		return options;
+	}
+
+	// world space length of a unit of model space, for transforms scaling all axes alike
+	float getUniformScale(const glm::mat4& transform)
+	{
+		return std::max(glm::length(glm::vec3(transform[0])), std::numeric_limits<float>::min());
+	}
+
+	// the camera position in the model space of each instance transform
+	std::vector<glm::vec3> getViewerPositions(const std::vector<glm::mat4>& transforms, const glm::vec3& camera_position)
+	{
+		std::vector<glm::vec3> positions;
+		for (const auto& transform : transforms)
+		{
+			positions.push_back(glm::vec3(glm::inverse(transform) * glm::vec4(camera_position, 1.0f)));
+		}
+		return positions;
+	}
+}
+
 _VulkanRenderer_Impl::_VulkanRenderer_Impl(GLFWwindow* window)
 	:vulkan_context(window)
+	, texture_cache(getTextureLoadOptions())
+	, texture_streamer(vulkan_context, VkDeviceSize(getGlobalTestSceneConfiguration().texture_budget_mb) * 1024 * 1024)
 {
 
 	queue_family_indices = vulkan_context.getQueueFamilyIndices();
@@ -331,13 +589,39 @@ void _VulkanRenderer_Impl::resize(int width, int height)
 
 void _VulkanRenderer_Impl::requestDraw(float deltatime)
 {
-	updateUniformBuffers(deltatime); // TODO: there is graphics queue waiting in utility.copyBuffer() called by this so I don't need to sync CPU and GPU elsewhere... but someday I will make the copy command able to use multiple times and I need to sync on writing the staging buffer
+	updateUniformBuffers(deltatime);
 	drawFrame();
 }
 
 void _VulkanRenderer_Impl::cleanUp()
 {
 	vkDeviceWaitIdle(graphics_device);
+	for (uint32_t frame = 0; frame < FRAME_COUNT; frame++)
+	{
+		readTimestamps(frame);
+		readCullingStatistics(frame);
+	}
+	if (gpu_frame_time_count > 0)
+	{
+		std::cout << "GPU time of depth prepass, light culling and forward pass: " << gpu_frame_time_total_ms / gpu_frame_time_count
+			<< " ms average over " << gpu_frame_time_count << " frames" << std::endl;
+	}
+	if (culling_frame_count > 0)
+	{
+		double frame_count = double(culling_frame_count);
+		std::cout << "Culled per frame: " << culled_parts_total / frame_count << " of " << (culled_parts_total + visible_parts_total) / frame_count
+			<< " mesh parts, " << culled_meshlets_total / frame_count << " of " << (culled_meshlets_total + visible_meshlets_total) / frame_count
+			<< " meshlets, " << culled_triangles_total / frame_count << " of " << (culled_triangles_total + visible_triangles_total) / frame_count
+			<< " triangles, average over " << culling_frame_count << " frames" << std::endl;
+		std::cout << "Occluded per frame: " << occluded_parts_total / frame_count << " mesh parts, "
+			<< occluded_triangles_total / frame_count << " triangles" << std::endl;
+	}
+	vulkan_context.getMemoryAllocator().printStatistics(std::cout);
+	if (texture_streamer.getBudget() > 0)
+	{
+		std::cout << "Streamed textures: " << texture_streamer.getResidentSize() / (1024 * 1024) << " MB resident, budget "
+			<< texture_streamer.getBudget() / (1024 * 1024) << " MB" << std::endl;
+	}
 }
 
 void _VulkanRenderer_Impl::setCamera(const glm::mat4 & view, const glm::vec3 campos)
@@ -346,6 +630,49 @@ void _VulkanRenderer_Impl::setCamera(const glm::mat4 & view, const glm::vec3 cam
 	this->cam_pos = campos;
 }
 
+uint32_t _VulkanRenderer_Impl::addInstance(const glm::mat4& transform)
+{
+	uint32_t instance;
+	if (!free_instance_ids.empty())
+	{
+		instance = free_instance_ids.back();
+		free_instance_ids.pop_back();
+	}
+	else
+	{
+		if (instance_slots.size() >= MAX_INSTANCE_COUNT)
+		{
+			throw std::runtime_error("Too many instances!");
+		}
+		instance = static_cast<uint32_t>(instance_slots.size());
+		instance_slots.emplace_back();
+	}
+	instance_slots[instance].transform = transform;
+	instance_slots[instance].alive = true;
+	return instance;
+}
+
+void _VulkanRenderer_Impl::setInstanceTransform(uint32_t instance, const glm::mat4& transform)
+{
+	if (instance >= instance_slots.size() || !instance_slots[instance].alive)
+	{
+		throw std::runtime_error("Invalid instance!");
+	}
+	instance_slots[instance].transform = transform;
+	depth_pyramid_valid = false; // the last depth prepass shows the instance where it was
+}
+
+void _VulkanRenderer_Impl::removeInstance(uint32_t instance)
+{
+	if (instance >= instance_slots.size() || !instance_slots[instance].alive)
+	{
+		throw std::runtime_error("Invalid instance!");
+	}
+	instance_slots[instance].alive = false;
+	free_instance_ids.push_back(instance);
+	depth_pyramid_valid = false; // the last depth prepass still shows the instance
+}
+
 void _VulkanRenderer_Impl::createSwapChain()
 {
 	auto support_details = SwapChainSupportDetails::querySwapChainSupport(physical_device, vulkan_context.getWindowSurface());
@@ -565,13 +892,12 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 
 	// instance_descriptor_set_layout
 	{
-		// Transform information
-		// create descriptor for uniform buffer objects
+		// Transform information of every instance, at the frame's range in frame_ring_buffer
 		VkDescriptorSetLayoutBinding ubo_layout_binding = {};
 		ubo_layout_binding.binding = 0;
-		ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
 		ubo_layout_binding.descriptorCount = 1;
-		ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT; // only referencing from vertex shader
+		ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // only referencing from vertex shader
 		// VK_SHADER_STAGE_ALL_GRAPHICS
 		ubo_layout_binding.pImmutableSamplers = nullptr; // Optional
 
@@ -594,7 +920,7 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 	{
 		vk::DescriptorSetLayoutBinding ubo_layout_binding = {
 			0,  // binding
-			vk::DescriptorType::eStorageBuffer,  // descriptorType // FIXME: change back to uniform
+			vk::DescriptorType::eStorageBufferDynamic,  // descriptorType, at the camera of the frame in frame_ring_buffer // FIXME: change back to uniform
 			1,  // descriptorCount
 			vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute, // stagFlags
 			nullptr, // pImmutableSamplers
@@ -631,7 +957,7 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 			// uniform buffer for point lights
 			VkDescriptorSetLayoutBinding lb = {};
 			lb.binding = 1;
-			lb.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // FIXME: change back to uniform
+			lb.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC; // at the lights of the frame in frame_ring_buffer // FIXME: change back to uniform
 			lb.descriptorCount = 1;  // maybe we can use this for different types of lights
 			lb.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 			lb.pImmutableSamplers = nullptr;
@@ -649,6 +975,70 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 		);
 	}
 
+	// meshlet_culling_descriptor_set_layout: meshlet records, then the culling input, the draws of both passes and the draw counts of a frame,
+	// then the depth pyramid
+	{
+		std::array<vk::DescriptorSetLayoutBinding, 6> bindings;
+		for (uint32_t binding = 0; binding < 5; binding++)
+		{
+			bindings[binding] = {
+				binding, // binding
+				binding == 0 ? vk::DescriptorType::eStorageBuffer : vk::DescriptorType::eStorageBufferDynamic, // descriptorType, at the ranges of the frame in frame_ring_buffer
+				1, // descriptorCount
+				vk::ShaderStageFlagBits::eCompute, // stageFlags
+				nullptr, // pImmutableSamplers
+			};
+		}
+		bindings[5] = {
+			5, // binding
+			vk::DescriptorType::eCombinedImageSampler, // descriptorType
+			1, // descriptorCount
+			vk::ShaderStageFlagBits::eCompute, // stageFlags
+			nullptr, // pImmutableSamplers
+		};
+
+		vk::DescriptorSetLayoutCreateInfo create_info = {
+			vk::DescriptorSetLayoutCreateFlags(), // flags
+			static_cast<uint32_t>(bindings.size()),
+			bindings.data()
+		};
+
+		meshlet_culling_descriptor_set_layout = VRaii<vk::DescriptorSetLayout>(
+			device.createDescriptorSetLayout(create_info, nullptr),
+			raii_layout_deleter
+		);
+	}
+
+	// depth_pyramid_descriptor_set_layout: the depth image or the level below, and the level written
+	{
+		std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {};
+		bindings[0] = {
+			0, // binding
+			vk::DescriptorType::eCombinedImageSampler, // descriptorType
+			1, // descriptorCount
+			vk::ShaderStageFlagBits::eCompute, // stageFlags
+			nullptr, // pImmutableSamplers
+		};
+		bindings[1] = {
+			1, // binding
+			vk::DescriptorType::eStorageImage, // descriptorType
+			1, // descriptorCount
+			vk::ShaderStageFlagBits::eCompute, // stageFlags
+			nullptr, // pImmutableSamplers
+		};
+
+		vk::DescriptorSetLayoutCreateInfo create_info = {
+			vk::DescriptorSetLayoutCreateFlags(), // flags
+			static_cast<uint32_t>(bindings.size()),
+			bindings.data()
+		};
+
+		depth_pyramid_descriptor_set_layout = VRaii<vk::DescriptorSetLayout>(
+			device.createDescriptorSetLayout(create_info, nullptr),
+			raii_layout_deleter
+		);
+	}
+
 	// descriptor set layout for intermediate objects during render passes, such as z-buffer
 	{
 		// reads from depth attachment of previous frame
@@ -673,42 +1063,42 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 		);
 	}
 
-	// material_descriptror_layout // TODO: maybe I still need to do for each instance
+	// material_descriptror_layout, bindless: every material and texture of the model, picked per draw by material index
 	{
-		// reads from depth attachment of previous frame
-		// descriptor for texture sampler
-
-		vk::DescriptorSetLayoutBinding uniform_layout_binding = {
+		vk::DescriptorSetLayoutBinding material_buffer_layout_binding = {
 			0, // binding
-			vk::DescriptorType::eUniformBuffer, // descriptorType
+			vk::DescriptorType::eStorageBuffer, // descriptorType
 			1, // descriptorCount
 			vk::ShaderStageFlagBits::eFragment ,  //stageFlags
 			nullptr, // pImmutableSamplers
 		};
 
-		vk::DescriptorSetLayoutBinding albedo_map_layout_binding = {
+		// upper bound, each set is allocated with the texture count of its model
+		vk::DescriptorSetLayoutBinding textures_layout_binding = {
 			1, // binding
 			vk::DescriptorType::eCombinedImageSampler, // descriptorType
-			1, // descriptorCount
+			VModel::getMaxTextureCount(vulkan_context.getPhysicalDeviceProperties().limits), // descriptorCount
 			vk::ShaderStageFlagBits::eFragment ,  //stageFlags
 			nullptr, // pImmutableSamplers
 		};
 
-		vk::DescriptorSetLayoutBinding normap_layout_binding = {
-			2, // binding
-			vk::DescriptorType::eCombinedImageSampler, // descriptorType
-			1, // descriptorCount
-			vk::ShaderStageFlagBits::eFragment ,  //stageFlags
-			nullptr, // pImmutableSamplers
-		};
+		std::array<vk::DescriptorSetLayoutBinding, 2> bindings = { material_buffer_layout_binding, textures_layout_binding };
 
-		std::array<vk::DescriptorSetLayoutBinding, 3> bindings = { uniform_layout_binding, albedo_map_layout_binding , normap_layout_binding };
+		std::array<VkDescriptorBindingFlagsEXT, 2> binding_flags = {
+			0,
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT
+		};
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_info = {};
+		binding_flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		binding_flags_info.bindingCount = static_cast<uint32_t>(binding_flags.size());
+		binding_flags_info.pBindingFlags = binding_flags.data();
 
 		vk::DescriptorSetLayoutCreateInfo create_info = {
 			vk::DescriptorSetLayoutCreateFlags(), // flags
 			static_cast<uint32_t>(bindings.size()),
 			bindings.data()
 		};
+		create_info.pNext = &binding_flags_info;
 
 		material_descriptor_set_layout = VRaii<vk::DescriptorSetLayout>(
 			device.createDescriptorSetLayout(create_info, nullptr),
@@ -730,9 +1120,11 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 		device.destroyPipeline(obj);
 	};
 
+	auto scene_vertex_format = getGlobalTestSceneConfiguration().vertex_format;
+
 	// create main pipeline
 	{
-		auto vert_shader_code = util::readFile(util::getContentPath("forwardplus_vert.spv"));
+		auto vert_shader_code = util::readFile(util::getContentPath(vertex_format::getForwardPlusVertexShaderName(scene_vertex_format)));
 		auto frag_shader_code = util::readFile(util::getContentPath("forwardplus_frag.spv"));
 		// auto light_culling_comp_shader_code = util::readFile(util::getContentPath("light_culling.comp.spv"));
 
@@ -760,8 +1152,8 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 		VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
 		vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-		auto binding_description = vulkan_util::getVertexBindingDesciption();
-		auto attr_description = vulkan_util::getVertexAttributeDescriptions();
+		auto binding_description = vertex_format::getVertexBindingDescription(scene_vertex_format);
+		auto attr_description = vertex_format::getVertexAttributeDescriptions(scene_vertex_format);
 
 		vertex_input_info.vertexBindingDescriptionCount = 1;
 		vertex_input_info.pVertexBindingDescriptions = &binding_description;
@@ -857,10 +1249,14 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 		dynamic_state_info.dynamicStateCount = 2;
 		dynamic_state_info.pDynamicStates = dynamicStates;
 
-		VkPushConstantRange push_constant_range = {};
-		push_constant_range.offset = 0;
-		push_constant_range.size = sizeof(PushConstantObject);
-		push_constant_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		std::array<VkPushConstantRange, 2> push_constant_ranges = {};
+		push_constant_ranges[0].offset = 0;
+		push_constant_ranges[0].size = sizeof(PushConstantObject);
+		push_constant_ranges[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		// position dequantization of compact vertex formats
+		push_constant_ranges[1].offset = VERTEX_PUSH_CONSTANT_OFFSET;
+		push_constant_ranges[1].size = sizeof(VertexPushConstantObject);
+		push_constant_ranges[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
 		// no uniform variables or push constants
 		VkPipelineLayoutCreateInfo pipeline_layout_info = {};
@@ -868,8 +1264,8 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 		std::vector<VkDescriptorSetLayout> set_layouts = { object_descriptor_set_layout.get(), camera_descriptor_set_layout.get(), light_culling_descriptor_set_layout.get(), intermediate_descriptor_set_layout.get(), material_descriptor_set_layout.get() };
 		pipeline_layout_info.setLayoutCount = static_cast<uint32_t>(set_layouts.size()); // Optional
 		pipeline_layout_info.pSetLayouts = set_layouts.data(); // Optional
-		pipeline_layout_info.pushConstantRangeCount = 1; // Optional
-		pipeline_layout_info.pPushConstantRanges = &push_constant_range; // Optional
+		pipeline_layout_info.pushConstantRangeCount = static_cast<uint32_t>(push_constant_ranges.size()); // Optional
+		pipeline_layout_info.pPushConstantRanges = push_constant_ranges.data(); // Optional
 
 		VkPipelineLayout temp_layout;
 		auto pipeline_layout_result = vkCreatePipelineLayout(graphics_device, &pipeline_layout_info, nullptr,
@@ -918,7 +1314,7 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 			pre_pass_depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
 			pre_pass_depth_stencil.depthWriteEnable = VK_TRUE;
 
-			auto depth_vert_shader_code = util::readFile(util::getContentPath("depth_vert.spv"));
+			auto depth_vert_shader_code = util::readFile(util::getContentPath(vertex_format::getDepthVertexShaderName(scene_vertex_format)));
 			// auto light_culling_comp_shader_code = util::readFile(util::getContentPath("light_culling.comp.spv"));
 			auto depth_vert_shader_module = createShaderModule(depth_vert_shader_code);
 			VkPipelineShaderStageCreateInfo depth_vert_shader_stage_info = {};
@@ -928,14 +1324,31 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 			depth_vert_shader_stage_info.pName = "main";
 			VkPipelineShaderStageCreateInfo depth_shader_stages[] = { depth_vert_shader_stage_info };
 
+			// the prepass reads a separate position-only vertex stream
+			VkPipelineVertexInputStateCreateInfo depth_vertex_input_info = {};
+			depth_vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+			auto depth_binding_description = vertex_format::getPositionBindingDescription(scene_vertex_format);
+			auto depth_attr_description = vertex_format::getPositionAttributeDescriptions(scene_vertex_format);
+
+			depth_vertex_input_info.vertexBindingDescriptionCount = 1;
+			depth_vertex_input_info.pVertexBindingDescriptions = &depth_binding_description;
+			depth_vertex_input_info.vertexAttributeDescriptionCount = (uint32_t)depth_attr_description.size();
+			depth_vertex_input_info.pVertexAttributeDescriptions = depth_attr_description.data();
+
 			std::array<vk::DescriptorSetLayout, 2> depth_set_layouts = { object_descriptor_set_layout.get(), camera_descriptor_set_layout.get() };
+			vk::PushConstantRange depth_push_constant_range = {
+				vk::ShaderStageFlagBits::eVertex,  // stageFlags
+				VERTEX_PUSH_CONSTANT_OFFSET,  // offset
+				sizeof(VertexPushConstantObject)  // size
+			};
 
 			vk::PipelineLayoutCreateInfo depth_layout_info = {
 				vk::PipelineLayoutCreateFlags(),  // flags
 				static_cast<uint32_t>(depth_set_layouts.size()),  // setLayoutCount
 				depth_set_layouts.data(),  // setlayouts
-				0,  // pushConstantRangeCount
-				nullptr // pushConstantRanges
+				1,  // pushConstantRangeCount
+				&depth_push_constant_range // pushConstantRanges
 			};
 			depth_pipeline_layout = VRaii<vk::PipelineLayout>(
 				device.createPipelineLayout(depth_layout_info, nullptr),
@@ -947,7 +1360,7 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 			depth_pipeline_info.stageCount = 1;
 			depth_pipeline_info.pStages = depth_shader_stages;
 
-			depth_pipeline_info.pVertexInputState = &vertex_input_info;
+			depth_pipeline_info.pVertexInputState = &depth_vertex_input_info;
 			depth_pipeline_info.pInputAssemblyState = &input_assembly_info;
 			depth_pipeline_info.pViewportState = &viewport_state_info;
 			depth_pipeline_info.pRasterizationState = &rasterizer;
@@ -1061,7 +1474,8 @@ void _VulkanRenderer_Impl::createTextureSampler()
 	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	sampler_info.mipLodBias = 0.0f;
 	sampler_info.minLod = 0.0f;
-	sampler_info.maxLod = 0.0f;
+	// every level of the textures' mip chains, image views clamp to the levels they have
+	sampler_info.maxLod = getGlobalTestSceneConfiguration().generate_mipmaps ? VK_LOD_CLAMP_NONE : 0.0f;
 
 	VkSampler sampler;
 	if (vkCreateSampler(graphics_device, &sampler_info, nullptr, &sampler) != VK_SUCCESS)
@@ -1078,47 +1492,6 @@ void _VulkanRenderer_Impl::createTextureSampler()
 	);
 }
 
-void _VulkanRenderer_Impl::createUniformBuffers()
-{
-	// create buffers for scene object
-	{
-		VkDeviceSize bufferSize = sizeof(SceneObjectUbo);
-
-		std::tie(object_staging_buffer, object_staging_buffer_memory) = utility.createBuffer(bufferSize
-			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		std::tie(object_uniform_buffer, object_uniform_buffer_memory) = utility.createBuffer(bufferSize
-			, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	}
-
-	// Adding data to scene object buffer
-	{
-		SceneObjectUbo ubo = {};
-		ubo.model = glm::scale(glm::mat4(1.0f), glm::vec3(getGlobalTestSceneConfiguration().scale));;
-
-		void* data;
-		vkMapMemory(graphics_device, object_staging_buffer_memory.get(), 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(graphics_device, object_staging_buffer_memory.get());
-		utility.copyBuffer(object_staging_buffer.get(), object_uniform_buffer.get(), sizeof(ubo));
-	}
-
-	// create buffers for camera
-	{
-		VkDeviceSize bufferSize = sizeof(CameraUbo);
-
-		std::tie(camera_staging_buffer, camera_staging_buffer_memory) = utility.createBuffer(bufferSize
-			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		std::tie(camera_uniform_buffer, camera_uniform_buffer_memory) = utility.createBuffer(bufferSize
-			, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT  // FIXME: change back to uniform
-			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-			, queue_family_indices.graphics_family
-			, 0);//		, queue_family_indices.compute_family);
-	}
-}
-
 void _VulkanRenderer_Impl::createLights()
 {
 	for (int i = 0; i < getGlobalTestSceneConfiguration().light_num; i++) {
@@ -1127,32 +1500,25 @@ void _VulkanRenderer_Impl::createLights()
 		while (color.length() < 0.8f);
 		pointlights.emplace_back(glm::linearRand(getGlobalTestSceneConfiguration().min_light_pos, getGlobalTestSceneConfiguration().max_light_pos), getGlobalTestSceneConfiguration().light_radius, color);
 	}
-	// TODO: choose between memory mapping and staging buffer
-	//  (given that the lights are moving)
-	auto light_num = static_cast<int>(pointlights.size());
-
+	// the lights are moving, so they are written to frame_ring_buffer every frame
 	pointlight_buffer_size = sizeof(PointLight) * MAX_POINT_LIGHT_COUNT + sizeof(glm::vec4); // vec4 rather than int for padding
-
-	std::tie(lights_staging_buffer, lights_staging_buffer_memory) = utility.createBuffer(pointlight_buffer_size
-		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	std::tie(pointlight_buffer, pointlight_buffer_memory) = utility.createBuffer(pointlight_buffer_size
-		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT  // FIXME: change back to uniform
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT); // using barrier to sync
 }
 
 void _VulkanRenderer_Impl::createDescriptorPool()
 {
 	// Create descriptor pool for uniform buffer
-	std::array<VkDescriptorPoolSize, 3> pool_sizes = {};
+	std::array<VkDescriptorPoolSize, 5> pool_sizes = {};
 	//std::array<VkDescriptorPoolSize, 2> pool_sizes = {};
 	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	pool_sizes[0].descriptorCount = 100; // transform buffer & light buffer & camera buffer & light buffer in compute pipeline
 	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	pool_sizes[1].descriptorCount = 100; // sampler for color map and normal map and depth map from depth prepass... and so many from scene materials
+	pool_sizes[1].descriptorCount = MAX_DEPTH_PYRAMID_LEVELS + 2 + VModel::getMaxTextureCount(vulkan_context.getPhysicalDeviceProperties().limits); // depth map from depth prepass, each depth pyramid level and the pyramid in meshlet culling, and the texture array of the bindless materials
 	pool_sizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	pool_sizes[2].descriptorCount = 3; // light visiblity buffer in graphics pipeline and compute pipeline
+	pool_sizes[2].descriptorCount = 5; // light visiblity buffer in graphics pipeline and compute pipeline, meshlet cull records, bindless materials
+	pool_sizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	pool_sizes[3].descriptorCount = 7; // instances, camera, lights, culling input, draws and draw counts in frame_ring_buffer
+	pool_sizes[4].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	pool_sizes[4].descriptorCount = MAX_DEPTH_PYRAMID_LEVELS; // each level of the depth pyramid, read through the samplers above
 
 	VkDescriptorPoolCreateInfo pool_info = {};
 	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -1193,11 +1559,11 @@ void _VulkanRenderer_Impl::createSceneObjectDescriptorSet()
 		throw std::runtime_error("Failed to allocate descriptor set!");
 	}
 
-	// refer to the uniform object buffer
+	// refer to the instances, the frame's are at a dynamic offset
 	VkDescriptorBufferInfo buffer_info = {};
-	buffer_info.buffer = object_uniform_buffer.get();
+	buffer_info.buffer = frame_ring_buffer.getBuffer();
 	buffer_info.offset = 0;
-	buffer_info.range = sizeof(SceneObjectUbo);
+	buffer_info.range = frame_ring_buffer.getRangeSize(FRAME_RANGE_INSTANCES);
 
 	//std::array<VkWriteDescriptorSet, 4> descriptor_writes = {};
 	std::array<VkWriteDescriptorSet, 1> descriptor_writes = {};
@@ -1207,7 +1573,7 @@ void _VulkanRenderer_Impl::createSceneObjectDescriptorSet()
 	descriptor_writes[0].dstSet = object_descriptor_set;
 	descriptor_writes[0].dstBinding = 0;
 	descriptor_writes[0].dstArrayElement = 0;
-	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
 	descriptor_writes[0].descriptorCount = 1;
 	descriptor_writes[0].pBufferInfo = &buffer_info;
 	descriptor_writes[0].pImageInfo = nullptr; // Optional
@@ -1235,8 +1601,8 @@ void _VulkanRenderer_Impl::createCameraDescriptorSet()
 	{
 		// refer to the uniform object buffer
 		vk::DescriptorBufferInfo camera_uniform_buffer_info{
-			camera_uniform_buffer.get(), // buffer_
-			0, //offset_
+			frame_ring_buffer.getBuffer(), // buffer_
+			0, //offset_, the frame's camera is at a dynamic offset
 			sizeof(CameraUbo) // range_
 		};
 
@@ -1247,7 +1613,7 @@ void _VulkanRenderer_Impl::createCameraDescriptorSet()
 			0, // dstBinding
 			0, // distArrayElement
 			1, // descriptorCount
-			vk::DescriptorType::eStorageBuffer, //descriptorType // FIXME: change back to uniform
+			vk::DescriptorType::eStorageBufferDynamic, //descriptorType // FIXME: change back to uniform
 			nullptr, //pImageInfo
 			&camera_uniform_buffer_info, //pBufferInfo
 			nullptr //pTexBufferView
@@ -1303,6 +1669,21 @@ void _VulkanRenderer_Impl::updateIntermediateDescriptorSet()
 
 void _VulkanRenderer_Impl::createDepthPrePassCommandBuffer()
 {
+	for (uint32_t frame = 0; frame < FRAME_COUNT; frame++)
+	{
+		sortDepthDraws(cam_pos, frame);
+		recordDepthPrePassCommandBuffer(frame);
+	}
+}
+
+/**
+* Records the depth prepass command buffer of frame with the draw order in its depth_draw_list;
+* the frame must be done on the GPU
+*/
+void _VulkanRenderer_Impl::recordDepthPrePassCommandBuffer(uint32_t frame)
+{
+	auto& depth_prepass_command_buffer = frames[frame].depth_prepass_command_buffer;
+
 	if (depth_prepass_command_buffer)
 	{
 		device.freeCommandBuffers(graphics_command_pool, 1, &depth_prepass_command_buffer);
@@ -1332,6 +1713,14 @@ void _VulkanRenderer_Impl::createDepthPrePassCommandBuffer()
 
 		command.begin(begin_info);
 
+		if (timestamp_query_pool.get() != VK_NULL_HANDLE)
+		{
+			vkCmdResetQueryPool(static_cast<VkCommandBuffer>(command), timestamp_query_pool.get(), frame * 2, 2);
+			vkCmdWriteTimestamp(static_cast<VkCommandBuffer>(command), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool.get(), frame * 2);
+		}
+
+		recordMeshletCulling(static_cast<VkCommandBuffer>(command), frame);
+
 		std::array<vk::ClearValue, 1> clear_values = {};
 		clear_values[0].depthStencil = vk::ClearDepthStencilValue( 1.0f, 0 ); // 1.0 is far view plane
 		vk::RenderPassBeginInfo depth_pass_info = {
@@ -1343,160 +1732,780 @@ void _VulkanRenderer_Impl::createDepthPrePassCommandBuffer()
 		};
 		command.beginRenderPass(&depth_pass_info, vk::SubpassContents::eInline);
 
-		for (const auto& part: model.getMeshParts() )
-		{
-			command.bindPipeline(vk::PipelineBindPoint::eGraphics, depth_pipeline.get());
-
-			std::array<vk::DescriptorSet, 2> depth_descriptor_sets = { object_descriptor_set, camera_descriptor_set };
-			std::array<uint32_t, 0> depth_dynamic_offsets;
-			command.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, depth_pipeline_layout.get(), 0, depth_descriptor_sets, depth_dynamic_offsets);
-
-			std::array<vk::Buffer, 1> depth_vertex_buffers = { part.vertex_buffer_section.buffer };
-			std::array<vk::DeviceSize, 1> depth_offsets = { part.vertex_buffer_section.offset };
-			command.bindVertexBuffers(0, depth_vertex_buffers, depth_offsets);
-			command.bindIndexBuffer(part.index_buffer_section.buffer, part.index_buffer_section.offset, vk::IndexType::eUint32);
+		std::array<vk::DescriptorSet, 2> depth_descriptor_sets = { object_descriptor_set, camera_descriptor_set };
+		std::array<uint32_t, 2> depth_dynamic_offsets = { frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_INSTANCES), frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_CAMERA) };
+		command.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, depth_pipeline_layout.get(), 0, depth_descriptor_sets, depth_dynamic_offsets);
 
-			command.drawIndexed(static_cast<uint32_t>(part.index_count), 1, 0, 0, 0);
-		}
+		// binds the depth pipeline with the first draw
+		recordMeshletDraws(static_cast<VkCommandBuffer>(command), frame, DrawPass::depth_prepass, frames[frame].depth_draw_list);
 		command.endRenderPass();
 
-		command.end();
+		recordDepthPyramid(static_cast<VkCommandBuffer>(command));
 
+		command.end();
 	}
-
 }
 
-void _VulkanRenderer_Impl::createGraphicsCommandBuffers()
+/**
+* Sorts the mesh parts front to back from camera_position into the depth_draw_list of frame,
+* and returns whether the order differs from the one its depth prepass was recorded with
+*/
+bool _VulkanRenderer_Impl::sortDepthDraws(const glm::vec3& camera_position, uint32_t frame)
 {
-	// Free old command buffers, if any
-	if (command_buffers.size() > 0)
+	// parts are in model space, each draw covers every instance so the nearest one counts
+	auto transforms = getInstanceTransforms();
+	float scale = transforms.empty() ? 1.0f : getUniformScale(transforms[0]);
+
+	DrawList draw_list;
+	draw_list.build(model.getMeshParts(), DrawPass::depth_prepass, DRAW_PIPELINE_DEPTH
+		, getViewerPositions(transforms, camera_position), CAMERA_NEAR_PLANE / scale, CAMERA_FAR_PLANE / scale);
+	if (draw_list.hasSameOrder(frames[frame].depth_draw_list))
 	{
-		vkFreeCommandBuffers(graphics_device, graphics_command_pool, (uint32_t)command_buffers.size(), command_buffers.data());
+		return false;
 	}
-	command_buffers.clear();
+	frames[frame].depth_draw_list = std::move(draw_list);
+	return true;
+}
 
-	command_buffers.resize(swap_chain_framebuffers.size());
+void _VulkanRenderer_Impl::createTimestampQueryPool()
+{
+	if (!vulkan_context.getPhysicalDeviceProperties().limits.timestampComputeAndGraphics)
+	{
+		std::cout << "The device has no timestamps on graphics queues, GPU frame time will not be reported" << std::endl;
+		return;
+	}
 
-	VkCommandBufferAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	alloc_info.commandPool = graphics_command_pool;
-	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	// primary: can be submitted to a queue but cannot be called from other command buffers
-	// secondary: can be called by others but cannot be submitted to a queue
-	alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+	VkQueryPoolCreateInfo query_pool_info = {};
+	query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	query_pool_info.queryCount = 2 * FRAME_COUNT;
 
-	auto alloc_result = vkAllocateCommandBuffers(graphics_device, &alloc_info, command_buffers.data());
-	if (alloc_result != VK_SUCCESS)
+	VkQueryPool query_pool;
+	if (vkCreateQueryPool(graphics_device, &query_pool_info, nullptr, &query_pool) != VK_SUCCESS)
 	{
-		throw std::runtime_error("failed to allocate command buffers!");
+		throw std::runtime_error("Failed to create timestamp query pool!");
 	}
+	timestamp_query_pool = VRaii<VkQueryPool>(
+		query_pool,
+		[device = this->device](auto& obj)
+		{
+			device.destroyQueryPool(obj);
+		}
+	);
+}
 
-	// record command buffers
-	for (size_t i = 0; i < command_buffers.size(); i++)
+/**
+* Adds the GPU time of the last submission of frame to the average; the frame must be done on the GPU
+*/
+void _VulkanRenderer_Impl::readTimestamps(uint32_t frame)
+{
+	if (!frames[frame].timestamps_pending)
 	{
-		VkCommandBufferBeginInfo begin_info = {};
-		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		begin_info.pInheritanceInfo = nullptr; // Optional
-
-		vkBeginCommandBuffer(command_buffers[i], &begin_info);
+		return;
+	}
+	frames[frame].timestamps_pending = false;
 
-		// render pass
-		{
-			VkRenderPassBeginInfo render_pass_info = {};
-			render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			render_pass_info.renderPass = render_pass.get();
-			render_pass_info.framebuffer = swap_chain_framebuffers[i].get();
-			render_pass_info.renderArea.offset = { 0, 0 };
-			render_pass_info.renderArea.extent = swap_chain_extent;
-
-			std::array<VkClearValue, 1> clear_values = {};
-			clear_values[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-			//clear_values[1].depthStencil = { 1.0f, 0 }; // don't clear with depth prepass
-			render_pass_info.clearValueCount = (uint32_t)clear_values.size();
-			render_pass_info.pClearValues = clear_values.data();
-
-			vkCmdBeginRenderPass(command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-
-			PushConstantObject pco = {
-				static_cast<int>(swap_chain_extent.width),
-				static_cast<int>(swap_chain_extent.height),
-				tile_count_per_row, tile_count_per_col,
-				debug_view_index
-			};
-			vkCmdPushConstants(command_buffers[i], pipeline_layout.get(), VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pco), &pco);
+	uint64_t timestamps[2];
+	auto result = vkGetQueryPoolResults(graphics_device, timestamp_query_pool.get(), frame * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t)
+		, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+	if (result == VK_SUCCESS && timestamps[1] > timestamps[0])
+	{
+		gpu_frame_time_total_ms += (timestamps[1] - timestamps[0]) * double(vulkan_context.getPhysicalDeviceProperties().limits.timestampPeriod) / 1e6;
+		gpu_frame_time_count++;
+	}
+}
 
+void _VulkanRenderer_Impl::createMeshletDrawOffsets()
+{
+	meshlet_draw_offsets.clear();
+	uint32_t draw_count = 0;
+	for (const auto& part : model.getMeshParts())
+	{
+		meshlet_draw_offsets.push_back(draw_count);
+		draw_count += static_cast<uint32_t>(part.meshlets.size());
+	}
+	meshlet_draw_offsets.push_back(draw_count);
+}
 
-			vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline.get());
+/**
+* Creates the meshlet culling compute pipeline, which writes the meshlet draws of a frame before its depth prepass
+*/
+void _VulkanRenderer_Impl::createMeshletCullingPipeline()
+{
+	auto raii_pipeline_layout_deleter = [device = this->device](auto & obj)
+	{
+		device.destroyPipelineLayout(obj);
+	};
+	auto raii_pipeline_deleter = [device = this->device](auto & obj)
+	{
+		device.destroyPipeline(obj);
+	};
 
-			std::array<VkDescriptorSet, 4> descriptor_sets = { object_descriptor_set, camera_descriptor_set, light_culling_descriptor_set, intermediate_descriptor_set };
-			vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS
-				, pipeline_layout.get(), 0, static_cast<uint32_t>(descriptor_sets.size()), descriptor_sets.data(), 0, nullptr);
+	VkPushConstantRange push_constant_range = {};
+	push_constant_range.offset = 0;
+	push_constant_range.size = sizeof(MeshletCullingPushConstants);
+	push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayout set_layouts[] = { meshlet_culling_descriptor_set_layout.get() };
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = 1;
+	pipeline_layout_info.pSetLayouts = set_layouts;
+	pipeline_layout_info.pushConstantRangeCount = 1;
+	pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+	VkPipelineLayout temp_layout;
+	vulkan_util::checkResult(vkCreatePipelineLayout(graphics_device, &pipeline_layout_info, nullptr, &temp_layout));
+	meshlet_culling_pipeline_layout = VRaii<VkPipelineLayout>(temp_layout, raii_pipeline_layout_deleter);
+
+	auto comp_shader_module = createShaderModule(util::readFile(util::getContentPath("meshlet_culling_comp.spv")));
+	VkPipelineShaderStageCreateInfo comp_shader_stage_info = {};
+	comp_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	comp_shader_stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	comp_shader_stage_info.module = comp_shader_module.get();
+	comp_shader_stage_info.pName = "main";
+
+	VkComputePipelineCreateInfo pipeline_create_info = {};
+	pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_create_info.stage = comp_shader_stage_info;
+	pipeline_create_info.layout = meshlet_culling_pipeline_layout.get();
+	pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_create_info.basePipelineIndex = -1;
+
+	VkPipeline temp_pipeline;
+	vulkan_util::checkResult(vkCreateComputePipelines(graphics_device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &temp_pipeline));
+	meshlet_culling_pipeline = VRaii<VkPipeline>(temp_pipeline, raii_pipeline_deleter);
+}
 
-			for (const auto& part : model.getMeshParts())
+/**
+* Uploads the bounds and draw parameters of every meshlet in the order of their draws, for meshlet culling on the GPU.
+* Needs the meshlet draw offsets
+*/
+void _VulkanRenderer_Impl::createMeshletCullRecordBuffer()
+{
+	const auto& parts = model.getMeshParts();
+	std::vector<MeshletCullRecord> records;
+	records.reserve(meshlet_draw_offsets.back());
+	uint32_t max_part_meshlet_count = 0;
+	for (uint32_t part_index = 0; part_index < parts.size(); part_index++)
+	{
+		const auto& part = parts[part_index];
+		max_part_meshlet_count = std::max(max_part_meshlet_count, static_cast<uint32_t>(part.meshlets.size()));
+		for (const auto& chunk : part.index_chunks)
+		{
+			for (auto i = chunk.first_meshlet; i < chunk.first_meshlet + chunk.meshlet_count; i++)
 			{
-
-				// bind vertex buffer
-				VkBuffer vertex_buffers[] = { part.vertex_buffer_section.buffer };
-				VkDeviceSize offsets[] = { part.vertex_buffer_section.offset };
-				vkCmdBindVertexBuffers(command_buffers[i], 0, 1, vertex_buffers, offsets);
-				//vkCmdBindIndexBuffer(command_buffers[i], index_buffer, 0, VK_INDEX_TYPE_UINT16);
-				vkCmdBindIndexBuffer(command_buffers[i], part.index_buffer_section.buffer, part.index_buffer_section.offset, VK_INDEX_TYPE_UINT32);
-
-				std::array<VkDescriptorSet, 1> mesh_descriptor_sets = { part.material_descriptor_set };
-				vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS
-					, pipeline_layout.get(), static_cast<uint32_t>(descriptor_sets.size()), static_cast<uint32_t>(mesh_descriptor_sets.size()), mesh_descriptor_sets.data(), 0, nullptr);
-
-				//vkCmdDraw(command_buffers[i], VERTICES.size(), 1, 0, 0);
-				vkCmdDrawIndexed(command_buffers[i], static_cast<uint32_t>(part.index_count), 1, 0, 0, 0);
+				const auto& meshlet = part.meshlets[i];
+				MeshletCullRecord record = {};
+				record.sphere = glm::vec4(meshlet.center, meshlet.radius);
+				record.cone = glm::vec4(meshlet.cone_axis, meshlet.cone_cutoff);
+				record.box_min = glm::vec4(part.meshlet_bounds[i].min, 0.0f);
+				record.box_max = glm::vec4(part.meshlet_bounds[i].max, 0.0f);
+				record.first_index = part.first_index + meshlet.first_index;
+				record.index_count = meshlet.index_count;
+				record.vertex_offset = part.vertex_offset + static_cast<int32_t>(chunk.first_vertex);
+				record.position_offset = part.position_offset + static_cast<int32_t>(chunk.first_position);
+				record.part = part_index;
+				record.meshlet = i;
+				records.push_back(record);
 			}
-			vkCmdEndRenderPass(command_buffers[i]);
-			//utility.recordTransitImageLayout(command_buffers[i], pre_pass_depth_image.get(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-		
 		}
+	}
 
-		auto record_result = vkEndCommandBuffer(command_buffers[i]);
-		if (record_result != VK_SUCCESS)
-		{
-			throw std::runtime_error("Failed to record command buffer!");
-		}
+	std::tie(meshlet_cull_record_buffer, meshlet_cull_record_buffer_memory) = utility.createBuffer(sizeof(MeshletCullRecord) * std::max<size_t>(records.size(), 1)
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (!records.empty())
+	{
+		VUploadBatch upload_batch{ vulkan_context };
+		upload_batch.uploadBuffer(meshlet_cull_record_buffer.get(), 0, records.data(), sizeof(MeshletCullRecord) * records.size());
+		upload_batch.submit();
 	}
+
+	// a part's draws are then issued by one call, reading the count of visible ones
+#ifdef VK_KHR_draw_indirect_count
+	compact_meshlet_draws = vulkan_context.getDrawIndexedIndirectCount() != nullptr && vulkan_context.getEnabledFeatures().multiDrawIndirect
+		&& max_part_meshlet_count <= vulkan_context.getPhysicalDeviceProperties().limits.maxDrawIndirectCount;
+#endif
 }
 
-void _VulkanRenderer_Impl::createSemaphores()
+/**
+* Creates the ring buffer of the data written every frame: camera, lights, culling input, meshlet draws and their counts,
+* one region per frame in flight. Needs the meshlet draw count
+*/
+void _VulkanRenderer_Impl::createFrameRingBuffer()
 {
-	vk::SemaphoreCreateInfo semaphore_info = { vk::SemaphoreCreateFlags() };
-
-	auto destroy_func = [&device = this->device](auto & obj)
+	std::vector<VkDeviceSize> range_sizes(FRAME_RANGE_COUNT);
+	range_sizes[FRAME_RANGE_CAMERA] = sizeof(CameraUbo);
+	range_sizes[FRAME_RANGE_LIGHTS] = pointlight_buffer_size;
+	range_sizes[FRAME_RANGE_MESHLET_DRAWS] = sizeof(VkDrawIndexedIndirectCommand) * std::max<uint32_t>(meshlet_draw_offsets.back(), 1);
+	range_sizes[FRAME_RANGE_DEPTH_MESHLET_DRAWS] = range_sizes[FRAME_RANGE_MESHLET_DRAWS];
+	range_sizes[FRAME_RANGE_CULLING] = sizeof(CullingParameters) + sizeof(PartCullState) * model.getMeshParts().size();
+	range_sizes[FRAME_RANGE_DRAW_COUNTS] = sizeof(DrawCountsHeader) + sizeof(uint32_t) * model.getMeshParts().size();
+	range_sizes[FRAME_RANGE_INSTANCES] = sizeof(InstanceData) * MAX_INSTANCE_COUNT;
+
+	frame_ring_buffer = VFrameRingBuffer(vulkan_context, FRAME_COUNT, range_sizes
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT); // FIXME: change back to uniform
+
+	// every meshlet of the full detail is drawn until the first update, or always with culling and LODs disabled
+	for (uint32_t frame = 0; frame < FRAME_COUNT; frame++)
 	{
-		device.destroySemaphore(obj);
+		updateMeshletCulling(nullptr, frame);
+	}
+}
+
+void _VulkanRenderer_Impl::createMeshletCullingDescriptorSet()
+{
+	vk::DescriptorSetLayout layouts[] = { meshlet_culling_descriptor_set_layout.get() };
+	vk::DescriptorSetAllocateInfo alloc_info = {
+		descriptor_pool.get(), // descriptorPool
+		1, // descriptorSetCount
+		layouts // pSetLayouts
 	};
+	meshlet_culling_descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
 
-	render_finished_semaphore = VRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-	);
-	image_available_semaphore = VRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-	);
-	lightculling_completed_semaphore = VRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-	);
-	depth_prepass_finished_semaphore = VRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-	);
-}
+	// binding 0 holds the records, the others the ranges of frame_ring_buffer at dynamic offsets
+	std::array<vk::DescriptorBufferInfo, 5> buffer_infos = {};
+	buffer_infos[0] = vk::DescriptorBufferInfo(meshlet_cull_record_buffer.get(), 0, VK_WHOLE_SIZE);
+	std::array<FrameRange, 4> ranges = { FRAME_RANGE_CULLING, FRAME_RANGE_MESHLET_DRAWS, FRAME_RANGE_DEPTH_MESHLET_DRAWS, FRAME_RANGE_DRAW_COUNTS };
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		buffer_infos[i + 1] = vk::DescriptorBufferInfo(frame_ring_buffer.getBuffer(), 0, frame_ring_buffer.getRangeSize(ranges[i]));
+	}
 
+	std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+	for (uint32_t binding = 0; binding < buffer_infos.size(); binding++)
+	{
+		descriptor_writes.emplace_back(
+			meshlet_culling_descriptor_set, // dstSet
+			binding, // dstBinding
+			0, // dstArrayElement
+			1, // descriptorCount
+			binding == 0 ? vk::DescriptorType::eStorageBuffer : vk::DescriptorType::eStorageBufferDynamic, // descriptorType
+			nullptr, // pImageInfo
+			&buffer_infos[binding], // pBufferInfo
+			nullptr // pTexelBufferView
+		);
+	}
+	device.updateDescriptorSets(descriptor_writes, std::array<vk::CopyDescriptorSet, 0>());
+}
 
 /**
-* Create compute pipeline for light culling
+* Records the meshlet culling compute pass of frame, which writes the meshlet draws of both passes and their counts.
+* Mesh parts are first tested against the depth pyramid of the previous frame, then their meshlets
 */
-void _VulkanRenderer_Impl::createComputePipeline()
+void _VulkanRenderer_Impl::recordMeshletCulling(VkCommandBuffer command_buffer, uint32_t frame)
 {
-	// Step 1: Create Pipeline
+	auto meshlet_count = meshlet_draw_offsets.back();
+	if (meshlet_count == 0)
+	{
+		return;
+	}
+
+	VkBuffer buffer = frame_ring_buffer.getBuffer();
+	vkCmdFillBuffer(command_buffer, buffer, frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_DRAW_COUNTS), frame_ring_buffer.getRangeSize(FRAME_RANGE_DRAW_COUNTS), 0);
+
+	// the cleared counts, and the depth pyramid built at the end of the previous submission
+	VkMemoryBarrier clear_barrier = {};
+	clear_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clear_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	clear_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		, 0, 1, &clear_barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshlet_culling_pipeline.get());
+	VkDescriptorSet descriptor_sets[] = { meshlet_culling_descriptor_set };
+	uint32_t dynamic_offsets[] = {
+		frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_CULLING),
+		frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_MESHLET_DRAWS),
+		frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_DEPTH_MESHLET_DRAWS),
+		frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_DRAW_COUNTS),
+	};
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshlet_culling_pipeline_layout.get(), 0, 1, descriptor_sets, 4, dynamic_offsets);
+
+	auto part_count = static_cast<uint32_t>(model.getMeshParts().size());
+	MeshletCullingPushConstants push_constants = { part_count, compact_meshlet_draws ? 1u : 0u, 1u };
+	vkCmdPushConstants(command_buffer, meshlet_culling_pipeline_layout.get(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+	vkCmdDispatch(command_buffer, (part_count + MESHLET_CULLING_GROUP_SIZE - 1) / MESHLET_CULLING_GROUP_SIZE, 1, 1);
+
+	// occluded parts are marked in the culling input
+	VkMemoryBarrier part_barrier = {};
+	part_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	part_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	part_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &part_barrier, 0, nullptr, 0, nullptr);
+
+	push_constants = { meshlet_count, compact_meshlet_draws ? 1u : 0u, 0u };
+	vkCmdPushConstants(command_buffer, meshlet_culling_pipeline_layout.get(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+	vkCmdDispatch(command_buffer, (meshlet_count + MESHLET_CULLING_GROUP_SIZE - 1) / MESHLET_CULLING_GROUP_SIZE, 1, 1);
+
+	// the draws are read by both passes, the counters by readCullingStatistics once the frame is done
+	VkMemoryBarrier draw_barrier = {};
+	draw_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	draw_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	draw_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &draw_barrier, 0, nullptr, 0, nullptr);
+}
+
+/**
+* Creates the compute pipeline reducing the depth prepass output into depth_pyramid, one level per dispatch
+*/
+void _VulkanRenderer_Impl::createDepthPyramidPipeline()
+{
+	auto raii_pipeline_layout_deleter = [device = this->device](auto & obj)
+	{
+		device.destroyPipelineLayout(obj);
+	};
+	auto raii_pipeline_deleter = [device = this->device](auto & obj)
+	{
+		device.destroyPipeline(obj);
+	};
+	auto raii_sampler_deleter = [device = this->device](auto & obj)
+	{
+		device.destroySampler(obj);
+	};
+
+	// texels are fetched one by one, the sampler only has to leave them unfiltered
+	VkSamplerCreateInfo sampler_info = {};
+	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.magFilter = VK_FILTER_NEAREST;
+	sampler_info.minFilter = VK_FILTER_NEAREST;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.compareEnable = VK_FALSE;
+	sampler_info.compareOp = VK_COMPARE_OP_ALWAYS;
+	sampler_info.minLod = 0.0f;
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+
+	VkSampler sampler;
+	vulkan_util::checkResult(vkCreateSampler(graphics_device, &sampler_info, nullptr, &sampler));
+	depth_pyramid_sampler = VRaii<VkSampler>(sampler, raii_sampler_deleter);
+
+	VkPushConstantRange push_constant_range = {};
+	push_constant_range.offset = 0;
+	push_constant_range.size = sizeof(DepthPyramidPushConstants);
+	push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayout set_layouts[] = { depth_pyramid_descriptor_set_layout.get() };
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = 1;
+	pipeline_layout_info.pSetLayouts = set_layouts;
+	pipeline_layout_info.pushConstantRangeCount = 1;
+	pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+	VkPipelineLayout temp_layout;
+	vulkan_util::checkResult(vkCreatePipelineLayout(graphics_device, &pipeline_layout_info, nullptr, &temp_layout));
+	depth_pyramid_pipeline_layout = VRaii<VkPipelineLayout>(temp_layout, raii_pipeline_layout_deleter);
+
+	auto comp_shader_module = createShaderModule(util::readFile(util::getContentPath("depth_pyramid_comp.spv")));
+	VkPipelineShaderStageCreateInfo comp_shader_stage_info = {};
+	comp_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	comp_shader_stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	comp_shader_stage_info.module = comp_shader_module.get();
+	comp_shader_stage_info.pName = "main";
+
+	VkComputePipelineCreateInfo pipeline_create_info = {};
+	pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_create_info.stage = comp_shader_stage_info;
+	pipeline_create_info.layout = depth_pyramid_pipeline_layout.get();
+	pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_create_info.basePipelineIndex = -1;
+
+	VkPipeline temp_pipeline;
+	vulkan_util::checkResult(vkCreateComputePipelines(graphics_device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &temp_pipeline));
+	depth_pyramid_pipeline = VRaii<VkPipeline>(temp_pipeline, raii_pipeline_deleter);
+}
+
+/**
+* Creates depth_pyramid for the swap chain extent: level 0 at half of it rounded up, halved down to a single texel.
+* Rounding up keeps every depth texel covered by levels of odd size
+*/
+void _VulkanRenderer_Impl::createDepthPyramid()
+{
+	depth_pyramid_level_sizes.clear();
+	glm::ivec2 size(swap_chain_extent.width, swap_chain_extent.height);
+	do
+	{
+		size = (size + 1) / 2;
+		depth_pyramid_level_sizes.push_back(size);
+	} while ((size.x > 1 || size.y > 1) && depth_pyramid_level_sizes.size() < MAX_DEPTH_PYRAMID_LEVELS);
+	auto level_count = static_cast<uint32_t>(depth_pyramid_level_sizes.size());
+
+	depth_pyramid_level_views.clear();
+	depth_pyramid_view = VRaii<VkImageView>();
+	std::tie(depth_pyramid, depth_pyramid_memory) = utility.createImage(depth_pyramid_level_sizes[0].x, depth_pyramid_level_sizes[0].y
+		, VK_FORMAT_R32_SFLOAT
+		, VK_IMAGE_TILING_OPTIMAL
+		, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		, level_count);
+	depth_pyramid_view = utility.createImageView(depth_pyramid.get(), VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, level_count);
+	for (uint32_t level = 0; level < level_count; level++)
+	{
+		depth_pyramid_level_views.push_back(utility.createImageView(depth_pyramid.get(), VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 1, level));
+	}
+
+	// written and read by compute shaders only, so it stays in the general layout
+	auto command_buffer = utility.beginSingleTimeCommands();
+	utility.recordTransitImageLayout(command_buffer, depth_pyramid.get(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, level_count);
+	utility.endSingleTimeCommands(command_buffer);
+
+	depth_pyramid_valid = false;
+}
+
+void _VulkanRenderer_Impl::createDepthPyramidDescriptorSets()
+{
+	std::vector<vk::DescriptorSetLayout> layouts(depth_pyramid_descriptor_sets.size(), depth_pyramid_descriptor_set_layout.get());
+	vk::DescriptorSetAllocateInfo alloc_info = {
+		descriptor_pool.get(), // descriptorPool
+		static_cast<uint32_t>(layouts.size()), // descriptorSetCount
+		layouts.data() // pSetLayouts
+	};
+	auto sets = device.allocateDescriptorSets(alloc_info);
+	std::copy(sets.begin(), sets.end(), depth_pyramid_descriptor_sets.begin());
+}
+
+/**
+* Points the reduction of each level at the level below, or at the depth image for level 0,
+* and meshlet culling at the whole pyramid. Needs to rerun after createDepthPyramid
+*/
+void _VulkanRenderer_Impl::updateDepthPyramidDescriptorSets()
+{
+	auto level_count = depth_pyramid_level_views.size();
+	std::vector<vk::DescriptorImageInfo> image_infos;
+	image_infos.reserve(level_count * 2 + 1);
+	std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+	for (size_t level = 0; level < level_count; level++)
+	{
+		image_infos.emplace_back(depth_pyramid_sampler.get()
+			, level == 0 ? depth_image_view.get() : depth_pyramid_level_views[level - 1].get()
+			, level == 0 ? vk::ImageLayout::eDepthStencilReadOnlyOptimal : vk::ImageLayout::eGeneral);
+		descriptor_writes.emplace_back(depth_pyramid_descriptor_sets[level], 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &image_infos.back(), nullptr, nullptr);
+
+		image_infos.emplace_back(vk::Sampler(), depth_pyramid_level_views[level].get(), vk::ImageLayout::eGeneral);
+		descriptor_writes.emplace_back(depth_pyramid_descriptor_sets[level], 1, 0, 1, vk::DescriptorType::eStorageImage, &image_infos.back(), nullptr, nullptr);
+	}
+
+	image_infos.emplace_back(depth_pyramid_sampler.get(), depth_pyramid_view.get(), vk::ImageLayout::eGeneral);
+	descriptor_writes.emplace_back(meshlet_culling_descriptor_set, 5, 0, 1, vk::DescriptorType::eCombinedImageSampler, &image_infos.back(), nullptr, nullptr);
+
+	device.updateDescriptorSets(descriptor_writes, std::array<vk::CopyDescriptorSet, 0>());
+}
+
+/**
+* Records the reduction of the depth prepass output into depth_pyramid, after the depth prepass;
+* meshlet culling of the next frame tests against it
+*/
+void _VulkanRenderer_Impl::recordDepthPyramid(VkCommandBuffer command_buffer)
+{
+	// the depth written by the prepass, and the pyramid done being read by meshlet culling of this frame
+	VkMemoryBarrier depth_barrier = {};
+	depth_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	depth_barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depth_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		, 0, 1, &depth_barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, depth_pyramid_pipeline.get());
+	for (size_t level = 0; level < depth_pyramid_level_sizes.size(); level++)
+	{
+		if (level > 0)
+		{
+			VkMemoryBarrier level_barrier = {};
+			level_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			level_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			level_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &level_barrier, 0, nullptr, 0, nullptr);
+		}
+
+		VkDescriptorSet descriptor_set = depth_pyramid_descriptor_sets[level];
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, depth_pyramid_pipeline_layout.get(), 0, 1, &descriptor_set, 0, nullptr);
+
+		auto size = depth_pyramid_level_sizes[level];
+		DepthPyramidPushConstants push_constants = {
+			level == 0 ? glm::ivec2(swap_chain_extent.width, swap_chain_extent.height) : depth_pyramid_level_sizes[level - 1],
+			size
+		};
+		vkCmdPushConstants(command_buffer, depth_pyramid_pipeline_layout.get(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+		vkCmdDispatch(command_buffer, (size.x + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, (size.y + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, 1);
+	}
+}
+
+/**
+* Sizes software_occlusion_buffer after the swap chain, with workers to rasterize it, if software occlusion is on
+*/
+void _VulkanRenderer_Impl::createSoftwareOcclusionBuffer()
+{
+	if (!getGlobalTestSceneConfiguration().software_occlusion || model.getOccluders().empty())
+	{
+		return;
+	}
+	auto height = std::max<uint32_t>(SOFTWARE_OCCLUSION_WIDTH * swap_chain_extent.height / std::max(swap_chain_extent.width, 1u), 1);
+	software_occlusion_buffer = SoftwareOcclusionBuffer(SOFTWARE_OCCLUSION_WIDTH, height);
+	if (!software_occlusion_threads)
+	{
+		software_occlusion_threads = std::make_unique<util::ThreadPool>(getGlobalTestSceneConfiguration().loader_thread_count);
+	}
+}
+
+/**
+* Places instance_count copies of the model side by side along x, at the scale of the scene
+*/
+void _VulkanRenderer_Impl::createInstances()
+{
+	const auto& config = getGlobalTestSceneConfiguration();
+	BoundingBox bounds;
+	for (const auto& part : model.getMeshParts())
+	{
+		bounds.expand(part.bounds);
+	}
+	float spacing = bounds.min.x <= bounds.max.x ? (bounds.max.x - bounds.min.x) * config.scale * 1.1f : 0.0f;
+	for (unsigned i = 0; i < config.instance_count; i++)
+	{
+		addInstance(glm::translate(glm::mat4(1.0f), glm::vec3(spacing * i, 0.0f, 0.0f)) * glm::scale(glm::mat4(1.0f), glm::vec3(config.scale)));
+	}
+}
+
+// transforms of the live instances, in the order their InstanceData is written and drawn
+std::vector<glm::mat4> _VulkanRenderer_Impl::getInstanceTransforms() const
+{
+	std::vector<glm::mat4> transforms;
+	for (const auto& slot : instance_slots)
+	{
+		if (slot.alive)
+		{
+			transforms.push_back(slot.transform);
+		}
+	}
+	return transforms;
+}
+
+/**
+* Records the indirect meshlet draws of pass in the order of draw_list, binding the pipeline, index buffer
+* and per part push constants only when they differ from what the previous draw left bound
+*/
+void _VulkanRenderer_Impl::recordMeshletDraws(VkCommandBuffer command_buffer, uint32_t frame, DrawPass pass, const DrawList& draw_list)
+{
+	bool depth_prepass = pass == DrawPass::depth_prepass;
+	const auto& pool = depth_prepass ? model.getDepthGeometryPool() : model.getGeometryPool();
+	const auto& parts = model.getMeshParts();
+	VkPipelineLayout layout = depth_prepass ? static_cast<VkPipelineLayout>(depth_pipeline_layout.get()) : pipeline_layout.get();
+	VkBuffer vertex_buffers[] = { pool.vertices.buffer };
+	VkDeviceSize vertex_offsets[] = { pool.vertices.offset };
+	vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, vertex_offsets);
+
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	VkBuffer draw_buffer = frame_ring_buffer.getBuffer();
+	VkDeviceSize draws_offset = frame_ring_buffer.getDynamicOffset(frame, depth_prepass ? FRAME_RANGE_DEPTH_MESHLET_DRAWS : FRAME_RANGE_MESHLET_DRAWS);
+	auto max_draw_count = vulkan_context.getEnabledFeatures().multiDrawIndirect
+		? std::max<uint32_t>(vulkan_context.getPhysicalDeviceProperties().limits.maxDrawIndirectCount, 1) : 1;
+
+	// what the previous draw left bound
+	const VMeshPart* previous_part = nullptr;
+	VkPipeline bound_pipeline = VK_NULL_HANDLE;
+
+	for (const auto& item : draw_list.getItems())
+	{
+		auto part_index = item.part;
+		const auto& part = parts[part_index];
+
+		VkPipeline pipeline = (item.sort_key >> 56) == DRAW_PIPELINE_DEPTH ? static_cast<VkPipeline>(depth_pipeline.get()) : graphics_pipeline.get();
+		if (pipeline != bound_pipeline)
+		{
+			vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			bound_pipeline = pipeline;
+		}
+		if (!previous_part || part.index_type != previous_part->index_type)
+		{
+			const auto& indices = pool.getIndices(part.index_type);
+			vkCmdBindIndexBuffer(command_buffer, indices.buffer, indices.offset, static_cast<VkIndexType>(part.index_type));
+		}
+		if (!previous_part || part.position_quantization.scale != previous_part->position_quantization.scale
+			|| part.position_quantization.bias != previous_part->position_quantization.bias)
+		{
+			VertexPushConstantObject vertex_pco = { part.position_quantization };
+			vkCmdPushConstants(command_buffer, layout, VK_SHADER_STAGE_VERTEX_BIT, VERTEX_PUSH_CONSTANT_OFFSET, sizeof(vertex_pco), &vertex_pco);
+		}
+		if (!depth_prepass && (!previous_part || part.material_index != previous_part->material_index))
+		{
+			int material_index = static_cast<int>(part.material_index);
+			vkCmdPushConstants(command_buffer, layout, VK_SHADER_STAGE_FRAGMENT_BIT
+				, offsetof(PushConstantObject, material_index), sizeof(material_index), &material_index);
+		}
+		previous_part = &part;
+
+		auto draw_count = static_cast<uint32_t>(part.meshlets.size());
+		VkDeviceSize offset = draws_offset + VkDeviceSize(stride) * meshlet_draw_offsets[part_index];
+#ifdef VK_KHR_draw_indirect_count
+		if (compact_meshlet_draws)
+		{
+			// the visible draws are packed at the start of the part's draws
+			VkDeviceSize count_offset = frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_DRAW_COUNTS) + sizeof(DrawCountsHeader) + sizeof(uint32_t) * part_index;
+			vulkan_context.getDrawIndexedIndirectCount()(command_buffer, draw_buffer, offset, draw_buffer, count_offset, draw_count, stride);
+			continue;
+		}
+#endif
+		// otherwise culled meshlets still cost a draw here, but with no instances
+		for (uint32_t i = 0; i < draw_count; i += max_draw_count)
+		{
+			vkCmdDrawIndexedIndirect(command_buffer, draw_buffer, offset + VkDeviceSize(stride) * i, std::min(max_draw_count, draw_count - i), stride);
+		}
+	}
+}
+
+void _VulkanRenderer_Impl::createGraphicsCommandBuffers()
+{
+	// grouped by material only, the depth prepass already laid down the nearest surfaces so the camera does not matter
+	shading_draw_list.build(model.getMeshParts(), DrawPass::shading, DRAW_PIPELINE_FORWARD, {}, 0.0f, 0.0f);
+
+	for (uint32_t frame = 0; frame < FRAME_COUNT; frame++)
+	{
+		auto& command_buffers = frames[frame].command_buffers;
+
+		// Free old command buffers, if any
+		if (command_buffers.size() > 0)
+		{
+			vkFreeCommandBuffers(graphics_device, graphics_command_pool, (uint32_t)command_buffers.size(), command_buffers.data());
+		}
+		command_buffers.clear();
+
+		command_buffers.resize(swap_chain_framebuffers.size());
+
+		VkCommandBufferAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.commandPool = graphics_command_pool;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		// primary: can be submitted to a queue but cannot be called from other command buffers
+		// secondary: can be called by others but cannot be submitted to a queue
+		alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+
+		auto alloc_result = vkAllocateCommandBuffers(graphics_device, &alloc_info, command_buffers.data());
+		if (alloc_result != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate command buffers!");
+		}
+
+		// record command buffers
+		for (size_t i = 0; i < command_buffers.size(); i++)
+		{
+			VkCommandBufferBeginInfo begin_info = {};
+			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+			begin_info.pInheritanceInfo = nullptr; // Optional
+
+			vkBeginCommandBuffer(command_buffers[i], &begin_info);
+
+			// render pass
+			{
+				VkRenderPassBeginInfo render_pass_info = {};
+				render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+				render_pass_info.renderPass = render_pass.get();
+				render_pass_info.framebuffer = swap_chain_framebuffers[i].get();
+				render_pass_info.renderArea.offset = { 0, 0 };
+				render_pass_info.renderArea.extent = swap_chain_extent;
+
+				std::array<VkClearValue, 1> clear_values = {};
+				clear_values[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+				//clear_values[1].depthStencil = { 1.0f, 0 }; // don't clear with depth prepass
+				render_pass_info.clearValueCount = (uint32_t)clear_values.size();
+				render_pass_info.pClearValues = clear_values.data();
+
+				vkCmdBeginRenderPass(command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+
+				PushConstantObject pco = {
+					static_cast<int>(swap_chain_extent.width),
+					static_cast<int>(swap_chain_extent.height),
+					tile_count_per_row, tile_count_per_col,
+					debug_view_index
+				};
+				vkCmdPushConstants(command_buffers[i], pipeline_layout.get(), VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pco), &pco);
+
+
+				// the materials are bound once with everything else, each draw only pushes its material index
+				std::array<VkDescriptorSet, 5> descriptor_sets = { object_descriptor_set, camera_descriptor_set, light_culling_descriptor_set, intermediate_descriptor_set, model.getMaterialDescriptorSet() };
+				std::array<uint32_t, 3> dynamic_offsets = { frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_INSTANCES), frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_CAMERA), frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_LIGHTS) };
+				vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS
+					, pipeline_layout.get(), 0, static_cast<uint32_t>(descriptor_sets.size()), descriptor_sets.data()
+					, static_cast<uint32_t>(dynamic_offsets.size()), dynamic_offsets.data());
+
+				// binds the forward pipeline with the first draw
+				recordMeshletDraws(command_buffers[i], frame, DrawPass::shading, shading_draw_list);
+				vkCmdEndRenderPass(command_buffers[i]);
+				if (timestamp_query_pool.get() != VK_NULL_HANDLE)
+				{
+					vkCmdWriteTimestamp(command_buffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool.get(), frame * 2 + 1);
+				}
+				//utility.recordTransitImageLayout(command_buffers[i], pre_pass_depth_image.get(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+		
+			}
+
+			auto record_result = vkEndCommandBuffer(command_buffers[i]);
+			if (record_result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to record command buffer!");
+			}
+		}
+	}
+}
+
+void _VulkanRenderer_Impl::createSyncObjects()
+{
+	vk::SemaphoreCreateInfo semaphore_info = { vk::SemaphoreCreateFlags() };
+
+	auto destroy_func = [&device = this->device](auto & obj)
+	{
+		device.destroySemaphore(obj);
+	};
+
+	for (auto& frame : frames)
+	{
+		frame.render_finished_semaphore = VRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+		);
+		frame.image_available_semaphore = VRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+		);
+		frame.lightculling_completed_semaphore = VRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+		);
+		frame.depth_prepass_finished_semaphore = VRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+		);
+		frame.frame_finished_semaphore = VRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+		);
+
+		// signaled, as no frame has used its resources yet
+		VkFenceCreateInfo fence_info = {};
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		VkFence fence;
+		vulkan_util::checkResult(vkCreateFence(graphics_device, &fence_info, nullptr, &fence), "Failed to create frame fence!");
+		frame.fence = VRaii<VkFence>(
+			fence,
+			[device = this->device](auto& obj)
+			{
+				device.destroyFence(obj);
+			}
+		);
+	}
+}
+
+
+/**
+* Create compute pipeline for light culling
+*/
+void _VulkanRenderer_Impl::createComputePipeline()
+{
+	// Step 1: Create Pipeline
 	{
 		auto raii_pipeline_layout_deleter = [device = this->device](auto & obj)
 		{
@@ -1604,8 +2613,8 @@ void _VulkanRenderer_Impl::createLightVisibilityBuffer()
 
 		// refer to the uniform object buffer
 		vk::DescriptorBufferInfo pointlight_buffer_info = {
-			pointlight_buffer.get(), // buffer_
-			0, //offset_
+			frame_ring_buffer.getBuffer(), // buffer_
+			0, //offset_, the frame's lights are at a dynamic offset
 			pointlight_buffer_size // range_
 		};
 
@@ -1627,7 +2636,7 @@ void _VulkanRenderer_Impl::createLightVisibilityBuffer()
 			1, // dstBinding
 			0, // distArrayElement
 			1, // descriptorCount
-			vk::DescriptorType::eStorageBuffer, //descriptorType // FIXME: change back to uniform
+			vk::DescriptorType::eStorageBufferDynamic, //descriptorType // FIXME: change back to uniform
 			nullptr, //pImageInfo
 			&pointlight_buffer_info, //pBufferInfo
 			nullptr //pTexBufferView
@@ -1641,129 +2650,136 @@ void _VulkanRenderer_Impl::createLightVisibilityBuffer()
 
 void _VulkanRenderer_Impl::createLightCullingCommandBuffer()
 {
-
-	if (light_culling_command_buffer)
+	for (uint32_t frame = 0; frame < FRAME_COUNT; frame++)
 	{
-		device.freeCommandBuffers(compute_command_pool, 1, &light_culling_command_buffer);
-		light_culling_command_buffer = nullptr;
-	}
+		auto& light_culling_command_buffer = frames[frame].light_culling_command_buffer;
 
-	// Create light culling command buffer
-	{
-		vk::CommandBufferAllocateInfo alloc_info = {
-			compute_command_pool, // command pool
-			vk::CommandBufferLevel::ePrimary, // level
-			1 // commandBufferCount
-		};
+		if (light_culling_command_buffer)
+		{
+			device.freeCommandBuffers(compute_command_pool, 1, &light_culling_command_buffer);
+			light_culling_command_buffer = nullptr;
+		}
 
-		light_culling_command_buffer = device.allocateCommandBuffers(alloc_info)[0];
-	}
+		// Create light culling command buffer
+		{
+			vk::CommandBufferAllocateInfo alloc_info = {
+				compute_command_pool, // command pool
+				vk::CommandBufferLevel::ePrimary, // level
+				1 // commandBufferCount
+			};
 
-	// Record command buffer
-	{
-		vk::CommandBufferBeginInfo begin_info =
+			light_culling_command_buffer = device.allocateCommandBuffers(alloc_info)[0];
+		}
+
+		// Record command buffer
 		{
-			vk::CommandBufferUsageFlagBits::eSimultaneousUse,
-			nullptr
-		};
+			vk::CommandBufferBeginInfo begin_info =
+			{
+				vk::CommandBufferUsageFlagBits::eSimultaneousUse,
+				nullptr
+			};
 
-		vk::CommandBuffer command(light_culling_command_buffer);
+			vk::CommandBuffer command(light_culling_command_buffer);
 
-		command.begin(begin_info);
+			command.begin(begin_info);
 
-		// using barrier since the sharing mode when allocating memory is exclusive
-		// begin after fragment shader finished reading from storage buffer
-
-		std::vector<vk::BufferMemoryBarrier> barriers_before;
-		barriers_before.emplace_back
-		(
-			vk::AccessFlagBits::eShaderRead,  // srcAccessMask
-			vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
-			0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // srcQueueFamilyIndex
-			0, //static_cast<uint32_t>(queue_family_indices.compute_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(light_visibility_buffer.get()),  // buffer
-			0,  // offset
-			light_visibility_buffer_size  // size
-		);
-		barriers_before.emplace_back
-		(
-			vk::AccessFlagBits::eShaderRead,  // srcAccessMask // FIXME: change back to uniform
-			vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
-			0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // srcQueueFamilyIndex
-			0, //static_cast<uint32_t>(queue_family_indices.compute_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(pointlight_buffer.get()),  // buffer
-			0,  // offset
-			pointlight_buffer_size  // size
-		);
+			// using barrier since the sharing mode when allocating memory is exclusive
+			// begin after fragment shader finished reading from storage buffer
+			// the lights are only written by the host before submission, so they need no barrier
 
-		command.pipelineBarrier(
-			vk::PipelineStageFlagBits::eFragmentShader,  // srcStageMask
-			vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
-			vk::DependencyFlags(),  // dependencyFlags
-			0,  // memoryBarrierCount
-			nullptr,  // pBUfferMemoryBarriers
-			static_cast<uint32_t>(barriers_before.size()),  // bufferMemoryBarrierCount
-			barriers_before.data(),  // pBUfferMemoryBarriers
-			0,  // imageMemoryBarrierCount
-			nullptr // pImageMemoryBarriers
-		);
+			std::vector<vk::BufferMemoryBarrier> barriers_before;
+			barriers_before.emplace_back
+			(
+				vk::AccessFlagBits::eShaderRead,  // srcAccessMask
+				vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
+				0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // srcQueueFamilyIndex
+				0, //static_cast<uint32_t>(queue_family_indices.compute_family),  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(light_visibility_buffer.get()),  // buffer
+				0,  // offset
+				light_visibility_buffer_size  // size
+			);
 
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eFragmentShader,  // srcStageMask
+				vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+				vk::DependencyFlags(),  // dependencyFlags
+				0,  // memoryBarrierCount
+				nullptr,  // pBUfferMemoryBarriers
+				static_cast<uint32_t>(barriers_before.size()),  // bufferMemoryBarrierCount
+				barriers_before.data(),  // pBUfferMemoryBarriers
+				0,  // imageMemoryBarrierCount
+				nullptr // pImageMemoryBarriers
+			);
 
-		// barrier
-		command.bindDescriptorSets(
-			vk::PipelineBindPoint::eCompute, // pipelineBindPoint
-			compute_pipeline_layout.get(), // layout
-			0, // firstSet
-			std::array<vk::DescriptorSet, 3>{light_culling_descriptor_set, camera_descriptor_set, intermediate_descriptor_set}, // descriptorSets
-			std::array<uint32_t, 0>() // pDynamicOffsets
-		);
 
-		PushConstantObject pco = { static_cast<int>(swap_chain_extent.width), static_cast<int>(swap_chain_extent.height), tile_count_per_row, tile_count_per_col };
-		command.pushConstants(compute_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pco), &pco);
+			// barrier
+			command.bindDescriptorSets(
+				vk::PipelineBindPoint::eCompute, // pipelineBindPoint
+				compute_pipeline_layout.get(), // layout
+				0, // firstSet
+				std::array<vk::DescriptorSet, 3>{light_culling_descriptor_set, camera_descriptor_set, intermediate_descriptor_set}, // descriptorSets
+				std::array<uint32_t, 2>{frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_LIGHTS), frame_ring_buffer.getDynamicOffset(frame, FRAME_RANGE_CAMERA)} // pDynamicOffsets
+			);
 
-		command.bindPipeline(vk::PipelineBindPoint::eCompute, static_cast<VkPipeline>(compute_pipeline.get()));
-		command.dispatch(tile_count_per_row, tile_count_per_col, 1);
+			PushConstantObject pco = { static_cast<int>(swap_chain_extent.width), static_cast<int>(swap_chain_extent.height), tile_count_per_row, tile_count_per_col };
+			command.pushConstants(compute_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pco), &pco);
 
+			command.bindPipeline(vk::PipelineBindPoint::eCompute, static_cast<VkPipeline>(compute_pipeline.get()));
+			command.dispatch(tile_count_per_row, tile_count_per_col, 1);
 
-		std::vector<vk::BufferMemoryBarrier> barriers_after;
-		barriers_after.emplace_back
-		(
-			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
-			vk::AccessFlagBits::eShaderRead,  // dstAccessMask
-			0,//static_cast<uint32_t>(queue_family_indices.compute_family), // srcQueueFamilyIndex
-			0,//static_cast<uint32_t>(queue_family_indices.graphics_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(light_visibility_buffer.get()),  // buffer
-			0,  // offset
-			light_visibility_buffer_size  // size
-		);
-		barriers_after.emplace_back
-		(
-			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask // TODO: change back to uniform
-			vk::AccessFlagBits::eShaderRead,  // dstAccessMask
-			0, //static_cast<uint32_t>(queue_family_indices.compute_family), // srcQueueFamilyIndex
-			0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(pointlight_buffer.get()),  // buffer
-			0,  // offset
-			pointlight_buffer_size  // size
-		);
 
-		command.pipelineBarrier(
-			vk::PipelineStageFlagBits::eComputeShader,
-			vk::PipelineStageFlagBits::eFragmentShader,
-			vk::DependencyFlags(),
-			0, nullptr,
-			static_cast<uint32_t>(barriers_after.size()), barriers_after.data(), // TODO
-			0, nullptr
-		);
+			std::vector<vk::BufferMemoryBarrier> barriers_after;
+			barriers_after.emplace_back
+			(
+				vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
+				vk::AccessFlagBits::eShaderRead,  // dstAccessMask
+				0,//static_cast<uint32_t>(queue_family_indices.compute_family), // srcQueueFamilyIndex
+				0,//static_cast<uint32_t>(queue_family_indices.graphics_family),  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(light_visibility_buffer.get()),  // buffer
+				0,  // offset
+				light_visibility_buffer_size  // size
+			);
 
-		command.end();
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::PipelineStageFlagBits::eFragmentShader,
+				vk::DependencyFlags(),
+				0, nullptr,
+				static_cast<uint32_t>(barriers_after.size()), barriers_after.data(), // TODO
+				0, nullptr
+			);
+
+			command.end();
+		}
 	}
 }
 
 
 
+/**
+* Waits until the GPU is done with every frame in flight
+*/
+void _VulkanRenderer_Impl::waitForFrames()
+{
+	std::array<VkFence, FRAME_COUNT> fences;
+	for (uint32_t frame = 0; frame < FRAME_COUNT; frame++)
+	{
+		fences[frame] = frames[frame].fence.get();
+	}
+	vulkan_util::checkResult(vkWaitForFences(graphics_device, FRAME_COUNT, fences.data(), VK_TRUE, std::numeric_limits<uint64_t>::max())
+		, "Failed to wait for frames!");
+}
+
+/**
+* Writes the camera, the lights and the culling input of the next frame into its region of frame_ring_buffer,
+* after waiting for the frame which last used that region
+*/
 void _VulkanRenderer_Impl::updateUniformBuffers(float deltatime)
 {
+	vulkan_util::checkResult(vkWaitForFences(graphics_device, 1, frames[frame_index].fence.data(), VK_TRUE, std::numeric_limits<uint64_t>::max())
+		, "Failed to wait for frame!");
+	readTimestamps(frame_index);
+
 	static auto start_time = std::chrono::high_resolution_clock::now();
 
 	auto current_time = std::chrono::high_resolution_clock::now();
@@ -1773,24 +2789,43 @@ void _VulkanRenderer_Impl::updateUniformBuffers(float deltatime)
 	{
 		CameraUbo ubo = {};
 		ubo.view = view_matrix;
-		ubo.proj = glm::perspective(glm::radians(45.0f), swap_chain_extent.width / (float)swap_chain_extent.height, 0.5f, 100.0f);
+		ubo.proj = glm::perspective(glm::radians(45.0f), swap_chain_extent.width / (float)swap_chain_extent.height, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
 		ubo.proj[1][1] *= -1; //since the Y axis of Vulkan NDC points down
 		ubo.projview = ubo.proj * ubo.view;
 		ubo.cam_pos = cam_pos;
 
-		void* data;
-		vkMapMemory(graphics_device, camera_staging_buffer_memory.get(), 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(graphics_device, camera_staging_buffer_memory.get());
+		memcpy(frame_ring_buffer.getData(frame_index, FRAME_RANGE_CAMERA), &ubo, sizeof(ubo));
 
-		// TODO: maybe I shouldn't use single time buffer
-		utility.copyBuffer(camera_staging_buffer.get(), camera_uniform_buffer.get(), sizeof(ubo));
+		// normal and MVP matrices once per instance rather than per vertex
+		auto transforms = getInstanceTransforms();
+		auto instances = static_cast<InstanceData*>(frame_ring_buffer.getData(frame_index, FRAME_RANGE_INSTANCES));
+		for (size_t i = 0; i < transforms.size(); i++)
+		{
+			instances[i] = { transforms[i], glm::transpose(glm::inverse(transforms[i])), ubo.projview * transforms[i] };
+		}
+
+		if (getGlobalTestSceneConfiguration().meshlet_culling || getGlobalTestSceneConfiguration().lod_pixel_error > 0.0f)
+		{
+			updateMeshletCulling(&ubo, frame_index);
+		}
+		else if (static_cast<CullingParameters*>(frame_ring_buffer.getData(frame_index, FRAME_RANGE_CULLING))->instances.x != transforms.size())
+		{
+			// the draws written without a camera still carry the instance count of before
+			updateMeshletCulling(nullptr, frame_index);
+		}
+		if (texture_streamer.getBudget() > 0)
+		{
+			updateTextureStreaming(ubo);
+		}
+		if (sortDepthDraws(ubo.cam_pos, frame_index))
+		{
+			recordDepthPrePassCommandBuffer(frame_index);
+		}
 	}
 
 	// update light ubo
 	{
 		auto light_num = static_cast<int>(pointlights.size());
-		VkDeviceSize bufferSize = sizeof(PointLight) * MAX_POINT_LIGHT_COUNT + sizeof(glm::vec4);
 
 		for (int i = 0; i < light_num; i++) {
 			pointlights[i].pos += glm::vec3(0, 3.0f, 0) * deltatime;
@@ -1800,12 +2835,235 @@ void _VulkanRenderer_Impl::updateUniformBuffers(float deltatime)
 		}
 
 		auto pointlights_size = sizeof(PointLight) * pointlights.size();
-		void* data;
-		vkMapMemory(graphics_device, lights_staging_buffer_memory.get(), 0, pointlight_buffer_size, 0, &data);
+		auto data = static_cast<char*>(frame_ring_buffer.getData(frame_index, FRAME_RANGE_LIGHTS));
 		memcpy(data, &light_num, sizeof(int));
-		memcpy((char*)data + sizeof(glm::vec4), pointlights.data(), pointlights_size);
-		vkUnmapMemory(graphics_device, lights_staging_buffer_memory.get());
-		utility.copyBuffer(lights_staging_buffer.get(), pointlight_buffer.get(), pointlight_buffer_size);
+		memcpy(data + sizeof(glm::vec4), pointlights.data(), pointlights_size);
+	}
+}
+
+/**
+* Picks a level of detail for every mesh part and culls the parts through the model's bounding volume hierarchy,
+* then writes them with the frustum of every instance into the culling input of frame. The meshlet culling compute pass
+* rejects parts hidden in the depth pyramid, culls the meshlets of the others by their spheres, normal cones and the depth pyramid,
+* and writes the indirect draws of both passes. Without a camera, every meshlet of the full detail levels is drawn.
+* Copies of the model share their draws, which keep a part or meshlet as long as the frustum of any copy holds it;
+* normal cones and occlusion are only culled for a single instance
+*/
+void _VulkanRenderer_Impl::updateMeshletCulling(const CameraUbo* camera, uint32_t frame)
+{
+	readCullingStatistics(frame);
+
+	const auto& config = getGlobalTestSceneConfiguration();
+	auto transforms = getInstanceTransforms();
+	bool cull = camera && config.meshlet_culling && !transforms.empty();
+	bool single_instance = cull && transforms.size() == 1;
+	bool select_lod = camera && config.lod_pixel_error > 0.0f && !transforms.empty();
+
+	// meshlet and LOD bounds are in model space, occlusion is only tested in that of the first instance
+	auto model_matrix = transforms.empty() ? glm::mat4(1.0f) : transforms[0];
+	std::vector<Frustum> frustums(transforms.size());
+	std::vector<glm::vec3> viewer_positions(transforms.size(), glm::vec3(0.0f)); // of each instance
+	float pixels_per_distance = 0.0f; // screen pixels covered by a length at distance 1, in any space
+	if (camera)
+	{
+		for (size_t i = 0; i < transforms.size(); i++)
+		{
+			frustums[i] = meshlet::extractFrustum(camera->projview * transforms[i]);
+		}
+		viewer_positions = getViewerPositions(transforms, camera->cam_pos);
+		pixels_per_distance = std::abs(camera->proj[1][1]) * swap_chain_extent.height * 0.5f;
+	}
+
+	auto parameters = static_cast<CullingParameters*>(frame_ring_buffer.getData(frame, FRAME_RANGE_CULLING));
+	parameters->viewer_position = glm::vec4(viewer_positions.empty() ? glm::vec3(0.0f) : viewer_positions[0], single_instance ? 1.0f : 0.0f);
+	parameters->instances = glm::uvec4(static_cast<uint32_t>(transforms.size()), cull ? static_cast<uint32_t>(frustums.size()) : 0, 0, 0);
+	if (cull)
+	{
+		std::copy(frustums.begin(), frustums.end(), parameters->frustums);
+	}
+
+	// parts behind the occluders are rejected before the GPU tests the others against its depth pyramid
+	bool software_occlusion_cull = single_instance && config.software_occlusion && !model.getOccluders().empty();
+	auto projview = camera ? camera->projview * model_matrix : glm::mat4(1.0f);
+	if (software_occlusion_cull)
+	{
+		software_occlusion_buffer.render(model.getOccluders(), projview, software_occlusion_threads.get());
+	}
+
+	// the pyramid is built from the depth prepass of the frame submitted last, seen with its camera
+	bool occlusion_cull = single_instance && config.occlusion_culling && depth_pyramid_valid;
+	parameters->pyramid_projview = depth_pyramid_projview;
+	parameters->pyramid = glm::ivec4(swap_chain_extent.width, swap_chain_extent.height, depth_pyramid_level_sizes.size(), occlusion_cull ? 1 : 0);
+	if (camera)
+	{
+		depth_pyramid_projview = projview;
+		depth_pyramid_valid = true;
+	}
+	auto part_states = reinterpret_cast<PartCullState*>(parameters + 1);
+
+	const auto& parts = model.getMeshParts();
+	part_visibility.assign(parts.size(), FrustumTest::inside);
+	if (cull)
+	{
+		// against the union of the frustums: inside any of them, else crossing any of them, else outside
+		model.getPartHierarchy().cullFrustum(FrustumPlanes(frustums[0]), &part_visibility);
+		std::vector<FrustumTest> instance_visibility;
+		for (size_t i = 1; i < frustums.size(); i++)
+		{
+			model.getPartHierarchy().cullFrustum(FrustumPlanes(frustums[i]), &instance_visibility);
+			for (size_t part_index = 0; part_index < parts.size(); part_index++)
+			{
+				part_visibility[part_index] = std::max(part_visibility[part_index], instance_visibility[part_index]);
+			}
+		}
+	}
+	CullingStatistics statistics;
+
+	for (size_t part_index = 0; part_index < parts.size(); part_index++)
+	{
+		const auto& part = parts[part_index];
+
+		// the coarsest level whose error projects to at most lod_pixel_error pixels from the nearest point of the part in any instance
+		size_t lod_index = 0;
+		if (select_lod)
+		{
+			float distance = std::numeric_limits<float>::max();
+			for (size_t i = 0; i < transforms.size(); i++)
+			{
+				distance = std::min(distance, std::max(glm::length(part.bounds_center - viewer_positions[i]) - part.bounds_radius
+					, CAMERA_NEAR_PLANE / getUniformScale(transforms[i])));
+			}
+			while (lod_index + 1 < part.lods.size()
+				&& part.lods[lod_index + 1].error * pixels_per_distance / distance <= config.lod_pixel_error)
+			{
+				lod_index++;
+			}
+		}
+		const auto& lod = part.lods[lod_index];
+
+		auto visibility = static_cast<uint32_t>(part_visibility[part_index]);
+		if (software_occlusion_cull && part_visibility[part_index] != FrustumTest::outside && software_occlusion_buffer.isOccluded(part.bounds, projview))
+		{
+			visibility = PART_OCCLUDED;
+			statistics.occluded_parts++;
+		}
+		part_states[part_index] = { glm::vec4(part.bounds.min, 1.0f), glm::vec4(part.bounds.max, 1.0f)
+			, lod.first_meshlet, lod.meshlet_count, visibility, meshlet_draw_offsets[part_index] };
+		statistics.culled_triangles += lod.index_count / 3; // until the GPU counts the visible ones
+		if (visibility == static_cast<uint32_t>(FrustumTest::outside) || visibility == PART_OCCLUDED)
+		{
+			statistics.culled_parts++;
+			statistics.culled_meshlets += lod.meshlet_count;
+		}
+		else
+		{
+			statistics.visible_parts++;
+			statistics.visible_meshlets += lod.meshlet_count; // until the GPU culls some of them
+		}
+	}
+
+	frames[frame].pending_culling_statistics = statistics;
+	frames[frame].culling_statistics_pending = cull;
+}
+
+/**
+* Completes the culling statistics of the last submission of frame with the counters of meshlet culling;
+* the frame must be done on the GPU
+*/
+void _VulkanRenderer_Impl::readCullingStatistics(uint32_t frame)
+{
+	if (!frames[frame].culling_statistics_pending)
+	{
+		return;
+	}
+	frames[frame].culling_statistics_pending = false;
+
+	auto statistics = frames[frame].pending_culling_statistics;
+	const auto& counters = *static_cast<const DrawCountsHeader*>(frame_ring_buffer.getData(frame, FRAME_RANGE_DRAW_COUNTS));
+	auto visible_meshlets = std::min(counters.visible_meshlets, statistics.visible_meshlets);
+	statistics.culled_meshlets += statistics.visible_meshlets - visible_meshlets;
+	statistics.visible_meshlets = visible_meshlets;
+	auto occluded_parts = std::min(counters.occluded_parts, statistics.visible_parts);
+	statistics.culled_parts += occluded_parts;
+	statistics.visible_parts -= occluded_parts;
+	statistics.occluded_parts += occluded_parts;
+	statistics.visible_triangles = std::min(counters.visible_triangles, statistics.culled_triangles);
+	statistics.culled_triangles -= statistics.visible_triangles;
+	statistics.occluded_triangles = std::min(counters.occluded_triangles, statistics.culled_triangles);
+
+	culling_statistics = statistics;
+	culling_frame_count++;
+	culled_parts_total += statistics.culled_parts;
+	visible_parts_total += statistics.visible_parts;
+	culled_meshlets_total += statistics.culled_meshlets;
+	visible_meshlets_total += statistics.visible_meshlets;
+	occluded_parts_total += statistics.occluded_parts;
+	culled_triangles_total += statistics.culled_triangles;
+	visible_triangles_total += statistics.visible_triangles;
+	occluded_triangles_total += statistics.occluded_triangles;
+}
+
+/**
+* Requests the mip level every visible material texture needs from the screen size of its mesh parts:
+* one unit of texture coordinates covers uv_world_scale * pixels_per_distance / distance pixels at the nearest point of a part.
+* Textures are only swapped once every frame in flight is done with them;
+* the forward command buffers are then rerecorded, as their descriptors are rewritten
+*/
+void _VulkanRenderer_Impl::updateTextureStreaming(const CameraUbo& camera)
+{
+	auto transforms = getInstanceTransforms();
+	std::vector<meshlet::Frustum> frustums;
+	for (const auto& transform : transforms)
+	{
+		frustums.push_back(meshlet::extractFrustum(camera.projview * transform));
+	}
+	auto viewer_positions = getViewerPositions(transforms, camera.cam_pos);
+	float pixels_per_distance = std::abs(camera.proj[1][1]) * swap_chain_extent.height * 0.5f;
+
+	auto requestLevel = [this](const VTexture* texture, float pixels_per_uv)
+	{
+		if (texture)
+		{
+			float texels_per_pixel = std::max(texture->width, texture->height) / pixels_per_uv;
+			auto level = texels_per_pixel > 1.0f ? static_cast<uint32_t>(std::log2(texels_per_pixel)) : 0;
+			texture_streamer.requestLevel(texture, level);
+		}
+	};
+	for (const auto& part : model.getMeshParts())
+	{
+		if (part.uv_world_scale <= 0.0f)
+		{
+			continue;
+		}
+		// the nearest instance seeing the part decides the resolution
+		float distance = std::numeric_limits<float>::max();
+		for (size_t i = 0; i < transforms.size(); i++)
+		{
+			if (meshlet::isSphereInFrustum(frustums[i], part.bounds_center, part.bounds_radius))
+			{
+				distance = std::min(distance, std::max(glm::length(part.bounds_center - viewer_positions[i]) - part.bounds_radius
+					, CAMERA_NEAR_PLANE / getUniformScale(transforms[i])));
+			}
+		}
+		if (distance == std::numeric_limits<float>::max())
+		{
+			continue;
+		}
+		float pixels_per_uv = part.uv_world_scale * pixels_per_distance / distance;
+		requestLevel(part.albedo_texture, pixels_per_uv);
+		requestLevel(part.normal_texture, pixels_per_uv);
+	}
+
+	bool swap_textures = texture_streamer.hasCompletedUploads();
+	if (swap_textures)
+	{
+		waitForFrames();
+	}
+	auto changed_textures = texture_streamer.update(swap_textures);
+	if (!changed_textures.empty())
+	{
+		model.updateMaterialDescriptorSet(device, texture_sampler.get(), changed_textures);
+		createGraphicsCommandBuffers();
 	}
 }
 
@@ -1813,11 +3071,13 @@ const uint64_t ACQUIRE_NEXT_IMAGE_TIMEOUT{ std::numeric_limits<uint64_t>::max()
 
 void _VulkanRenderer_Impl::drawFrame()
 {
+	auto& frame = frames[frame_index];
+
 	// 1. Acquiring an image from the swap chain
 	uint32_t image_index;
 	{
 		auto aquiring_result = vkAcquireNextImageKHR(graphics_device, swap_chain.get()
-			, ACQUIRE_NEXT_IMAGE_TIMEOUT, image_available_semaphore.get(), VK_NULL_HANDLE, &image_index);
+			, ACQUIRE_NEXT_IMAGE_TIMEOUT, frame.image_available_semaphore.get(), VK_NULL_HANDLE, &image_index);
 
 		if (aquiring_result == VK_ERROR_OUT_OF_DATE_KHR)
 		{
@@ -1833,30 +3093,32 @@ void _VulkanRenderer_Impl::drawFrame()
 
 	// submit depth pre-pass command buffer
 	{
+		// the previous frame must be done with the depth and light visibility buffers shared by all frames
+		vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eAllCommands };
 		vk::SubmitInfo submit_info = {
-			0, // waitSemaphoreCount
-			nullptr, // pWaitSemaphores
-			nullptr, // pwaitDstStageMask
+			previous_frame_semaphore ? 1u : 0u, // waitSemaphoreCount
+			&previous_frame_semaphore, // pWaitSemaphores
+			wait_stages, // pwaitDstStageMask
 			1, // commandBufferCount
-			&depth_prepass_command_buffer, // pCommandBuffers
+			&frame.depth_prepass_command_buffer, // pCommandBuffers
 			1, // singalSemaphoreCount
-			depth_prepass_finished_semaphore.data() // pSingalSemaphores
+			frame.depth_prepass_finished_semaphore.data() // pSingalSemaphores
 		};
 		graphics_queue.submit(1, &submit_info, nullptr);
 	}
 
 	// submit light culling command buffer
 	{
-		vk::Semaphore wait_semaphores[] = { depth_prepass_finished_semaphore.get() }; // which semaphore to wait
+		vk::Semaphore wait_semaphores[] = { frame.depth_prepass_finished_semaphore.get() }; // which semaphore to wait
 		vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eComputeShader }; // which stage to execute
 		vk::SubmitInfo submit_info = {
 			1, // waitSemaphoreCount
 			wait_semaphores, // pWaitSemaphores
 			wait_stages, // pwaitDstStageMask
 			1, // commandBufferCount
-			&light_culling_command_buffer, // pCommandBuffers
+			&frame.light_culling_command_buffer, // pCommandBuffers
 			1, // singalSemaphoreCount
-			lightculling_completed_semaphore.data() // pSingalSemaphores
+			frame.lightculling_completed_semaphore.data() // pSingalSemaphores
 		};
 		compute_queue.submit(1, &submit_info, nullptr);
 	}
@@ -1865,30 +3127,33 @@ void _VulkanRenderer_Impl::drawFrame()
 	{
 		VkSubmitInfo submit_info = {};
 		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		VkSemaphore wait_semaphores[] = { image_available_semaphore.get() , lightculling_completed_semaphore.get() }; // which semaphore to wait
-		VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT }; // which stage to execute
+		VkSemaphore wait_semaphores[] = { frame.image_available_semaphore.get() , frame.lightculling_completed_semaphore.get() }; // which semaphore to wait
+		// the meshlet draws written at the start of the depth prepass are read by the draw indirect stage
+		VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT }; // which stage to execute
 		submit_info.waitSemaphoreCount = 2;
 		submit_info.pWaitSemaphores = wait_semaphores;
 		submit_info.pWaitDstStageMask = wait_stages;
 		submit_info.commandBufferCount = 1;
-		submit_info.pCommandBuffers = &command_buffers[image_index];
-		VkSemaphore signal_semaphores[] = { render_finished_semaphore.get() };
-		submit_info.signalSemaphoreCount = 1;
+		submit_info.pCommandBuffers = &frame.command_buffers[image_index];
+		VkSemaphore signal_semaphores[] = { frame.render_finished_semaphore.get(), frame.frame_finished_semaphore.get() };
+		submit_info.signalSemaphoreCount = 2;
 		submit_info.pSignalSemaphores = signal_semaphores;
 
-		auto submit_result = vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+		vkResetFences(graphics_device, 1, frame.fence.data());
+		auto submit_result = vkQueueSubmit(graphics_queue, 1, &submit_info, frame.fence.get());
 		if (submit_result != VK_SUCCESS) {
 			throw std::runtime_error("Failed to submit draw command buffer!");
 		}
+		frame.timestamps_pending = timestamp_query_pool.get() != VK_NULL_HANDLE;
+		previous_frame_semaphore = frame.frame_finished_semaphore.get();
 	}
-	// TODO: use Fence and we can have cpu start working at a earlier time
 
 	// 3. Submitting the result back to the swap chain to show it on screen
 	{
 		VkPresentInfoKHR present_info = {};
 		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 		present_info.waitSemaphoreCount = 1;
-		VkSemaphore present_wait_semaphores[] = { render_finished_semaphore.get() };
+		VkSemaphore present_wait_semaphores[] = { frame.render_finished_semaphore.get() };
 		present_info.pWaitSemaphores = present_wait_semaphores;
 		VkSwapchainKHR swapChains[] = { swap_chain.get() };
 		present_info.swapchainCount = 1;
@@ -1897,6 +3162,7 @@ void _VulkanRenderer_Impl::drawFrame()
 		present_info.pResults = nullptr; // Optional, check for if every single chains is successful
 
 		VkResult present_result = vkQueuePresentKHR(present_queue, &present_info);
+		frame_index = (frame_index + 1) % FRAME_COUNT;
 
 		if (present_result == VK_ERROR_OUT_OF_DATE_KHR || present_result == VK_SUBOPTIMAL_KHR)
 		{
@@ -1943,6 +3209,11 @@ int VulkanRenderer::getDebugViewIndex() const
 	return p_impl->getDebugViewIndex();
 }
 
+CullingStatistics VulkanRenderer::getCullingStatistics() const
+{
+	return p_impl->getCullingStatistics();
+}
+
 void VulkanRenderer::resize(int width, int height)
 {
 	p_impl->resize(width, height);
@@ -1967,3 +3238,18 @@ void VulkanRenderer::setCamera(const glm::mat4 & view, const glm::vec3 campos)
 {
 	p_impl->setCamera(view, campos);
 }
+
+uint32_t VulkanRenderer::addInstance(const glm::mat4& transform)
+{
+	return p_impl->addInstance(transform);
+}
+
+void VulkanRenderer::setInstanceTransform(uint32_t instance, const glm::mat4& transform)
+{
+	p_impl->setInstanceTransform(instance, transform);
+}
+
+void VulkanRenderer::removeInstance(uint32_t instance)
+{
+	p_impl->removeInstance(instance);
+}
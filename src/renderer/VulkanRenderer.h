@@ -6,10 +6,27 @@
 #include <glm/glm.hpp>
 
 #include <memory>
+#include <cstdint>
 
 struct GLFWwindow;
 class _VulkanRenderer_Impl;
 
+/**
+* Mesh parts, meshlets and triangles of the picked levels of detail, kept or rejected by culling in the last frame read back.
+* Occluded parts and triangles are the share of the culled ones rejected by software occlusion or the depth pyramid
+*/
+struct CullingStatistics
+{
+	uint32_t visible_parts = 0;
+	uint32_t culled_parts = 0;
+	uint32_t occluded_parts = 0;
+	uint32_t visible_meshlets = 0;
+	uint32_t culled_meshlets = 0;
+	uint32_t visible_triangles = 0;
+	uint32_t culled_triangles = 0;
+	uint32_t occluded_triangles = 0;
+};
+
 class VulkanRenderer
 {
 public:
@@ -17,6 +34,7 @@ public:
 	~VulkanRenderer();
 
 	int getDebugViewIndex() const;
+	CullingStatistics getCullingStatistics() const;
 
 	void resize(int width, int height);
 	void changeDebugViewIndex(int target_view);
@@ -25,6 +43,15 @@ public:
 
 	void setCamera(const glm::mat4 & view, const glm::vec3 campos);
 
+	/**
+	* Adds a copy of the model at transform, from model to world space, and returns its id.
+	* Every copy is drawn by the same instanced draws, one per mesh part
+	*/
+	uint32_t addInstance(const glm::mat4& transform);
+	void setInstanceTransform(uint32_t instance, const glm::mat4& transform);
+	// the id may be returned again by a later addInstance
+	void removeInstance(uint32_t instance);
+
 	VulkanRenderer(const VulkanRenderer&) = delete;
 	VulkanRenderer& operator= (const VulkanRenderer&) = delete;
 	VulkanRenderer(VulkanRenderer&&) = delete;
@@ -0,0 +1,165 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "bounding_volume.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VFPR_FRUSTUM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+FrustumPlanes::FrustumPlanes(const Frustum& frustum)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		// a plane at distance 1 with no normal never rejects anything
+		glm::vec4 plane = i < 6 ? frustum.planes[i] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		x[i] = plane.x;
+		y[i] = plane.y;
+		z[i] = plane.z;
+		w[i] = plane.w;
+	}
+}
+
+FrustumTest FrustumPlanes::testBox(const BoundingBox& box) const
+{
+	if (box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z)
+	{
+		return FrustumTest::outside;
+	}
+	auto center = box.getCenter();
+	auto extent = (box.max - box.min) * 0.5f;
+	bool inside = true;
+
+	// signed distance of the center against the projected radius of the box, per plane
+#ifdef VFPR_FRUSTUM_SSE2
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	const __m128 zero = _mm_setzero_ps();
+	__m128 center_x = _mm_set1_ps(center.x);
+	__m128 center_y = _mm_set1_ps(center.y);
+	__m128 center_z = _mm_set1_ps(center.z);
+	__m128 extent_x = _mm_set1_ps(extent.x);
+	__m128 extent_y = _mm_set1_ps(extent.y);
+	__m128 extent_z = _mm_set1_ps(extent.z);
+	for (int i = 0; i < 8; i += 4)
+	{
+		__m128 plane_x = _mm_load_ps(x + i);
+		__m128 plane_y = _mm_load_ps(y + i);
+		__m128 plane_z = _mm_load_ps(z + i);
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x, center_x), _mm_mul_ps(plane_y, center_y))
+			, _mm_add_ps(_mm_mul_ps(plane_z, center_z), _mm_load_ps(w + i)));
+		__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign_mask, plane_x), extent_x), _mm_mul_ps(_mm_andnot_ps(sign_mask, plane_y), extent_y))
+			, _mm_mul_ps(_mm_andnot_ps(sign_mask, plane_z), extent_z));
+		if (_mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), zero)) != 0)
+		{
+			return FrustumTest::outside;
+		}
+		if (_mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), zero)) != 0)
+		{
+			inside = false;
+		}
+	}
+#else
+	for (int i = 0; i < 6; i++)
+	{
+		float distance = x[i] * center.x + y[i] * center.y + z[i] * center.z + w[i];
+		float radius = std::abs(x[i]) * extent.x + std::abs(y[i]) * extent.y + std::abs(z[i]) * extent.z;
+		if (distance + radius < 0.0f)
+		{
+			return FrustumTest::outside;
+		}
+		if (distance - radius < 0.0f)
+		{
+			inside = false;
+		}
+	}
+#endif
+	return inside ? FrustumTest::inside : FrustumTest::intersecting;
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(const std::vector<BoundingBox>& bounds, uint32_t max_leaf_size)
+{
+	items.resize(bounds.size());
+	for (uint32_t i = 0; i < items.size(); i++)
+	{
+		items[i] = i;
+	}
+	item_bounds = bounds;
+	if (!items.empty())
+	{
+		build(0, static_cast<uint32_t>(items.size()), std::max<uint32_t>(max_leaf_size, 1));
+	}
+
+	// keep the boxes next to the leaves that test them
+	for (uint32_t i = 0; i < items.size(); i++)
+	{
+		item_bounds[i] = bounds[items[i]];
+	}
+}
+
+/**
+* Appends the subtree of items [first_item, first_item + item_count), split at the median center along the longest axis
+*/
+void BoundingVolumeHierarchy::build(uint32_t first_item, uint32_t item_count, uint32_t max_leaf_size)
+{
+	auto node_index = nodes.size();
+	nodes.emplace_back();
+
+	BoundingBox bounds;
+	BoundingBox center_bounds;
+	for (auto i = first_item; i < first_item + item_count; i++)
+	{
+		bounds.expand(item_bounds[items[i]]);
+		center_bounds.expand(item_bounds[items[i]].getCenter());
+	}
+	nodes[node_index].bounds = bounds;
+	nodes[node_index].first_item = first_item;
+	nodes[node_index].item_count = item_count;
+
+	if (item_count > max_leaf_size)
+	{
+		auto size = center_bounds.max - center_bounds.min;
+		int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+		auto begin = items.begin() + first_item;
+		auto middle = begin + item_count / 2;
+		std::nth_element(begin, middle, begin + item_count, [this, axis](uint32_t a, uint32_t b)
+		{
+			return item_bounds[a].getCenter()[axis] < item_bounds[b].getCenter()[axis];
+		});
+
+		build(first_item, item_count / 2, max_leaf_size);
+		build(first_item + item_count / 2, item_count - item_count / 2, max_leaf_size);
+	}
+	nodes[node_index].skip = static_cast<uint32_t>(nodes.size());
+}
+
+void BoundingVolumeHierarchy::cullFrustum(const FrustumPlanes& planes, std::vector<FrustumTest>* results) const
+{
+	results->assign(items.size(), FrustumTest::outside);
+
+	uint32_t node_index = 0;
+	while (node_index < nodes.size())
+	{
+		const auto& node = nodes[node_index];
+		auto result = planes.testBox(node.bounds);
+		if (result == FrustumTest::intersecting && node.skip == node_index + 1)
+		{
+			// a leaf partly in the frustum, test each of its boxes
+			for (auto i = node.first_item; i < node.first_item + node.item_count; i++)
+			{
+				(*results)[items[i]] = planes.testBox(item_bounds[i]);
+			}
+		}
+		else if (result == FrustumTest::inside)
+		{
+			for (auto i = node.first_item; i < node.first_item + node.item_count; i++)
+			{
+				(*results)[items[i]] = FrustumTest::inside;
+			}
+		}
+		node_index = result == FrustumTest::intersecting ? node_index + 1 : node.skip;
+	}
+}
@@ -0,0 +1,98 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "meshlet.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+
+/**
+* Axis aligned bounding box, empty when min > max
+*/
+struct BoundingBox
+{
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+	void expand(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void expand(const BoundingBox& other)
+	{
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+
+	glm::vec3 getCenter() const
+	{
+		return (min + max) * 0.5f;
+	}
+};
+
+enum class FrustumTest : uint8_t
+{
+	outside = 0,
+	intersecting,
+	inside,
+};
+
+/**
+* Frustum planes in structure of arrays layout, four planes per SIMD test.
+* The two unused slots hold planes that accept everything
+*/
+struct FrustumPlanes
+{
+	alignas(16) float x[8];
+	alignas(16) float y[8];
+	alignas(16) float z[8];
+	alignas(16) float w[8];
+
+	explicit FrustumPlanes(const Frustum& frustum);
+
+	FrustumTest testBox(const BoundingBox& box) const;
+};
+
+/**
+* Binary bounding volume hierarchy over a static set of boxes, such as the mesh parts of a model.
+* Nodes are stored depth first, so a subtree is a contiguous range of nodes and items
+*/
+class BoundingVolumeHierarchy
+{
+public:
+	BoundingVolumeHierarchy() = default;
+	explicit BoundingVolumeHierarchy(const std::vector<BoundingBox>& item_bounds, uint32_t max_leaf_size = 2);
+
+	/**
+	* Writes the test result of every item into results, indexed like the boxes the hierarchy was built from.
+	* Subtrees entirely inside or outside the frustum are resolved without testing their items
+	*/
+	void cullFrustum(const FrustumPlanes& planes, std::vector<FrustumTest>* results) const;
+
+	size_t getItemCount() const
+	{
+		return items.size();
+	}
+
+private:
+	struct Node
+	{
+		BoundingBox bounds;
+		uint32_t first_item = 0;  // of the subtree, in items
+		uint32_t item_count = 0;
+		uint32_t skip = 0;  // node index past the subtree; a leaf if it is the next node
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> items;  // original item indices, in node order
+	std::vector<BoundingBox> item_bounds;  // in node order
+
+	void build(uint32_t first_item, uint32_t item_count, uint32_t max_leaf_size);
+};
@@ -0,0 +1,207 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "compressed_texture_file.h"
+
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+
+namespace
+{
+	const char TEXTURE_FILE_MAGIC[8] = { 'V', 'F', 'P', 'R', 'B', 'C', 'T', 'X' };
+	const uint32_t TEXTURE_FILE_VERSION = 1;  // bump when the file layout or the encoder output changes
+	const uint64_t LEVEL_ALIGNMENT = 16;
+	const uint32_t MAX_LEVEL_COUNT = 32;
+	const uint32_t TEXTURE_FLAG_NORMAL_MAP = 1 << 0;
+
+	// Every field has a fixed size so the layout is the same across compilers
+	struct TextureFileHeader
+	{
+		char magic[8];
+		uint32_t format_version;
+		uint32_t block_format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t level_count;
+		uint32_t flags;
+		uint64_t source_size;
+		int64_t source_modified_time;
+		uint32_t source_path_length;
+		uint32_t reserved;
+	};
+
+	struct TextureLevelIndex
+	{
+		uint64_t byte_offset;  // from the beginning of the file
+		uint64_t byte_length;
+	};
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	bool isBlockFormat(uint32_t value)
+	{
+		return value == static_cast<uint32_t>(BlockFormat::bc1)
+			|| value == static_cast<uint32_t>(BlockFormat::bc3)
+			|| value == static_cast<uint32_t>(BlockFormat::bc5);
+	}
+}
+
+std::string CompressedTextureFile::getCachePath(const std::string& image_path)
+{
+	return image_path + ".vfprtex";
+}
+
+bool CompressedTextureFile::open(const std::string& image_path, bool normal_map)
+{
+	file.close();
+	levels.clear();
+
+	util::FileStat source_stat;
+	if (!util::getFileStat(image_path, &source_stat))
+	{
+		return false;
+	}
+
+	if (!file.open(getCachePath(image_path)))
+	{
+		return false;
+	}
+
+	auto invalidate = [this]()
+	{
+		levels.clear();
+		file.close();
+		return false;
+	};
+
+	TextureFileHeader header;
+	if (file.size() < sizeof(header))
+	{
+		return invalidate();
+	}
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, TEXTURE_FILE_MAGIC, sizeof(TEXTURE_FILE_MAGIC)) != 0
+		|| header.format_version != TEXTURE_FILE_VERSION
+		|| !isBlockFormat(header.block_format)
+		|| header.width == 0 || header.height == 0
+		|| header.level_count == 0 || header.level_count > MAX_LEVEL_COUNT
+		|| header.flags != (normal_map ? TEXTURE_FLAG_NORMAL_MAP : 0)
+		|| header.source_size != source_stat.size
+		|| header.source_modified_time != source_stat.modified_time)
+	{
+		return invalidate();
+	}
+
+	uint64_t level_index_offset = sizeof(header) + uint64_t(header.source_path_length);
+	if (header.source_path_length > file.size()
+		|| level_index_offset + sizeof(TextureLevelIndex) * header.level_count > file.size()
+		|| std::string(file.data() + sizeof(header), header.source_path_length) != image_path)
+	{
+		return invalidate();
+	}
+
+	format = static_cast<BlockFormat>(header.block_format);
+	width = header.width;
+	height = header.height;
+	for (uint32_t level = 0; level < header.level_count; level++)
+	{
+		TextureLevelIndex index;
+		memcpy(&index, file.data() + level_index_offset + sizeof(TextureLevelIndex) * level, sizeof(index));
+
+		auto expected_length = texture_compression::getLevelSize(format, std::max<uint32_t>(width >> level, 1), std::max<uint32_t>(height >> level, 1));
+		if (index.byte_length != expected_length
+			|| index.byte_offset > file.size() || index.byte_length > file.size() - index.byte_offset
+			|| index.byte_offset % LEVEL_ALIGNMENT != 0)
+		{
+			return invalidate();
+		}
+		levels.push_back({ reinterpret_cast<const uint8_t*>(file.data() + index.byte_offset), static_cast<size_t>(index.byte_length) });
+	}
+
+	return true;
+}
+
+bool CompressedTextureFile::write(const std::string& image_path, bool normal_map, BlockFormat format, const std::vector<TextureLevel>& levels)
+{
+	util::FileStat source_stat;
+	if (levels.empty() || levels.size() > MAX_LEVEL_COUNT || !util::getFileStat(image_path, &source_stat))
+	{
+		return false;
+	}
+
+	TextureFileHeader header = {};
+	memcpy(header.magic, TEXTURE_FILE_MAGIC, sizeof(TEXTURE_FILE_MAGIC));
+	header.format_version = TEXTURE_FILE_VERSION;
+	header.block_format = static_cast<uint32_t>(format);
+	header.width = levels[0].width;
+	header.height = levels[0].height;
+	header.level_count = static_cast<uint32_t>(levels.size());
+	header.flags = normal_map ? TEXTURE_FLAG_NORMAL_MAP : 0;
+	header.source_size = source_stat.size;
+	header.source_modified_time = source_stat.modified_time;
+	header.source_path_length = static_cast<uint32_t>(image_path.size());
+
+	// lay out the file: header, source path, level index, then aligned levels
+	std::vector<TextureLevelIndex> level_index(levels.size());
+	uint64_t offset = sizeof(header) + image_path.size() + sizeof(TextureLevelIndex) * levels.size();
+	for (size_t level = 0; level < levels.size(); level++)
+	{
+		offset = alignUp(offset, LEVEL_ALIGNMENT);
+		level_index[level].byte_offset = offset;
+		level_index[level].byte_length = levels[level].data.size();
+		offset += levels[level].data.size();
+	}
+
+	// write to a temporary file first so that an interrupted write never leaves a valid-looking file
+	auto cache_path = getCachePath(image_path);
+	auto temp_path = cache_path + ".tmp";
+	{
+		std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+		if (!stream.is_open())
+		{
+			return false;
+		}
+
+		uint64_t written = 0;
+		auto write = [&stream, &written](const void* src, size_t length)
+		{
+			stream.write(static_cast<const char*>(src), length);
+			written += length;
+		};
+		auto pad = [&stream, &written](uint64_t target)
+		{
+			static const char zeros[LEVEL_ALIGNMENT] = {};
+			stream.write(zeros, static_cast<std::streamsize>(target - written));
+			written = target;
+		};
+
+		write(&header, sizeof(header));
+		write(image_path.data(), image_path.size());
+		write(level_index.data(), sizeof(TextureLevelIndex) * level_index.size());
+		for (size_t level = 0; level < levels.size(); level++)
+		{
+			pad(level_index[level].byte_offset);
+			write(levels[level].data.data(), levels[level].data.size());
+		}
+
+		if (!stream.good())
+		{
+			stream.close();
+			std::remove(temp_path.c_str());
+			return false;
+		}
+	}
+
+	std::remove(cache_path.c_str()); // rename() does not overwrite on Windows
+	if (std::rename(temp_path.c_str(), cache_path.c_str()) != 0)
+	{
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,83 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "texture_compression.h"
+#include "../util.h"
+
+#include <vector>
+#include <string>
+
+/**
+* A block compressed texture with its mip chain, transcoded from an image file and stored next to it.
+* Laid out like KTX2: a header, a level index of byte offset and length per mip level, then the aligned levels.
+* The file is keyed by the source path, size and modification time, the transcoder version and the texture usage,
+* and is read through a memory mapping so that levels are copied straight into staging memory
+*/
+class CompressedTextureFile
+{
+public:
+	CompressedTextureFile() = default;
+	~CompressedTextureFile() = default;
+	CompressedTextureFile(CompressedTextureFile&&) = default;
+	CompressedTextureFile& operator= (CompressedTextureFile&&) = default;
+	CompressedTextureFile(const CompressedTextureFile&) = delete;
+	CompressedTextureFile& operator= (const CompressedTextureFile&) = delete;
+
+	static std::string getCachePath(const std::string& image_path);
+
+	// Maps the transcoded file of image_path; returns false if it is missing, stale, corrupted or was made for another usage
+	bool open(const std::string& image_path, bool normal_map);
+
+	bool isOpen() const
+	{
+		return file.isOpen();
+	}
+
+	BlockFormat getFormat() const
+	{
+		return format;
+	}
+
+	uint32_t getWidth() const
+	{
+		return width;
+	}
+
+	uint32_t getHeight() const
+	{
+		return height;
+	}
+
+	uint32_t getLevelCount() const
+	{
+		return static_cast<uint32_t>(levels.size());
+	}
+
+	const uint8_t* getLevelData(uint32_t level) const
+	{
+		return levels[level].data;
+	}
+
+	size_t getLevelSize(uint32_t level) const
+	{
+		return levels[level].size;
+	}
+
+	// Writes the compressed levels of image_path, level 0 first; returns false if the file could not be written
+	static bool write(const std::string& image_path, bool normal_map, BlockFormat format, const std::vector<TextureLevel>& levels);
+
+private:
+	struct LevelView
+	{
+		const uint8_t* data;
+		size_t size;
+	};
+
+	util::MappedFile file;
+	BlockFormat format = BlockFormat::bc1;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<LevelView> levels;
+};
@@ -5,6 +5,7 @@
 
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <unordered_set>
 #include <iostream>
 #include <cstring>
@@ -24,7 +25,8 @@ const std::vector<const char*> VALIDATION_LAYERS = {
 };
 
 const std::vector<const char*> DEVICE_EXTENSIONS = {
-	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+	VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+	VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME // bindless material textures
 };
 
 VContext::VContext(GLFWwindow* window)
@@ -222,7 +224,7 @@ void VContext::createInstance()
 	app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	app_info.pEngineName = "No Engine";
 	app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	app_info.apiVersion = VK_API_VERSION_1_0;
+	app_info.apiVersion = VK_API_VERSION_1_1; // vkGetPhysicalDeviceFeatures2 and maintenance3 for descriptor indexing
 
 	VkInstanceCreateInfo instance_info = {}; // not optional
 	instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -322,6 +324,39 @@ bool checkDeviceExtensionSupport(VkPhysicalDevice device)
 	return required_extensions.empty();
 }
 
+bool isDeviceExtensionSupported(VkPhysicalDevice device, const char* extension_name)
+{
+	uint32_t extension_count;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, nullptr);
+
+	std::vector<VkExtensionProperties> available_extensions(extension_count);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, available_extensions.data());
+
+	return std::any_of(available_extensions.begin(), available_extensions.end(), [extension_name](const VkExtensionProperties& extension)
+	{
+		return strcmp(extension.extensionName, extension_name) == 0;
+	});
+}
+
+
+// the descriptor indexing features bindless materials are built on, queried from device or to enable on it
+VkPhysicalDeviceDescriptorIndexingFeaturesEXT getBindlessMaterialFeatures(VkPhysicalDevice device)
+{
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {};
+	indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	VkPhysicalDeviceFeatures2 features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &indexing_features;
+	vkGetPhysicalDeviceFeatures2(device, &features);
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT bindless_features = {};
+	bindless_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	bindless_features.runtimeDescriptorArray = indexing_features.runtimeDescriptorArray;
+	bindless_features.descriptorBindingPartiallyBound = indexing_features.descriptorBindingPartiallyBound;
+	bindless_features.descriptorBindingVariableDescriptorCount = indexing_features.descriptorBindingVariableDescriptorCount;
+	return bindless_features;
+}
 
 bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR window_surface)
 {
@@ -345,7 +380,22 @@ bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR window_surface)
 		swap_chain_adequate = !swap_chain_support.formats.empty() && !swap_chain_support.present_modes.empty();
 	}
 
-	return indices.isComplete() && extensions_supported && swap_chain_adequate;
+	bool bindless_materials_supported = false;
+	if (extensions_supported)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device, &properties);
+		VkPhysicalDeviceFeatures features;
+		vkGetPhysicalDeviceFeatures(device, &features);
+		auto bindless_features = getBindlessMaterialFeatures(device);
+		bindless_materials_supported = properties.apiVersion >= VK_API_VERSION_1_1
+			&& features.shaderSampledImageArrayDynamicIndexing
+			&& bindless_features.runtimeDescriptorArray
+			&& bindless_features.descriptorBindingPartiallyBound
+			&& bindless_features.descriptorBindingVariableDescriptorCount;
+	}
+
+	return indices.isComplete() && extensions_supported && swap_chain_adequate && bindless_materials_supported;
 }
 
 // Pick up a graphics card to use
@@ -464,13 +514,25 @@ void VContext::createLogicalDevice()
 	// Specify used device features
 	VkPhysicalDeviceFeatures device_features = {}; // Everything is by default VK_FALSE
 
-												   // Create the logical device
+	// optional features, renderer falls back when they are missing
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+	device_features.multiDrawIndirect = supported_features.multiDrawIndirect; // one indirect draw call per mesh part for meshlets
+	device_features.textureCompressionBC = supported_features.textureCompressionBC; // block compressed material textures
+	device_features.shaderSampledImageArrayDynamicIndexing = VK_TRUE; // material textures picked per draw, checked by isDeviceSuitable
+	enabled_features = device_features;
+
+	// a variable count array of every material texture, not all of it necessarily written
+	auto bindless_features = getBindlessMaterialFeatures(physical_device);
+
+	// Create the logical device
 	VkDeviceCreateInfo device_create_info = {};
 	device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	device_create_info.pQueueCreateInfos = queue_create_infos.data();
 	device_create_info.queueCreateInfoCount = static_cast<uint32_t> (queue_create_infos.size());
 
 	device_create_info.pEnabledFeatures = &device_features;
+	device_create_info.pNext = &bindless_features;
 
 	if (ENABLE_VALIDATION_LAYERS)
 	{
@@ -482,8 +544,18 @@ void VContext::createLogicalDevice()
 		device_create_info.enabledLayerCount = 0;
 	}
 
-	device_create_info.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
-	device_create_info.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+	// optional extensions, renderer falls back when they are missing
+	auto device_extensions = DEVICE_EXTENSIONS;
+#ifdef VK_KHR_draw_indirect_count
+	bool draw_indirect_count_supported = isDeviceExtensionSupported(physical_device, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	if (draw_indirect_count_supported)
+	{
+		device_extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME); // compacted meshlet draws from GPU culling
+	}
+#endif
+
+	device_create_info.enabledExtensionCount = static_cast<uint32_t>(device_extensions.size());
+	device_create_info.ppEnabledExtensionNames = device_extensions.data();
 
 	VkDevice temp_device;
 	auto result = vkCreateDevice(physical_device, &device_create_info, nullptr, &temp_device);
@@ -500,6 +572,14 @@ void VContext::createLogicalDevice()
 		}
 	};
 	auto device = graphics_device.get();
+	memory_allocator.reset(new VMemoryAllocator(physical_device, temp_device));
+#ifdef VK_KHR_draw_indirect_count
+	if (draw_indirect_count_supported)
+	{
+		cmd_draw_indexed_indirect_count = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+			vkGetDeviceProcAddr(temp_device, "vkCmdDrawIndexedIndirectCountKHR"));
+	}
+#endif
 
 #ifdef ONE_QUEUE
 	graphics_queue = device.getQueue(indices.graphics_family, 0);
@@ -4,11 +4,13 @@
 #pragma once
 
 #include "raii.h"
+#include "memory_allocator.h"
 
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan.hpp>
 
 #include <vector>
+#include <memory>
 
 struct GLFWwindow;
 
@@ -68,6 +70,20 @@ public:
 		return physical_device_properties;
 	}
 
+	// features enabled on the logical device, a subset of what the physical device supports
+	const VkPhysicalDeviceFeatures& getEnabledFeatures() const
+	{
+		return enabled_features;
+	}
+
+#ifdef VK_KHR_draw_indirect_count
+	// vkCmdDrawIndexedIndirectCountKHR, or null when VK_KHR_draw_indirect_count is not supported
+	PFN_vkCmdDrawIndexedIndirectCountKHR getDrawIndexedIndirectCount() const
+	{
+		return cmd_draw_indexed_indirect_count;
+	}
+#endif
+
 	vk::Device getDevice() const
 	{
 		return graphics_device.get();
@@ -103,6 +119,12 @@ public:
 		return compute_queue_command_pool.get();
 	}
 
+	// sub-allocates the device memory of every resource created through VUtility
+	VMemoryAllocator& getMemoryAllocator() const
+	{
+		return *memory_allocator;
+	}
+
 private:
 
 	GLFWwindow* window;
@@ -121,7 +143,12 @@ private:
 
 	VRaii<vk::CommandPool> graphics_queue_command_pool;
 	VRaii<vk::CommandPool> compute_queue_command_pool;
+	std::unique_ptr<VMemoryAllocator> memory_allocator; // destroyed before the device
 	vk::PhysicalDeviceProperties physical_device_properties;
+	VkPhysicalDeviceFeatures enabled_features = {};
+#ifdef VK_KHR_draw_indirect_count
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmd_draw_indexed_indirect_count = nullptr;
+#endif
 
 	static void DestroyDebugReportCallbackEXT(VkInstance instance
 		, VkDebugReportCallbackEXT callback
@@ -0,0 +1,70 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "draw_list.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+const uint32_t MATERIAL_KEY_BITS = 24;
+const uint32_t DEPTH_KEY_BITS = 16;
+
+void DrawList::build(const std::vector<VMeshPart>& parts, DrawPass pass, uint32_t pipeline
+	, const std::vector<glm::vec3>& viewer_positions, float near_distance, float far_distance)
+{
+	items.resize(parts.size());
+	for (uint32_t i = 0; i < parts.size(); i++)
+	{
+		const auto& part = parts[i];
+		float distance = viewer_positions.empty() ? 0.0f : std::numeric_limits<float>::max();
+		for (const auto& viewer_position : viewer_positions)
+		{
+			distance = std::min(distance, glm::length(part.bounds_center - viewer_position) - part.bounds_radius);
+		}
+		items[i].part = i;
+		items[i].sort_key = makeSortKey(pass, pipeline, part.material_index
+			, part.index_type == vk::IndexType::eUint32 ? 1 : 0, getDepthBucket(distance, near_distance, far_distance));
+	}
+
+	// stable, so parts with equal keys keep the order of the model
+	std::stable_sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b)
+	{
+		return a.sort_key < b.sort_key;
+	});
+}
+
+bool DrawList::hasSameOrder(const DrawList& other) const
+{
+	return items.size() == other.items.size() && std::equal(items.begin(), items.end(), other.items.begin(), [](const DrawItem& a, const DrawItem& b)
+	{
+		return a.part == b.part;
+	});
+}
+
+uint64_t DrawList::makeSortKey(DrawPass pass, uint32_t pipeline, uint32_t material, uint32_t index_type, uint32_t depth_bucket)
+{
+	uint64_t material_key = std::min<uint64_t>(material, (1ull << MATERIAL_KEY_BITS) - 1);
+	uint64_t depth_key = std::min<uint64_t>(depth_bucket, (1ull << DEPTH_KEY_BITS) - 1);
+	uint64_t key = uint64_t(pipeline & 0xff) << 56;
+	if (pass == DrawPass::depth_prepass)
+	{
+		key |= depth_key << (MATERIAL_KEY_BITS + 1) | uint64_t(index_type & 1) << MATERIAL_KEY_BITS | material_key;
+	}
+	else
+	{
+		key |= material_key << (DEPTH_KEY_BITS + 1) | uint64_t(index_type & 1) << DEPTH_KEY_BITS | depth_key;
+	}
+	return key;
+}
+
+uint32_t DrawList::getDepthBucket(float distance, float near_distance, float far_distance)
+{
+	if (!(distance > near_distance) || !(far_distance > near_distance))
+	{
+		return 0;
+	}
+	// equal ratios of distance per bucket, so nearby parts are told apart more finely than distant ones
+	float t = std::log(distance / near_distance) / std::log(far_distance / near_distance);
+	return std::min(static_cast<uint32_t>(t * DEPTH_BUCKET_COUNT), DEPTH_BUCKET_COUNT - 1);
+}
@@ -0,0 +1,61 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "model.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+enum class DrawPass : uint8_t
+{
+	depth_prepass = 0,  // front to back for early depth rejection
+	shading,  // grouped by material, whose depths were already laid down
+};
+
+/**
+* A mesh part drawn by a pass, with the key it is sorted by:
+* the pipeline in the top 8 bits, then for the depth prepass the depth bucket (16 bits), index type (1) and material (24),
+* or for shading the material, index type and depth bucket
+*/
+struct DrawItem
+{
+	uint64_t sort_key = 0;
+	uint32_t part = 0;  // index in VModel::getMeshParts()
+};
+
+/**
+* The mesh parts of a model in the order a pass records their draws, so that state changes are
+* grouped and the command buffer recorder can leave out binds of the state already bound
+*/
+class DrawList
+{
+public:
+	static const uint32_t DEPTH_BUCKET_COUNT = 256;
+
+	/**
+	* Sorts the parts for pass. Depth buckets are spaced logarithmically over [near_distance, far_distance]
+	* from the nearest of viewer_positions, one per instance, to the nearest point of each part's bounding sphere,
+	* all in model space. With no viewer positions every part falls in the first bucket
+	*/
+	void build(const std::vector<VMeshPart>& parts, DrawPass pass, uint32_t pipeline
+		, const std::vector<glm::vec3>& viewer_positions, float near_distance, float far_distance);
+
+	const std::vector<DrawItem>& getItems() const
+	{
+		return items;
+	}
+
+	// whether both lists draw the same parts in the same order, whatever their keys
+	bool hasSameOrder(const DrawList& other) const;
+
+	static uint64_t makeSortKey(DrawPass pass, uint32_t pipeline, uint32_t material, uint32_t index_type, uint32_t depth_bucket);
+
+	static uint32_t getDepthBucket(float distance, float near_distance, float far_distance);
+
+private:
+	std::vector<DrawItem> items;
+};
@@ -0,0 +1,42 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "frame_ring_buffer.h"
+
+#include "context.h"
+#include "vulkan_util.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+	VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+VFrameRingBuffer::VFrameRingBuffer(const VContext& context, uint32_t frame_count, const std::vector<VkDeviceSize>& range_sizes, VkBufferUsageFlags usage)
+	: frame_count(frame_count)
+	, range_sizes(range_sizes)
+{
+	const auto& limits = context.getPhysicalDeviceProperties().limits;
+	auto alignment = std::max<VkDeviceSize>({ limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment, 16 });
+
+	for (auto size : range_sizes)
+	{
+		range_offsets.push_back(region_size);
+		region_size = alignUp(region_size + size, alignment);
+	}
+	if (region_size * frame_count > std::numeric_limits<uint32_t>::max())
+	{
+		throw std::runtime_error("Frame ring buffer is too large for dynamic offsets!");
+	}
+
+	VUtility utility{ context };
+	std::tie(buffer, memory) = utility.createBuffer(std::max<VkDeviceSize>(region_size * frame_count, 1)
+		, usage
+		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
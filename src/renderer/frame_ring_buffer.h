@@ -0,0 +1,71 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "raii.h"
+#include "memory_allocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+class VContext;
+
+/**
+* Persistently mapped host visible buffer for data the CPU rewrites every frame, like the camera and the lights.
+* The buffer is a ring of one region per frame in flight: a frame writes its own region while the GPU still reads the others.
+* Each region is split into the same ranges at the same offsets, so the pre-recorded command buffers of a frame
+* address its copy with dynamic offsets, and uploading is a memcpy into getData().
+* The caller must wait for the frame that last used a region before writing to it
+*/
+class VFrameRingBuffer
+{
+public:
+	VFrameRingBuffer() = default;
+	/**
+	* Creates frame_count regions holding a range of each of range_sizes, in order,
+	* every range aligned for dynamic uniform and storage buffer offsets
+	*/
+	VFrameRingBuffer(const VContext& context, uint32_t frame_count, const std::vector<VkDeviceSize>& range_sizes, VkBufferUsageFlags usage);
+	~VFrameRingBuffer() = default;
+
+	VFrameRingBuffer(VFrameRingBuffer&&) = default;
+	VFrameRingBuffer& operator= (VFrameRingBuffer&&) = default;
+	VFrameRingBuffer(const VFrameRingBuffer&) = delete;
+	VFrameRingBuffer& operator= (const VFrameRingBuffer&) = delete;
+
+	VkBuffer getBuffer() const
+	{
+		return buffer.get();
+	}
+
+	uint32_t getFrameCount() const
+	{
+		return frame_count;
+	}
+
+	VkDeviceSize getRangeSize(uint32_t range) const
+	{
+		return range_sizes[range];
+	}
+
+	// offset of range in the region of frame, for a descriptor bound at offset 0 with the size of the range
+	uint32_t getDynamicOffset(uint32_t frame, uint32_t range) const
+	{
+		return static_cast<uint32_t>(region_size * frame + range_offsets[range]);
+	}
+
+	void* getData(uint32_t frame, uint32_t range) const
+	{
+		return static_cast<char*>(memory.getMappedData()) + getDynamicOffset(frame, range);
+	}
+
+private:
+	VRaii<VkBuffer> buffer;
+	VMemoryAllocation memory;
+	uint32_t frame_count = 0;
+	VkDeviceSize region_size = 0;
+	std::vector<VkDeviceSize> range_offsets;
+	std::vector<VkDeviceSize> range_sizes;
+};
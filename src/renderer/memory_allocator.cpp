@@ -0,0 +1,231 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "memory_allocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+VMemoryAllocation::~VMemoryAllocation()
+{
+	release();
+}
+
+VMemoryAllocation::VMemoryAllocation(VMemoryAllocation&& other)
+{
+	*this = std::move(other);
+}
+
+VMemoryAllocation& VMemoryAllocation::operator= (VMemoryAllocation&& other)
+{
+	if (this != &other)
+	{
+		release();
+		allocator = other.allocator;
+		block = other.block;
+		handle = other.handle;
+		memory = other.memory;
+		offset = other.offset;
+		size = other.size;
+		mapped = other.mapped;
+		other.allocator = nullptr;
+		other.block = nullptr;
+		other.handle = TlsfAllocator::INVALID_HANDLE;
+		other.memory = VK_NULL_HANDLE;
+		other.mapped = nullptr;
+	}
+	return *this;
+}
+
+void VMemoryAllocation::release()
+{
+	if (allocator)
+	{
+		allocator->free(*this);
+		allocator = nullptr;
+	}
+}
+
+VMemoryAllocator::VMemoryAllocator(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize block_size)
+	: device(device)
+	, block_size(block_size)
+{
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	buffer_image_granularity = properties.limits.bufferImageGranularity;
+	pools.resize(memory_properties.memoryTypeCount * 2);
+}
+
+VMemoryAllocator::~VMemoryAllocator()
+{
+	for (auto& pool : pools)
+	{
+		for (auto& block : pool.blocks)
+		{
+			vkFreeMemory(device, block->memory, nullptr);
+		}
+	}
+}
+
+uint32_t VMemoryAllocator::findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+	{
+		bool type_supported = (type_filter & (1 << i)) != 0;
+		bool properties_supported = ((memory_properties.memoryTypes[i].propertyFlags & properties) == properties);
+		if (type_supported && properties_supported)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to find suitable memory type!");
+}
+
+VMemoryAllocator::Block* VMemoryAllocator::createBlock(uint32_t pool_index, VkDeviceSize size, bool dedicated)
+{
+	auto memory_type = pool_index / 2;
+
+	VkMemoryAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = size;
+	alloc_info.memoryTypeIndex = memory_type;
+
+	std::unique_ptr<Block> block(new Block(size));
+	block->pool_index = pool_index;
+	block->dedicated = dedicated;
+	if (vkAllocateMemory(device, &alloc_info, nullptr, &block->memory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate device memory block!");
+	}
+	if (memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		void* mapped;
+		if (vkMapMemory(device, block->memory, 0, size, 0, &mapped) != VK_SUCCESS)
+		{
+			vkFreeMemory(device, block->memory, nullptr);
+			throw std::runtime_error("Failed to map device memory block!");
+		}
+		block->mapped = static_cast<char*>(mapped);
+	}
+
+	pools[pool_index].blocks.push_back(std::move(block));
+	return pools[pool_index].blocks.back().get();
+}
+
+VMemoryAllocation VMemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto memory_type = findMemoryType(requirements.memoryTypeBits, properties);
+	// with a granularity of 1, linear and optimal resources can share blocks
+	auto pool_index = memory_type * 2 + (linear && buffer_image_granularity > 1 ? 1 : 0);
+	auto heap_size = memory_properties.memoryHeaps[memory_properties.memoryTypes[memory_type].heapIndex].size;
+	auto pool_block_size = std::max<VkDeviceSize>(std::min(block_size, heap_size / 8), 1);
+
+	VMemoryAllocation allocation;
+	auto alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+	auto& blocks = pools[pool_index].blocks;
+	bool dedicated = requirements.size > pool_block_size / 2;
+	if (!dedicated)
+	{
+		for (auto& block : blocks)
+		{
+			if (block->dedicated)
+			{
+				continue;
+			}
+			allocation.handle = block->ranges.allocate(requirements.size, alignment, &allocation.offset);
+			if (allocation.handle != TlsfAllocator::INVALID_HANDLE)
+			{
+				allocation.block = block.get();
+				break;
+			}
+		}
+	}
+	if (!allocation.block)
+	{
+		// a new block, or a dedicated one for large resources
+		auto block = createBlock(pool_index, dedicated ? requirements.size : pool_block_size, dedicated);
+		allocation.handle = block->ranges.allocate(requirements.size, alignment, &allocation.offset);
+		allocation.block = block;
+		if (allocation.handle == TlsfAllocator::INVALID_HANDLE)
+		{
+			throw std::runtime_error("Failed to sub-allocate device memory!");
+		}
+	}
+
+	auto block = static_cast<Block*>(allocation.block);
+	allocation.allocator = this;
+	allocation.memory = block->memory;
+	allocation.size = requirements.size;
+	allocation.mapped = block->mapped ? block->mapped + allocation.offset : nullptr;
+	return allocation;
+}
+
+void VMemoryAllocator::free(VMemoryAllocation& allocation)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto block = static_cast<Block*>(allocation.block);
+	block->ranges.free(allocation.handle);
+	if (!block->ranges.isEmpty())
+	{
+		return;
+	}
+
+	// keep one empty block per pool so that resources recreated on every resize do not allocate again
+	auto& blocks = pools[block->pool_index].blocks;
+	bool other_empty_block = std::any_of(blocks.begin(), blocks.end(), [block](const std::unique_ptr<Block>& other)
+	{
+		return other.get() != block && other->ranges.isEmpty();
+	});
+	if (other_empty_block || block->dedicated)
+	{
+		vkFreeMemory(device, block->memory, nullptr);
+		blocks.erase(std::find_if(blocks.begin(), blocks.end(), [block](const std::unique_ptr<Block>& other)
+		{
+			return other.get() == block;
+		}));
+	}
+}
+
+VMemoryAllocator::Statistics VMemoryAllocator::getStatistics() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Statistics statistics;
+	VkDeviceSize free_size = 0;
+	float weighted_fragmentation = 0.0f;
+	for (const auto& pool : pools)
+	{
+		for (const auto& block : pool.blocks)
+		{
+			const auto& ranges = block->ranges;
+			statistics.block_count++;
+			statistics.allocation_count += ranges.getAllocationCount();
+			statistics.block_size += ranges.getSize();
+			statistics.used_size += ranges.getUsedSize();
+			statistics.free_range_count += ranges.getFreeRangeCount();
+
+			auto block_free_size = ranges.getSize() - ranges.getUsedSize();
+			if (block_free_size > 0)
+			{
+				free_size += block_free_size;
+				weighted_fragmentation += static_cast<float>(block_free_size - ranges.getLargestFreeRange());
+			}
+		}
+	}
+	statistics.fragmentation = free_size > 0 ? weighted_fragmentation / free_size : 0.0f;
+	return statistics;
+}
+
+void VMemoryAllocator::printStatistics(std::ostream& stream) const
+{
+	auto statistics = getStatistics();
+	stream << "Device memory: " << statistics.allocation_count << " allocations in " << statistics.block_count << " blocks, "
+		<< statistics.used_size / (1024 * 1024) << " of " << statistics.block_size / (1024 * 1024) << " MB used, "
+		<< statistics.free_range_count << " free ranges, fragmentation " << statistics.fragmentation << std::endl;
+}
@@ -0,0 +1,141 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "tlsf_allocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+class VMemoryAllocator;
+
+/**
+* A range of device memory sub-allocated by VMemoryAllocator, returned to it on destruction.
+* Move only, like VRaii
+*/
+class VMemoryAllocation
+{
+public:
+	VMemoryAllocation() = default;
+	~VMemoryAllocation();
+
+	VMemoryAllocation(VMemoryAllocation&& other);
+	VMemoryAllocation& operator= (VMemoryAllocation&& other);
+	VMemoryAllocation(const VMemoryAllocation&) = delete;
+	VMemoryAllocation& operator= (const VMemoryAllocation&) = delete;
+
+	VkDeviceMemory getMemory() const
+	{
+		return memory;
+	}
+
+	VkDeviceSize getOffset() const
+	{
+		return offset;
+	}
+
+	VkDeviceSize getSize() const
+	{
+		return size;
+	}
+
+	// persistently mapped address of the range, nullptr unless the memory is host visible
+	void* getMappedData() const
+	{
+		return mapped;
+	}
+
+private:
+	friend class VMemoryAllocator;
+
+	VMemoryAllocator* allocator = nullptr;
+	void* block = nullptr;  // of the allocator
+	uint32_t handle = TlsfAllocator::INVALID_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr;
+
+	void release();
+};
+
+/**
+* Sub-allocates device memory from large blocks, one pool of blocks per memory type.
+* Ranges are placed by a TlsfAllocator per block. Linear resources (buffers) and optimally tiled images
+* get separate pools, so they never share a bufferImageGranularity page.
+* Host visible blocks are mapped once for their lifetime. Empty blocks are freed, except the last one of each pool.
+* Every allocation must be released before the allocator is destroyed
+*/
+class VMemoryAllocator
+{
+public:
+	static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+	struct Statistics
+	{
+		uint32_t block_count = 0;
+		uint32_t allocation_count = 0;
+		VkDeviceSize block_size = 0;  // total of every block
+		VkDeviceSize used_size = 0;
+		uint32_t free_range_count = 0;
+		// 1 - largest free range / total free size, averaged over blocks by their free size; 0 when free memory is contiguous
+		float fragmentation = 0.0f;
+	};
+
+	VMemoryAllocator(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize block_size = DEFAULT_BLOCK_SIZE);
+	~VMemoryAllocator();
+
+	VMemoryAllocator(VMemoryAllocator&&) = delete;
+	VMemoryAllocator& operator= (VMemoryAllocator&&) = delete;
+	VMemoryAllocator(const VMemoryAllocator&) = delete;
+	VMemoryAllocator& operator= (const VMemoryAllocator&) = delete;
+
+	/**
+	* Allocates memory for a resource with the given requirements from the first memory type having properties.
+	* linear is true for buffers and linearly tiled images.
+	* Resources larger than half a block get a block of their own.
+	* Throws std::runtime_error if no memory type matches or the device is out of memory
+	*/
+	VMemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+
+	Statistics getStatistics() const;
+	void printStatistics(std::ostream& stream) const;
+
+private:
+	friend class VMemoryAllocation;
+
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		char* mapped = nullptr;
+		TlsfAllocator ranges;
+		uint32_t pool_index = 0;
+		bool dedicated = false;  // larger than the blocks of its pool, for one resource
+
+		explicit Block(VkDeviceSize size)
+			: ranges(size)
+		{}
+	};
+
+	// blocks of one memory type and resource kind
+	struct Pool
+	{
+		std::vector<std::unique_ptr<Block>> blocks;
+	};
+
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	VkDeviceSize block_size;
+	VkDeviceSize buffer_image_granularity;
+	std::vector<Pool> pools;  // two per memory type, optimal images first
+	mutable std::mutex mutex;
+
+	uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties) const;
+	Block* createBlock(uint32_t pool_index, VkDeviceSize size, bool dedicated);
+	void free(VMemoryAllocation& allocation);
+};
@@ -0,0 +1,365 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "mesh_cache.h"
+
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+
+namespace
+{
+	const char CACHE_MAGIC[8] = { 'V', 'F', 'P', 'R', 'M', 'E', 'S', 'H' };
+	const uint32_t CACHE_FORMAT_VERSION = 4;
+	const uint64_t CACHE_DATA_ALIGNMENT = 16;
+
+	// Every field has a fixed size so the layout is the same across compilers
+	struct CacheFileHeader
+	{
+		char magic[8];
+		uint32_t format_version;
+		uint32_t loader_version;
+		uint32_t loader_flags;
+		uint32_t reserved;
+		uint32_t vertex_size;
+		uint32_t index_size;
+		uint32_t meshlet_size;
+		uint32_t lod_size;
+		uint64_t source_size;
+		int64_t source_modified_time;
+		uint32_t source_path_length;
+		uint32_t group_count;
+	};
+
+	struct CacheGroupHeader
+	{
+		uint64_t vertex_count;
+		uint64_t index_count;
+		uint64_t vertex_offset; // from the beginning of the file
+		uint64_t index_offset;
+		uint64_t meshlet_count;
+		uint64_t meshlet_offset;
+		uint64_t lod_count;
+		uint64_t lod_offset;
+		uint32_t albedo_map_path_length;
+		uint32_t normal_map_path_length;
+	};
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// bounds-checked sequential reads from the mapped file
+	class CacheReader
+	{
+	public:
+		CacheReader(const char* data, size_t size)
+			: data(data)
+			, size(size)
+		{}
+
+		bool read(void* dst, size_t length)
+		{
+			if (length > size - offset)
+			{
+				return false;
+			}
+			memcpy(dst, data + offset, length);
+			offset += length;
+			return true;
+		}
+
+		bool readString(std::string* dst, size_t length)
+		{
+			if (length > size - offset)
+			{
+				return false;
+			}
+			dst->assign(data + offset, length);
+			offset += length;
+			return true;
+		}
+
+		bool contains(uint64_t range_offset, uint64_t range_size) const
+		{
+			return range_offset <= size && range_size <= size - range_offset;
+		}
+
+	private:
+		const char* data;
+		size_t size;
+		size_t offset = 0;
+	};
+}
+
+MeshGroupView::MeshGroupView(const MeshMaterialGroup& group)
+	: vertices(group.vertices.data())
+	, vertex_count(group.vertices.size())
+	, vertex_indices(group.vertex_indices.data())
+	, index_count(group.vertex_indices.size())
+	, meshlets(group.meshlets.data())
+	, meshlet_count(group.meshlets.size())
+	, lods(group.lods.data())
+	, lod_count(group.lods.size())
+	, albedo_map_path(group.albedo_map_path)
+	, normal_map_path(group.normal_map_path)
+{}
+
+std::string MeshCache::getCachePath(const std::string& model_path)
+{
+	return model_path + ".vfprcache";
+}
+
+bool MeshCache::open(const std::string& model_path, uint32_t loader_flags)
+{
+	file.close();
+	groups.clear();
+
+	util::FileStat source_stat;
+	if (!util::getFileStat(model_path, &source_stat))
+	{
+		return false;
+	}
+
+	if (!file.open(getCachePath(model_path)))
+	{
+		return false;
+	}
+
+	auto invalidate = [this]()
+	{
+		groups.clear();
+		file.close();
+		return false;
+	};
+
+	CacheReader reader(file.data(), file.size());
+
+	CacheFileHeader header;
+	if (!reader.read(&header, sizeof(header))
+		|| memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+		|| header.format_version != CACHE_FORMAT_VERSION
+		|| header.loader_version != MESH_LOADER_VERSION
+		|| header.loader_flags != loader_flags
+		|| header.vertex_size != sizeof(util::Vertex)
+		|| header.index_size != sizeof(util::Vertex::index_t)
+		|| header.meshlet_size != sizeof(Meshlet)
+		|| header.lod_size != sizeof(MeshLod)
+		|| header.source_size != source_stat.size
+		|| header.source_modified_time != source_stat.modified_time)
+	{
+		return invalidate();
+	}
+
+	std::string source_path;
+	if (!reader.readString(&source_path, header.source_path_length) || source_path != model_path)
+	{
+		return invalidate();
+	}
+
+	// a corrupt count must fail the read below instead of the allocation
+	if (header.group_count > file.size() / sizeof(CacheGroupHeader))
+	{
+		return invalidate();
+	}
+	std::vector<CacheGroupHeader> group_headers(header.group_count);
+	if (!reader.read(group_headers.data(), sizeof(CacheGroupHeader) * group_headers.size()))
+	{
+		return invalidate();
+	}
+
+	groups.resize(header.group_count);
+	for (size_t i = 0; i < group_headers.size(); i++)
+	{
+		const auto& group_header = group_headers[i];
+		auto& group = groups[i];
+
+		if (!reader.readString(&group.albedo_map_path, group_header.albedo_map_path_length)
+			|| !reader.readString(&group.normal_map_path, group_header.normal_map_path_length))
+		{
+			return invalidate();
+		}
+
+		// guard against overflow before checking the ranges
+		if (group_header.vertex_count > file.size() / sizeof(util::Vertex)
+			|| group_header.index_count > file.size() / sizeof(util::Vertex::index_t)
+			|| group_header.meshlet_count > file.size() / sizeof(Meshlet)
+			|| group_header.lod_count > file.size() / sizeof(MeshLod))
+		{
+			return invalidate();
+		}
+		uint64_t vertex_section_size = group_header.vertex_count * sizeof(util::Vertex);
+		uint64_t index_section_size = group_header.index_count * sizeof(util::Vertex::index_t);
+		uint64_t meshlet_section_size = group_header.meshlet_count * sizeof(Meshlet);
+		uint64_t lod_section_size = group_header.lod_count * sizeof(MeshLod);
+		if (!reader.contains(group_header.vertex_offset, vertex_section_size)
+			|| !reader.contains(group_header.index_offset, index_section_size)
+			|| !reader.contains(group_header.meshlet_offset, meshlet_section_size)
+			|| !reader.contains(group_header.lod_offset, lod_section_size)
+			|| group_header.vertex_offset % CACHE_DATA_ALIGNMENT != 0
+			|| group_header.index_offset % CACHE_DATA_ALIGNMENT != 0
+			|| group_header.meshlet_offset % CACHE_DATA_ALIGNMENT != 0
+			|| group_header.lod_offset % CACHE_DATA_ALIGNMENT != 0)
+		{
+			return invalidate();
+		}
+
+		group.vertices = reinterpret_cast<const util::Vertex*>(file.data() + group_header.vertex_offset);
+		group.vertex_count = static_cast<size_t>(group_header.vertex_count);
+		group.vertex_indices = reinterpret_cast<const util::Vertex::index_t*>(file.data() + group_header.index_offset);
+		group.index_count = static_cast<size_t>(group_header.index_count);
+		group.meshlets = reinterpret_cast<const Meshlet*>(file.data() + group_header.meshlet_offset);
+		group.meshlet_count = static_cast<size_t>(group_header.meshlet_count);
+		group.lods = reinterpret_cast<const MeshLod*>(file.data() + group_header.lod_offset);
+		group.lod_count = static_cast<size_t>(group_header.lod_count);
+
+		// indices are used to look up vertices on the CPU as well as on the GPU
+		for (size_t n = 0; n < group.index_count; n++)
+		{
+			if (group.vertex_indices[n] >= group.vertex_count)
+			{
+				return invalidate();
+			}
+		}
+
+		// meshlets must stay within the index section, they become indirect draws
+		for (size_t m = 0; m < group.meshlet_count; m++)
+		{
+			const auto& range = group.meshlets[m];
+			if (range.first_index > group.index_count || range.index_count > group.index_count - range.first_index)
+			{
+				return invalidate();
+			}
+		}
+		if (group.lod_count == 0)
+		{
+			return invalidate();
+		}
+		for (size_t l = 0; l < group.lod_count; l++)
+		{
+			const auto& lod = group.lods[l];
+			if (lod.first_index > group.index_count || lod.index_count > group.index_count - lod.first_index
+				|| lod.first_meshlet > group.meshlet_count || lod.meshlet_count > group.meshlet_count - lod.first_meshlet)
+			{
+				return invalidate();
+			}
+		}
+	}
+
+	return true;
+}
+
+bool MeshCache::write(const std::string& model_path, uint32_t loader_flags, const std::vector<MeshMaterialGroup>& groups)
+{
+	util::FileStat source_stat;
+	if (!util::getFileStat(model_path, &source_stat))
+	{
+		return false;
+	}
+
+	CacheFileHeader header = {};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.format_version = CACHE_FORMAT_VERSION;
+	header.loader_version = MESH_LOADER_VERSION;
+	header.loader_flags = loader_flags;
+	header.vertex_size = sizeof(util::Vertex);
+	header.index_size = sizeof(util::Vertex::index_t);
+	header.meshlet_size = sizeof(Meshlet);
+	header.lod_size = sizeof(MeshLod);
+	header.source_size = source_stat.size;
+	header.source_modified_time = source_stat.modified_time;
+	header.source_path_length = static_cast<uint32_t>(model_path.size());
+	header.group_count = static_cast<uint32_t>(groups.size());
+
+	// lay out the file: header, source path, group headers, texture paths, then aligned data sections
+	std::vector<CacheGroupHeader> group_headers(groups.size());
+	uint64_t offset = sizeof(header) + model_path.size() + sizeof(CacheGroupHeader) * groups.size();
+	for (const auto& group : groups)
+	{
+		offset += group.albedo_map_path.size() + group.normal_map_path.size();
+	}
+	for (size_t i = 0; i < groups.size(); i++)
+	{
+		auto& group_header = group_headers[i];
+		group_header.vertex_count = groups[i].vertices.size();
+		group_header.index_count = groups[i].vertex_indices.size();
+		group_header.meshlet_count = groups[i].meshlets.size();
+		group_header.lod_count = groups[i].lods.size();
+		group_header.albedo_map_path_length = static_cast<uint32_t>(groups[i].albedo_map_path.size());
+		group_header.normal_map_path_length = static_cast<uint32_t>(groups[i].normal_map_path.size());
+
+		offset = alignUp(offset, CACHE_DATA_ALIGNMENT);
+		group_header.vertex_offset = offset;
+		offset += group_header.vertex_count * sizeof(util::Vertex);
+		offset = alignUp(offset, CACHE_DATA_ALIGNMENT);
+		group_header.index_offset = offset;
+		offset += group_header.index_count * sizeof(util::Vertex::index_t);
+		offset = alignUp(offset, CACHE_DATA_ALIGNMENT);
+		group_header.meshlet_offset = offset;
+		offset += group_header.meshlet_count * sizeof(Meshlet);
+		offset = alignUp(offset, CACHE_DATA_ALIGNMENT);
+		group_header.lod_offset = offset;
+		offset += group_header.lod_count * sizeof(MeshLod);
+	}
+
+	// write to a temporary file first so that an interrupted write never leaves a valid-looking cache
+	auto cache_path = getCachePath(model_path);
+	auto temp_path = cache_path + ".tmp";
+	{
+		std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+		if (!stream.is_open())
+		{
+			return false;
+		}
+
+		uint64_t written = 0;
+		auto write = [&stream, &written](const void* src, size_t length)
+		{
+			stream.write(static_cast<const char*>(src), length);
+			written += length;
+		};
+		auto pad = [&stream, &written](uint64_t target)
+		{
+			static const char zeros[CACHE_DATA_ALIGNMENT] = {};
+			stream.write(zeros, static_cast<std::streamsize>(target - written));
+			written = target;
+		};
+
+		write(&header, sizeof(header));
+		write(model_path.data(), model_path.size());
+		write(group_headers.data(), sizeof(CacheGroupHeader) * group_headers.size());
+		for (const auto& group : groups)
+		{
+			write(group.albedo_map_path.data(), group.albedo_map_path.size());
+			write(group.normal_map_path.data(), group.normal_map_path.size());
+		}
+		for (size_t i = 0; i < groups.size(); i++)
+		{
+			pad(group_headers[i].vertex_offset);
+			write(groups[i].vertices.data(), sizeof(util::Vertex) * groups[i].vertices.size());
+			pad(group_headers[i].index_offset);
+			write(groups[i].vertex_indices.data(), sizeof(util::Vertex::index_t) * groups[i].vertex_indices.size());
+			pad(group_headers[i].meshlet_offset);
+			write(groups[i].meshlets.data(), sizeof(Meshlet) * groups[i].meshlets.size());
+			pad(group_headers[i].lod_offset);
+			write(groups[i].lods.data(), sizeof(MeshLod) * groups[i].lods.size());
+		}
+
+		if (!stream.good())
+		{
+			stream.close();
+			std::remove(temp_path.c_str());
+			return false;
+		}
+	}
+
+	std::remove(cache_path.c_str()); // rename() does not overwrite on Windows
+	if (std::rename(temp_path.c_str(), cache_path.c_str()) != 0)
+	{
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
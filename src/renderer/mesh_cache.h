@@ -0,0 +1,65 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "mesh_loader.h"
+#include "../util.h"
+
+#include <vector>
+#include <string>
+
+/**
+* Non-owning view of a material group, pointing either into a MeshMaterialGroup or into a mapped cache file
+*/
+struct MeshGroupView
+{
+	const util::Vertex* vertices = nullptr;
+	size_t vertex_count = 0;
+	const util::Vertex::index_t* vertex_indices = nullptr;
+	size_t index_count = 0;
+	const Meshlet* meshlets = nullptr;
+	size_t meshlet_count = 0;
+	const MeshLod* lods = nullptr;
+	size_t lod_count = 0;
+
+	std::string albedo_map_path = "";
+	std::string normal_map_path = "";
+
+	MeshGroupView() = default;
+	MeshGroupView(const MeshMaterialGroup& group);
+};
+
+/**
+* A versioned binary cache of loadModel() output, stored next to the model file.
+* The cache is keyed by the source path, size, modification time, MESH_LOADER_VERSION and loader flags,
+* and is read through a memory mapping so that vertex, index, meshlet and LOD data can be copied straight
+* into staging buffers without parsing or hashing
+*/
+class MeshCache
+{
+public:
+	MeshCache() = default;
+	~MeshCache() = default;
+	MeshCache(MeshCache&&) = default;
+	MeshCache& operator= (MeshCache&&) = default;
+	MeshCache(const MeshCache&) = delete;
+	MeshCache& operator= (const MeshCache&) = delete;
+
+	static std::string getCachePath(const std::string& model_path);
+
+	// Maps the cache of model_path; returns false if the cache is missing, stale, corrupted or written with other loader flags
+	bool open(const std::string& model_path, uint32_t loader_flags);
+
+	const std::vector<MeshGroupView>& getGroups() const
+	{
+		return groups;
+	}
+
+	// Writes the cache of model_path; returns false if the cache could not be written
+	static bool write(const std::string& model_path, uint32_t loader_flags, const std::vector<MeshMaterialGroup>& groups);
+
+private:
+	util::MappedFile file;
+	std::vector<MeshGroupView> groups;
+};
@@ -0,0 +1,773 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "mesh_loader.h"
+
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "../thread_pool.h"
+
+#include <tiny_obj_loader.h>
+
+#include <map>
+#include <stdexcept>
+#include <chrono>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	// the last chunk absorbs the remainder, so tiny files are not split at all
+	const size_t MIN_CHUNK_SIZE = 1 << 20;
+	const size_t CHUNKS_PER_THREAD = 4;
+
+	// levels of detail stop below this, or when simplification stalls
+	const size_t MIN_LOD_TRIANGLE_COUNT = 64;
+	const float MIN_LOD_REDUCTION = 0.75f;
+
+	struct ObjCorner
+	{
+		int32_t position;  // 0-based, -1 if not given
+		int32_t tex_coord;
+		int32_t normal;
+	};
+
+	struct ObjTriangle
+	{
+		ObjCorner corners[3];
+	};
+
+	// a corner component given as a negative (relative) index, which can only be resolved
+	// after the element counts of all previous chunks are known
+	struct ObjRelativeIndex
+	{
+		uint32_t triangle;
+		uint8_t corner;
+		uint8_t component; // 0: position 1: tex_coord 2: normal
+	};
+
+	/**
+	* Everything parsed from a range of whole lines of an OBJ file
+	*/
+	struct ObjChunk
+	{
+		const char* begin = nullptr;
+		const char* end = nullptr;
+
+		std::vector<float> positions;
+		std::vector<float> tex_coords;
+		std::vector<float> normals;
+
+		std::vector<ObjTriangle> triangles;
+		std::vector<int32_t> triangle_materials; // index into material_names, -1 if set by a previous chunk
+		std::vector<std::string> material_names; // "usemtl" names in order of appearance
+		std::vector<std::string> material_libraries;
+		std::vector<ObjRelativeIndex> relative_indices;
+
+		// filled after all chunks are parsed
+		size_t position_offset = 0;
+		size_t tex_coord_offset = 0;
+		size_t normal_offset = 0;
+		int32_t start_material = -1; // material in effect at the beginning of this chunk
+		std::vector<int32_t> triangle_groups;
+	};
+
+	inline bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	inline const char* skipSpaces(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p))
+		{
+			p++;
+		}
+		return p;
+	}
+
+	inline const char* nextWord(const char* p, const char* end, std::string* word)
+	{
+		p = skipSpaces(p, end);
+		auto word_begin = p;
+		while (p < end && !isSpace(*p) && *p != '\n')
+		{
+			p++;
+		}
+		word->assign(word_begin, p);
+		return p;
+	}
+
+	double powerOfTen(int exponent)
+	{
+		// exactly representable in double, so that short decimals round correctly
+		static const double exact[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		if (exponent >= 0 && exponent <= 22)
+		{
+			return exact[exponent];
+		}
+		return std::pow(10.0, exponent);
+	}
+
+	// Returns nullptr if there is no number at p. Does not read past end
+	const char* parseFloat(const char* p, const char* end, float* out)
+	{
+		p = skipSpaces(p, end);
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		uint64_t mantissa = 0;
+		int significant_digits = 0;
+		int exponent = 0;
+		bool has_digits = false;
+
+		auto accumulate = [&](char c, bool fractional)
+		{
+			int digit = c - '0';
+			if (significant_digits < 19)
+			{
+				mantissa = mantissa * 10 + digit;
+				if (mantissa > 0)
+				{
+					significant_digits++;
+				}
+				if (fractional)
+				{
+					exponent--;
+				}
+			}
+			else if (!fractional)
+			{
+				exponent++;
+			}
+			has_digits = true;
+		};
+
+		while (p < end && isDigit(*p))
+		{
+			accumulate(*p++, false);
+		}
+		if (p < end && *p == '.')
+		{
+			p++;
+			while (p < end && isDigit(*p))
+			{
+				accumulate(*p++, true);
+			}
+		}
+		if (!has_digits)
+		{
+			return nullptr;
+		}
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			auto q = p + 1;
+			bool exponent_negative = false;
+			if (q < end && (*q == '-' || *q == '+'))
+			{
+				exponent_negative = *q == '-';
+				q++;
+			}
+			if (q < end && isDigit(*q))
+			{
+				int value = 0;
+				while (q < end && isDigit(*q))
+				{
+					value = std::min(value * 10 + (*q++ - '0'), 10000);
+				}
+				exponent += exponent_negative ? -value : value;
+				p = q;
+			}
+		}
+
+		double value = static_cast<double>(mantissa);
+		value = exponent < 0 ? value / powerOfTen(-exponent) : value * powerOfTen(exponent);
+		*out = static_cast<float>(negative ? -value : value);
+		return p;
+	}
+
+	const char* parseInt(const char* p, const char* end, int64_t* out)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+		if (p >= end || !isDigit(*p))
+		{
+			return nullptr;
+		}
+		int64_t value = 0;
+		while (p < end && isDigit(*p))
+		{
+			value = std::min<int64_t>(value * 10 + (*p++ - '0'), INT32_MAX);
+		}
+		*out = negative ? -value : value;
+		return p;
+	}
+
+	void parseChunk(ObjChunk* chunk)
+	{
+		auto p = chunk->begin;
+		auto end = chunk->end;
+
+		std::vector<ObjCorner> face;
+		std::vector<uint8_t> face_relative; // bit i set if component i of the corner is relative
+		int32_t current_material = -1;
+		std::string word;
+
+		auto fail = [](const char* what)
+		{
+			throw std::runtime_error(std::string("OBJ parsing error: ") + what);
+		};
+
+		while (p < end)
+		{
+			p = skipSpaces(p, end);
+			auto line_end = std::find(p, end, '\n');
+
+			if (p + 1 < line_end && p[0] == 'v' && isSpace(p[1]))
+			{
+				float xyz[3];
+				auto q = p + 1;
+				for (int i = 0; i < 3; i++)
+				{
+					q = parseFloat(q, line_end, &xyz[i]);
+					if (!q)
+					{
+						fail("invalid vertex position");
+					}
+				}
+				chunk->positions.insert(chunk->positions.end(), xyz, xyz + 3);
+			}
+			else if (p + 2 < line_end && p[0] == 'v' && p[1] == 't' && isSpace(p[2]))
+			{
+				float uv[2] = { 0.0f, 0.0f };
+				auto q = parseFloat(p + 2, line_end, &uv[0]);
+				if (!q)
+				{
+					fail("invalid texture coordinate");
+				}
+				parseFloat(q, line_end, &uv[1]); // v is optional
+				chunk->tex_coords.insert(chunk->tex_coords.end(), uv, uv + 2);
+			}
+			else if (p + 2 < line_end && p[0] == 'v' && p[1] == 'n' && isSpace(p[2]))
+			{
+				float xyz[3];
+				auto q = p + 2;
+				for (int i = 0; i < 3; i++)
+				{
+					q = parseFloat(q, line_end, &xyz[i]);
+					if (!q)
+					{
+						fail("invalid vertex normal");
+					}
+				}
+				chunk->normals.insert(chunk->normals.end(), xyz, xyz + 3);
+			}
+			else if (p + 1 < line_end && p[0] == 'f' && isSpace(p[1]))
+			{
+				face.clear();
+				face_relative.clear();
+				int64_t local_counts[3] = {
+					static_cast<int64_t>(chunk->positions.size() / 3),
+					static_cast<int64_t>(chunk->tex_coords.size() / 2),
+					static_cast<int64_t>(chunk->normals.size() / 3)
+				};
+
+				auto q = skipSpaces(p + 1, line_end);
+				while (q < line_end)
+				{
+					// v, v/vt, v//vn or v/vt/vn
+					int32_t components[3] = { -1, -1, -1 };
+					uint8_t relative = 0;
+					for (int c = 0; c < 3; c++)
+					{
+						if (c > 0)
+						{
+							if (q >= line_end || *q != '/')
+							{
+								break;
+							}
+							q++;
+							if (q < line_end && *q == '/')
+							{
+								continue; // empty component
+							}
+						}
+						int64_t index;
+						q = parseInt(q, line_end, &index);
+						if (!q || index == 0)
+						{
+							fail("invalid face index");
+						}
+						if (index > 0)
+						{
+							components[c] = static_cast<int32_t>(index - 1);
+						}
+						else
+						{
+							// relative to this chunk for now, the chunk's offset is added later
+							components[c] = static_cast<int32_t>(local_counts[c] + index);
+							relative |= 1 << c;
+						}
+					}
+					face.push_back({ components[0], components[1], components[2] });
+					face_relative.push_back(relative);
+					q = skipSpaces(q, line_end);
+				}
+
+				// triangulate as a fan, just like tinyobj
+				for (size_t i = 2; i < face.size(); i++)
+				{
+					size_t corner_ids[3] = { 0, i - 1, i };
+					ObjTriangle triangle;
+					for (uint8_t c = 0; c < 3; c++)
+					{
+						triangle.corners[c] = face[corner_ids[c]];
+						for (uint8_t component = 0; component < 3; component++)
+						{
+							if (face_relative[corner_ids[c]] & (1 << component))
+							{
+								chunk->relative_indices.push_back({ static_cast<uint32_t>(chunk->triangles.size()), c, component });
+							}
+						}
+					}
+					chunk->triangles.push_back(triangle);
+					chunk->triangle_materials.push_back(current_material);
+				}
+			}
+			else if (line_end - p > 6 && std::equal(p, p + 6, "usemtl") && isSpace(p[6]))
+			{
+				nextWord(p + 6, line_end, &word);
+				current_material = static_cast<int32_t>(chunk->material_names.size());
+				chunk->material_names.push_back(word);
+			}
+			else if (line_end - p > 6 && std::equal(p, p + 6, "mtllib") && isSpace(p[6]))
+			{
+				nextWord(p + 6, line_end, &word);
+				chunk->material_libraries.push_back(word);
+			}
+			// everything else (comments, groups, smoothing groups...) is ignored
+
+			p = line_end < end ? line_end + 1 : end;
+		}
+	}
+
+	static_assert(sizeof(util::Vertex) == 11 * sizeof(float), "util::Vertex is expected to be tightly packed floats");
+
+	const util::Vertex::index_t EMPTY_SLOT = 0xFFFFFFFFu;
+
+	/**
+	* Open-addressing (linear probing) table from vertex bytes to an index into a vertex vector.
+	* Slots store only 32-bit indices, vertices are compared bytewise against the vector,
+	* so -0.0f and 0.0f are treated as different values
+	*/
+	class VertexDedupTable
+	{
+	public:
+		using index_t = util::Vertex::index_t;
+
+		// expected_insertions is an upper bound of unique vertices, normally the corner count
+		explicit VertexDedupTable(size_t expected_insertions)
+		{
+			size_t capacity = 16;
+			while (capacity < expected_insertions)
+			{
+				capacity *= 2;
+			}
+			slots.assign(capacity, EMPTY_SLOT);
+		}
+
+		/**
+		* Returns the index of an equal vertex in vertices, or appends vertex and returns its new index
+		*/
+		index_t findOrInsert(const util::Vertex& vertex, std::vector<util::Vertex>* vertices)
+		{
+			if ((size + 1) * 10 > slots.size() * 7)
+			{
+				grow(*vertices);
+			}
+
+			size_t mask = slots.size() - 1;
+			for (size_t slot = hashVertex(vertex) & mask; ; slot = (slot + 1) & mask)
+			{
+				auto index = slots[slot];
+				if (index == EMPTY_SLOT)
+				{
+					index = static_cast<index_t>(vertices->size());
+					vertices->push_back(vertex);
+					slots[slot] = index;
+					size++;
+					return index;
+				}
+				if (std::memcmp(&(*vertices)[index], &vertex, sizeof(util::Vertex)) == 0)
+				{
+					return index;
+				}
+			}
+		}
+
+	private:
+		std::vector<index_t> slots;
+		size_t size = 0;
+
+		static size_t hashVertex(const util::Vertex& vertex)
+		{
+			uint32_t words[11];
+			std::memcpy(words, &vertex, sizeof(words));
+			// FNV-1a offset basis, then whole words mixed by a multiply and xor-shift instead of bytes by the FNV prime
+			uint64_t hash = 0xcbf29ce484222325ull;
+			for (auto word : words)
+			{
+				hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+				hash ^= hash >> 32;
+			}
+			return static_cast<size_t>(hash);
+		}
+
+		void grow(const std::vector<util::Vertex>& vertices)
+		{
+			std::vector<index_t> old_slots(slots.size() * 2, EMPTY_SLOT);
+			old_slots.swap(slots);
+			size_t mask = slots.size() - 1;
+			for (auto index : old_slots)
+			{
+				if (index == EMPTY_SLOT)
+				{
+					continue;
+				}
+				size_t slot = hashVertex(vertices[index]) & mask;
+				while (slots[slot] != EMPTY_SLOT)
+				{
+					slot = (slot + 1) & mask;
+				}
+				slots[slot] = index;
+			}
+		}
+	};
+
+	/**
+	* Simplifies the group into levels of about half the triangles of the previous one, appends them
+	* after the full detail indices and splits every level into meshlets.
+	* Errors accumulate along the chain, since every level is simplified from the previous one
+	*/
+	void buildLods(MeshMaterialGroup* group, const MeshLoadOptions& options)
+	{
+		using index_t = util::Vertex::index_t;
+
+		std::vector<std::vector<index_t>> levels;
+		std::vector<float> errors = { 0.0f };
+		levels.push_back(std::move(group->vertex_indices));
+		while (options.generate_lods && levels.size() < MAX_MESH_LOD_COUNT && levels.back().size() / 3 > MIN_LOD_TRIANGLE_COUNT)
+		{
+			const auto& previous = levels.back();
+			float error = 0.0f;
+			auto level = mesh_simplifier::simplify(group->vertices, previous, previous.size() / 6 * 3, &error);
+			if (level.size() > previous.size() * MIN_LOD_REDUCTION)
+			{
+				break;
+			}
+			if (options.optimize_meshes)
+			{
+				std::vector<uint32_t> cluster_starts;
+				mesh_optimizer::optimizeVertexCache(&level, group->vertices.size(), &cluster_starts);
+				mesh_optimizer::optimizeOverdraw(&level, group->vertices, cluster_starts);
+			}
+			levels.push_back(std::move(level));
+			errors.push_back(errors.back() + error);
+		}
+
+		group->vertex_indices.clear();
+		group->meshlets.clear();
+		group->lods.clear();
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			MeshLod lod;
+			lod.first_index = static_cast<uint32_t>(group->vertex_indices.size());
+			lod.index_count = static_cast<uint32_t>(levels[i].size());
+			lod.first_meshlet = static_cast<uint32_t>(group->meshlets.size());
+			lod.error = errors[i];
+
+			for (auto meshlet : meshlet::buildMeshlets(group->vertices, levels[i]))
+			{
+				meshlet.first_index += lod.first_index;
+				group->meshlets.push_back(meshlet);
+			}
+			lod.meshlet_count = static_cast<uint32_t>(group->meshlets.size()) - lod.first_meshlet;
+
+			group->vertex_indices.insert(group->vertex_indices.end(), levels[i].begin(), levels[i].end());
+			group->lods.push_back(lod);
+		}
+	}
+
+	float getMilliseconds(std::chrono::high_resolution_clock::time_point from, std::chrono::high_resolution_clock::time_point to)
+	{
+		return std::chrono::duration<float, std::milli>(to - from).count();
+	}
+}
+
+uint32_t getMeshLoaderFlags(const MeshLoadOptions& options)
+{
+	uint32_t flags = 0;
+	if (options.optimize_meshes)
+	{
+		flags |= MESH_LOADER_FLAG_OPTIMIZED;
+	}
+	if (options.generate_lods)
+	{
+		flags |= MESH_LOADER_FLAG_LODS;
+	}
+	return flags;
+}
+
+std::vector<MeshMaterialGroup> loadModel(const std::string& path, const MeshLoadOptions& options)
+{
+	using util::Vertex;
+	using clock = std::chrono::high_resolution_clock;
+
+	auto start_time = clock::now();
+
+	util::MappedFile file;
+	if (!file.open(path))
+	{
+		throw std::runtime_error("Failed to open model " + path);
+	}
+
+	util::ThreadPool thread_pool(options.thread_count);
+
+	// Split the file into chunks of whole lines
+	std::vector<ObjChunk> chunks;
+	{
+		size_t chunk_count = std::max<size_t>(1, std::min<size_t>(thread_pool.getThreadCount() * CHUNKS_PER_THREAD, file.size() / MIN_CHUNK_SIZE));
+		auto file_begin = file.data();
+		auto file_end = file.data() + file.size();
+		auto chunk_begin = file_begin;
+		for (size_t i = 0; i < chunk_count && chunk_begin < file_end; i++)
+		{
+			auto chunk_end = (i + 1 == chunk_count) ? file_end : std::max(chunk_begin, file_begin + file.size() * (i + 1) / chunk_count);
+			chunk_end = std::find(chunk_end, file_end, '\n');
+			if (chunk_end < file_end)
+			{
+				chunk_end++;
+			}
+			chunks.emplace_back();
+			chunks.back().begin = chunk_begin;
+			chunks.back().end = chunk_end;
+			chunk_begin = chunk_end;
+		}
+	}
+
+	thread_pool.parallelFor(chunks.size(), [&chunks](size_t i)
+	{
+		parseChunk(&chunks[i]);
+	});
+
+	auto parse_end_time = clock::now();
+
+	// Load materials
+	std::string folder = util::findFolderName(path) + "/";
+	std::vector<tinyobj::material_t> materials;
+	std::map<std::string, int> material_map;
+	{
+		tinyobj::MaterialFileReader material_reader(folder);
+		for (const auto& chunk : chunks)
+		{
+			for (const auto& library : chunk.material_libraries)
+			{
+				std::string err;
+				material_reader(library, &materials, &material_map, &err);
+				if (!err.empty())
+				{
+					std::cerr << err << std::endl;
+				}
+			}
+		}
+	}
+
+	// Resolve element offsets and the material in effect at the beginning of each chunk
+	size_t position_count = 0;
+	size_t tex_coord_count = 0;
+	size_t normal_count = 0;
+	{
+		int32_t current_material = -1;
+		for (auto& chunk : chunks)
+		{
+			chunk.position_offset = position_count;
+			chunk.tex_coord_offset = tex_coord_count;
+			chunk.normal_offset = normal_count;
+			position_count += chunk.positions.size() / 3;
+			tex_coord_count += chunk.tex_coords.size() / 2;
+			normal_count += chunk.normals.size() / 3;
+
+			chunk.start_material = current_material;
+			if (!chunk.material_names.empty())
+			{
+				auto found = material_map.find(chunk.material_names.back());
+				current_material = found != material_map.end() ? found->second : -1;
+			}
+		}
+	}
+
+	std::vector<MeshMaterialGroup> groups(materials.size() + 1); // group parts of the same material together, +1 for unknown material
+
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		if (materials[i].diffuse_texname != "")
+		{
+			groups[i + 1].albedo_map_path = folder + materials[i].diffuse_texname;
+		}
+		if (materials[i].normal_texname != "")
+		{
+			groups[i + 1].normal_map_path = folder + materials[i].normal_texname;
+		}
+		else if (materials[i].bump_texname != "")
+		{
+			// CryEngine sponza scene uses keyword "bump" to store normal
+			groups[i + 1].normal_map_path = folder + materials[i].bump_texname;
+		}
+	}
+
+	// Merge attributes, resolve relative indices and assign each triangle a group (0 for unknown material)
+	std::vector<float> positions(position_count * 3);
+	std::vector<float> tex_coords(tex_coord_count * 2);
+	std::vector<float> normals(normal_count * 3);
+	std::vector<std::vector<size_t>> group_triangle_counts(chunks.size(), std::vector<size_t>(groups.size(), 0));
+
+	thread_pool.parallelFor(chunks.size(), [&](size_t i)
+	{
+		auto& chunk = chunks[i];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.position_offset * 3);
+		std::copy(chunk.tex_coords.begin(), chunk.tex_coords.end(), tex_coords.begin() + chunk.tex_coord_offset * 2);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normal_offset * 3);
+
+		const size_t offsets[3] = { chunk.position_offset, chunk.tex_coord_offset, chunk.normal_offset };
+		for (const auto& relative : chunk.relative_indices)
+		{
+			auto& corner = chunk.triangles[relative.triangle].corners[relative.corner];
+			int32_t* components[3] = { &corner.position, &corner.tex_coord, &corner.normal };
+			*components[relative.component] += static_cast<int32_t>(offsets[relative.component]);
+		}
+
+		std::vector<int32_t> local_material_ids(chunk.material_names.size());
+		for (size_t m = 0; m < chunk.material_names.size(); m++)
+		{
+			auto found = material_map.find(chunk.material_names[m]);
+			local_material_ids[m] = found != material_map.end() ? found->second : -1;
+		}
+
+		chunk.triangle_groups.resize(chunk.triangles.size());
+		for (size_t t = 0; t < chunk.triangles.size(); t++)
+		{
+			auto local_material = chunk.triangle_materials[t];
+			auto material_id = local_material < 0 ? chunk.start_material : local_material_ids[local_material];
+			chunk.triangle_groups[t] = material_id + 1;
+			group_triangle_counts[i][material_id + 1]++;
+		}
+
+		chunk.positions = {};
+		chunk.tex_coords = {};
+		chunk.normals = {};
+	});
+
+	// Build each group's vertex and index lists, one task per material, keeping the face order of the file
+	thread_pool.parallelFor(groups.size(), [&](size_t group_id)
+	{
+		size_t triangle_count = 0;
+		for (const auto& counts : group_triangle_counts)
+		{
+			triangle_count += counts[group_id];
+		}
+		auto& group = groups[group_id];
+		if (triangle_count == 0)
+		{
+			group.lods.emplace_back(); // a single empty level
+			return;
+		}
+
+		group.vertex_indices.reserve(triangle_count * 3);
+		// most corners share a vertex with their neighbours, so one slot per corner keeps the load factor low
+		VertexDedupTable unique_vertices(triangle_count * 3);
+
+		for (const auto& chunk : chunks)
+		{
+			for (size_t t = 0; t < chunk.triangles.size(); t++)
+			{
+				if (chunk.triangle_groups[t] != static_cast<int32_t>(group_id))
+				{
+					continue;
+				}
+
+				for (const auto& corner : chunk.triangles[t].corners)
+				{
+					if (corner.position < 0 || static_cast<size_t>(corner.position) >= position_count
+						|| corner.tex_coord >= static_cast<int64_t>(tex_coord_count)
+						|| corner.normal >= static_cast<int64_t>(normal_count))
+					{
+						throw std::runtime_error("OBJ parsing error: face index out of range in " + path);
+					}
+
+					Vertex vertex = {};
+
+					vertex.pos = {
+						positions[3 * corner.position + 0],
+						positions[3 * corner.position + 1],
+						positions[3 * corner.position + 2]
+					};
+
+					if (corner.tex_coord >= 0)
+					{
+						vertex.tex_coord = {
+							tex_coords[2 * corner.tex_coord + 0],
+							1.0f - tex_coords[2 * corner.tex_coord + 1]
+						};
+					}
+
+					if (corner.normal >= 0)
+					{
+						vertex.normal = {
+							normals[3 * corner.normal + 0],
+							normals[3 * corner.normal + 1],
+							normals[3 * corner.normal + 2]
+						};
+					}
+
+					group.vertex_indices.push_back(unique_vertices.findOrInsert(vertex, &group.vertices));
+				}
+			}
+		}
+
+		if (options.optimize_meshes)
+		{
+			mesh_optimizer::optimizeMesh(&group.vertices, &group.vertex_indices);
+		}
+		buildLods(&group, options);
+	});
+
+	// compare runs with thread_count 1 and the default to get the speedup of the threads
+	auto end_time = clock::now();
+	float parse_milliseconds = getMilliseconds(start_time, parse_end_time);
+	std::cout << "Loaded " << path << " in " << getMilliseconds(start_time, end_time) << " ms"
+		<< " (parsing: " << parse_milliseconds << " ms, " << file.size() / 1000.0f / std::max(parse_milliseconds, 0.001f) << " MB/s"
+		<< (options.optimize_meshes ? ", building and optimizing groups: " : ", building groups: ") << getMilliseconds(parse_end_time, end_time) << " ms"
+		<< ", " << thread_pool.getThreadCount() << " threads, " << chunks.size() << " chunks)" << std::endl;
+
+	return groups;
+}
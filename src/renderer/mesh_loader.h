@@ -0,0 +1,64 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "../util.h"
+#include "vertex_format.h"
+#include "meshlet.h"
+
+#include <vector>
+#include <string>
+
+// Bump this whenever the output of loadModel() changes, so that stale mesh caches get rebuilt
+const uint32_t MESH_LOADER_VERSION = 6;
+
+const uint32_t MAX_MESH_LOD_COUNT = 6;
+
+/**
+* A level of detail of a material group: ranges of its index buffer and meshlets.
+* error is how far in model space the level may deviate from the full detail mesh
+*/
+struct MeshLod
+{
+	uint32_t first_index = 0;
+	uint32_t index_count = 0;
+	uint32_t first_meshlet = 0;
+	uint32_t meshlet_count = 0;
+	float error = 0.0f;
+	uint32_t reserved[3] = {};
+};
+
+struct MeshMaterialGroup // grouped by material
+{
+	std::vector<util::Vertex> vertices = {};
+	std::vector<util::Vertex::index_t> vertex_indices = {}; // all levels of detail, full detail first
+	std::vector<Meshlet> meshlets = {}; // partition of vertex_indices in order
+	std::vector<MeshLod> lods = {}; // at least one
+
+	std::string albedo_map_path = "";
+	std::string normal_map_path = "";
+};
+
+struct MeshLoadOptions
+{
+	unsigned thread_count = 0; // 0 for one thread per hardware thread
+	VertexFormat vertex_format = VertexFormat::full; // layout of uploaded vertex buffers, does not affect the loaded groups
+	bool optimize_meshes = true; // reorder triangles and vertices for vertex cache, overdraw and vertex fetch
+	bool generate_lods = true; // append simplified levels of detail to every group
+	uint32_t occluder_triangle_budget = 0; // triangles of the largest groups kept on the CPU as occluders, does not affect the loaded groups
+};
+
+// Options affecting the output of loadModel(), cached meshes are only reused with the same flags
+const uint32_t MESH_LOADER_FLAG_OPTIMIZED = 1 << 0;
+const uint32_t MESH_LOADER_FLAG_LODS = 1 << 1;
+uint32_t getMeshLoaderFlags(const MeshLoadOptions& options);
+
+/**
+* Parse an OBJ file and group its deduplicated vertices by material, simplify every group into
+* a chain of levels of detail, and split every level into meshlets.
+* The file is parsed in chunks of lines and the groups are built on a thread pool,
+* the result is the same regardless of thread count.
+* Group 0 holds faces without a material
+*/
+std::vector<MeshMaterialGroup> loadModel(const std::string& path, const MeshLoadOptions& options = {});
@@ -0,0 +1,370 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <numeric>
+
+using mesh_optimizer::index_t;
+
+namespace
+{
+	const index_t INVALID_INDEX = 0xFFFFFFFFu;
+
+	/**
+	* FIFO post-transform cache simulated with timestamps: a vertex is in the cache
+	* if fewer than cache_size misses happened since it was last loaded
+	*/
+	class FifoCache
+	{
+	public:
+		FifoCache(size_t vertex_count, unsigned cache_size)
+			: timestamps(vertex_count, 0)
+			, cache_size(cache_size)
+			, time(cache_size + 1)
+		{}
+
+		// returns true on a miss
+		bool access(index_t vertex)
+		{
+			if (time - timestamps[vertex] > cache_size)
+			{
+				timestamps[vertex] = time++;
+				return true;
+			}
+			return false;
+		}
+
+		void flush()
+		{
+			time += cache_size + 1;
+		}
+
+	private:
+		std::vector<uint32_t> timestamps;
+		uint32_t cache_size;
+		uint32_t time;
+	};
+
+	struct TriangleAdjacency
+	{
+		std::vector<uint32_t> offsets; // triangles of vertex v are triangles[offsets[v]..offsets[v + 1])
+		std::vector<uint32_t> triangles;
+
+		TriangleAdjacency(const std::vector<index_t>& indices, size_t vertex_count)
+			: offsets(vertex_count + 1, 0)
+			, triangles(indices.size())
+		{
+			for (auto index : indices)
+			{
+				offsets[index + 1]++;
+			}
+			for (size_t v = 0; v < vertex_count; v++)
+			{
+				offsets[v + 1] += offsets[v];
+			}
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	};
+}
+
+VertexCacheStatistics mesh_optimizer::analyzeVertexCache(const index_t* indices, size_t index_count, size_t vertex_count, unsigned cache_size)
+{
+	VertexCacheStatistics statistics;
+	statistics.triangle_count = index_count / 3;
+
+	FifoCache cache(vertex_count, cache_size);
+	std::vector<char> referenced(vertex_count, 0);
+	for (size_t i = 0; i < index_count; i++)
+	{
+		if (cache.access(indices[i]))
+		{
+			statistics.cache_misses++;
+		}
+		if (!referenced[indices[i]])
+		{
+			referenced[indices[i]] = 1;
+			statistics.vertex_count++;
+		}
+	}
+
+	if (statistics.triangle_count > 0)
+	{
+		statistics.acmr = static_cast<float>(statistics.cache_misses) / statistics.triangle_count;
+	}
+	if (statistics.vertex_count > 0)
+	{
+		statistics.atvr = static_cast<float>(statistics.cache_misses) / statistics.vertex_count;
+	}
+	return statistics;
+}
+
+void mesh_optimizer::optimizeVertexCache(std::vector<index_t>* indices, size_t vertex_count, std::vector<uint32_t>* cluster_starts, unsigned cache_size)
+{
+	cluster_starts->clear();
+	size_t triangle_count = indices->size() / 3;
+	if (triangle_count == 0)
+	{
+		return;
+	}
+
+	TriangleAdjacency adjacency(*indices, vertex_count);
+	std::vector<uint32_t> live_triangles(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++)
+	{
+		live_triangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+	}
+
+	std::vector<uint32_t> timestamps(vertex_count, 0);
+	std::vector<char> emitted(triangle_count, 0);
+	std::vector<index_t> dead_end_stack;
+	std::vector<index_t> candidates;
+	std::vector<index_t> output;
+	output.reserve(indices->size());
+
+	uint32_t time = cache_size + 1;
+	size_t cursor = 0;
+
+	// next vertex with live triangles once the fan has no good candidate left
+	auto skipDeadEnd = [&]()
+	{
+		while (!dead_end_stack.empty())
+		{
+			auto vertex = dead_end_stack.back();
+			dead_end_stack.pop_back();
+			if (live_triangles[vertex] > 0)
+			{
+				return vertex;
+			}
+		}
+		while (cursor < vertex_count)
+		{
+			if (live_triangles[cursor] > 0)
+			{
+				return static_cast<index_t>(cursor);
+			}
+			cursor++;
+		}
+		return INVALID_INDEX;
+	};
+
+	index_t fanning_vertex = (*indices)[0];
+	while (fanning_vertex != INVALID_INDEX)
+	{
+		candidates.clear();
+
+		// emit all remaining triangles around the fanning vertex
+		for (auto k = adjacency.offsets[fanning_vertex]; k < adjacency.offsets[fanning_vertex + 1]; k++)
+		{
+			auto triangle = adjacency.triangles[k];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+			emitted[triangle] = 1;
+
+			for (size_t c = 0; c < 3; c++)
+			{
+				auto vertex = (*indices)[triangle * 3 + c];
+				output.push_back(vertex);
+				dead_end_stack.push_back(vertex);
+				candidates.push_back(vertex);
+				live_triangles[vertex]--;
+				if (time - timestamps[vertex] > cache_size)
+				{
+					timestamps[vertex] = time++;
+				}
+			}
+		}
+
+		// pick the candidate that stays in the cache after fanning around it, preferring the oldest one
+		index_t next_vertex = INVALID_INDEX;
+		int best_priority = -1;
+		for (auto vertex : candidates)
+		{
+			if (live_triangles[vertex] == 0)
+			{
+				continue;
+			}
+			int priority = 0;
+			if (time - timestamps[vertex] + 2 * live_triangles[vertex] <= cache_size)
+			{
+				priority = static_cast<int>(time - timestamps[vertex]);
+			}
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				next_vertex = vertex;
+			}
+		}
+
+		fanning_vertex = next_vertex != INVALID_INDEX ? next_vertex : skipDeadEnd();
+	}
+
+	indices->swap(output);
+
+	// hard cluster boundaries: triangles missing the cache with all three vertices
+	FifoCache cache(vertex_count, cache_size);
+	for (size_t t = 0; t < triangle_count; t++)
+	{
+		int misses = 0;
+		for (size_t c = 0; c < 3; c++)
+		{
+			misses += cache.access((*indices)[t * 3 + c]) ? 1 : 0;
+		}
+		if (t == 0 || misses == 3)
+		{
+			cluster_starts->push_back(static_cast<uint32_t>(t));
+		}
+	}
+}
+
+void mesh_optimizer::optimizeOverdraw(std::vector<index_t>* indices, const std::vector<util::Vertex>& vertices, const std::vector<uint32_t>& cluster_starts
+	, float threshold, unsigned cache_size)
+{
+	size_t triangle_count = indices->size() / 3;
+	if (triangle_count == 0 || cluster_starts.empty())
+	{
+		return;
+	}
+
+	FifoCache cache(vertices.size(), cache_size);
+	auto countMisses = [&cache, indices](size_t triangle)
+	{
+		int misses = 0;
+		for (size_t c = 0; c < 3; c++)
+		{
+			misses += cache.access((*indices)[triangle * 3 + c]) ? 1 : 0;
+		}
+		return misses;
+	};
+
+	// split hard clusters where the running ACMR gets within threshold of the cluster's own ACMR
+	std::vector<uint32_t> soft_starts;
+	for (size_t h = 0; h < cluster_starts.size(); h++)
+	{
+		size_t begin = cluster_starts[h];
+		size_t end = h + 1 < cluster_starts.size() ? cluster_starts[h + 1] : triangle_count;
+
+		cache.flush();
+		size_t cluster_misses = 0;
+		for (size_t t = begin; t < end; t++)
+		{
+			cluster_misses += countMisses(t);
+		}
+		float cluster_acmr = static_cast<float>(cluster_misses) / (end - begin);
+
+		cache.flush();
+		soft_starts.push_back(static_cast<uint32_t>(begin));
+		size_t soft_begin = begin;
+		size_t soft_misses = 0;
+		for (size_t t = begin; t < end; t++)
+		{
+			soft_misses += countMisses(t);
+			if (t + 1 < end && soft_misses <= threshold * cluster_acmr * (t + 1 - soft_begin))
+			{
+				soft_starts.push_back(static_cast<uint32_t>(t + 1));
+				soft_begin = t + 1;
+				soft_misses = 0;
+				cache.flush();
+			}
+		}
+	}
+
+	// sort clusters by how much they face away from the mesh centroid, outermost first
+	std::vector<glm::vec3> triangle_centroids(triangle_count);
+	std::vector<glm::vec3> triangle_normals(triangle_count); // area weighted
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for (size_t t = 0; t < triangle_count; t++)
+	{
+		const auto& p0 = vertices[(*indices)[t * 3 + 0]].pos;
+		const auto& p1 = vertices[(*indices)[t * 3 + 1]].pos;
+		const auto& p2 = vertices[(*indices)[t * 3 + 2]].pos;
+		triangle_centroids[t] = (p0 + p1 + p2) / 3.0f;
+		triangle_normals[t] = glm::cross(p1 - p0, p2 - p0) * 0.5f;
+		float area = glm::length(triangle_normals[t]);
+		mesh_centroid += triangle_centroids[t] * area;
+		mesh_area += area;
+	}
+	if (mesh_area > 0.0f)
+	{
+		mesh_centroid /= mesh_area;
+	}
+
+	size_t cluster_count = soft_starts.size();
+	std::vector<float> cluster_keys(cluster_count);
+	for (size_t c = 0; c < cluster_count; c++)
+	{
+		size_t begin = soft_starts[c];
+		size_t end = c + 1 < cluster_count ? soft_starts[c + 1] : triangle_count;
+
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = begin; t < end; t++)
+		{
+			float triangle_area = glm::length(triangle_normals[t]);
+			centroid += triangle_centroids[t] * triangle_area;
+			normal += triangle_normals[t];
+			area += triangle_area;
+		}
+		float normal_length = glm::length(normal);
+		if (area > 0.0f && normal_length > 0.0f)
+		{
+			cluster_keys[c] = glm::dot(centroid / area - mesh_centroid, normal / normal_length);
+		}
+		else
+		{
+			cluster_keys[c] = 0.0f;
+		}
+	}
+
+	std::vector<uint32_t> cluster_order(cluster_count);
+	std::iota(cluster_order.begin(), cluster_order.end(), 0);
+	std::stable_sort(cluster_order.begin(), cluster_order.end(), [&cluster_keys](uint32_t a, uint32_t b)
+	{
+		return cluster_keys[a] > cluster_keys[b];
+	});
+
+	std::vector<index_t> output;
+	output.reserve(indices->size());
+	for (auto c : cluster_order)
+	{
+		size_t begin = soft_starts[c];
+		size_t end = c + 1 < cluster_count ? soft_starts[c + 1] : triangle_count;
+		output.insert(output.end(), indices->begin() + begin * 3, indices->begin() + end * 3);
+	}
+	indices->swap(output);
+}
+
+void mesh_optimizer::optimizeVertexFetch(std::vector<util::Vertex>* vertices, std::vector<index_t>* indices)
+{
+	std::vector<index_t> remap(vertices->size(), INVALID_INDEX);
+	std::vector<util::Vertex> output;
+	output.reserve(vertices->size());
+
+	for (auto& index : *indices)
+	{
+		if (remap[index] == INVALID_INDEX)
+		{
+			remap[index] = static_cast<index_t>(output.size());
+			output.push_back((*vertices)[index]);
+		}
+		index = remap[index];
+	}
+	vertices->swap(output);
+}
+
+void mesh_optimizer::optimizeMesh(std::vector<util::Vertex>* vertices, std::vector<index_t>* indices)
+{
+	std::vector<uint32_t> cluster_starts;
+	optimizeVertexCache(indices, vertices->size(), &cluster_starts);
+	optimizeOverdraw(indices, *vertices, cluster_starts);
+	optimizeVertexFetch(vertices, indices);
+}
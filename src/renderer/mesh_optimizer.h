@@ -0,0 +1,54 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "../util.h"
+
+#include <vector>
+
+/**
+* Post-transform vertex cache statistics of an index buffer, simulated with a FIFO cache.
+* ACMR: cache misses per triangle (0.5 ideal for large regular grids, 3 worst).
+* ATVR: cache misses per referenced vertex (1 ideal)
+*/
+struct VertexCacheStatistics
+{
+	size_t triangle_count = 0;
+	size_t vertex_count = 0; // vertices referenced by the index buffer
+	size_t cache_misses = 0;
+	float acmr = 0.0f;
+	float atvr = 0.0f;
+};
+
+namespace mesh_optimizer
+{
+	const unsigned DEFAULT_VERTEX_CACHE_SIZE = 16;
+	const float DEFAULT_OVERDRAW_THRESHOLD = 1.05f; // max ACMR regression allowed by overdraw sorting
+
+	using index_t = util::Vertex::index_t;
+
+	VertexCacheStatistics analyzeVertexCache(const index_t* indices, size_t index_count, size_t vertex_count, unsigned cache_size = DEFAULT_VERTEX_CACHE_SIZE);
+
+	/**
+	* Reorders triangles for vertex cache locality with Tipsify (Sander et al. 2007).
+	* Fills cluster_starts with the first triangle of every run of triangles that starts with a cold cache,
+	* used as hard boundaries by optimizeOverdraw()
+	*/
+	void optimizeVertexCache(std::vector<index_t>* indices, size_t vertex_count, std::vector<uint32_t>* cluster_starts, unsigned cache_size = DEFAULT_VERTEX_CACHE_SIZE);
+
+	/**
+	* Reorders clusters of triangles so that outward facing clusters draw first (Sander et al. 2007),
+	* splitting hard clusters further where the vertex cache efficiency allows
+	*/
+	void optimizeOverdraw(std::vector<index_t>* indices, const std::vector<util::Vertex>& vertices, const std::vector<uint32_t>& cluster_starts
+		, float threshold = DEFAULT_OVERDRAW_THRESHOLD, unsigned cache_size = DEFAULT_VERTEX_CACHE_SIZE);
+
+	/**
+	* Reorders vertices in the order of their first reference and drops unreferenced ones
+	*/
+	void optimizeVertexFetch(std::vector<util::Vertex>* vertices, std::vector<index_t>* indices);
+
+	// all three steps in order
+	void optimizeMesh(std::vector<util::Vertex>* vertices, std::vector<index_t>* indices);
+}
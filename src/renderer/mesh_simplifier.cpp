@@ -0,0 +1,318 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <cmath>
+
+using mesh_simplifier::index_t;
+
+namespace
+{
+	/**
+	* Sum of squared distances to a set of planes, as a symmetric 4x4 matrix, weighted by triangle area
+	*/
+	struct Quadric
+	{
+		double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+		double b0 = 0, b1 = 0, b2 = 0;
+		double c = 0;
+		double weight = 0;
+
+		Quadric() = default;
+
+		// plane dot(normal, p) + d = 0 with a unit normal
+		Quadric(const glm::dvec3& normal, double d, double weight)
+			: a00(normal.x * normal.x * weight), a11(normal.y * normal.y * weight), a22(normal.z * normal.z * weight)
+			, a01(normal.x * normal.y * weight), a02(normal.x * normal.z * weight), a12(normal.y * normal.z * weight)
+			, b0(normal.x * d * weight), b1(normal.y * d * weight), b2(normal.z * d * weight)
+			, c(d * d * weight)
+			, weight(weight)
+		{}
+
+		Quadric& operator+= (const Quadric& other)
+		{
+			a00 += other.a00; a11 += other.a11; a22 += other.a22;
+			a01 += other.a01; a02 += other.a02; a12 += other.a12;
+			b0 += other.b0; b1 += other.b1; b2 += other.b2;
+			c += other.c;
+			weight += other.weight;
+			return *this;
+		}
+
+		// weighted average squared distance of p to the planes
+		double evaluate(const glm::vec3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double error = a00 * x * x + a11 * y * y + a22 * z * z
+				+ 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+				+ 2 * (b0 * x + b1 * y + b2 * z)
+				+ c;
+			return weight > 0 ? std::max(error, 0.0) / weight : 0.0;
+		}
+	};
+
+	struct Collapse
+	{
+		index_t from;
+		index_t to;
+		float cost;
+	};
+
+	// vertex to triangle lists of the current index buffer
+	struct VertexTriangles
+	{
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+
+		VertexTriangles(const std::vector<index_t>& indices, size_t vertex_count)
+			: offsets(vertex_count + 1, 0)
+			, triangles(indices.size())
+		{
+			for (auto index : indices)
+			{
+				offsets[index + 1]++;
+			}
+			std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	};
+
+	/**
+	* Marks vertices that must not move: those sharing a position with another vertex (normal or UV seams)
+	* and those on an open border of the mesh
+	*/
+	std::vector<char> findLockedVertices(const std::vector<util::Vertex>& vertices, const std::vector<index_t>& indices)
+	{
+		// group vertices by position
+		std::vector<index_t> sorted(vertices.size());
+		std::iota(sorted.begin(), sorted.end(), 0);
+		auto position_less = [&vertices](index_t a, index_t b)
+		{
+			const auto& pa = vertices[a].pos;
+			const auto& pb = vertices[b].pos;
+			return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+		};
+		std::sort(sorted.begin(), sorted.end(), position_less);
+
+		std::vector<index_t> position_ids(vertices.size());
+		std::vector<uint32_t> position_sizes;
+		for (size_t i = 0; i < sorted.size(); i++)
+		{
+			if (i == 0 || position_less(sorted[i - 1], sorted[i]))
+			{
+				position_sizes.push_back(0);
+			}
+			position_ids[sorted[i]] = static_cast<index_t>(position_sizes.size() - 1);
+			position_sizes.back()++;
+		}
+
+		std::vector<char> locked(vertices.size(), 0);
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			locked[v] = position_sizes[position_ids[v]] > 1;
+		}
+
+		// a border edge has no twin running the other way
+		auto edgeKey = [](index_t a, index_t b)
+		{
+			return (static_cast<uint64_t>(a) << 32) | b;
+		};
+		std::unordered_map<uint64_t, uint32_t> edges;
+		edges.reserve(indices.size());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (size_t e = 0; e < 3; e++)
+			{
+				edges[edgeKey(position_ids[indices[i + e]], position_ids[indices[i + (e + 1) % 3]])]++;
+			}
+		}
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (size_t e = 0; e < 3; e++)
+			{
+				auto a = indices[i + e];
+				auto b = indices[i + (e + 1) % 3];
+				if (edges.find(edgeKey(position_ids[b], position_ids[a])) == edges.end())
+				{
+					locked[a] = 1;
+					locked[b] = 1;
+				}
+			}
+		}
+		return locked;
+	}
+}
+
+std::vector<index_t> mesh_simplifier::simplify(const std::vector<util::Vertex>& vertices, const std::vector<index_t>& indices
+	, size_t target_index_count, float* result_error)
+{
+	std::vector<index_t> result = indices;
+	double max_error_squared = 0.0;
+
+	auto locked = findLockedVertices(vertices, indices);
+
+	std::vector<Quadric> quadrics(vertices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		glm::dvec3 p0 = vertices[indices[i + 0]].pos;
+		glm::dvec3 p1 = vertices[indices[i + 1]].pos;
+		glm::dvec3 p2 = vertices[indices[i + 2]].pos;
+		auto normal = glm::cross(p1 - p0, p2 - p0);
+		double length = glm::length(normal);
+		if (length <= util::SMALL_NUMBER)
+		{
+			continue;
+		}
+		normal /= length;
+		Quadric quadric(normal, -glm::dot(normal, p0), length * 0.5);
+		for (size_t c = 0; c < 3; c++)
+		{
+			quadrics[indices[i + c]] += quadric;
+		}
+	}
+
+	auto collapseCost = [&](index_t from, index_t to)
+	{
+		Quadric quadric = quadrics[from];
+		quadric += quadrics[to];
+		return static_cast<float>(quadric.evaluate(vertices[to].pos));
+	};
+
+	std::vector<Collapse> collapses;
+	std::vector<char> touched(vertices.size());
+	std::vector<index_t> remap(vertices.size());
+
+	// every pass collapses the cheapest independent edges, then rebuilds the index buffer
+	while (result.size() > target_index_count)
+	{
+		VertexTriangles vertex_triangles(result, vertices.size());
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (size_t e = 0; e < 3; e++)
+			{
+				auto a = result[i + e];
+				auto b = result[i + (e + 1) % 3];
+				if (!locked[a])
+				{
+					collapses.push_back({ a, b, collapseCost(a, b) });
+				}
+				if (!locked[b])
+				{
+					collapses.push_back({ b, a, collapseCost(b, a) });
+				}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+		{
+			return a.cost < b.cost;
+		});
+
+		// moving from onto to must not flip any remaining triangle around from, neither against its
+		// current normal nor against the average normal of the ring, which catches flips built up over passes
+		auto flips = [&](index_t from, index_t to)
+		{
+			glm::vec3 ring_normal(0.0f);
+			for (auto t = vertex_triangles.offsets[from]; t < vertex_triangles.offsets[from + 1]; t++)
+			{
+				auto triangle = &result[vertex_triangles.triangles[t] * 3];
+				const auto& p0 = vertices[triangle[0]].pos;
+				ring_normal += glm::cross(vertices[triangle[1]].pos - p0, vertices[triangle[2]].pos - p0);
+			}
+
+			for (auto t = vertex_triangles.offsets[from]; t < vertex_triangles.offsets[from + 1]; t++)
+			{
+				auto triangle = &result[vertex_triangles.triangles[t] * 3];
+				if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+				{
+					continue; // collapses with the edge
+				}
+				glm::vec3 before[3], after[3];
+				for (size_t c = 0; c < 3; c++)
+				{
+					before[c] = vertices[triangle[c]].pos;
+					after[c] = triangle[c] == from ? vertices[to].pos : before[c];
+				}
+				auto normal_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+				auto normal_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+				// a plain 90 degree test lets a series of collapses flip a triangle, so allow about 75 degrees
+				if (glm::dot(normal_before, normal_after) <= 0.25f * glm::length(normal_before) * glm::length(normal_after)
+					|| glm::dot(ring_normal, normal_after) <= 0.0f)
+				{
+					return true;
+				}
+			}
+			return false;
+		};
+
+		std::fill(touched.begin(), touched.end(), 0);
+		std::iota(remap.begin(), remap.end(), 0);
+		size_t triangle_count = result.size() / 3;
+		size_t target_triangle_count = target_index_count / 3;
+		size_t collapse_count = 0;
+		for (const auto& collapse : collapses)
+		{
+			if (triangle_count <= target_triangle_count)
+			{
+				break;
+			}
+			if (collapse.from == collapse.to || touched[collapse.from] || touched[collapse.to] || flips(collapse.from, collapse.to))
+			{
+				continue;
+			}
+
+			// triangles around from are frozen for the rest of the pass, so later flip tests stay valid
+			for (auto t = vertex_triangles.offsets[collapse.from]; t < vertex_triangles.offsets[collapse.from + 1]; t++)
+			{
+				auto triangle = &result[vertex_triangles.triangles[t] * 3];
+				bool removed = false;
+				for (size_t c = 0; c < 3; c++)
+				{
+					touched[triangle[c]] = 1;
+					removed = removed || triangle[c] == collapse.to;
+				}
+				if (removed)
+				{
+					triangle_count--;
+				}
+			}
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to] += quadrics[collapse.from];
+			max_error_squared = std::max(max_error_squared, static_cast<double>(collapse.cost));
+			collapse_count++;
+		}
+
+		if (collapse_count == 0)
+		{
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			auto a = remap[result[i + 0]];
+			auto b = remap[result[i + 1]];
+			auto c = remap[result[i + 2]];
+			if (a != b && b != c && a != c)
+			{
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+		}
+		result.resize(write);
+	}
+
+	*result_error = static_cast<float>(std::sqrt(max_error_squared));
+	return result;
+}
@@ -0,0 +1,23 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "../util.h"
+
+#include <vector>
+
+namespace mesh_simplifier
+{
+	using index_t = util::Vertex::index_t;
+
+	/**
+	* Quadric error metric edge collapse simplification (Garland and Heckbert 1997).
+	* Returns a new index buffer over the same vertices with about target_index_count indices or more,
+	* if the mesh cannot be simplified further. Vertices on open borders and on attribute seams
+	* (several vertices sharing a position) are never moved, so silhouettes and UV seams stay intact.
+	* result_error receives the largest collapse error as a distance in model space
+	*/
+	std::vector<index_t> simplify(const std::vector<util::Vertex>& vertices, const std::vector<index_t>& indices
+		, size_t target_index_count, float* result_error);
+}
@@ -0,0 +1,184 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+
+static_assert(sizeof(Meshlet) == 48, "unexpected padding in Meshlet");
+
+namespace
+{
+	void computeMeshletBounds(Meshlet* meshlet, const std::vector<util::Vertex>& vertices, const std::vector<meshlet::index_t>& indices)
+	{
+		auto begin = meshlet->first_index;
+		auto end = meshlet->first_index + meshlet->index_count;
+
+		glm::vec3 min_pos = vertices[indices[begin]].pos;
+		glm::vec3 max_pos = min_pos;
+		for (auto i = begin; i < end; i++)
+		{
+			min_pos = glm::min(min_pos, vertices[indices[i]].pos);
+			max_pos = glm::max(max_pos, vertices[indices[i]].pos);
+		}
+		meshlet->center = (min_pos + max_pos) * 0.5f;
+		float radius_squared = 0.0f;
+		for (auto i = begin; i < end; i++)
+		{
+			auto offset = vertices[indices[i]].pos - meshlet->center;
+			radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+		}
+		meshlet->radius = std::sqrt(radius_squared);
+
+		// normal cone around the average of the triangle normals
+		std::vector<glm::vec3> normals;
+		normals.reserve(meshlet->index_count / 3);
+		glm::vec3 normal_sum(0.0f);
+		for (auto i = begin; i + 2 < end; i += 3)
+		{
+			const auto& p0 = vertices[indices[i + 0]].pos;
+			const auto& p1 = vertices[indices[i + 1]].pos;
+			const auto& p2 = vertices[indices[i + 2]].pos;
+			auto normal = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(normal);
+			if (length <= util::SMALL_NUMBER)
+			{
+				continue; // degenerate triangles are never rasterized
+			}
+			normals.push_back(normal / length);
+			normal_sum += normals.back();
+		}
+
+		meshlet->cone_axis = glm::vec3(0.0f);
+		meshlet->cone_cutoff = 1.0f;
+		float axis_length = glm::length(normal_sum);
+		if (normals.empty() || axis_length <= util::SMALL_NUMBER)
+		{
+			return;
+		}
+		auto axis = normal_sum / axis_length;
+		float min_dot = 1.0f;
+		for (const auto& normal : normals)
+		{
+			min_dot = std::min(min_dot, glm::dot(normal, axis));
+		}
+		if (min_dot <= 0.1f)
+		{
+			return; // the cone is too wide to ever cull anything
+		}
+		meshlet->cone_axis = axis;
+		meshlet->cone_cutoff = std::sqrt(1.0f - min_dot * min_dot); // sine of the cone's half angle
+	}
+}
+
+std::vector<Meshlet> meshlet::buildMeshlets(const std::vector<util::Vertex>& vertices, const std::vector<index_t>& indices
+	, uint32_t max_vertices, uint32_t max_triangles)
+{
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> vertex_stamps(vertices.size(), 0); // meshlet id + 1 of the last meshlet using the vertex
+
+	Meshlet current;
+	auto closeMeshlet = [&]()
+	{
+		if (current.index_count > 0)
+		{
+			computeMeshletBounds(&current, vertices, indices);
+			meshlets.push_back(current);
+		}
+		Meshlet next;
+		next.first_index = current.first_index + current.index_count;
+		current = next;
+	};
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		auto stamp = static_cast<uint32_t>(meshlets.size() + 1);
+		uint32_t new_vertices = 0;
+		for (size_t c = 0; c < 3; c++)
+		{
+			// count repeated corners of degenerate triangles once
+			bool repeated = (c > 0 && indices[i + c] == indices[i]) || (c > 1 && indices[i + c] == indices[i + 1]);
+			if (vertex_stamps[indices[i + c]] != stamp && !repeated)
+			{
+				new_vertices++;
+			}
+		}
+
+		if (current.vertex_count + new_vertices > max_vertices || current.index_count / 3 >= max_triangles)
+		{
+			closeMeshlet();
+			stamp = static_cast<uint32_t>(meshlets.size() + 1);
+			new_vertices = 0;
+			for (size_t c = 0; c < 3; c++)
+			{
+				bool repeated = (c > 0 && indices[i + c] == indices[i]) || (c > 1 && indices[i + c] == indices[i + 1]);
+				if (!repeated)
+				{
+					new_vertices++;
+				}
+			}
+		}
+
+		for (size_t c = 0; c < 3; c++)
+		{
+			vertex_stamps[indices[i + c]] = stamp;
+		}
+		current.vertex_count += new_vertices;
+		current.index_count += 3;
+	}
+	closeMeshlet();
+
+	return meshlets;
+}
+
+Frustum meshlet::extractFrustum(const glm::mat4& transform)
+{
+	// rows of the matrix; glm is column major
+	glm::vec4 rows[4];
+	for (int r = 0; r < 4; r++)
+	{
+		rows[r] = glm::vec4(transform[0][r], transform[1][r], transform[2][r], transform[3][r]);
+	}
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0]; // left
+	frustum.planes[1] = rows[3] - rows[0]; // right
+	frustum.planes[2] = rows[3] + rows[1]; // bottom (top with flipped Y)
+	frustum.planes[3] = rows[3] - rows[1];
+	frustum.planes[4] = rows[3] + rows[2]; // near, conservative for both [-1, 1] and [0, 1] depth ranges
+	frustum.planes[5] = rows[3] - rows[2]; // far
+
+	for (auto& plane : frustum.planes)
+	{
+		float length = glm::length(glm::vec3(plane));
+		if (length > util::SMALL_NUMBER)
+		{
+			plane /= length;
+		}
+	}
+	return frustum;
+}
+
+bool meshlet::isSphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius)
+{
+	for (const auto& plane : frustum.planes)
+	{
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool meshlet::isMeshletVisible(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& viewer_position)
+{
+	return isSphereInFrustum(frustum, meshlet.center, meshlet.radius) && isMeshletFrontFacing(meshlet, viewer_position);
+}
+
+bool meshlet::isMeshletFrontFacing(const Meshlet& meshlet, const glm::vec3& viewer_position)
+{
+	auto view_offset = meshlet.center - viewer_position;
+	return glm::dot(view_offset, meshlet.cone_axis) < meshlet.cone_cutoff * glm::length(view_offset) + meshlet.radius;
+}
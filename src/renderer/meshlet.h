@@ -0,0 +1,67 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "../util.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+/**
+* A run of consecutive triangles in a mesh part's index buffer, small enough to be culled as a unit.
+* Bounds are in model space. Every field has a fixed size so meshlets can be stored in the mesh cache as is
+*/
+struct Meshlet
+{
+	uint32_t first_index = 0;
+	uint32_t index_count = 0;
+	uint32_t vertex_count = 0; // distinct vertices referenced
+	uint32_t reserved = 0;
+
+	glm::vec3 center = {}; // bounding sphere
+	float radius = 0.0f;
+
+	// every triangle faces away from a viewer at v when dot(center - v, cone_axis) >= cone_cutoff * |center - v| + radius
+	glm::vec3 cone_axis = {};
+	float cone_cutoff = 1.0f; // 1 for meshlets that cannot be backface culled
+};
+
+/**
+* Planes of a view frustum as (normal, distance) with normals pointing inwards
+*/
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+namespace meshlet
+{
+	using index_t = util::Vertex::index_t;
+
+	/**
+	* Splits the index buffer into meshlets in its current triangle order,
+	* so it should run after the vertex cache optimization
+	*/
+	std::vector<Meshlet> buildMeshlets(const std::vector<util::Vertex>& vertices, const std::vector<index_t>& indices
+		, uint32_t max_vertices = MESHLET_MAX_VERTICES, uint32_t max_triangles = MESHLET_MAX_TRIANGLES);
+
+	// Gribb-Hartmann plane extraction, transform is projection * view * model
+	Frustum extractFrustum(const glm::mat4& transform);
+
+	bool isSphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius);
+
+	// backface cone test alone, for meshlets already known to be in the frustum
+	bool isMeshletFrontFacing(const Meshlet& meshlet, const glm::vec3& viewer_position);
+
+	/**
+	* Frustum and backface cone test. viewer_position is in model space,
+	* the cone test assumes the model transform has no non-uniform scale
+	*/
+	bool isMeshletVisible(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& viewer_position);
+}
@@ -5,356 +5,594 @@
 
 #include "vulkan_util.h"
 #include "context.h"
+#include "mesh_loader.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "upload_batch.h"
+#include "texture_cache.h"
 #include "../util.h"
 
-#include <tiny_obj_loader.h>
-
-#include <unordered_map>
 #include <vector>
 #include <string>
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <map>
 
-namespace std {
-	// hash function for Vertex
-	template<> struct hash<util::Vertex>
-	{
-		size_t operator()(util::Vertex const& vertex) const
-		{
-			return vertex.hash();
-		}
-	};
-}
+const uint32_t MAX_MATERIAL_TEXTURES = 4096; // upper bound of the texture array, lowered to the device limits
 
-// uniform buffer object for model transformation
-struct MaterialUbo
+// std430 element of the material buffer, shared by the mesh parts with the same textures
+struct MaterialData
 {
-	int has_albedo_map;
-	int has_normal_map;
+	int albedo_texture;  // into the texture array, -1 for none
+	int normal_texture;
 };
 
-
-struct MeshMaterialGroup // grouped by material
+namespace
 {
-	std::vector<util::Vertex> vertices = {};
-	std::vector<util::Vertex::index_t> vertex_indices = {};
-	
-	std::string albedo_map_path = "";
-	std::string normal_map_path = "";
-};
+	// writes the texture array elements of a material descriptor set for textures[i] picked by write_texture(i)
+	template<typename Predicate>
+	void writeMaterialTextures(const vk::Device& device, const vk::Sampler& texture_sampler, const vk::DescriptorSet& descriptor_set
+		, const std::vector<std::shared_ptr<VTexture>>& textures, Predicate write_texture)
+	{
+		std::vector<vk::DescriptorImageInfo> image_infos;
+		std::vector<uint32_t> array_elements;
+		for (uint32_t i = 0; i < textures.size(); i++)
+		{
+			if (write_texture(i))
+			{
+				image_infos.emplace_back(texture_sampler, textures[i]->view.get(), vk::ImageLayout::eShaderReadOnlyOptimal);
+				array_elements.push_back(i);
+			}
+		}
 
-std::vector<MeshMaterialGroup> loadModel(const std::string& path)
-{
-	using util::Vertex;
+		// image_infos is complete, so the writes can point into it
+		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+		for (size_t i = 0; i < image_infos.size(); i++)
+		{
+			descriptor_writes.emplace_back(
+				descriptor_set,  //dstSet
+				1,  // dstBinding
+				array_elements[i],  // dstArrayElement
+				1,  // descriptorCOunt
+				vk::DescriptorType::eCombinedImageSampler,  // descriptorType
+				&image_infos[i],  // pImageInfo
+				nullptr,  // pBufferInfo
+				nullptr  // pTexelBufferView
+			);
+		}
 
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string err;
+		if (!descriptor_writes.empty())
+		{
+			device.updateDescriptorSets(descriptor_writes, std::array<vk::CopyDescriptorSet, 0>());
+		}
+	}
 
-	std::string folder = util::findFolderName(path) + "/";
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str(), folder.c_str()))
+	// model space length per unit of texture coordinates, from the ratio of the triangle areas in both spaces
+	float computeUvWorldScale(const util::Vertex* vertices, const util::Vertex::index_t* indices, size_t index_count)
 	{
-		throw std::runtime_error(err);  
+		double position_area = 0.0;
+		double uv_area = 0.0;
+		for (size_t i = 0; i + 2 < index_count; i += 3)
+		{
+			const auto& a = vertices[indices[i]];
+			const auto& b = vertices[indices[i + 1]];
+			const auto& c = vertices[indices[i + 2]];
+			position_area += glm::length(glm::cross(b.pos - a.pos, c.pos - a.pos));
+			auto uv_ab = b.tex_coord - a.tex_coord;
+			auto uv_ac = c.tex_coord - a.tex_coord;
+			uv_area += std::abs(uv_ab.x * uv_ac.y - uv_ab.y * uv_ac.x);
+		}
+		return uv_area > 0.0 ? static_cast<float>(std::sqrt(position_area / uv_area)) : 0.0f;
 	}
 
-	bool has_vertex_normal = attrib.normals.size() > 0;
-	assert(has_vertex_normal);
-
-	std::vector<MeshMaterialGroup> groups(materials.size() + 1); // group parts of the same material together, +1 for unknown material
+	const uint32_t MAX_INDEX_CHUNK_SPAN = 1 << 16;  // vertices addressable by 16-bit indices
 
-	for (size_t i = 0; i < materials.size(); i++)
+	/**
+	* Splits the meshlets of a group into runs whose vertices, and positions in the depth stream, each span at most
+	* MAX_INDEX_CHUNK_SPAN indices. Groups with up to that many vertices get a single chunk.
+	* Returns no chunks when a single meshlet spans more, then the group keeps 32-bit indices
+	*/
+	std::vector<VIndexChunk> buildIndexChunks(const MeshGroupView& group, const std::vector<util::Vertex::index_t>& depth_indices)
 	{
-		if (materials[i].diffuse_texname != "")
+		std::vector<VIndexChunk> chunks;
+		uint32_t min_vertex = 0, max_vertex = 0, min_position = 0, max_position = 0;
+		for (size_t m = 0; m < group.meshlet_count; m++)
 		{
-			groups[i + 1].albedo_map_path = folder + materials[i].diffuse_texname;
-		}
-		if (materials[i].normal_texname != "")
-		{
-			groups[i + 1].normal_map_path = folder + materials[i].normal_texname;
+			const auto& meshlet = group.meshlets[m];
+			if (meshlet.index_count == 0)
+			{
+				continue;
+			}
+			auto vertex_range = std::minmax_element(group.vertex_indices + meshlet.first_index, group.vertex_indices + meshlet.first_index + meshlet.index_count);
+			auto position_range = std::minmax_element(depth_indices.begin() + meshlet.first_index, depth_indices.begin() + meshlet.first_index + meshlet.index_count);
+			if (*vertex_range.second - *vertex_range.first >= MAX_INDEX_CHUNK_SPAN || *position_range.second - *position_range.first >= MAX_INDEX_CHUNK_SPAN)
+			{
+				return {};
+			}
+
+			if (!chunks.empty())
+			{
+				auto chunk_min_vertex = std::min(min_vertex, *vertex_range.first);
+				auto chunk_max_vertex = std::max(max_vertex, *vertex_range.second);
+				auto chunk_min_position = std::min(min_position, *position_range.first);
+				auto chunk_max_position = std::max(max_position, *position_range.second);
+				if (chunk_max_vertex - chunk_min_vertex < MAX_INDEX_CHUNK_SPAN && chunk_max_position - chunk_min_position < MAX_INDEX_CHUNK_SPAN)
+				{
+					min_vertex = chunk_min_vertex;
+					max_vertex = chunk_max_vertex;
+					min_position = chunk_min_position;
+					max_position = chunk_max_position;
+					chunks.back().meshlet_count = static_cast<uint32_t>(m + 1) - chunks.back().first_meshlet;
+					chunks.back().first_vertex = min_vertex;
+					chunks.back().first_position = min_position;
+					continue;
+				}
+			}
+
+			min_vertex = *vertex_range.first;
+			max_vertex = *vertex_range.second;
+			min_position = *position_range.first;
+			max_position = *position_range.second;
+			VIndexChunk chunk;
+			chunk.first_meshlet = chunks.empty() ? 0 : chunks.back().first_meshlet + chunks.back().meshlet_count;
+			chunk.meshlet_count = static_cast<uint32_t>(m + 1) - chunk.first_meshlet;
+			chunk.first_vertex = min_vertex;
+			chunk.first_position = min_position;
+			chunks.push_back(chunk);
 		}
-		else if (materials[i].bump_texname != "")
+		if (!chunks.empty())
 		{
-			// CryEngine sponza scene uses keyword "bump" to store normal
-			groups[i + 1].normal_map_path = folder + materials[i].bump_texname;
+			// meshlets without indices at the end
+			chunks.back().meshlet_count = static_cast<uint32_t>(group.meshlet_count) - chunks.back().first_meshlet;
 		}
+		return chunks;
 	}
 
-	std::vector<std::unordered_map <util::Vertex, size_t >> unique_vertices_per_group(materials.size() + 1);
-
-	auto appendVertex = [&unique_vertices_per_group, &groups](const Vertex& vertex, int material_id)
+	// copies indices into 16-bit ones relative to the first vertex or position of their chunk
+	void narrowIndices(const util::Vertex::index_t* indices, const Meshlet* meshlets, const std::vector<VIndexChunk>& chunks
+		, bool depth_stream, uint16_t* narrow_indices)
 	{
-		// 0 for unknown material
-		auto& unique_vertices = unique_vertices_per_group[material_id + 1];
-		auto& group = groups[material_id + 1];
-		if (unique_vertices.count(vertex) == 0)
+		for (const auto& chunk : chunks)
 		{
-			unique_vertices[vertex] = group.vertices.size(); // auto incrementing size
-			group.vertices.push_back(vertex);
+			auto first = depth_stream ? chunk.first_position : chunk.first_vertex;
+			for (uint32_t m = chunk.first_meshlet; m < chunk.first_meshlet + chunk.meshlet_count; m++)
+			{
+				const auto& meshlet = meshlets[m];
+				for (uint32_t i = meshlet.first_index; i < meshlet.first_index + meshlet.index_count; i++)
+				{
+					narrow_indices[i] = static_cast<uint16_t>(indices[i] - first);
+				}
+			}
 		}
-		group.vertex_indices.push_back(static_cast<util::Vertex::index_t>(unique_vertices[vertex]));
-	};
+	}
+
+	const uint32_t MAX_OCCLUDER_PART_TRIANGLES = 4096;
 
-	for (const auto& shape : shapes)
+	/**
+	* Picks the mesh parts with the largest bounds as occluders, each at the finest level of detail of at most
+	* MAX_OCCLUDER_PART_TRIANGLES triangles, until triangle_budget is spent. Only the vertices the level uses are kept
+	*/
+	std::vector<OccluderMesh> selectOccluders(const std::vector<const MeshGroupView*>& groups, const std::vector<VMeshPart>& parts, uint32_t triangle_budget)
 	{
+		std::vector<uint32_t> order(parts.size());
+		std::iota(order.begin(), order.end(), 0);
+		auto surfaceArea = [&parts](uint32_t i)
+		{
+			auto size = parts[i].bounds.max - parts[i].bounds.min;
+			return size.x * size.y + size.y * size.z + size.z * size.x;
+		};
+		std::stable_sort(order.begin(), order.end(), [&surfaceArea](uint32_t a, uint32_t b)
+		{
+			return surfaceArea(a) > surfaceArea(b);
+		});
 
-		size_t indexOffset = 0;
-		for (size_t n = 0; n < shape.mesh.num_face_vertices.size(); n++) 
+		std::vector<OccluderMesh> occluders;
+		for (auto i : order)
 		{
-			// per face
-			auto ngon = shape.mesh.num_face_vertices[n];
-			auto material_id = shape.mesh.material_ids[n];
-			for (size_t f = 0; f < ngon; f++) 
+			const auto& group = *groups[i];
+			const MeshLod* lod = nullptr;
+			for (size_t l = 0; l < group.lod_count && !lod; l++)
 			{
-				const auto& index = shape.mesh.indices[indexOffset + f];
-
-				Vertex vertex;
-
-				vertex.pos = {
-					attrib.vertices[3 * index.vertex_index + 0],
-					attrib.vertices[3 * index.vertex_index + 1],
-					attrib.vertices[3 * index.vertex_index + 2]
-				};
-
-				vertex.tex_coord = {
-					attrib.texcoords[2 * index.texcoord_index + 0],
-					1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-				};
-
-				vertex.normal = {
-					attrib.normals[3 * index.normal_index + 0],
-					attrib.normals[3 * index.normal_index + 1],
-					attrib.normals[3 * index.normal_index + 2]
-				};
-
-				appendVertex(vertex, material_id);
+				if (group.lods[l].index_count / 3 <= MAX_OCCLUDER_PART_TRIANGLES)
+				{
+					lod = &group.lods[l];
+				}
+			}
+			if (!lod || lod->index_count == 0 || lod->index_count / 3 > triangle_budget)
+			{
+				continue;
+			}
+			triangle_budget -= lod->index_count / 3;
 
+			OccluderMesh occluder;
+			occluder.part = i;
+			std::unordered_map<util::Vertex::index_t, uint32_t> remap;
+			for (auto index = lod->first_index; index < lod->first_index + lod->index_count; index++)
+			{
+				auto vertex = group.vertex_indices[index];
+				auto inserted = remap.emplace(vertex, static_cast<uint32_t>(occluder.positions.size()));
+				if (inserted.second)
+				{
+					occluder.positions.push_back(group.vertices[vertex].pos);
+				}
+				occluder.indices.push_back(inserted.first->second);
 			}
-			indexOffset += ngon;
+			occluders.push_back(std::move(occluder));
 		}
+		return occluders;
 	}
 
-	return groups;
+	// sections of the model buffer start at multiples of 4 bytes, as required for 32-bit index buffers
+	vk::DeviceSize alignSectionSize(vk::DeviceSize size)
+	{
+		return (size + 3) / 4 * 4;
+	}
 }
 
+
 /**
 * Load model from file and allocate vulkan resources needed
 */
 VModel VModel::loadModelFromFile(const VContext& vulkan_context, const std::string & path, const vk::Sampler& texture_sampler, const vk::DescriptorPool& descriptor_pool,
-	const vk::DescriptorSetLayout& material_descriptor_set_layout)
+	const vk::DescriptorSetLayout& material_descriptor_set_layout, VTextureCache& texture_cache, const MeshLoadOptions& load_options)
 {
 	VModel model;
+	model.vertex_format = load_options.vertex_format;
+	auto vertex_stride = vertex_format::getVertexStride(model.vertex_format);
 
 	auto device = vulkan_context.getDevice();
 	VUtility vulkan_utility{ vulkan_context };
 
-	//std::vector<util::Vertex> vertices, std::vector<util::Vertex::index_t> vertex_indices;
-	auto groups = loadModel(path);
-	vk::DeviceSize buffer_size = 0;
+	// warm start: vertex and index data are copied straight from the mapped cache file
+	MeshCache mesh_cache;
+	std::vector<MeshMaterialGroup> loaded_groups;
+	std::vector<MeshGroupView> groups;
+	auto loader_flags = getMeshLoaderFlags(load_options);
+	if (mesh_cache.open(path, loader_flags))
+	{
+		groups = mesh_cache.getGroups();
+	}
+	else
+	{
+		loaded_groups = loadModel(path, load_options);
+		if (!MeshCache::write(path, loader_flags, loaded_groups))
+		{
+			std::cerr << "Failed to write mesh cache " << MeshCache::getCachePath(path) << std::endl;
+		}
+		groups.assign(loaded_groups.begin(), loaded_groups.end());
+	}
+
+	// drop empty groups, and derive the position-only streams used by the depth prepass
+	struct DepthStream
+	{
+		std::vector<char> positions;
+		std::vector<util::Vertex::index_t> indices;
+	};
+	std::vector<const MeshGroupView*> uploaded_groups;
+	std::vector<VertexQuantization> quantizations;
+	std::vector<DepthStream> depth_streams;
+	std::vector<std::vector<VIndexChunk>> index_chunks;  // empty for groups with 32-bit indices
+	// every part is packed into the geometry pools, at these vertex offsets and first indices
+	std::vector<size_t> vertex_offsets;
+	std::vector<size_t> position_offsets;
+	std::vector<size_t> first_indices;
+	size_t position_count = 0;
+	size_t vertex_count = 0;
+	size_t narrow_index_count = 0;
+	size_t wide_index_count = 0;
 	for (const auto& group : groups)
 	{
-		if (group.vertex_indices.size() <= 0)
+		if (group.index_count <= 0)
 		{
 			continue;
 		}
-		vk::DeviceSize vertex_section_size = sizeof(group.vertices[0]) * group.vertices.size();
-		vk::DeviceSize index_section_size = sizeof(group.vertex_indices[0]) * group.vertex_indices.size();
-		buffer_size += vertex_section_size;
-		buffer_size += index_section_size;
+		uploaded_groups.push_back(&group);
+		quantizations.push_back(vertex_format::computeQuantization(model.vertex_format, group.vertices, group.vertex_count));
+		depth_streams.emplace_back();
+		vertex_format::buildPositionStream(model.vertex_format, group.vertices, group.vertex_count, group.vertex_indices, group.index_count
+			, quantizations.back(), &depth_streams.back().positions, &depth_streams.back().indices);
+		index_chunks.push_back(buildIndexChunks(group, depth_streams.back().indices));
+
+		vertex_offsets.push_back(vertex_count);
+		position_offsets.push_back(position_count);
+		auto& index_count = index_chunks.back().empty() ? wide_index_count : narrow_index_count;
+		first_indices.push_back(index_count);
+		vertex_count += group.vertex_count;
+		position_count += depth_streams.back().positions.size() / vertex_format::getPositionStride(model.vertex_format);
+		index_count += group.index_count;
+	}
+	if (vertex_count > static_cast<size_t>(std::numeric_limits<int32_t>::max())
+		|| std::max(narrow_index_count, wide_index_count) > std::numeric_limits<uint32_t>::max())
+	{
+		throw std::runtime_error("Model is too large for its geometry pools!");
 	}
+	std::cout << "Depth prepass positions: " << position_count << " (" << vertex_count << " vertices), "
+		<< narrow_index_count << " 16-bit and " << wide_index_count << " 32-bit indices" << std::endl;
 
-	std::tie(model.buffer, model.buffer_memory) = vulkan_utility.createBuffer(buffer_size
+	// pools of the forward pass, then of the depth prepass; both index the same triangles at the same first indices
+	vk::DeviceSize current_offset = 0;
+	auto reserveSection = [&current_offset](vk::DeviceSize section_size)
+	{
+		VBufferSection section = { {}, current_offset, section_size };
+		current_offset += alignSectionSize(section_size);
+		return section;
+	};
+	model.geometry_pool.vertices = reserveSection(vertex_stride * vertex_count);
+	model.geometry_pool.indices_16 = reserveSection(sizeof(uint16_t) * narrow_index_count);
+	model.geometry_pool.indices_32 = reserveSection(sizeof(util::Vertex::index_t) * wide_index_count);
+	model.depth_geometry_pool.vertices = reserveSection(vertex_format::getPositionStride(model.vertex_format) * position_count);
+	model.depth_geometry_pool.indices_16 = reserveSection(sizeof(uint16_t) * narrow_index_count);
+	model.depth_geometry_pool.indices_32 = reserveSection(sizeof(util::Vertex::index_t) * wide_index_count);
+
+	std::tie(model.buffer, model.buffer_memory) = vulkan_utility.createBuffer(std::max<vk::DeviceSize>(current_offset, 4)
 		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
 		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	for (auto pool : { &model.geometry_pool, &model.depth_geometry_pool })
+	{
+		pool->vertices.buffer = model.buffer.get();
+		pool->indices_16.buffer = model.buffer.get();
+		pool->indices_32.buffer = model.buffer.get();
+	}
 
-	vk::DeviceSize current_offset = 0;
-	
-	for (const auto& group : groups)
+	// every copy of the model goes through one batch; textures flush it as they are decoded, the rest is submitted at the end
+	VUploadBatch upload_batch{ vulkan_context };
+
+	// stages element_count elements of element_size bytes at first_element of a pool section; fill writes them into mapped staging memory
+	auto uploadToPool = [&](const VBufferSection& section, size_t element_size, size_t first_element, size_t element_count
+		, const std::function<void(void*)>& fill)
 	{
-		if (group.vertex_indices.size() <= 0)
+		if (element_count > 0)
 		{
-			continue;
+			fill(upload_batch.stageBuffer(section.buffer, section.offset + element_size * first_element, element_size * element_count));
 		}
+	};
 
-		vk::DeviceSize vertex_section_size = sizeof(group.vertices[0]) * group.vertices.size();
-		vk::DeviceSize index_section_size = sizeof(group.vertex_indices[0]) * group.vertex_indices.size();
-
-		VBufferSection vertex_buffer_section = { model.buffer.get(), current_offset, vertex_section_size };
-		// copy vertex data
+	// textures are decoded in parallel once every part is known, parts keep indices into texture_requests until then
+	const size_t NO_TEXTURE = static_cast<size_t>(-1);
+	std::vector<TextureRequest> texture_requests;
+	std::vector<std::pair<size_t, size_t>> part_textures;  // albedo and normal map
+	auto requestTexture = [&texture_requests, NO_TEXTURE](const std::string& texture_path, TextureUsage usage)
+	{
+		if (texture_path.empty())
 		{
-			auto staging_buffer_size = vertex_section_size;
-			auto host_data = group.vertices.data();
-
-			VRaii<VkBuffer> staging_buffer;
-			VRaii<VkDeviceMemory> staging_buffer_memory;
-			std::tie(staging_buffer, staging_buffer_memory) = vulkan_utility.createBuffer(staging_buffer_size
-				, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-				, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-			);
-
-			void* data = device.mapMemory(staging_buffer_memory.get(), 0, staging_buffer_size, vk::MemoryMapFlags());
-			memcpy(data, host_data, static_cast<size_t>(staging_buffer_size)); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-			device.unmapMemory(staging_buffer_memory.get());
-
-			vulkan_utility.copyBuffer(staging_buffer.get(), model.buffer.get(), staging_buffer_size, 0, current_offset);
-
-			current_offset += staging_buffer_size;
+			return NO_TEXTURE;
 		}
+		texture_requests.emplace_back(texture_path, usage);
+		return texture_requests.size() - 1;
+	};
 
-		VBufferSection index_buffer_section = { model.buffer.get(), current_offset, index_section_size };
-		// copy index data
+	for (size_t i = 0; i < uploaded_groups.size(); i++)
+	{
+		const auto& group = *uploaded_groups[i];
+		const auto& quantization = quantizations[i];
+		const auto& depth_stream = depth_streams[i];
+		const auto& chunks = index_chunks[i];
+		auto index_size = chunks.empty() ? sizeof(util::Vertex::index_t) : sizeof(uint16_t);
+		auto position_stride = vertex_format::getPositionStride(model.vertex_format);
+
+		uploadToPool(model.geometry_pool.vertices, vertex_stride, vertex_offsets[i], group.vertex_count, [&](void* data)
 		{
-			auto staging_buffer_size = index_section_size;
-			auto host_data = group.vertex_indices.data();
-
-			VRaii<VkBuffer> staging_buffer;
-			VRaii<VkDeviceMemory> staging_buffer_memory;
-			std::tie(staging_buffer, staging_buffer_memory) = vulkan_utility.createBuffer(staging_buffer_size
-				, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-				, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-			);
-
-			void* data = device.mapMemory(staging_buffer_memory.get(), 0, staging_buffer_size, vk::MemoryMapFlags());
-			memcpy(data, host_data, static_cast<size_t>(staging_buffer_size)); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-			device.unmapMemory(staging_buffer_memory.get());
-
-			vulkan_utility.copyBuffer(staging_buffer.get(), model.buffer.get(), staging_buffer_size, 0, current_offset);
-
-			current_offset += staging_buffer_size;
+			vertex_format::encodeVertices(model.vertex_format, group.vertices, group.vertex_count, quantization, data);
+		});
+		uploadToPool(model.depth_geometry_pool.vertices, position_stride, position_offsets[i], depth_stream.positions.size() / position_stride, [&](void* data)
+		{
+			memcpy(data, depth_stream.positions.data(), depth_stream.positions.size());
+		});
+		auto index_type = chunks.empty() ? vk::IndexType::eUint32 : vk::IndexType::eUint16;
+		uploadToPool(model.geometry_pool.getIndices(index_type), index_size, first_indices[i], group.index_count, [&](void* data)
+		{
+			if (chunks.empty())
+			{
+				memcpy(data, group.vertex_indices, index_size * group.index_count);
+			}
+			else
+			{
+				narrowIndices(group.vertex_indices, group.meshlets, chunks, false, static_cast<uint16_t*>(data));
+			}
+		});
+		uploadToPool(model.depth_geometry_pool.getIndices(index_type), index_size, first_indices[i], depth_stream.indices.size(), [&](void* data)
+		{
+			if (chunks.empty())
+			{
+				memcpy(data, depth_stream.indices.data(), index_size * depth_stream.indices.size());
+			}
+			else
+			{
+				narrowIndices(depth_stream.indices.data(), group.meshlets, chunks, true, static_cast<uint16_t*>(data));
+			}
+		});
+
+		// statistics of the full detail level
+		const auto& full_lod = group.lods[0];
+		auto statistics = mesh_optimizer::analyzeVertexCache(group.vertex_indices + full_lod.first_index, full_lod.index_count, group.vertex_count);
+		auto depth_statistics = mesh_optimizer::analyzeVertexCache(depth_stream.indices.data() + full_lod.first_index, full_lod.index_count
+			, depth_stream.positions.size() / vertex_format::getPositionStride(model.vertex_format));
+		std::cout << "Mesh part " << model.mesh_parts.size() << ": " << statistics.triangle_count << " triangles, "
+			<< "ACMR " << statistics.acmr << ", ATVR " << statistics.atvr
+			<< ", depth prepass ACMR " << depth_statistics.acmr << ", ATVR " << depth_statistics.atvr
+			<< ", " << group.meshlet_count << " meshlets in " << std::max<size_t>(chunks.size(), 1) << " index chunks, LOD triangles:";
+		for (size_t l = 0; l < group.lod_count; l++)
+		{
+			std::cout << " " << group.lods[l].index_count / 3;
+		}
+		std::cout << std::endl;
+
+		VMeshPart part;
+		part.index_count = full_lod.index_count;
+		part.index_type = index_type;
+		part.first_index = static_cast<uint32_t>(first_indices[i]);
+		part.vertex_offset = static_cast<int32_t>(vertex_offsets[i]);
+		part.position_offset = static_cast<int32_t>(position_offsets[i]);
+		part.position_quantization = quantization;
+		part.meshlets.assign(group.meshlets, group.meshlets + group.meshlet_count);
+		part.lods.assign(group.lods, group.lods + group.lod_count);
+		if (chunks.empty())
+		{
+			VIndexChunk chunk;
+			chunk.meshlet_count = static_cast<uint32_t>(group.meshlet_count);
+			part.index_chunks.push_back(chunk);
+		}
+		else
+		{
+			part.index_chunks = chunks;
 		}
 
-		VMeshPart part = { vertex_buffer_section, index_buffer_section, group.vertex_indices.size() };
-
-		if (!group.albedo_map_path.empty())
+		for (size_t v = 0; v < group.vertex_count; v++)
 		{
-			model.images.emplace_back();
-			model.image_memories.emplace_back();
-			model.imageviews.emplace_back();
-			std::tie(model.images.back(), model.image_memories.back(), model.imageviews.back()) = vulkan_utility.loadImageFromFile(group.albedo_map_path);
-			part.albedo_map = model.imageviews.back().get();
+			part.bounds.expand(group.vertices[v].pos);
 		}
-		if (!group.normal_map_path.empty())
+		part.bounds_center = part.bounds.getCenter();
+		part.bounds_radius = glm::length(part.bounds.max - part.bounds.min) * 0.5f;
+		for (const auto& meshlet : part.meshlets)
 		{
-			model.images.emplace_back();
-			model.image_memories.emplace_back();
-			model.imageviews.emplace_back();
-			std::tie(model.images.back(), model.image_memories.back(), model.imageviews.back()) = vulkan_utility.loadImageFromFile(group.normal_map_path);
-			part.normal_map = model.imageviews.back().get();
+			BoundingBox meshlet_bounds;
+			for (auto index = meshlet.first_index; index < meshlet.first_index + meshlet.index_count; index++)
+			{
+				meshlet_bounds.expand(group.vertices[group.vertex_indices[index]].pos);
+			}
+			part.meshlet_bounds.push_back(meshlet_bounds);
 		}
+		part.uv_world_scale = computeUvWorldScale(group.vertices, group.vertex_indices + full_lod.first_index, full_lod.index_count);
+
+		part_textures.emplace_back(requestTexture(group.albedo_map_path, TextureUsage::albedo)
+			, requestTexture(group.normal_map_path, TextureUsage::normal_map));
 
 		model.mesh_parts.push_back(part);
 	}
 
-	auto createMaterialDescriptorSet = [&vulkan_utility, &device, &texture_sampler, &descriptor_pool, &material_descriptor_set_layout, &uniform_buffer_memory = model.uniform_buffer_memory.get()](
-		VMeshPart& mesh_part
-		, VBufferSection uniform_buffer_section
-	)
+	std::vector<BoundingBox> part_bounds;
+	for (const auto& part : model.mesh_parts)
 	{
-		VkDescriptorSetLayout layouts[] = { material_descriptor_set_layout };
-		VkDescriptorSetAllocateInfo alloc_info = {};
-		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		alloc_info.descriptorPool = descriptor_pool;
-		alloc_info.descriptorSetCount = 1; 
-		alloc_info.pSetLayouts = layouts;
-
-		auto descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
-		MaterialUbo ubo{0, 0};
-
-		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+		part_bounds.push_back(part.bounds);
+	}
+	model.part_hierarchy = BoundingVolumeHierarchy(part_bounds);
+	if (load_options.occluder_triangle_budget > 0)
+	{
+		model.occluders = selectOccluders(uploaded_groups, model.mesh_parts, load_options.occluder_triangle_budget);
+		std::cout << "Software occlusion: " << model.occluders.size() << " of " << model.mesh_parts.size() << " mesh parts as occluders" << std::endl;
+	}
 
-		// refer to the uniform object buffer
-		vk::DescriptorBufferInfo uniform_buffer_info = {};
+	// each file is decoded once, and shared with the other parts and models using it;
+	// requests of the same file return the same texture, which the model keeps once
+	auto requested_textures = texture_cache.acquire(vulkan_context, upload_batch, texture_requests, load_options.thread_count);
+	std::vector<int> texture_indices(requested_textures.size());  // into model.textures, by request
+	{
+		std::unordered_map<const VTexture*, int> unique_indices;
+		for (size_t i = 0; i < requested_textures.size(); i++)
 		{
-			uniform_buffer_info.buffer = uniform_buffer_section.buffer;
-			uniform_buffer_info.offset = uniform_buffer_section.offset;
-			uniform_buffer_info.range = uniform_buffer_section.size;
-			// ubo
-			descriptor_writes.emplace_back(
-				descriptor_set,  //dstSet
-				0,  // dstBinding
-				0,  // dstArrayElement
-				1,  // descriptorCOunt
-				vk::DescriptorType::eUniformBuffer,  // descriptorType
-				nullptr,  // pImageInfo
-				&uniform_buffer_info,  // pBufferInfo
-				nullptr  // pTexelBufferView
-			);
+			auto inserted = unique_indices.emplace(requested_textures[i].get(), static_cast<int>(model.textures.size()));
+			if (inserted.second)
+			{
+				model.textures.push_back(requested_textures[i]);
+			}
+			texture_indices[i] = inserted.first->second;
 		}
-
-		vk::DescriptorImageInfo albedo_map_info = {};
-		if (mesh_part.albedo_map)
+	}
+	for (size_t i = 0; i < model.mesh_parts.size(); i++)
+	{
+		if (part_textures[i].first != NO_TEXTURE)
 		{
-			ubo.has_albedo_map = 1;
-			albedo_map_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-			albedo_map_info.imageView = mesh_part.albedo_map;
-			albedo_map_info.sampler = texture_sampler;
-
-			descriptor_writes.emplace_back(
-				descriptor_set,  //dstSet
-				1,  // dstBinding
-				0,  // dstArrayElement
-				1,  // descriptorCOunt
-				vk::DescriptorType::eCombinedImageSampler,  // descriptorType
-				&albedo_map_info,  // pImageInfo
-				nullptr,  // pBufferInfo
-				nullptr  // pTexelBufferView
-			);
+			model.mesh_parts[i].albedo_texture = requested_textures[part_textures[i].first].get();
 		}
-
-		vk::DescriptorImageInfo normalmap_info = {};
-		if (mesh_part.normal_map)
+		if (part_textures[i].second != NO_TEXTURE)
 		{
-			ubo.has_normal_map = 1;
-			normalmap_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-			normalmap_info.imageView = mesh_part.normal_map;
-			normalmap_info.sampler = texture_sampler;
-
-			descriptor_writes.emplace_back(
-				descriptor_set,  //dstSet
-				2,  // dstBinding
-				0,  // dstArrayElement
-				1,  // descriptorCOunt
-				vk::DescriptorType::eCombinedImageSampler,  // descriptorType
-				&normalmap_info,  // pImageInfo
-				nullptr,  // pBufferInfo
-				nullptr  // pTexelBufferView
-			);
+			model.mesh_parts[i].normal_texture = requested_textures[part_textures[i].second].get();
 		}
+	}
 
-		device.updateDescriptorSets(descriptor_writes, std::array<vk::CopyDescriptorSet, 0>());
-
-		mesh_part.material_descriptor_set = descriptor_set;
+	auto max_texture_count = getMaxTextureCount(vulkan_context.getPhysicalDeviceProperties().limits);
+	if (model.textures.size() > max_texture_count)
+	{
+		throw std::runtime_error("model has more textures than a material descriptor set can hold");
+	}
 
-		vk::DeviceSize staging_buffer_size = uniform_buffer_section.size;
-		VRaii<VkBuffer> staging_buffer;
-		VRaii<VkDeviceMemory> staging_buffer_memory;
-		std::tie(staging_buffer, staging_buffer_memory) = vulkan_utility.createBuffer(staging_buffer_size
-			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		);
+	// parts with the same textures share a material, so that draws can be grouped by it; every part requests
+	// its own textures, so materials are told apart by the textures the requests resolved to
+	std::vector<MaterialData> materials;
+	std::map<std::pair<int, int>, uint32_t> material_indices;
+	for (size_t i = 0; i < model.mesh_parts.size(); i++)
+	{
+		MaterialData material;
+		material.albedo_texture = part_textures[i].first != NO_TEXTURE ? texture_indices[part_textures[i].first] : -1;
+		material.normal_texture = part_textures[i].second != NO_TEXTURE ? texture_indices[part_textures[i].second] : -1;
+		auto inserted = material_indices.emplace(std::make_pair(material.albedo_texture, material.normal_texture), static_cast<uint32_t>(materials.size()));
+		if (inserted.second)
+		{
+			materials.push_back(material);
+		}
+		model.mesh_parts[i].material_index = inserted.first->second;
+	}
 
-		void* data = device.mapMemory(staging_buffer_memory.get(), 0, staging_buffer_size, vk::MemoryMapFlags());
-		memcpy(data, &ubo, static_cast<size_t>(staging_buffer_size)); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-		device.unmapMemory(staging_buffer_memory.get());
+	vk::DeviceSize material_buffer_size = sizeof(MaterialData) * std::max<size_t>(materials.size(), 1);
+	std::tie(model.material_buffer, model.material_buffer_memory) = vulkan_utility.createBuffer(material_buffer_size
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (!materials.empty())
+	{
+		upload_batch.uploadBuffer(model.material_buffer.get(), 0, materials.data(), sizeof(MaterialData) * materials.size());
+	}
 
-		vulkan_utility.copyBuffer(staging_buffer.get(), uniform_buffer_info.buffer, staging_buffer_size, 0, uniform_buffer_info.offset);
+	// the texture array is sized to the textures of the model, below the upper bound of the layout
+	{
+		auto texture_count = static_cast<uint32_t>(model.textures.size());
+		VkDescriptorSetVariableDescriptorCountAllocateInfoEXT variable_count_info = {};
+		variable_count_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+		variable_count_info.descriptorSetCount = 1;
+		variable_count_info.pDescriptorCounts = &texture_count;
 
-	};
+		VkDescriptorSetLayout layouts[] = { material_descriptor_set_layout };
+		VkDescriptorSetAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		alloc_info.pNext = &variable_count_info;
+		alloc_info.descriptorPool = descriptor_pool;
+		alloc_info.descriptorSetCount = 1;
+		alloc_info.pSetLayouts = layouts;
+		model.material_descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+
+		vk::DescriptorBufferInfo material_buffer_info = { model.material_buffer.get(), 0, material_buffer_size };
+		std::array<vk::WriteDescriptorSet, 1> descriptor_writes = {};
+		descriptor_writes[0] = {
+			model.material_descriptor_set,  //dstSet
+			0,  // dstBinding
+			0,  // dstArrayElement
+			1,  // descriptorCOunt
+			vk::DescriptorType::eStorageBuffer,  // descriptorType
+			nullptr,  // pImageInfo
+			&material_buffer_info,  // pBufferInfo
+			nullptr  // pTexelBufferView
+		};
+		device.updateDescriptorSets(descriptor_writes, std::array<vk::CopyDescriptorSet, 0>());
 
+		writeMaterialTextures(device, texture_sampler, model.material_descriptor_set, model.textures, [](uint32_t) { return true; });
+	}
 
-	auto min_alignment = vulkan_context.getPhysicalDeviceProperties().limits.minUniformBufferOffsetAlignment;
-	vk::DeviceSize alignment_offset = ((sizeof(MaterialUbo) - 1) / min_alignment + 1) * min_alignment;
+	auto staged_size = upload_batch.getStagedSize();
+	auto upload_start_time = std::chrono::high_resolution_clock::now();
+	upload_batch.submit();
+	std::cout << "Uploaded " << staged_size / (1024 * 1024) << " MB of model data, final submission "
+		<< std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - upload_start_time).count() << " ms" << std::endl;
 
-	vk::DeviceSize uniform_buffer_size = alignment_offset * model.mesh_parts.size();
-	std::tie(model.uniform_buffer, model.uniform_buffer_memory) = vulkan_utility.createBuffer(uniform_buffer_size
-		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	return model;
+}
 
-	vk::DeviceSize uniform_buffer_total_offset = 0;
-	for (auto& part : model.mesh_parts)
+void VModel::updateMaterialDescriptorSet(const vk::Device& device, const vk::Sampler& texture_sampler, const std::vector<const VTexture*>& changed_textures)
+{
+	writeMaterialTextures(device, texture_sampler, material_descriptor_set, textures, [this, &changed_textures](uint32_t i)
 	{
-		createMaterialDescriptorSet(part, VBufferSection(model.uniform_buffer.get(), uniform_buffer_total_offset, sizeof(MaterialUbo)));
-		uniform_buffer_total_offset += alignment_offset;
-	}
-
-	return model;
+		return std::find(changed_textures.begin(), changed_textures.end(), textures[i].get()) != changed_textures.end();
+	});
 }
 
+uint32_t VModel::getMaxTextureCount(const vk::PhysicalDeviceLimits& limits)
+{
+	// the fragment stage also samples the depth prepass
+	auto stage_limit = std::min(limits.maxPerStageDescriptorSamplers, limits.maxPerStageDescriptorSampledImages);
+	return std::min(MAX_MATERIAL_TEXTURES, std::max<uint32_t>(stage_limit, 2) - 1);
+}
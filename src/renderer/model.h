@@ -4,12 +4,18 @@
 #pragma once
 
 #include "raii.h"
+#include "bounding_volume.h"
+#include "software_occlusion.h"
+#include "mesh_loader.h"
+#include "texture_loader.h"
 
 #include <vulkan/vulkan.hpp>
 
 #include <vector>
+#include <memory>
 
 class VContext;
+class VTextureCache;
 
 /**
 * A structure that points to a part of a buffer
@@ -29,28 +35,57 @@ struct VBufferSection
 	{}
 };
 
-struct VMeshPart
+/**
+* Vertices and indices of every mesh part of a model, packed so that a pass binds them once
+* and addresses each part with the vertexOffset and firstIndex of its draws.
+* 16-bit and 32-bit indices are kept in separate sections, bound with their own index type
+*/
+struct VGeometryPool
 {
-	// todo: separate mesh part with material?
-	// (material as another global storage??)
-	VBufferSection vertex_buffer_section = {};
-	VBufferSection index_buffer_section = {};
-	VBufferSection material_uniform_buffer_section = {};
-	size_t index_count = 0;
-	vk::DescriptorSet material_descriptor_set = {};  // TODO: I still need a per-instance descriptor set
-
-
-	// handles for images (no ownership or so)
-	vk::ImageView albedo_map = {};
-	vk::ImageView normal_map = {};
+	VBufferSection vertices = {};
+	VBufferSection indices_16 = {};
+	VBufferSection indices_32 = {};
 
+	const VBufferSection& getIndices(vk::IndexType index_type) const
+	{
+		return index_type == vk::IndexType::eUint16 ? indices_16 : indices_32;
+	}
+};
 
+/**
+* A run of a mesh part's meshlets drawn with vertexOffset at first_vertex and first_position,
+* so that 16-bit indices relative to them reach every vertex the run uses
+*/
+struct VIndexChunk
+{
+	uint32_t first_meshlet = 0;
+	uint32_t meshlet_count = 0;
+	uint32_t first_vertex = 0;  // relative to the part's vertex_offset
+	uint32_t first_position = 0;  // relative to the part's position_offset
+};
 
-	VMeshPart(const VBufferSection& vertex_buffer_section, const VBufferSection& index_buffer_section, size_t index_count)
-		: vertex_buffer_section(vertex_buffer_section)
-		, index_buffer_section(index_buffer_section)
-		, index_count(index_count)
-	{}
+struct VMeshPart
+{
+	uint32_t material_index = 0;  // into the model's material buffer, shared by parts with the same textures
+	size_t index_count = 0;  // of the full detail level
+	vk::IndexType index_type = vk::IndexType::eUint32;  // picks the index sections of the geometry pools
+	uint32_t first_index = 0;  // of the part in the index sections of index_type, the same in both pools
+	int32_t vertex_offset = 0;  // of the part's first vertex in the geometry pool
+	int32_t position_offset = 0;  // of the part's first position in the depth geometry pool
+	std::vector<VIndexChunk> index_chunks = {};  // partition of meshlets; a single chunk at vertex 0 with 32-bit indices
+	VertexQuantization position_quantization = {};  // pushed to the vertex shader for the compact vertex formats
+	std::vector<Meshlet> meshlets = {};  // index ranges relative to first_index, culled each frame
+	std::vector<MeshLod> lods = {};  // ranges of meshlets, one is picked each frame by screen-space error
+	std::vector<BoundingBox> meshlet_bounds = {};  // model space, one per meshlet
+	BoundingBox bounds = {};  // model space, of all levels
+	glm::vec3 bounds_center = {};  // model space bounding sphere of all levels
+	float bounds_radius = 0.0f;
+	float uv_world_scale = 0.0f;  // average model space length covered by one unit of texture coordinates, 0 if unknown
+
+
+	// owned by the model's shared textures, whose views change when they are streamed
+	const VTexture* albedo_texture = nullptr;
+	const VTexture* normal_texture = nullptr;
 };
 
 /**
@@ -70,23 +105,76 @@ public:
 		return mesh_parts;
 	}
 
+	VertexFormat getVertexFormat() const
+	{
+		return vertex_format;
+	}
+
+	// vertices and indices of the forward pass
+	const VGeometryPool& getGeometryPool() const
+	{
+		return geometry_pool;
+	}
+
+	// positions only, for the depth prepass; same triangles as the geometry pool
+	const VGeometryPool& getDepthGeometryPool() const
+	{
+		return depth_geometry_pool;
+	}
+
+	// over the bounds of the mesh parts, in model space
+	const BoundingVolumeHierarchy& getPartHierarchy() const
+	{
+		return part_hierarchy;
+	}
+
+	// model space triangles of the largest mesh parts, within MeshLoadOptions::occluder_triangle_budget
+	const std::vector<OccluderMesh>& getOccluders() const
+	{
+		return occluders;
+	}
+
+	const std::vector<std::shared_ptr<VTexture>>& getTextures() const
+	{
+		return textures;
+	}
+
+	/**
+	* Materials of every mesh part and every texture of the model, bound once for all draws:
+	* binding 0 holds the materials indexed by VMeshPart::material_index, binding 1 the textures they index
+	*/
+	vk::DescriptorSet getMaterialDescriptorSet() const
+	{
+		return material_descriptor_set;
+	}
+
+	// rewrites the texture array elements of changed_textures, after their views were replaced
+	void updateMaterialDescriptorSet(const vk::Device& device, const vk::Sampler& texture_sampler, const std::vector<const VTexture*>& changed_textures);
+
+	// size of the texture array of material descriptor sets, within what the fragment stage can sample next to the depth sampler
+	static uint32_t getMaxTextureCount(const vk::PhysicalDeviceLimits& limits);
+
 	static VModel loadModelFromFile(const VContext& vulkan_context, const std::string& path
 		, const vk::Sampler& texture_sampler, const vk::DescriptorPool& descriptor_pool,
-		const vk::DescriptorSetLayout& material_descriptor_set_layout);
+		const vk::DescriptorSetLayout& material_descriptor_set_layout, VTextureCache& texture_cache, const MeshLoadOptions& load_options = {});
 
 	VModel(const VModel&) = delete;
 	VModel& operator= (const VModel&) = delete;
 
 private:
 	VRaii<VkBuffer> buffer;
-	VRaii<VkDeviceMemory> buffer_memory;
-	std::vector<VRaii<VkImage>> images;
-	std::vector<VRaii<VkImageView>> imageviews;
-	std::vector<VRaii<VkDeviceMemory>> image_memories; //TODO: use a single memory, or two
-	VRaii<VkBuffer> uniform_buffer;
-	VRaii<VkDeviceMemory> uniform_buffer_memory;
+	VMemoryAllocation buffer_memory;
+	VGeometryPool geometry_pool;  // sections of buffer
+	VGeometryPool depth_geometry_pool;
+	std::vector<std::shared_ptr<VTexture>> textures;  // each once, shared with other models through VTextureCache
+	VRaii<VkBuffer> material_buffer;
+	VMemoryAllocation material_buffer_memory;
+	vk::DescriptorSet material_descriptor_set;  // freed with the descriptor pool
 
 	std::vector<VMeshPart> mesh_parts;
+	BoundingVolumeHierarchy part_hierarchy;
+	std::vector<OccluderMesh> occluders;
+	VertexFormat vertex_format = VertexFormat::full;
 
 };
 
@@ -0,0 +1,360 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "software_occlusion.h"
+
+#include "../thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX2__)
+#define VFPR_OCCLUSION_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VFPR_OCCLUSION_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const uint32_t FULL_TILE_MASK = 0xffffffffu;
+	const uint32_t BANDS_PER_THREAD = 2;
+
+	/**
+	* Edge function a * x + b * y + c, positive on the inner side of the edge
+	*/
+	struct Edge
+	{
+		float a;
+		float b;
+		float c;
+	};
+
+	Edge makeEdge(const glm::vec3& from, const glm::vec3& to)
+	{
+		return { from.y - to.y, to.x - from.x, from.x * to.y - from.y * to.x };
+	}
+
+	/**
+	* Coverage mask of a tile whose first pixel center is at (x, y): the pixels strictly inside all three edges,
+	* so that pixels on a shared edge are left uncovered rather than covered by a gap
+	*/
+	uint32_t computeCoverage(const Edge edges[3], float x, float y)
+	{
+		uint32_t mask = 0;
+#if defined(VFPR_OCCLUSION_AVX2)
+		const __m256 lane_x = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+		__m256 values[3];
+		__m256 row_steps[3];
+		for (int i = 0; i < 3; i++)
+		{
+			values[i] = _mm256_add_ps(_mm256_set1_ps(edges[i].a * x + edges[i].b * y + edges[i].c), _mm256_mul_ps(_mm256_set1_ps(edges[i].a), lane_x));
+			row_steps[i] = _mm256_set1_ps(edges[i].b);
+		}
+		const __m256 zero = _mm256_setzero_ps();
+		for (uint32_t row = 0; row < SoftwareOcclusionBuffer::TILE_HEIGHT; row++)
+		{
+			__m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(values[0], zero, _CMP_GT_OQ), _mm256_cmp_ps(values[1], zero, _CMP_GT_OQ))
+				, _mm256_cmp_ps(values[2], zero, _CMP_GT_OQ));
+			mask |= static_cast<uint32_t>(_mm256_movemask_ps(inside)) << (row * SoftwareOcclusionBuffer::TILE_WIDTH);
+			for (int i = 0; i < 3; i++)
+			{
+				values[i] = _mm256_add_ps(values[i], row_steps[i]);
+			}
+		}
+#elif defined(VFPR_OCCLUSION_SSE2)
+		// two halves of four pixels per row
+		const __m128 lane_x = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+		__m128 values[2][3];
+		__m128 row_steps[3];
+		for (int i = 0; i < 3; i++)
+		{
+			__m128 a = _mm_set1_ps(edges[i].a);
+			values[0][i] = _mm_add_ps(_mm_set1_ps(edges[i].a * x + edges[i].b * y + edges[i].c), _mm_mul_ps(a, lane_x));
+			values[1][i] = _mm_add_ps(values[0][i], _mm_mul_ps(a, _mm_set1_ps(4.0f)));
+			row_steps[i] = _mm_set1_ps(edges[i].b);
+		}
+		const __m128 zero = _mm_setzero_ps();
+		for (uint32_t row = 0; row < SoftwareOcclusionBuffer::TILE_HEIGHT; row++)
+		{
+			for (uint32_t half = 0; half < 2; half++)
+			{
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(values[half][0], zero), _mm_cmpgt_ps(values[half][1], zero))
+					, _mm_cmpgt_ps(values[half][2], zero));
+				mask |= static_cast<uint32_t>(_mm_movemask_ps(inside)) << (row * SoftwareOcclusionBuffer::TILE_WIDTH + half * 4);
+				for (int i = 0; i < 3; i++)
+				{
+					values[half][i] = _mm_add_ps(values[half][i], row_steps[i]);
+				}
+			}
+		}
+#else
+		for (uint32_t row = 0; row < SoftwareOcclusionBuffer::TILE_HEIGHT; row++)
+		{
+			for (uint32_t column = 0; column < SoftwareOcclusionBuffer::TILE_WIDTH; column++)
+			{
+				bool inside = true;
+				for (int i = 0; i < 3; i++)
+				{
+					inside = inside && edges[i].a * (x + column) + edges[i].b * (y + row) + edges[i].c > 0.0f;
+				}
+				mask |= inside ? 1u << (row * SoftwareOcclusionBuffer::TILE_WIDTH + column) : 0u;
+			}
+		}
+#endif
+		return mask;
+	}
+
+	/**
+	* Appends the part of a clip space polygon edge on the near side of z = 0 that is kept, Sutherland-Hodgman style
+	*/
+	void clipNearEdge(const glm::vec4& from, const glm::vec4& to, std::vector<glm::vec4>* output)
+	{
+		if (from.z >= 0.0f)
+		{
+			output->push_back(from);
+		}
+		if ((from.z >= 0.0f) != (to.z >= 0.0f))
+		{
+			float t = from.z / (from.z - to.z);
+			auto point = from + (to - from) * t;
+			point.z = 0.0f;
+			output->push_back(point);
+		}
+	}
+}
+
+SoftwareOcclusionBuffer::SoftwareOcclusionBuffer(uint32_t width, uint32_t height)
+	: tile_columns((width + TILE_WIDTH - 1) / TILE_WIDTH)
+	, tile_rows((height + TILE_HEIGHT - 1) / TILE_HEIGHT)
+{
+	far_depths.resize(tile_columns * tile_rows);
+	working_depths.resize(far_depths.size());
+	working_masks.resize(far_depths.size());
+	clear();
+}
+
+void SoftwareOcclusionBuffer::clear()
+{
+	std::fill(far_depths.begin(), far_depths.end(), 1.0f);
+	std::fill(working_depths.begin(), working_depths.end(), 0.0f);
+	std::fill(working_masks.begin(), working_masks.end(), 0u);
+}
+
+void SoftwareOcclusionBuffer::render(const std::vector<OccluderMesh>& occluders, const glm::mat4& projview, util::ThreadPool* thread_pool)
+{
+	clear();
+
+	clip_positions.resize(occluders.size());
+	auto transform = [&](size_t i)
+	{
+		const auto& positions = occluders[i].positions;
+		clip_positions[i].resize(positions.size());
+		for (size_t v = 0; v < positions.size(); v++)
+		{
+			clip_positions[i][v] = projview * glm::vec4(positions[v], 1.0f);
+		}
+	};
+	auto rasterize_band = [&](uint32_t band, uint32_t band_count)
+	{
+		uint32_t first_row = tile_rows * band / band_count;
+		uint32_t end_row = tile_rows * (band + 1) / band_count;
+		for (size_t i = 0; i < occluders.size(); i++)
+		{
+			rasterize(clip_positions[i], occluders[i].indices, first_row, end_row);
+		}
+	};
+
+	if (!thread_pool)
+	{
+		for (size_t i = 0; i < occluders.size(); i++)
+		{
+			transform(i);
+		}
+		rasterize_band(0, 1);
+		return;
+	}
+	thread_pool->parallelFor(occluders.size(), transform);
+	auto band_count = std::max(1u, std::min(tile_rows, thread_pool->getThreadCount() * BANDS_PER_THREAD));
+	thread_pool->parallelFor(band_count, [&](size_t band)
+	{
+		rasterize_band(static_cast<uint32_t>(band), band_count);
+	});
+}
+
+void SoftwareOcclusionBuffer::rasterize(const std::vector<glm::vec4>& positions, const std::vector<uint32_t>& indices, uint32_t first_tile_row, uint32_t end_tile_row)
+{
+	glm::vec2 viewport_size(getWidth(), getHeight());
+	auto toScreen = [&viewport_size](const glm::vec4& clip)
+	{
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		return glm::vec3((glm::vec2(ndc) * 0.5f + 0.5f) * viewport_size, ndc.z);
+	};
+
+	std::vector<glm::vec4> polygon;
+	polygon.reserve(4);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const auto& c0 = positions[indices[i]];
+		const auto& c1 = positions[indices[i + 1]];
+		const auto& c2 = positions[indices[i + 2]];
+		if (c0.z >= 0.0f && c1.z >= 0.0f && c2.z >= 0.0f)
+		{
+			rasterizeTriangle(toScreen(c0), toScreen(c1), toScreen(c2), first_tile_row, end_tile_row);
+			continue;
+		}
+
+		// a triangle crossing the near plane becomes one or two
+		polygon.clear();
+		clipNearEdge(c0, c1, &polygon);
+		clipNearEdge(c1, c2, &polygon);
+		clipNearEdge(c2, c0, &polygon);
+		for (size_t v = 2; v < polygon.size(); v++)
+		{
+			rasterizeTriangle(toScreen(polygon[0]), toScreen(polygon[v - 1]), toScreen(polygon[v]), first_tile_row, end_tile_row);
+		}
+	}
+}
+
+void SoftwareOcclusionBuffer::rasterizeTriangle(const glm::vec3& v0, const glm::vec3& v1_in, const glm::vec3& v2_in, uint32_t first_tile_row, uint32_t end_tile_row)
+{
+	// counterclockwise in screen space, so that the inside of every edge is positive; both facings occlude
+	float area = (v1_in.x - v0.x) * (v2_in.y - v0.y) - (v1_in.y - v0.y) * (v2_in.x - v0.x);
+	if (!(std::abs(area) > 1e-6f))
+	{
+		return;
+	}
+	const auto& v1 = area > 0.0f ? v1_in : v2_in;
+	const auto& v2 = area > 0.0f ? v2_in : v1_in;
+	area = std::abs(area);
+
+	auto min_x = std::max(0.0f, std::min({ v0.x, v1.x, v2.x }));
+	auto max_x = std::min(float(getWidth()), std::max({ v0.x, v1.x, v2.x }));
+	auto min_y = std::max(float(first_tile_row * TILE_HEIGHT), std::min({ v0.y, v1.y, v2.y }));
+	auto max_y = std::min(float(end_tile_row * TILE_HEIGHT), std::max({ v0.y, v1.y, v2.y }));
+	if (min_x >= max_x || min_y >= max_y)
+	{
+		return;
+	}
+	auto first_column = static_cast<uint32_t>(min_x) / TILE_WIDTH;
+	auto end_column = std::min(tile_columns, static_cast<uint32_t>(std::ceil(max_x) + TILE_WIDTH - 1) / TILE_WIDTH);
+	auto first_row = static_cast<uint32_t>(min_y) / TILE_HEIGHT;
+	auto end_row = std::min(end_tile_row, static_cast<uint32_t>(std::ceil(max_y) + TILE_HEIGHT - 1) / TILE_HEIGHT);
+
+	Edge edges[3] = { makeEdge(v0, v1), makeEdge(v1, v2), makeEdge(v2, v0) };
+
+	// depth is affine in screen space; the farthest depth over a tile is at one of its corners,
+	// and never farther than the farthest vertex
+	glm::vec3 e1 = v1 - v0;
+	glm::vec3 e2 = v2 - v0;
+	float depth_dx = (e1.z * e2.y - e2.z * e1.y) / area;
+	float depth_dy = (e2.z * e1.x - e1.z * e2.x) / area;
+	float max_vertex_depth = std::max({ v0.z, v1.z, v2.z });
+	float tile_depth_step = std::max(depth_dx * TILE_WIDTH, 0.0f) + std::max(depth_dy * TILE_HEIGHT, 0.0f);
+
+	for (auto row = first_row; row < end_row; row++)
+	{
+		for (auto column = first_column; column < end_column; column++)
+		{
+			float x = float(column * TILE_WIDTH);
+			float y = float(row * TILE_HEIGHT);
+			auto coverage = computeCoverage(edges, x + 0.5f, y + 0.5f);
+			if (coverage == 0)
+			{
+				continue;
+			}
+			float corner_depth = v0.z + depth_dx * (x - v0.x) + depth_dy * (y - v0.y) + tile_depth_step;
+			updateTile(row * tile_columns + column, coverage, std::min(corner_depth, max_vertex_depth));
+		}
+	}
+}
+
+/**
+* Merges a triangle covering coverage of a tile, no farther than depth on it.
+* The working layer is dropped for a triangle much nearer than it, so the nearer surface builds up instead
+*/
+void SoftwareOcclusionBuffer::updateTile(uint32_t tile, uint32_t coverage, float depth)
+{
+	float& far_depth = far_depths[tile];
+	float& working_depth = working_depths[tile];
+	uint32_t& working_mask = working_masks[tile];
+	if (depth >= far_depth)
+	{
+		return;
+	}
+	if (working_mask != 0 && working_depth - depth > far_depth - working_depth)
+	{
+		working_mask = 0;
+		working_depth = 0.0f;
+	}
+	working_mask |= coverage;
+	working_depth = std::max(working_depth, depth);
+	if (working_mask == FULL_TILE_MASK)
+	{
+		far_depth = working_depth;
+		working_mask = 0;
+		working_depth = 0.0f;
+	}
+}
+
+bool SoftwareOcclusionBuffer::isOccluded(const BoundingBox& box, const glm::mat4& projview) const
+{
+	if (tile_columns == 0 || box.min.x > box.max.x)
+	{
+		return false;
+	}
+
+	glm::vec2 screen_min(std::numeric_limits<float>::max());
+	glm::vec2 screen_max(-std::numeric_limits<float>::max());
+	float nearest_depth = 1.0f;
+	for (int i = 0; i < 8; i++)
+	{
+		glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+		auto clip = projview * glm::vec4(corner, 1.0f);
+		if (clip.w <= 0.0f || clip.z < 0.0f)
+		{
+			return false;
+		}
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		auto screen = (glm::vec2(ndc) * 0.5f + 0.5f) * glm::vec2(getWidth(), getHeight());
+		screen_min = glm::min(screen_min, screen);
+		screen_max = glm::max(screen_max, screen);
+		nearest_depth = std::min(nearest_depth, ndc.z);
+	}
+	if (screen_max.x < 0.0f || screen_max.y < 0.0f || screen_min.x >= getWidth() || screen_min.y >= getHeight())
+	{
+		return false;
+	}
+
+	auto first_column = static_cast<uint32_t>(std::max(screen_min.x, 0.0f)) / TILE_WIDTH;
+	auto last_column = std::min(static_cast<uint32_t>(screen_max.x) / TILE_WIDTH, tile_columns - 1);
+	auto first_row = static_cast<uint32_t>(std::max(screen_min.y, 0.0f)) / TILE_HEIGHT;
+	auto last_row = std::min(static_cast<uint32_t>(screen_max.y) / TILE_HEIGHT, tile_rows - 1);
+
+	// occluded if every tile covered holds something nearer than the nearest point of the box
+	for (auto row = first_row; row <= last_row; row++)
+	{
+		const float* depths = far_depths.data() + row * tile_columns;
+		auto column = first_column;
+#if defined(VFPR_OCCLUSION_AVX2) || defined(VFPR_OCCLUSION_SSE2)
+		__m128 box_depth = _mm_set1_ps(nearest_depth);
+		for (; column + 4 <= last_column + 1; column += 4)
+		{
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(depths + column), box_depth)) != 0)
+			{
+				return false;
+			}
+		}
+#endif
+		for (; column <= last_column; column++)
+		{
+			if (depths[column] >= nearest_depth)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,100 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "bounding_volume.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+namespace util
+{
+	class ThreadPool;
+}
+
+/**
+* Model space triangles of a mesh part, rasterized on the CPU to hide what is behind them
+*/
+struct OccluderMesh
+{
+	uint32_t part = 0;  // index of the mesh part the triangles come from
+	std::vector<glm::vec3> positions = {};
+	std::vector<uint32_t> indices = {};
+};
+
+/**
+* A low resolution depth buffer for occlusion culling on the CPU, in the style of masked software occlusion culling.
+* Instead of a depth per pixel, each tile of 8x4 pixels keeps the farthest depth known to cover all of it,
+* and a coverage mask with the farthest depth of the triangles partly covering it, merged into the first once full.
+* Depths follow the depth buffer of the renderer: 0 at the near plane, 1 at the far plane.
+* Independent of Vulkan, so it can be exercised entirely on the CPU
+*/
+class SoftwareOcclusionBuffer
+{
+public:
+	static const uint32_t TILE_WIDTH = 8;
+	static const uint32_t TILE_HEIGHT = 4;
+
+	SoftwareOcclusionBuffer() = default;
+
+	// the size in pixels is rounded up to whole tiles
+	SoftwareOcclusionBuffer(uint32_t width, uint32_t height);
+
+	void clear();
+
+	/**
+	* Transforms the occluders by projview and rasterizes them, on the workers of thread_pool if there is one.
+	* Each worker rasterizes every triangle into its own band of tile rows, so no tile is written by two threads
+	*/
+	void render(const std::vector<OccluderMesh>& occluders, const glm::mat4& projview, util::ThreadPool* thread_pool = nullptr);
+
+	/**
+	* Rasterizes triangles with positions given in clip space into the tile rows [first_tile_row, end_tile_row).
+	* Triangles are clipped against the near plane
+	*/
+	void rasterize(const std::vector<glm::vec4>& positions, const std::vector<uint32_t>& indices, uint32_t first_tile_row, uint32_t end_tile_row);
+
+	/**
+	* Whether the box, transformed by projview, is behind the occluders rendered so far on every pixel it covers.
+	* Boxes crossing the near plane are never occluded
+	*/
+	bool isOccluded(const BoundingBox& box, const glm::mat4& projview) const;
+
+	uint32_t getWidth() const
+	{
+		return tile_columns * TILE_WIDTH;
+	}
+
+	uint32_t getHeight() const
+	{
+		return tile_rows * TILE_HEIGHT;
+	}
+
+	uint32_t getTileRowCount() const
+	{
+		return tile_rows;
+	}
+
+	// farthest depth covering each whole tile, row by row
+	const std::vector<float>& getTileDepths() const
+	{
+		return far_depths;
+	}
+
+private:
+	uint32_t tile_columns = 0;
+	uint32_t tile_rows = 0;
+
+	// per tile, row by row
+	std::vector<float> far_depths;
+	std::vector<float> working_depths;  // farthest depth of the triangles covering working_masks
+	std::vector<uint32_t> working_masks;  // bit x + y * TILE_WIDTH for the pixel (x, y) of the tile
+
+	std::vector<std::vector<glm::vec4>> clip_positions;  // of each occluder in the last render
+
+	void rasterizeTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, uint32_t first_tile_row, uint32_t end_tile_row);
+	void updateTile(uint32_t tile, uint32_t coverage, float depth);
+};
@@ -0,0 +1,78 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "texture_cache.h"
+
+#include "../util.h"
+
+#include <iostream>
+#include <iterator>
+
+std::vector<std::shared_ptr<VTexture>> VTextureCache::acquire(const VContext& context, VUploadBatch& upload_batch
+	, const std::vector<TextureRequest>& requests, unsigned thread_count)
+{
+	// drop the entries of textures no model uses anymore
+	for (auto it = textures.begin(); it != textures.end();)
+	{
+		it = it->second.expired() ? textures.erase(it) : std::next(it);
+	}
+
+	std::vector<std::shared_ptr<VTexture>> result(requests.size());
+	std::vector<TextureRequest> load_requests;
+	std::vector<std::string> load_keys;
+	std::unordered_map<std::string, size_t> load_indices;  // key to index in load_requests
+	std::vector<size_t> pending(requests.size(), 0);  // index in load_requests of each result not found in the cache
+	size_t reused_count = 0;
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		// the same image is transcoded differently as a normal map, so the usage is part of the key
+		auto canonical_path = util::getCanonicalPath(requests[i].path);
+		auto key = (requests[i].usage == TextureUsage::normal_map ? "normal:" : "albedo:") + canonical_path;
+		auto cached = textures.find(key);
+		if (cached != textures.end())
+		{
+			result[i] = cached->second.lock();
+			reused_count++;
+			continue;
+		}
+		auto loading = load_indices.find(key);
+		if (loading == load_indices.end())
+		{
+			loading = load_indices.emplace(key, load_requests.size()).first;
+			load_requests.emplace_back(canonical_path, requests[i].usage);
+			load_keys.push_back(key);
+		}
+		pending[i] = loading->second;
+	}
+
+	auto loaded = texture_loader::loadTextures(context, upload_batch, load_requests, thread_count, options);
+	std::vector<std::shared_ptr<VTexture>> shared_textures;
+	shared_textures.reserve(loaded.size());
+	for (size_t i = 0; i < loaded.size(); i++)
+	{
+		shared_textures.push_back(std::make_shared<VTexture>(std::move(loaded[i])));
+		textures[load_keys[i]] = shared_textures.back();
+	}
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		if (!result[i])
+		{
+			result[i] = shared_textures[pending[i]];
+		}
+	}
+
+	std::cout << "Texture cache: " << requests.size() << " textures requested, " << load_requests.size() << " loaded, "
+		<< reused_count << " reused from earlier models, " << requests.size() - load_requests.size() - reused_count << " duplicates shared"
+		<< std::endl;
+	return result;
+}
+
+size_t VTextureCache::getTextureCount() const
+{
+	size_t count = 0;
+	for (const auto& texture : textures)
+	{
+		count += texture.second.expired() ? 0 : 1;
+	}
+	return count;
+}
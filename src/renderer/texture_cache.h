@@ -0,0 +1,47 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "texture_loader.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+* Shares textures between mesh parts and models by canonical file path and usage.
+* The cache only holds weak references: a texture lives as long as a model using it,
+* and is decoded again if requested after every owner is gone.
+* Not thread safe, models are loaded on one thread
+*/
+class VTextureCache
+{
+public:
+	// options are passed to texture_loader::loadTextures for every texture of the cache
+	explicit VTextureCache(const TextureLoadOptions& options = {})
+		: options(options)
+	{}
+	~VTextureCache() = default;
+
+	VTextureCache(VTextureCache&&) = delete;
+	VTextureCache& operator= (VTextureCache&&) = delete;
+	VTextureCache(const VTextureCache&) = delete;
+	VTextureCache& operator= (const VTextureCache&) = delete;
+
+	/**
+	* Returns a texture for every request, in order. Requests of the same file and usage share one texture,
+	* textures still alive from earlier calls are reused, and the rest are decoded once
+	* and uploaded through upload_batch by texture_loader::loadTextures
+	*/
+	std::vector<std::shared_ptr<VTexture>> acquire(const VContext& context, VUploadBatch& upload_batch
+		, const std::vector<TextureRequest>& requests, unsigned thread_count = 0);
+
+	// number of textures alive
+	size_t getTextureCount() const;
+
+private:
+	TextureLoadOptions options;
+	std::unordered_map<std::string, std::weak_ptr<VTexture>> textures;
+};
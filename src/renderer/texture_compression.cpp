@@ -0,0 +1,397 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "texture_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	const uint32_t BLOCK_DIMENSION = 4;
+	const uint32_t BLOCK_TEXEL_COUNT = BLOCK_DIMENSION * BLOCK_DIMENSION;
+
+	struct Color
+	{
+		float r = 0.0f, g = 0.0f, b = 0.0f;
+	};
+
+	// gathers a 4x4 block of RGBA8 texels, repeating the last row and column at the edges
+	void loadBlock(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t block_x, uint32_t block_y, uint8_t block[BLOCK_TEXEL_COUNT][4])
+	{
+		for (uint32_t y = 0; y < BLOCK_DIMENSION; y++)
+		{
+			auto source_y = std::min(block_y * BLOCK_DIMENSION + y, height - 1);
+			for (uint32_t x = 0; x < BLOCK_DIMENSION; x++)
+			{
+				auto source_x = std::min(block_x * BLOCK_DIMENSION + x, width - 1);
+				memcpy(block[y * BLOCK_DIMENSION + x], rgba + (size_t(source_y) * width + source_x) * 4, 4);
+			}
+		}
+	}
+
+	uint16_t packColor565(const Color& color)
+	{
+		auto quantize = [](float value, int max)
+		{
+			return static_cast<uint16_t>(std::min(std::max(static_cast<int>(std::lround(value / 255.0f * max)), 0), max));
+		};
+		return static_cast<uint16_t>((quantize(color.r, 31) << 11) | (quantize(color.g, 63) << 5) | quantize(color.b, 31));
+	}
+
+	Color unpackColor565(uint16_t packed)
+	{
+		auto r = (packed >> 11) & 31;
+		auto g = (packed >> 5) & 63;
+		auto b = packed & 31;
+		Color color;
+		color.r = static_cast<float>((r << 3) | (r >> 2));
+		color.g = static_cast<float>((g << 2) | (g >> 4));
+		color.b = static_cast<float>((b << 3) | (b >> 2));
+		return color;
+	}
+
+	float distanceSquared(const Color& a, const uint8_t* texel)
+	{
+		float dr = a.r - texel[0], dg = a.g - texel[1], db = a.b - texel[2];
+		return dr * dr + dg * dg + db * db;
+	}
+
+	Color lerp(const Color& a, const Color& b, float t)
+	{
+		Color color;
+		color.r = a.r + (b.r - a.r) * t;
+		color.g = a.g + (b.g - a.g) * t;
+		color.b = a.b + (b.b - a.b) * t;
+		return color;
+	}
+
+	// picks the nearest of the four palette colors of the endpoints for every texel, returns the total squared error
+	float fitColorIndices(uint16_t endpoint0, uint16_t endpoint1, const uint8_t block[BLOCK_TEXEL_COUNT][4], uint8_t indices[BLOCK_TEXEL_COUNT])
+	{
+		Color palette[4];
+		palette[0] = unpackColor565(endpoint0);
+		palette[1] = unpackColor565(endpoint1);
+		palette[2] = lerp(palette[0], palette[1], 1.0f / 3.0f);
+		palette[3] = lerp(palette[0], palette[1], 2.0f / 3.0f);
+
+		float error = 0.0f;
+		for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+		{
+			float best_distance = distanceSquared(palette[0], block[i]);
+			indices[i] = 0;
+			for (uint8_t p = 1; p < 4; p++)
+			{
+				float distance = distanceSquared(palette[p], block[i]);
+				if (distance < best_distance)
+				{
+					best_distance = distance;
+					indices[i] = p;
+				}
+			}
+			error += best_distance;
+		}
+		return error;
+	}
+
+	/**
+	* Endpoints minimizing the squared error for fixed indices, solving the 2x2 normal equations per channel.
+	* Returns false if every texel uses the same weight
+	*/
+	bool refineEndpoints(const uint8_t block[BLOCK_TEXEL_COUNT][4], const uint8_t indices[BLOCK_TEXEL_COUNT], Color* endpoint0, Color* endpoint1)
+	{
+		const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f }; // of endpoint0 for each index
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		Color ax, bx;
+		for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+		{
+			float a = weights[indices[i]];
+			float b = 1.0f - a;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			ax.r += a * block[i][0]; ax.g += a * block[i][1]; ax.b += a * block[i][2];
+			bx.r += b * block[i][0]; bx.g += b * block[i][1]; bx.b += b * block[i][2];
+		}
+		float determinant = aa * bb - ab * ab;
+		if (std::abs(determinant) < 1e-6f)
+		{
+			return false;
+		}
+		float inverse = 1.0f / determinant;
+		endpoint0->r = (bb * ax.r - ab * bx.r) * inverse;
+		endpoint0->g = (bb * ax.g - ab * bx.g) * inverse;
+		endpoint0->b = (bb * ax.b - ab * bx.b) * inverse;
+		endpoint1->r = (aa * bx.r - ab * ax.r) * inverse;
+		endpoint1->g = (aa * bx.g - ab * ax.g) * inverse;
+		endpoint1->b = (aa * bx.b - ab * ax.b) * inverse;
+		return true;
+	}
+
+	// BC1 color block in four color mode, also used as the color half of BC3
+	void encodeColorBlock(const uint8_t block[BLOCK_TEXEL_COUNT][4], uint8_t* output)
+	{
+		Color mean;
+		for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+		{
+			mean.r += block[i][0];
+			mean.g += block[i][1];
+			mean.b += block[i][2];
+		}
+		mean.r /= BLOCK_TEXEL_COUNT;
+		mean.g /= BLOCK_TEXEL_COUNT;
+		mean.b /= BLOCK_TEXEL_COUNT;
+
+		// principal axis of the colors by power iteration on their covariance
+		float covariance[6] = {}; // rr, rg, rb, gg, gb, bb
+		for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+		{
+			float r = block[i][0] - mean.r, g = block[i][1] - mean.g, b = block[i][2] - mean.b;
+			covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+			covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+		}
+		Color axis;
+		axis.r = 1.0f; axis.g = 1.0f; axis.b = 1.0f;
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			Color next;
+			next.r = covariance[0] * axis.r + covariance[1] * axis.g + covariance[2] * axis.b;
+			next.g = covariance[1] * axis.r + covariance[3] * axis.g + covariance[4] * axis.b;
+			next.b = covariance[2] * axis.r + covariance[4] * axis.g + covariance[5] * axis.b;
+			float length = std::max(std::max(std::abs(next.r), std::abs(next.g)), std::abs(next.b));
+			if (length < 1e-6f)
+			{
+				break; // a single color, any axis works
+			}
+			axis.r = next.r / length;
+			axis.g = next.g / length;
+			axis.b = next.b / length;
+		}
+
+		float min_projection = 0.0f, max_projection = 0.0f;
+		float axis_length_squared = axis.r * axis.r + axis.g * axis.g + axis.b * axis.b;
+		for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+		{
+			float projection = ((block[i][0] - mean.r) * axis.r + (block[i][1] - mean.g) * axis.g + (block[i][2] - mean.b) * axis.b) / axis_length_squared;
+			min_projection = std::min(min_projection, projection);
+			max_projection = std::max(max_projection, projection);
+		}
+		Color endpoint0, endpoint1;
+		endpoint0.r = mean.r + axis.r * max_projection; endpoint0.g = mean.g + axis.g * max_projection; endpoint0.b = mean.b + axis.b * max_projection;
+		endpoint1.r = mean.r + axis.r * min_projection; endpoint1.g = mean.g + axis.g * min_projection; endpoint1.b = mean.b + axis.b * min_projection;
+
+		uint16_t packed0 = packColor565(endpoint0);
+		uint16_t packed1 = packColor565(endpoint1);
+		uint8_t indices[BLOCK_TEXEL_COUNT];
+		float error = fitColorIndices(packed0, packed1, block, indices);
+
+		Color refined0, refined1;
+		if (refineEndpoints(block, indices, &refined0, &refined1))
+		{
+			uint16_t refined_packed0 = packColor565(refined0);
+			uint16_t refined_packed1 = packColor565(refined1);
+			uint8_t refined_indices[BLOCK_TEXEL_COUNT];
+			float refined_error = fitColorIndices(refined_packed0, refined_packed1, block, refined_indices);
+			if (refined_error < error)
+			{
+				packed0 = refined_packed0;
+				packed1 = refined_packed1;
+				memcpy(indices, refined_indices, sizeof(indices));
+			}
+		}
+
+		// four color mode needs endpoint0 > endpoint1; swapping them maps index 0 <-> 1 and 2 <-> 3
+		if (packed0 < packed1)
+		{
+			std::swap(packed0, packed1);
+			for (auto& index : indices)
+			{
+				index ^= 1;
+			}
+		}
+		else if (packed0 == packed1)
+		{
+			memset(indices, 0, sizeof(indices));
+		}
+
+		uint32_t packed_indices = 0;
+		for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+		{
+			packed_indices |= uint32_t(indices[i]) << (2 * i);
+		}
+		output[0] = static_cast<uint8_t>(packed0 & 0xff);
+		output[1] = static_cast<uint8_t>(packed0 >> 8);
+		output[2] = static_cast<uint8_t>(packed1 & 0xff);
+		output[3] = static_cast<uint8_t>(packed1 >> 8);
+		for (int i = 0; i < 4; i++)
+		{
+			output[4 + i] = static_cast<uint8_t>(packed_indices >> (8 * i));
+		}
+	}
+
+	// BC4 block of one channel in eight value mode, used for BC3 alpha and both BC5 channels
+	void encodeChannelBlock(const uint8_t block[BLOCK_TEXEL_COUNT][4], uint32_t channel, uint8_t* output)
+	{
+		uint8_t max_value = 0, min_value = 255;
+		for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+		{
+			max_value = std::max(max_value, block[i][channel]);
+			min_value = std::min(min_value, block[i][channel]);
+		}
+
+		uint64_t packed_indices = 0;
+		if (max_value > min_value)
+		{
+			float palette[8];
+			palette[0] = max_value;
+			palette[1] = min_value;
+			for (int p = 2; p < 8; p++)
+			{
+				palette[p] = ((8 - p) * float(max_value) + (p - 1) * float(min_value)) / 7.0f;
+			}
+			for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+			{
+				uint64_t best_index = 0;
+				float best_distance = std::abs(palette[0] - block[i][channel]);
+				for (int p = 1; p < 8; p++)
+				{
+					float distance = std::abs(palette[p] - block[i][channel]);
+					if (distance < best_distance)
+					{
+						best_distance = distance;
+						best_index = p;
+					}
+				}
+				packed_indices |= best_index << (3 * i);
+			}
+		}
+
+		output[0] = max_value;
+		output[1] = min_value;
+		for (int i = 0; i < 6; i++)
+		{
+			output[2 + i] = static_cast<uint8_t>(packed_indices >> (8 * i));
+		}
+	}
+}
+
+uint32_t texture_compression::getBlockSize(BlockFormat format)
+{
+	return format == BlockFormat::bc1 ? 8 : 16;
+}
+
+size_t texture_compression::getLevelSize(BlockFormat format, uint32_t width, uint32_t height)
+{
+	size_t blocks_x = (width + BLOCK_DIMENSION - 1) / BLOCK_DIMENSION;
+	size_t blocks_y = (height + BLOCK_DIMENSION - 1) / BLOCK_DIMENSION;
+	return blocks_x * blocks_y * getBlockSize(format);
+}
+
+BlockFormat texture_compression::chooseFormat(const uint8_t* rgba, uint32_t width, uint32_t height, bool normal_map)
+{
+	if (normal_map)
+	{
+		return BlockFormat::bc5;
+	}
+	size_t texel_count = size_t(width) * height;
+	for (size_t i = 0; i < texel_count; i++)
+	{
+		if (rgba[i * 4 + 3] != 255)
+		{
+			return BlockFormat::bc3;
+		}
+	}
+	return BlockFormat::bc1;
+}
+
+std::vector<TextureLevel> texture_compression::buildMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, bool normal_map)
+{
+	std::vector<TextureLevel> levels(1);
+	levels[0].width = width;
+	levels[0].height = height;
+	levels[0].data.assign(rgba, rgba + size_t(width) * height * 4);
+
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		const auto& source = levels.back();
+		TextureLevel level;
+		level.width = std::max<uint32_t>(source.width / 2, 1);
+		level.height = std::max<uint32_t>(source.height / 2, 1);
+		level.data.resize(size_t(level.width) * level.height * 4);
+
+		for (uint32_t y = 0; y < level.height; y++)
+		{
+			uint32_t y0 = std::min(y * 2, source.height - 1);
+			uint32_t y1 = std::min(y * 2 + 1, source.height - 1);
+			for (uint32_t x = 0; x < level.width; x++)
+			{
+				uint32_t x0 = std::min(x * 2, source.width - 1);
+				uint32_t x1 = std::min(x * 2 + 1, source.width - 1);
+				const uint8_t* texels[4] = {
+					&source.data[(size_t(y0) * source.width + x0) * 4],
+					&source.data[(size_t(y0) * source.width + x1) * 4],
+					&source.data[(size_t(y1) * source.width + x0) * 4],
+					&source.data[(size_t(y1) * source.width + x1) * 4],
+				};
+				auto* output = &level.data[(size_t(y) * level.width + x) * 4];
+				for (int c = 0; c < 4; c++)
+				{
+					output[c] = static_cast<uint8_t>((texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c] + 2) / 4);
+				}
+
+				if (normal_map)
+				{
+					float n[3];
+					for (int c = 0; c < 3; c++)
+					{
+						n[c] = (texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c]) / (4.0f * 255.0f) * 2.0f - 1.0f;
+					}
+					float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+					if (length > 1e-4f)
+					{
+						for (int c = 0; c < 3; c++)
+						{
+							output[c] = static_cast<uint8_t>(std::lround((n[c] / length * 0.5f + 0.5f) * 255.0f));
+						}
+					}
+				}
+			}
+		}
+		levels.push_back(std::move(level));
+	}
+	return levels;
+}
+
+std::vector<uint8_t> texture_compression::compress(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height)
+{
+	std::vector<uint8_t> output(getLevelSize(format, width, height));
+	uint32_t blocks_x = (width + BLOCK_DIMENSION - 1) / BLOCK_DIMENSION;
+	uint32_t blocks_y = (height + BLOCK_DIMENSION - 1) / BLOCK_DIMENSION;
+	auto block_size = getBlockSize(format);
+
+	uint8_t block[BLOCK_TEXEL_COUNT][4];
+	for (uint32_t block_y = 0; block_y < blocks_y; block_y++)
+	{
+		for (uint32_t block_x = 0; block_x < blocks_x; block_x++)
+		{
+			loadBlock(rgba, width, height, block_x, block_y, block);
+			auto* block_output = &output[(size_t(block_y) * blocks_x + block_x) * block_size];
+			switch (format)
+			{
+			case BlockFormat::bc1:
+				encodeColorBlock(block, block_output);
+				break;
+			case BlockFormat::bc3:
+				encodeChannelBlock(block, 3, block_output);
+				encodeColorBlock(block, block_output + 8);
+				break;
+			case BlockFormat::bc5:
+				encodeChannelBlock(block, 0, block_output);
+				encodeChannelBlock(block, 1, block_output + 8);
+				break;
+			}
+		}
+	}
+	return output;
+}
@@ -0,0 +1,52 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+* Block compression formats written by the texture transcoder, numbered as in their BCn names
+*/
+enum class BlockFormat : uint32_t
+{
+	bc1 = 1,  // RGB, 4 bits per texel, for opaque color
+	bc3 = 3,  // RGBA, 8 bits per texel, for color with alpha
+	bc5 = 5,  // two channels, 8 bits per texel, for tangent space normal maps
+};
+
+/**
+* One mip level, either RGBA8 texels or compressed blocks
+*/
+struct TextureLevel
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> data;
+};
+
+namespace texture_compression
+{
+	// bytes per 4x4 block
+	uint32_t getBlockSize(BlockFormat format);
+
+	size_t getLevelSize(BlockFormat format, uint32_t width, uint32_t height);
+
+	// BC5 for normal maps, otherwise BC3 if any texel is not fully opaque and BC1 if all are
+	BlockFormat chooseFormat(const uint8_t* rgba, uint32_t width, uint32_t height, bool normal_map);
+
+	/**
+	* Box filtered RGBA8 mip chain down to 1x1, starting with a copy of the source as level 0.
+	* Normal map levels are renormalized after filtering
+	*/
+	std::vector<TextureLevel> buildMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, bool normal_map);
+
+	/**
+	* Compresses RGBA8 texels into 4x4 blocks; edge blocks of sizes not divisible by 4 repeat the last row and column.
+	* BC1 and the color half of BC3 fit endpoints along the principal axis of each block and refine them by least squares.
+	* BC5 stores the red and green channels
+	*/
+	std::vector<uint8_t> compress(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height);
+}
@@ -0,0 +1,401 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "texture_loader.h"
+
+#include "vulkan_util.h"
+#include "context.h"
+#include "upload_batch.h"
+#include "texture_compression.h"
+#include "compressed_texture_file.h"
+#include "../thread_pool.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	using clock_type = std::chrono::high_resolution_clock;
+
+	struct LoadedTexture
+	{
+		// RGBA8 level 0, when the mip chain is built by GPU blits
+		stbi_uc* pixels = nullptr;
+		// every level otherwise, mapped from the transcoded file or built now
+		std::shared_ptr<VTextureLevels> levels;
+		VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		bool from_file = false;
+		bool transcoded = false;
+
+		std::exception_ptr error;
+		float load_ms = 0.0f;
+		uint64_t submission = 0;  // of the upload batch
+		clock_type::time_point upload_start;
+		float upload_ms = 0.0f;
+		bool uploaded = false;
+	};
+
+	float millisecondsSince(clock_type::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(clock_type::now() - start).count();
+	}
+
+	bool canGenerateMipmaps(const VContext& context, VkFormat format)
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(context.getPhysicalDevice(), format, &properties);
+		VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+		return (properties.optimalTilingFeatures & required) == required;
+	}
+
+	VkFormat getVkFormat(BlockFormat format)
+	{
+		switch (format)
+		{
+		case BlockFormat::bc1:
+			return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case BlockFormat::bc3:
+			return VK_FORMAT_BC3_UNORM_BLOCK;
+		case BlockFormat::bc5:
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		}
+		return VK_FORMAT_UNDEFINED;
+	}
+
+	const char* getFormatName(VkFormat format)
+	{
+		switch (format)
+		{
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			return "BC1";
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+			return "BC3";
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+			return "BC5";
+		default:
+			return "RGBA8";
+		}
+	}
+
+	stbi_uc* decodeImage(const std::string& path, LoadedTexture* texture)
+	{
+		int width, height, channels;
+		stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+		if (!pixels)
+		{
+			throw std::runtime_error("Failed to load image" + path);
+		}
+		texture->width = static_cast<uint32_t>(width);
+		texture->height = static_cast<uint32_t>(height);
+		return pixels;
+	}
+
+	std::vector<TextureLevel> buildLevels(stbi_uc* pixels, uint32_t width, uint32_t height, bool generate_mipmaps, bool normal_map)
+	{
+		if (generate_mipmaps)
+		{
+			return texture_compression::buildMipChain(pixels, width, height, normal_map);
+		}
+		std::vector<TextureLevel> levels(1);
+		levels[0].width = width;
+		levels[0].height = height;
+		levels[0].data.assign(pixels, pixels + size_t(width) * height * 4);
+		return levels;
+	}
+
+	// runs on a worker: reads the transcoded file, or decodes the image and transcodes it
+	void loadCompressedTexture(const TextureRequest& request, bool generate_mipmaps, LoadedTexture* texture)
+	{
+		bool normal_map = request.usage == TextureUsage::normal_map;
+		CompressedTextureFile file;
+		if (file.open(request.path, normal_map))
+		{
+			auto expected_levels = generate_mipmaps ? texture_loader::getMipLevelCount(file.getWidth(), file.getHeight()) : 1;
+			if (file.getLevelCount() == expected_levels)
+			{
+				texture->format = getVkFormat(file.getFormat());
+				texture->width = file.getWidth();
+				texture->height = file.getHeight();
+				texture->from_file = true;
+				texture->levels = std::make_shared<VTextureLevels>(std::move(file));
+				return;
+			}
+			file = CompressedTextureFile(); // unmap before it is rewritten
+		}
+
+		stbi_uc* pixels = decodeImage(request.path, texture);
+		auto block_format = texture_compression::chooseFormat(pixels, texture->width, texture->height, normal_map);
+		auto rgba_levels = buildLevels(pixels, texture->width, texture->height, generate_mipmaps, normal_map);
+		stbi_image_free(pixels);
+
+		std::vector<TextureLevel> levels(rgba_levels.size());
+		for (size_t level = 0; level < rgba_levels.size(); level++)
+		{
+			levels[level].width = rgba_levels[level].width;
+			levels[level].height = rgba_levels[level].height;
+			levels[level].data = texture_compression::compress(block_format
+				, rgba_levels[level].data.data(), rgba_levels[level].width, rgba_levels[level].height);
+			rgba_levels[level].data = std::vector<uint8_t>(); // release as we go
+		}
+		texture->format = getVkFormat(block_format);
+		texture->transcoded = true;
+
+		if (!CompressedTextureFile::write(request.path, normal_map, block_format, levels))
+		{
+			std::cerr << "Failed to write transcoded texture " << CompressedTextureFile::getCachePath(request.path) << std::endl;
+		}
+		else if (file.open(request.path, normal_map))
+		{
+			// streamed textures keep their levels, the mapping costs no memory until a level is read
+			texture->levels = std::make_shared<VTextureLevels>(std::move(file));
+			return;
+		}
+		texture->levels = std::make_shared<VTextureLevels>(std::move(levels));
+	}
+}
+
+uint32_t VTextureLevels::getLevelCount() const
+{
+	return file.isOpen() ? file.getLevelCount() : static_cast<uint32_t>(levels.size());
+}
+
+const void* VTextureLevels::getLevelData(uint32_t level) const
+{
+	return file.isOpen() ? static_cast<const void*>(file.getLevelData(level)) : levels[level].data.data();
+}
+
+VkDeviceSize VTextureLevels::getLevelSize(uint32_t level) const
+{
+	return file.isOpen() ? file.getLevelSize(level) : levels[level].data.size();
+}
+
+std::vector<std::pair<const void*, VkDeviceSize>> VTextureLevels::getLevels(uint32_t first_level) const
+{
+	std::vector<std::pair<const void*, VkDeviceSize>> result;
+	for (uint32_t level = first_level; level < getLevelCount(); level++)
+	{
+		result.emplace_back(getLevelData(level), getLevelSize(level));
+	}
+	return result;
+}
+
+uint32_t texture_loader::getMipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	for (auto extent = std::max(width, height); extent > 1; extent >>= 1)
+	{
+		levels++;
+	}
+	return levels;
+}
+
+uint32_t texture_loader::getFirstLevelWithin(uint32_t width, uint32_t height, uint32_t max_size)
+{
+	uint32_t level = 0;
+	for (auto extent = std::max(width, height); extent > std::max(max_size, 1u); extent >>= 1)
+	{
+		level++;
+	}
+	return level;
+}
+
+VTexture texture_loader::createResidentImage(const VContext& context, VUploadBatch& upload_batch, const VTexture& texture, uint32_t first_level)
+{
+	VTexture result;
+	result.format = texture.format;
+	result.width = texture.width;
+	result.height = texture.height;
+	result.mip_levels = texture.mip_levels;
+	result.resident_level = first_level;
+	result.levels = texture.levels;
+
+	auto width = std::max(texture.width >> first_level, 1u);
+	auto height = std::max(texture.height >> first_level, 1u);
+	auto level_count = texture.mip_levels - first_level;
+	VUtility utility{ context };
+	std::tie(result.image, result.memory) = utility.createImage(width, height
+		, result.format
+		, VK_IMAGE_TILING_OPTIMAL
+		, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		, level_count);
+	upload_batch.uploadImageLevels(result.image.get(), width, height, texture.levels->getLevels(first_level));
+	result.view = utility.createImageView(result.image.get(), result.format, VK_IMAGE_ASPECT_COLOR_BIT, level_count);
+	return result;
+}
+
+std::vector<VTexture> texture_loader::loadTextures(const VContext& context, VUploadBatch& upload_batch
+	, const std::vector<TextureRequest>& requests, unsigned thread_count, const TextureLoadOptions& options)
+{
+	std::vector<VTexture> textures(requests.size());
+	if (requests.empty())
+	{
+		return textures;
+	}
+
+	auto start_time = clock_type::now();
+	std::vector<LoadedTexture> loaded(requests.size());
+
+	bool compress = options.compress;
+	if (compress && !context.getEnabledFeatures().textureCompressionBC)
+	{
+		std::cerr << "The device does not support BC textures, textures will be uploaded uncompressed" << std::endl;
+		compress = false;
+	}
+	bool generate_mipmaps = options.generate_mipmaps;
+	bool streaming = options.streaming && generate_mipmaps;
+	if (generate_mipmaps && !compress && !streaming && !canGenerateMipmaps(context, VK_FORMAT_R8G8B8A8_UNORM))
+	{
+		std::cerr << "The device cannot blit VK_FORMAT_R8G8B8A8_UNORM with linear filtering, textures will have no mip maps" << std::endl;
+		generate_mipmaps = false;
+	}
+
+	// workers push the index of every finished texture, the calling thread uploads them in that order
+	std::vector<size_t> finished;
+	std::mutex finished_mutex;
+	std::condition_variable finished_condition;
+
+	// declared last so its destructor joins the workers before the state they write goes away
+	util::ThreadPool thread_pool(std::min<unsigned>(thread_count > 0 ? thread_count : util::ThreadPool::getDefaultThreadCount()
+		, static_cast<unsigned>(requests.size())));
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		thread_pool.submit([&, i]()
+		{
+			auto& texture = loaded[i];
+			auto load_start = clock_type::now();
+			try
+			{
+				if (compress)
+				{
+					loadCompressedTexture(requests[i], generate_mipmaps, &texture);
+				}
+				else if (streaming)
+				{
+					stbi_uc* pixels = decodeImage(requests[i].path, &texture);
+					auto levels = buildLevels(pixels, texture.width, texture.height, true, requests[i].usage == TextureUsage::normal_map);
+					stbi_image_free(pixels);
+					texture.levels = std::make_shared<VTextureLevels>(std::move(levels));
+				}
+				else
+				{
+					texture.pixels = decodeImage(requests[i].path, &texture);
+				}
+			}
+			catch (...)
+			{
+				texture.error = std::current_exception();
+			}
+			texture.load_ms = millisecondsSince(load_start);
+			{
+				std::lock_guard<std::mutex> lock(finished_mutex);
+				finished.push_back(i);
+			}
+			finished_condition.notify_one();
+		});
+	}
+
+	VUtility utility{ context };
+	auto pollUploads = [&]()
+	{
+		for (auto& texture : loaded)
+		{
+			if (texture.submission > 0 && !texture.uploaded && upload_batch.isSubmissionComplete(texture.submission))
+			{
+				texture.upload_ms = millisecondsSince(texture.upload_start);
+				texture.uploaded = true;
+			}
+		}
+	};
+
+	std::exception_ptr error;
+	for (size_t uploaded_count = 0; uploaded_count < requests.size(); uploaded_count++)
+	{
+		size_t i;
+		{
+			std::unique_lock<std::mutex> lock(finished_mutex);
+			finished_condition.wait(lock, [&finished, uploaded_count]() { return finished.size() > uploaded_count; });
+			i = finished[uploaded_count];
+		}
+
+		auto& texture = loaded[i];
+		if (texture.error || error)
+		{
+			// keep draining so every decoded image is freed, then report the first failure
+			error = error ? error : texture.error;
+			stbi_image_free(texture.pixels);
+			continue;
+		}
+
+		auto& result = textures[i];
+		result.format = texture.format;
+		result.width = texture.width;
+		result.height = texture.height;
+		texture.upload_start = clock_type::now();
+		if (texture.levels)
+		{
+			result.mip_levels = texture.levels->getLevelCount();
+			result.levels = texture.levels;
+			auto first_level = streaming ? getFirstLevelWithin(result.width, result.height, STREAMING_INITIAL_SIZE) : 0;
+			result = createResidentImage(context, upload_batch, result, first_level);
+			if (!streaming)
+			{
+				result.levels.reset();
+			}
+			texture.levels.reset();
+		}
+		else
+		{
+			result.mip_levels = generate_mipmaps ? getMipLevelCount(result.width, result.height) : 1;
+			std::tie(result.image, result.memory) = utility.createImage(result.width, result.height
+				, result.format
+				, VK_IMAGE_TILING_OPTIMAL
+				, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+				, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+				, result.mip_levels);
+			memcpy(upload_batch.stageImage(result.image.get(), result.width, result.height, result.mip_levels)
+				, texture.pixels, size_t(result.width) * result.height * 4);
+			stbi_image_free(texture.pixels);
+			texture.pixels = nullptr;
+			result.view = utility.createImageView(result.image.get(), result.format, VK_IMAGE_ASPECT_COLOR_BIT, result.mip_levels);
+		}
+		texture.submission = upload_batch.flush();
+
+		pollUploads();
+	}
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	for (auto& texture : loaded)
+	{
+		upload_batch.waitForSubmission(texture.submission);
+	}
+	pollUploads();
+
+	float load_total_ms = 0.0f;
+	size_t transcoded_count = 0;
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		const char* load_kind = loaded[i].from_file ? "read" : loaded[i].transcoded ? "transcode" : "decode";
+		std::cout << "Texture " << requests[i].path << " (" << textures[i].width << "x" << textures[i].height << " " << getFormatName(textures[i].format)
+			<< ", " << textures[i].mip_levels - textures[i].resident_level << " of " << textures[i].mip_levels << " mips): "
+			<< load_kind << " " << loaded[i].load_ms << " ms, upload " << loaded[i].upload_ms << " ms" << std::endl;
+		load_total_ms += loaded[i].load_ms;
+		transcoded_count += loaded[i].transcoded ? 1 : 0;
+	}
+	std::cout << "Loaded " << requests.size() << " textures (" << transcoded_count << " transcoded) in " << millisecondsSince(start_time) << " ms ("
+		<< load_total_ms << " ms of loading on " << thread_pool.getThreadCount() << " threads)" << std::endl;
+
+	return textures;
+}
@@ -0,0 +1,123 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "raii.h"
+#include "memory_allocator.h"
+#include "compressed_texture_file.h"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <utility>
+
+class VContext;
+class VUploadBatch;
+
+/**
+* Every mip level of a texture kept on the CPU, mapped from its CompressedTextureFile or owned,
+* so that any range of levels can be uploaded again
+*/
+class VTextureLevels
+{
+public:
+	explicit VTextureLevels(CompressedTextureFile&& file)
+		: file(std::move(file))
+	{}
+
+	explicit VTextureLevels(std::vector<TextureLevel>&& levels)
+		: levels(std::move(levels))
+	{}
+
+	uint32_t getLevelCount() const;
+	const void* getLevelData(uint32_t level) const;
+	VkDeviceSize getLevelSize(uint32_t level) const;
+
+	// levels first_level to the last one, for VUploadBatch::uploadImageLevels
+	std::vector<std::pair<const void*, VkDeviceSize>> getLevels(uint32_t first_level) const;
+
+private:
+	CompressedTextureFile file;
+	std::vector<TextureLevel> levels;
+};
+
+/**
+* A sampled texture in device local memory.
+* The image holds mip levels resident_level to mip_levels - 1, and its own level 0 is resident_level
+*/
+struct VTexture
+{
+	VRaii<VkImage> image;
+	VMemoryAllocation memory;
+	VRaii<VkImageView> view;
+	VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+	uint32_t width = 0;  // of the full resolution level
+	uint32_t height = 0;
+	uint32_t mip_levels = 1;  // of the full chain
+	uint32_t resident_level = 0;
+	std::shared_ptr<const VTextureLevels> levels;  // only kept for streamed textures
+};
+
+enum class TextureUsage
+{
+	albedo,
+	normal_map,  // tangent space, the shader reconstructs z from x and y
+};
+
+struct TextureRequest
+{
+	std::string path;
+	TextureUsage usage = TextureUsage::albedo;
+
+	TextureRequest() = default;
+
+	TextureRequest(const std::string& path, TextureUsage usage)
+		: path(path)
+		, usage(usage)
+	{}
+};
+
+struct TextureLoadOptions
+{
+	bool generate_mipmaps = true;
+	// transcode to BC1 or BC3 for albedo and BC5 for normal maps, cached next to the image files;
+	// ignored if the device has no BC texture support
+	bool compress = true;
+	// upload only the levels of at most STREAMING_INITIAL_SIZE texels and keep every level in VTexture::levels
+	// for VTextureStreamer; needs generate_mipmaps
+	bool streaming = false;
+};
+
+namespace texture_loader
+{
+	// largest dimension of the levels streamed textures start with
+	const uint32_t STREAMING_INITIAL_SIZE = 64;
+
+	/**
+	* Loads the requested image files on a pool of thread_count workers (0 for one per hardware thread).
+	* With options.compress, workers read each texture's CompressedTextureFile, or decode, build the mip chain,
+	* transcode and write it on first load. Otherwise they decode RGBA8 and the mip chain is built on the GPU by blits,
+	* or on the CPU when options.streaming needs every level.
+	* The calling thread uploads every texture through upload_batch as soon as its worker is done,
+	* flushing the batch so the GPU copies while the rest are still being loaded.
+	* Returns after every texture upload has completed, with textures in the order of requests.
+	* Throws std::runtime_error if a file cannot be decoded
+	*/
+	std::vector<VTexture> loadTextures(const VContext& context, VUploadBatch& upload_batch
+		, const std::vector<TextureRequest>& requests, unsigned thread_count = 0, const TextureLoadOptions& options = {});
+
+	// levels of a full mip chain down to 1x1
+	uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+
+	// finest level whose largest dimension is at most max_size
+	uint32_t getFirstLevelWithin(uint32_t width, uint32_t height, uint32_t max_size);
+
+	/**
+	* Creates an image for levels first_level to the last one of texture.levels, records their upload into upload_batch
+	* and returns it with its view; the caller flushes the batch. Other fields are copied from texture
+	*/
+	VTexture createResidentImage(const VContext& context, VUploadBatch& upload_batch, const VTexture& texture, uint32_t first_level);
+}
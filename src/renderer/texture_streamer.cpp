@@ -0,0 +1,175 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "texture_streamer.h"
+
+#include "context.h"
+
+#include <algorithm>
+
+VTextureStreamer::VTextureStreamer(const VContext& context, VkDeviceSize budget, VkDeviceSize max_upload_size)
+	: context(&context)
+	, budget(budget)
+	, max_upload_size(max_upload_size)
+	, upload_batch(context, max_upload_size)
+{}
+
+void VTextureStreamer::addTextures(const std::vector<std::shared_ptr<VTexture>>& new_textures)
+{
+	for (const auto& texture : new_textures)
+	{
+		if (!texture || !texture->levels || texture_indices.count(texture.get()) > 0)
+		{
+			continue;
+		}
+		texture_indices[texture.get()] = textures.size();
+		textures.emplace_back();
+		auto& streamed = textures.back();
+		streamed.texture = texture;
+		streamed.coarsest_level = texture->resident_level;
+		streamed.requested_level = texture->resident_level;
+	}
+}
+
+void VTextureStreamer::requestLevel(const VTexture* texture, uint32_t level)
+{
+	auto found = texture_indices.find(texture);
+	if (found != texture_indices.end())
+	{
+		auto& streamed = textures[found->second];
+		streamed.requested_level = std::min(streamed.requested_level, level);
+	}
+}
+
+bool VTextureStreamer::hasCompletedUploads()
+{
+	for (const auto& streamed : textures)
+	{
+		if (streamed.pending && upload_batch.isSubmissionComplete(streamed.submission))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<const VTexture*> VTextureStreamer::update(bool swap_completed_uploads)
+{
+	std::vector<const VTexture*> changed;
+	for (auto& streamed : textures)
+	{
+		if (swap_completed_uploads && streamed.pending && upload_batch.isSubmissionComplete(streamed.submission))
+		{
+			// the old image ends up in pending and is destroyed with it
+			auto& texture = *streamed.texture;
+			std::swap(texture.image, streamed.pending->image);
+			std::swap(texture.memory, streamed.pending->memory);
+			std::swap(texture.view, streamed.pending->view);
+			texture.resident_level = streamed.pending->resident_level;
+			streamed.pending.reset();
+			streamed.submission = 0;
+			changed.push_back(&texture);
+		}
+	}
+
+	// fit the requested levels into the budget by dropping the largest resident level left, one at a time
+	std::vector<uint32_t> target_levels(textures.size());
+	VkDeviceSize total_size = 0;
+	VkDeviceSize resident_size = 0;
+	for (size_t i = 0; i < textures.size(); i++)
+	{
+		const auto& streamed = textures[i];
+		target_levels[i] = std::min(streamed.requested_level, streamed.coarsest_level);
+		total_size += getLevelsSize(*streamed.texture, target_levels[i]);
+		resident_size += getLevelsSize(*streamed.texture, streamed.texture->resident_level);
+	}
+	bool over_budget = resident_size > budget;
+	while (total_size > budget)
+	{
+		size_t largest = textures.size();
+		VkDeviceSize largest_size = 0;
+		for (size_t i = 0; i < textures.size(); i++)
+		{
+			if (target_levels[i] < textures[i].coarsest_level)
+			{
+				auto level_size = textures[i].texture->levels->getLevelSize(target_levels[i]);
+				if (level_size > largest_size)
+				{
+					largest = i;
+					largest_size = level_size;
+				}
+			}
+		}
+		if (largest == textures.size())
+		{
+			break; // every texture is at the levels it was loaded with
+		}
+		total_size -= largest_size;
+		target_levels[largest]++;
+	}
+
+	VkDeviceSize upload_size = 0;
+	bool uploading = false;
+	for (size_t i = 0; i < textures.size(); i++)
+	{
+		auto& streamed = textures[i];
+		auto& texture = *streamed.texture;
+		auto target_level = target_levels[i];
+		streamed.requested_level = streamed.coarsest_level;
+
+		// levels are only dropped a level late or when memory is short, so that textures at a boundary do not thrash
+		bool stream_in = target_level < texture.resident_level;
+		bool stream_out = target_level > texture.resident_level + 1 || (over_budget && target_level > texture.resident_level);
+		if (streamed.pending || !(stream_in || stream_out))
+		{
+			continue;
+		}
+
+		auto image_size = getLevelsSize(texture, target_level);
+		if (upload_size > 0 && upload_size + image_size > max_upload_size)
+		{
+			continue;
+		}
+		upload_size += image_size;
+		streamed.pending.reset(new VTexture(texture_loader::createResidentImage(*context, upload_batch, texture, target_level)));
+		uploading = true;
+	}
+
+	if (uploading)
+	{
+		auto submission = upload_batch.flush();
+		for (auto& streamed : textures)
+		{
+			if (streamed.pending && streamed.submission == 0)
+			{
+				streamed.submission = submission;
+			}
+		}
+	}
+
+	return changed;
+}
+
+VkDeviceSize VTextureStreamer::getResidentSize() const
+{
+	VkDeviceSize size = 0;
+	for (const auto& streamed : textures)
+	{
+		size += getLevelsSize(*streamed.texture, streamed.texture->resident_level);
+		if (streamed.pending)
+		{
+			size += getLevelsSize(*streamed.pending, streamed.pending->resident_level);
+		}
+	}
+	return size;
+}
+
+VkDeviceSize VTextureStreamer::getLevelsSize(const VTexture& texture, uint32_t first_level)
+{
+	VkDeviceSize size = 0;
+	for (uint32_t level = first_level; level < texture.levels->getLevelCount(); level++)
+	{
+		size += texture.levels->getLevelSize(level);
+	}
+	return size;
+}
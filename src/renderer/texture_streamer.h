@@ -0,0 +1,84 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "texture_loader.h"
+#include "upload_batch.h"
+
+#include <vulkan/vulkan.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class VContext;
+
+/**
+* Streams the mip levels of textures loaded with TextureLoadOptions::streaming in and out under a memory budget.
+* Each frame the renderer requests the finest level every texture needs, and update() replaces the images
+* of textures whose resident levels should change: an image holding the wanted levels is uploaded from VTexture::levels
+* and swapped in once its upload has completed. Textures never drop below the levels they were loaded with.
+* Not thread safe
+*/
+class VTextureStreamer
+{
+public:
+	// bytes uploaded by one update() at most, unless a single texture is larger
+	static const VkDeviceSize DEFAULT_MAX_UPLOAD_SIZE = 16 * 1024 * 1024;
+
+	VTextureStreamer(const VContext& context, VkDeviceSize budget, VkDeviceSize max_upload_size = DEFAULT_MAX_UPLOAD_SIZE);
+	~VTextureStreamer() = default;
+
+	VTextureStreamer(VTextureStreamer&&) = delete;
+	VTextureStreamer& operator= (VTextureStreamer&&) = delete;
+	VTextureStreamer(const VTextureStreamer&) = delete;
+	VTextureStreamer& operator= (const VTextureStreamer&) = delete;
+
+	// textures without VTexture::levels are ignored, the others are kept alive by the streamer
+	void addTextures(const std::vector<std::shared_ptr<VTexture>>& textures);
+
+	// finest level texture needs for the next update(); a texture requested several times gets the finest one
+	void requestLevel(const VTexture* texture, uint32_t level);
+
+	/**
+	* Swaps in the images whose uploads have completed, then fits the requested levels into the budget,
+	* dropping the largest levels first, and starts the uploads to reach them. Replaced images are destroyed,
+	* so the GPU must be done with every command buffer using them; with swap_completed_uploads false
+	* the swaps wait for a later update.
+	* Returns the textures whose view changed, whose descriptors must be rewritten
+	*/
+	std::vector<const VTexture*> update(bool swap_completed_uploads = true);
+
+	// whether uploads have completed, to be swapped in by update()
+	bool hasCompletedUploads();
+
+	// device memory of the resident levels of every streamed texture, including uploads in flight
+	VkDeviceSize getResidentSize() const;
+
+	VkDeviceSize getBudget() const
+	{
+		return budget;
+	}
+
+private:
+	struct StreamedTexture
+	{
+		std::shared_ptr<VTexture> texture;
+		uint32_t coarsest_level = 0;  // the level it was loaded with
+		uint32_t requested_level = 0;
+		std::unique_ptr<VTexture> pending;  // image being uploaded
+		uint64_t submission = 0;
+	};
+
+	const VContext* context;
+	VkDeviceSize budget;
+	VkDeviceSize max_upload_size;
+	std::vector<StreamedTexture> textures;
+	std::unordered_map<const VTexture*, size_t> texture_indices;
+	// declared after the textures so that it waits for their uploads before they are destroyed
+	VUploadBatch upload_batch;
+
+	// bytes of levels first_level to the last one of texture
+	static VkDeviceSize getLevelsSize(const VTexture& texture, uint32_t first_level);
+};
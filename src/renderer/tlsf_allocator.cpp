@@ -0,0 +1,306 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "tlsf_allocator.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+	uint32_t findMostSignificantBit(uint64_t value)
+	{
+		uint32_t bit = 0;
+		while (value >>= 1)
+		{
+			bit++;
+		}
+		return bit;
+	}
+
+	uint32_t findLeastSignificantBit(uint64_t value)
+	{
+		uint32_t bit = 0;
+		while ((value & 1) == 0)
+		{
+			value >>= 1;
+			bit++;
+		}
+		return bit;
+	}
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+const uint32_t TlsfAllocator::INVALID_HANDLE;
+
+TlsfAllocator::TlsfAllocator(uint64_t size)
+	: size(size)
+{
+	for (auto& first_level : free_lists)
+	{
+		std::fill(std::begin(first_level), std::end(first_level), INVALID_HANDLE);
+	}
+	if (size > 0)
+	{
+		auto handle = createNode();
+		nodes[handle].size = size;
+		insertFreeNode(handle);
+	}
+}
+
+void TlsfAllocator::getBin(uint64_t size, uint32_t* first_level, uint32_t* second_level)
+{
+	// sizes below SECOND_LEVEL_COUNT share the first bin linearly, larger ones are split in SECOND_LEVEL_COUNT steps per power of two
+	if (size < SECOND_LEVEL_COUNT)
+	{
+		*first_level = 0;
+		*second_level = static_cast<uint32_t>(size);
+		return;
+	}
+	auto bit = findMostSignificantBit(size);
+	*first_level = bit - SECOND_LEVEL_BITS + 1;
+	*second_level = static_cast<uint32_t>(size >> (bit - SECOND_LEVEL_BITS)) - SECOND_LEVEL_COUNT;
+}
+
+uint32_t TlsfAllocator::createNode()
+{
+	if (unused_nodes != INVALID_HANDLE)
+	{
+		auto handle = unused_nodes;
+		unused_nodes = nodes[handle].next_free;
+		nodes[handle] = Node();
+		return handle;
+	}
+	nodes.emplace_back();
+	return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void TlsfAllocator::releaseNode(uint32_t handle)
+{
+	nodes[handle] = Node();
+	nodes[handle].next_free = unused_nodes;
+	unused_nodes = handle;
+}
+
+void TlsfAllocator::insertFreeNode(uint32_t handle)
+{
+	uint32_t first_level, second_level;
+	getBin(nodes[handle].size, &first_level, &second_level);
+
+	auto& head = free_lists[first_level][second_level];
+	auto& node = nodes[handle];
+	node.free = true;
+	node.previous_free = INVALID_HANDLE;
+	node.next_free = head;
+	if (head != INVALID_HANDLE)
+	{
+		nodes[head].previous_free = handle;
+	}
+	head = handle;
+	first_level_bitmap |= uint64_t(1) << first_level;
+	second_level_bitmaps[first_level] |= 1u << second_level;
+}
+
+void TlsfAllocator::removeFreeNode(uint32_t handle)
+{
+	uint32_t first_level, second_level;
+	getBin(nodes[handle].size, &first_level, &second_level);
+
+	auto& node = nodes[handle];
+	if (node.previous_free != INVALID_HANDLE)
+	{
+		nodes[node.previous_free].next_free = node.next_free;
+	}
+	else
+	{
+		free_lists[first_level][second_level] = node.next_free;
+	}
+	if (node.next_free != INVALID_HANDLE)
+	{
+		nodes[node.next_free].previous_free = node.previous_free;
+	}
+	node.free = false;
+	node.previous_free = INVALID_HANDLE;
+	node.next_free = INVALID_HANDLE;
+
+	if (free_lists[first_level][second_level] == INVALID_HANDLE)
+	{
+		second_level_bitmaps[first_level] &= ~(1u << second_level);
+		if (second_level_bitmaps[first_level] == 0)
+		{
+			first_level_bitmap &= ~(uint64_t(1) << first_level);
+		}
+	}
+}
+
+uint32_t TlsfAllocator::findFreeNode(uint64_t size)
+{
+	// round up to the next bin, so that every range of the bin found is large enough
+	if (size >= SECOND_LEVEL_COUNT)
+	{
+		auto round = (uint64_t(1) << (findMostSignificantBit(size) - SECOND_LEVEL_BITS)) - 1;
+		if (size > std::numeric_limits<uint64_t>::max() - round)
+		{
+			return INVALID_HANDLE;
+		}
+		size += round;
+	}
+	uint32_t first_level, second_level;
+	getBin(size, &first_level, &second_level);
+	if (first_level >= FIRST_LEVEL_COUNT)
+	{
+		return INVALID_HANDLE;
+	}
+
+	auto second_level_map = second_level_bitmaps[first_level] & (~0u << second_level);
+	if (second_level_map == 0)
+	{
+		auto first_level_map = first_level + 1 < 64 ? first_level_bitmap & (~uint64_t(0) << (first_level + 1)) : 0;
+		if (first_level_map == 0)
+		{
+			return INVALID_HANDLE;
+		}
+		first_level = findLeastSignificantBit(first_level_map);
+		second_level_map = second_level_bitmaps[first_level];
+	}
+	second_level = findLeastSignificantBit(second_level_map);
+	return free_lists[first_level][second_level];
+}
+
+uint32_t TlsfAllocator::findFittingNode(uint64_t size, uint64_t alignment)
+{
+	uint32_t first_level, second_level;
+	getBin(size, &first_level, &second_level);
+	for (auto handle = free_lists[first_level][second_level]; handle != INVALID_HANDLE; handle = nodes[handle].next_free)
+	{
+		const auto& node = nodes[handle];
+		if (alignUp(node.offset, alignment) + size <= node.offset + node.size)
+		{
+			return handle;
+		}
+	}
+	return INVALID_HANDLE;
+}
+
+uint32_t TlsfAllocator::split(uint32_t handle, uint64_t offset)
+{
+	auto back = createNode();
+	auto& node = nodes[handle];
+	auto& back_node = nodes[back];
+	back_node.offset = offset;
+	back_node.size = node.offset + node.size - offset;
+	back_node.previous_physical = handle;
+	back_node.next_physical = node.next_physical;
+	if (node.next_physical != INVALID_HANDLE)
+	{
+		nodes[node.next_physical].previous_physical = back;
+	}
+	node.next_physical = back;
+	node.size = offset - node.offset;
+	return back;
+}
+
+uint32_t TlsfAllocator::allocate(uint64_t size, uint64_t alignment, uint64_t* offset)
+{
+	if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0)
+	{
+		throw std::runtime_error("TlsfAllocator: invalid allocation size or alignment");
+	}
+
+	// any range of at least size + alignment - 1 bytes holds an aligned allocation
+	auto handle = findFreeNode(size + alignment - 1);
+	if (handle == INVALID_HANDLE)
+	{
+		// the rounded up bins skip ranges that fit exactly, such as one freed by an allocation of the same size
+		handle = findFittingNode(size, alignment);
+		if (handle == INVALID_HANDLE)
+		{
+			return INVALID_HANDLE;
+		}
+	}
+	removeFreeNode(handle);
+
+	auto aligned_offset = alignUp(nodes[handle].offset, alignment);
+	if (aligned_offset > nodes[handle].offset)
+	{
+		// the padding in front stays free
+		auto front = handle;
+		handle = split(front, aligned_offset);
+		insertFreeNode(front);
+	}
+	if (nodes[handle].size > size)
+	{
+		insertFreeNode(split(handle, aligned_offset + size));
+	}
+
+	used_size += nodes[handle].size;
+	allocation_count++;
+	*offset = aligned_offset;
+	return handle;
+}
+
+void TlsfAllocator::free(uint32_t handle)
+{
+	if (handle >= nodes.size() || nodes[handle].free || nodes[handle].size == 0)
+	{
+		throw std::runtime_error("TlsfAllocator: invalid handle freed");
+	}
+	used_size -= nodes[handle].size;
+	allocation_count--;
+
+	// merge with the free neighbours
+	auto previous = nodes[handle].previous_physical;
+	if (previous != INVALID_HANDLE && nodes[previous].free)
+	{
+		removeFreeNode(previous);
+		nodes[previous].size += nodes[handle].size;
+		nodes[previous].next_physical = nodes[handle].next_physical;
+		if (nodes[handle].next_physical != INVALID_HANDLE)
+		{
+			nodes[nodes[handle].next_physical].previous_physical = previous;
+		}
+		releaseNode(handle);
+		handle = previous;
+	}
+	auto next = nodes[handle].next_physical;
+	if (next != INVALID_HANDLE && nodes[next].free)
+	{
+		removeFreeNode(next);
+		nodes[handle].size += nodes[next].size;
+		nodes[handle].next_physical = nodes[next].next_physical;
+		if (nodes[next].next_physical != INVALID_HANDLE)
+		{
+			nodes[nodes[next].next_physical].previous_physical = handle;
+		}
+		releaseNode(next);
+	}
+	insertFreeNode(handle);
+}
+
+uint32_t TlsfAllocator::getFreeRangeCount() const
+{
+	uint32_t count = 0;
+	for (const auto& node : nodes)
+	{
+		count += node.free ? 1 : 0;
+	}
+	return count;
+}
+
+uint64_t TlsfAllocator::getLargestFreeRange() const
+{
+	uint64_t largest = 0;
+	for (const auto& node : nodes)
+	{
+		if (node.free)
+		{
+			largest = std::max(largest, node.size);
+		}
+	}
+	return largest;
+}
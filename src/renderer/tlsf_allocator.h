@@ -0,0 +1,92 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+* Two-level segregated fit allocator of offsets in a range of a fixed size, used to sub-allocate device memory blocks.
+* Free ranges are binned by the power of two of their size and 16 linear steps within it, so that
+* finding a range large enough and merging freed ranges with their free neighbours take constant time.
+* Only offsets are managed, the memory itself is never touched
+*/
+class TlsfAllocator
+{
+public:
+	static const uint32_t INVALID_HANDLE = ~0u;
+
+	explicit TlsfAllocator(uint64_t size);
+
+	/**
+	* Allocates size bytes at an offset aligned to alignment, a power of two.
+	* Ranges are taken from the bins in constant time. When none of them is certain to fit, only the ranges
+	* in the bin of size itself are searched, so a request can fail while a range elsewhere would fit it.
+	* Returns a handle to free it with, or INVALID_HANDLE if no fitting range was found
+	*/
+	uint32_t allocate(uint64_t size, uint64_t alignment, uint64_t* offset);
+	void free(uint32_t handle);
+
+	uint64_t getSize() const
+	{
+		return size;
+	}
+
+	uint64_t getUsedSize() const
+	{
+		return used_size;
+	}
+
+	uint32_t getAllocationCount() const
+	{
+		return allocation_count;
+	}
+
+	bool isEmpty() const
+	{
+		return allocation_count == 0;
+	}
+
+	uint32_t getFreeRangeCount() const;
+	uint64_t getLargestFreeRange() const;
+
+private:
+	static const uint32_t SECOND_LEVEL_BITS = 4;
+	static const uint32_t SECOND_LEVEL_COUNT = 1 << SECOND_LEVEL_BITS;
+	static const uint32_t FIRST_LEVEL_COUNT = 64 - SECOND_LEVEL_BITS + 1;
+
+	// a range of the allocator, free or allocated, linked to its neighbours in offset order
+	struct Node
+	{
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		uint32_t previous_physical = INVALID_HANDLE;
+		uint32_t next_physical = INVALID_HANDLE;
+		uint32_t previous_free = INVALID_HANDLE;  // in the list of its bin, or of unused nodes
+		uint32_t next_free = INVALID_HANDLE;
+		bool free = false;
+	};
+
+	uint64_t size;
+	uint64_t used_size = 0;
+	uint32_t allocation_count = 0;
+
+	std::vector<Node> nodes;
+	uint32_t unused_nodes = INVALID_HANDLE;
+	uint64_t first_level_bitmap = 0;
+	uint32_t second_level_bitmaps[FIRST_LEVEL_COUNT] = {};
+	uint32_t free_lists[FIRST_LEVEL_COUNT][SECOND_LEVEL_COUNT];
+
+	static void getBin(uint64_t size, uint32_t* first_level, uint32_t* second_level);
+
+	uint32_t createNode();
+	void releaseNode(uint32_t handle);
+	void insertFreeNode(uint32_t handle);
+	void removeFreeNode(uint32_t handle);
+	uint32_t findFreeNode(uint64_t size);
+	// a free range of the bin of size that holds size bytes at an aligned offset
+	uint32_t findFittingNode(uint64_t size, uint64_t alignment);
+	// splits the range of handle at offset; returns the node of the back part, which is not linked to any list
+	uint32_t split(uint32_t handle, uint64_t offset);
+};
@@ -0,0 +1,330 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "upload_batch.h"
+
+#include "context.h"
+#include "vulkan_util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+	const VkDeviceSize STAGING_ALIGNMENT = 16;
+
+	VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// layout transition of mip levels, ordered after the transfers recorded before it
+	void recordMipLevelBarrier(VkCommandBuffer command_buffer, VkImage image, uint32_t base_mip_level, uint32_t mip_levels
+		, VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = old_layout;
+		barrier.newLayout = new_layout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = base_mip_level;
+		barrier.subresourceRange.levelCount = mip_levels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = src_access;
+		barrier.dstAccessMask = dst_access;
+		vkCmdPipelineBarrier(command_buffer
+			, VK_PIPELINE_STAGE_TRANSFER_BIT
+			, dst_stage
+			, 0
+			, 0, nullptr
+			, 0, nullptr
+			, 1, &barrier
+		);
+	}
+
+	int32_t getMipExtent(uint32_t extent, uint32_t mip_level)
+	{
+		return static_cast<int32_t>(std::max<uint32_t>(extent >> mip_level, 1));
+	}
+}
+
+VUploadBatch::VUploadBatch(const VContext& context, VkDeviceSize staging_block_size)
+	: context(&context)
+	, device(context.getDevice())
+	, staging_block_size(staging_block_size)
+{
+	// buffer to image copies need offsets aligned to the texel size as well
+	image_offset_alignment = std::max<VkDeviceSize>(
+		std::max<VkDeviceSize>(context.getPhysicalDeviceProperties().limits.optimalBufferCopyOffsetAlignment, 4)
+		, STAGING_ALIGNMENT);
+}
+
+VUploadBatch::~VUploadBatch()
+{
+	if (command_buffer != VK_NULL_HANDLE)
+	{
+		// never submitted, the recorded copies are dropped
+		vkFreeCommandBuffers(device, context->getGraphicsCommandPool(), 1, &command_buffer);
+	}
+	retireSubmissions(submission_count);
+	releaseStaging();
+}
+
+std::pair<VUploadBatch::StagingBlock*, VkDeviceSize> VUploadBatch::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+	if (!blocks.empty())
+	{
+		auto& block = blocks.back();
+		auto offset = alignUp(block.used, alignment);
+		if (offset + size <= block.size)
+		{
+			block.used = offset + size;
+			block.last_submission = submission_count + 1;
+			return { &block, offset };
+		}
+	}
+
+	// oversized requests get a block of their own
+	VUtility utility{ *context };
+	blocks.emplace_back();
+	auto& block = blocks.back();
+	block.size = std::max(size, staging_block_size);
+	std::tie(block.buffer, block.memory) = utility.createBuffer(block.size
+		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	block.mapped = static_cast<char*>(block.memory.getMappedData());
+	block.used = size;
+	block.last_submission = submission_count + 1;
+	return { &block, 0 };
+}
+
+VkCommandBuffer VUploadBatch::getCommandBuffer()
+{
+	if (command_buffer == VK_NULL_HANDLE)
+	{
+		VkCommandBufferAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandPool = context->getGraphicsCommandPool();
+		alloc_info.commandBufferCount = 1;
+		vulkan_util::checkResult(vkAllocateCommandBuffers(device, &alloc_info, &command_buffer), "Failed to allocate upload command buffer!");
+
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(command_buffer, &begin_info);
+	}
+	return command_buffer;
+}
+
+void* VUploadBatch::stageBuffer(VkBuffer dst_buffer, VkDeviceSize dst_offset, VkDeviceSize size)
+{
+	auto allocation = allocate(size, STAGING_ALIGNMENT);
+	staged_size += size;
+
+	VkBufferCopy copy_region = {};
+	copy_region.srcOffset = allocation.second;
+	copy_region.dstOffset = dst_offset;
+	copy_region.size = size;
+	vkCmdCopyBuffer(getCommandBuffer(), allocation.first->buffer.get(), dst_buffer, 1, &copy_region);
+
+	return allocation.first->mapped + allocation.second;
+}
+
+void VUploadBatch::uploadBuffer(VkBuffer dst_buffer, VkDeviceSize dst_offset, const void* data, VkDeviceSize size)
+{
+	memcpy(stageBuffer(dst_buffer, dst_offset, size), data, static_cast<size_t>(size));
+}
+
+void* VUploadBatch::stageImage(VkImage dst_image, uint32_t width, uint32_t height, uint32_t mip_levels)
+{
+	VkDeviceSize size = VkDeviceSize(width) * height * 4;
+	auto allocation = allocate(size, image_offset_alignment);
+	staged_size += size;
+
+	VUtility utility{ *context };
+	auto command = getCommandBuffer();
+	utility.recordTransitImageLayout(command, dst_image, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, mip_levels);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = allocation.second;
+	region.bufferRowLength = 0; // tightly packed
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { width, height, 1 };
+	vkCmdCopyBufferToImage(command, allocation.first->buffer.get(), dst_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	// every level is filtered down from the one above it, which is then left for sampling
+	for (uint32_t level = 1; level < mip_levels; level++)
+	{
+		recordMipLevelBarrier(command, dst_image, level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+			, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+		VkImageBlit blit = {};
+		blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+		blit.srcOffsets[1] = { getMipExtent(width, level - 1), getMipExtent(height, level - 1), 1 };
+		blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+		blit.dstOffsets[1] = { getMipExtent(width, level), getMipExtent(height, level), 1 };
+		vkCmdBlitImage(command
+			, dst_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+			, dst_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+			, 1, &blit, VK_FILTER_LINEAR);
+
+		recordMipLevelBarrier(command, dst_image, level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+			, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+	recordMipLevelBarrier(command, dst_image, mip_levels - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+	return allocation.first->mapped + allocation.second;
+}
+
+void VUploadBatch::uploadImageLevels(VkImage dst_image, uint32_t width, uint32_t height, const std::vector<std::pair<const void*, VkDeviceSize>>& levels)
+{
+	auto mip_levels = static_cast<uint32_t>(levels.size());
+	std::vector<VkDeviceSize> level_offsets(levels.size());
+	VkDeviceSize size = 0;
+	for (size_t level = 0; level < levels.size(); level++)
+	{
+		level_offsets[level] = alignUp(size, image_offset_alignment);
+		size = level_offsets[level] + levels[level].second;
+	}
+	auto allocation = allocate(size, image_offset_alignment);
+	staged_size += size;
+
+	std::vector<VkBufferImageCopy> regions(levels.size());
+	for (uint32_t level = 0; level < mip_levels; level++)
+	{
+		memcpy(allocation.first->mapped + allocation.second + level_offsets[level], levels[level].first, static_cast<size_t>(levels[level].second));
+
+		auto& region = regions[level];
+		region.bufferOffset = allocation.second + level_offsets[level];
+		region.bufferRowLength = 0; // tightly packed
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { static_cast<uint32_t>(getMipExtent(width, level)), static_cast<uint32_t>(getMipExtent(height, level)), 1 };
+	}
+
+	VUtility utility{ *context };
+	auto command = getCommandBuffer();
+	utility.recordTransitImageLayout(command, dst_image, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, mip_levels);
+	vkCmdCopyBufferToImage(command, allocation.first->buffer.get(), dst_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+		, static_cast<uint32_t>(regions.size()), regions.data());
+	recordMipLevelBarrier(command, dst_image, 0, mip_levels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+uint64_t VUploadBatch::flush()
+{
+	if (command_buffer == VK_NULL_HANDLE)
+	{
+		return submission_count;
+	}
+
+	// make the copied data visible to every later use, so callers need no barriers of their own
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+		| VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(command_buffer
+		, VK_PIPELINE_STAGE_TRANSFER_BIT
+		, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
+		, 0
+		, 1, &barrier
+		, 0, nullptr
+		, 0, nullptr
+	);
+	vkEndCommandBuffer(command_buffer);
+
+	VkFenceCreateInfo fence_info = {};
+	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	VkFence fence_handle;
+	vulkan_util::checkResult(vkCreateFence(device, &fence_info, nullptr, &fence_handle), "Failed to create upload fence!");
+	VRaii<VkFence> fence(fence_handle, [device = this->device](auto& obj) { vkDestroyFence(device, obj, nullptr); });
+
+	VkSubmitInfo submit_info = {};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &command_buffer;
+	vulkan_util::checkResult(vkQueueSubmit(context->getGraphicsQueue(), 1, &submit_info, fence.get()), "Failed to submit uploads!");
+
+	submission_count++;
+	pending_submissions.push_back({ submission_count, command_buffer, std::move(fence) });
+	command_buffer = VK_NULL_HANDLE;
+	return submission_count;
+}
+
+bool VUploadBatch::isSubmissionComplete(uint64_t submission)
+{
+	retireSubmissions(0);
+	return submission <= completed_submission_count;
+}
+
+void VUploadBatch::waitForSubmission(uint64_t submission)
+{
+	retireSubmissions(submission);
+}
+
+void VUploadBatch::submit()
+{
+	flush();
+	retireSubmissions(submission_count);
+	releaseStaging();
+}
+
+void VUploadBatch::retireSubmissions(uint64_t wait_until)
+{
+	while (!pending_submissions.empty())
+	{
+		auto& submission = pending_submissions.front();
+		if (submission.id <= wait_until)
+		{
+			vulkan_util::checkResult(vkWaitForFences(device, 1, submission.fence.data(), VK_TRUE, std::numeric_limits<uint64_t>::max())
+				, "Failed to wait for uploads!");
+		}
+		else if (vkGetFenceStatus(device, submission.fence.get()) != VK_SUCCESS)
+		{
+			break;
+		}
+		vkFreeCommandBuffers(device, context->getGraphicsCommandPool(), 1, &submission.command_buffer);
+		completed_submission_count = submission.id;
+		pending_submissions.pop_front();
+	}
+
+	// the current block is rewound rather than released, the others are released once nothing reads them
+	for (size_t i = 0; i + 1 < blocks.size();)
+	{
+		if (blocks[i].last_submission <= completed_submission_count)
+		{
+			blocks.erase(blocks.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+	if (!blocks.empty() && blocks.back().last_submission <= completed_submission_count)
+	{
+		blocks.back().used = 0;
+	}
+}
+
+void VUploadBatch::releaseStaging()
+{
+	blocks.clear();
+	staged_size = 0;
+}
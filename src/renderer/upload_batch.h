@@ -0,0 +1,116 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "raii.h"
+#include "memory_allocator.h"
+
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+#include <deque>
+#include <utility>
+
+class VContext;
+
+/**
+* Batches uploads of buffer and image data to device local memory.
+* Data is packed into a few large persistently mapped staging blocks and every copy is recorded
+* into one command buffer, which submit() sends to the graphics queue with a single fence wait.
+* flush() sends the copies recorded so far without waiting, so the GPU can copy while more data is staged.
+* Staging blocks are recycled once every submission reading them has completed
+*/
+class VUploadBatch
+{
+public:
+	static const VkDeviceSize DEFAULT_STAGING_BLOCK_SIZE = 64 * 1024 * 1024;
+
+	VUploadBatch(const VContext& context, VkDeviceSize staging_block_size = DEFAULT_STAGING_BLOCK_SIZE);
+	~VUploadBatch();
+
+	VUploadBatch(VUploadBatch&&) = delete;
+	VUploadBatch& operator= (VUploadBatch&&) = delete;
+	VUploadBatch(const VUploadBatch&) = delete;
+	VUploadBatch& operator= (const VUploadBatch&) = delete;
+
+	/**
+	* Records a copy of size bytes into dst_buffer at dst_offset and returns the staging memory to fill.
+	* The memory stays valid until submit()
+	*/
+	void* stageBuffer(VkBuffer dst_buffer, VkDeviceSize dst_offset, VkDeviceSize size);
+
+	void uploadBuffer(VkBuffer dst_buffer, VkDeviceSize dst_offset, const void* data, VkDeviceSize size);
+
+	/**
+	* Records a copy of tightly packed RGBA8 pixels into mip level 0 of an image created in the preinitialized layout
+	* and returns the staging memory to fill. Levels 1 to mip_levels - 1 are then generated by linear blits,
+	* so the format must support blits and linear filtering with optimal tiling.
+	* All levels are left in the shader read only layout
+	*/
+	void* stageImage(VkImage dst_image, uint32_t width, uint32_t height, uint32_t mip_levels = 1);
+
+	/**
+	* Records copies of prebuilt mip levels, such as block compressed ones, into an image created in the preinitialized layout,
+	* level 0 first, and leaves all of them in the shader read only layout. The data is copied into staging memory right away
+	*/
+	void uploadImageLevels(VkImage dst_image, uint32_t width, uint32_t height, const std::vector<std::pair<const void*, VkDeviceSize>>& levels);
+
+	/**
+	* Submits the copies recorded so far with a fence of their own and returns without waiting.
+	* Returns the id of the submission, to be polled with isSubmissionComplete()
+	*/
+	uint64_t flush();
+
+	// Polls the fences of flushed submissions and releases the staging memory they no longer need
+	bool isSubmissionComplete(uint64_t submission);
+
+	void waitForSubmission(uint64_t submission);
+
+	// Submits all recorded copies and waits for every submission on its fence; the batch can be reused afterwards
+	void submit();
+
+	VkDeviceSize getStagedSize() const
+	{
+		return staged_size;
+	}
+
+private:
+	struct StagingBlock
+	{
+		VRaii<VkBuffer> buffer;
+		VMemoryAllocation memory;
+		char* mapped = nullptr;
+		VkDeviceSize size = 0;
+		VkDeviceSize used = 0;
+		uint64_t last_submission = 0;  // id of the last submission reading the block
+	};
+
+	struct PendingSubmission
+	{
+		uint64_t id;
+		VkCommandBuffer command_buffer;
+		VRaii<VkFence> fence;
+	};
+
+	const VContext* context;
+	VkDevice device;
+	VkDeviceSize staging_block_size;
+	VkDeviceSize image_offset_alignment;
+
+	std::vector<StagingBlock> blocks;
+	VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+	VkDeviceSize staged_size = 0;
+
+	std::deque<PendingSubmission> pending_submissions;  // in submission order
+	uint64_t submission_count = 0;
+	uint64_t completed_submission_count = 0;
+
+	// returns the block and offset of size bytes of staging memory
+	std::pair<StagingBlock*, VkDeviceSize> allocate(VkDeviceSize size, VkDeviceSize alignment);
+	VkCommandBuffer getCommandBuffer();
+	// frees the completed submissions in order, waiting for those up to wait_until
+	void retireSubmissions(uint64_t wait_until);
+	void releaseStaging();
+};
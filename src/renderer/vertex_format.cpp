@@ -0,0 +1,298 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "vertex_format.h"
+
+#include "vulkan_util.h"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+static_assert(sizeof(CompactVertex) == 20, "unexpected padding in CompactVertex");
+static_assert(sizeof(QuantizedVertex) == 16, "unexpected padding in QuantizedVertex");
+static_assert(sizeof(VertexPushConstantObject) == 32, "unexpected padding in VertexPushConstantObject");
+
+size_t vertex_format::getVertexStride(VertexFormat format)
+{
+	switch (format)
+	{
+	case VertexFormat::full:
+		return sizeof(util::Vertex);
+	case VertexFormat::compact:
+		return sizeof(CompactVertex);
+	case VertexFormat::quantized:
+		return sizeof(QuantizedVertex);
+	}
+	throw std::runtime_error("unknown vertex format");
+}
+
+VkVertexInputBindingDescription vertex_format::getVertexBindingDescription(VertexFormat format)
+{
+	auto binding_description = vulkan_util::getVertexBindingDesciption();
+	binding_description.stride = static_cast<uint32_t>(getVertexStride(format));
+	return binding_description;
+}
+
+std::vector<VkVertexInputAttributeDescription> vertex_format::getVertexAttributeDescriptions(VertexFormat format)
+{
+	if (format == VertexFormat::full)
+	{
+		auto full_descriptions = vulkan_util::getVertexAttributeDescriptions();
+		return std::vector<VkVertexInputAttributeDescription>(full_descriptions.begin(), full_descriptions.end());
+	}
+
+	// same locations as the full format, color is dropped
+	std::vector<VkVertexInputAttributeDescription> attr_descriptions(3);
+	attr_descriptions[0].binding = 0;
+	attr_descriptions[0].location = 0;
+	attr_descriptions[1].binding = 0;
+	attr_descriptions[1].location = 2;
+	attr_descriptions[1].format = VK_FORMAT_R16G16_SFLOAT;
+	attr_descriptions[2].binding = 0;
+	attr_descriptions[2].location = 3;
+	attr_descriptions[2].format = VK_FORMAT_R16G16_SNORM;
+
+	if (format == VertexFormat::compact)
+	{
+		attr_descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attr_descriptions[0].offset = offsetof(CompactVertex, pos);
+		attr_descriptions[1].offset = offsetof(CompactVertex, tex_coord);
+		attr_descriptions[2].offset = offsetof(CompactVertex, normal);
+	}
+	else
+	{
+		attr_descriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+		attr_descriptions[0].offset = offsetof(QuantizedVertex, pos);
+		attr_descriptions[1].offset = offsetof(QuantizedVertex, tex_coord);
+		attr_descriptions[2].offset = offsetof(QuantizedVertex, normal);
+	}
+	return attr_descriptions;
+}
+
+const char* vertex_format::getForwardPlusVertexShaderName(VertexFormat format)
+{
+	return format == VertexFormat::full ? "forwardplus_vert.spv" : "forwardplus_compact_vert.spv";
+}
+
+const char* vertex_format::getDepthVertexShaderName(VertexFormat format)
+{
+	return format == VertexFormat::full ? "depth_vert.spv" : "depth_compact_vert.spv";
+}
+
+VertexQuantization vertex_format::computeQuantization(VertexFormat format, const util::Vertex* vertices, size_t vertex_count)
+{
+	VertexQuantization quantization;
+	if (format != VertexFormat::quantized || vertex_count == 0)
+	{
+		return quantization;
+	}
+
+	glm::vec3 min_pos = vertices[0].pos;
+	glm::vec3 max_pos = vertices[0].pos;
+	for (size_t i = 1; i < vertex_count; i++)
+	{
+		min_pos = glm::min(min_pos, vertices[i].pos);
+		max_pos = glm::max(max_pos, vertices[i].pos);
+	}
+
+	quantization.bias = min_pos;
+	quantization.scale = (max_pos - min_pos) / 65535.0f;
+	return quantization;
+}
+
+size_t vertex_format::getPositionStride(VertexFormat format)
+{
+	return format == VertexFormat::quantized ? sizeof(QuantizedVertex::pos) : sizeof(glm::vec3);
+}
+
+VkVertexInputBindingDescription vertex_format::getPositionBindingDescription(VertexFormat format)
+{
+	auto binding_description = vulkan_util::getVertexBindingDesciption();
+	binding_description.stride = static_cast<uint32_t>(getPositionStride(format));
+	return binding_description;
+}
+
+std::vector<VkVertexInputAttributeDescription> vertex_format::getPositionAttributeDescriptions(VertexFormat format)
+{
+	std::vector<VkVertexInputAttributeDescription> attr_descriptions(1);
+	attr_descriptions[0].binding = 0;
+	attr_descriptions[0].location = 0;
+	attr_descriptions[0].format = format == VertexFormat::quantized ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
+	attr_descriptions[0].offset = 0;
+	return attr_descriptions;
+}
+
+namespace
+{
+	const util::Vertex::index_t EMPTY_SLOT = 0xFFFFFFFFu;
+
+	/**
+	* Open-addressing (linear probing) table from encoded position bytes to an index into a position stream,
+	* like the vertex table of the mesh loader. Slots store only 32-bit indices, positions are compared bytewise against the stream
+	*/
+	class PositionDedupTable
+	{
+	public:
+		using index_t = util::Vertex::index_t;
+
+		// max_positions is an upper bound of unique positions, so the table never grows
+		PositionDedupTable(size_t max_positions, size_t stride)
+			: stride(stride)
+		{
+			size_t capacity = 16;
+			while (capacity < max_positions * 2)
+			{
+				capacity *= 2;
+			}
+			slots.assign(capacity, EMPTY_SLOT);
+		}
+
+		/**
+		* Returns the index of equal position bytes in positions, or appends position and returns its new index
+		*/
+		index_t findOrInsert(const char* position, std::vector<char>* positions)
+		{
+			size_t mask = slots.size() - 1;
+			for (size_t slot = hashPosition(position) & mask; ; slot = (slot + 1) & mask)
+			{
+				auto index = slots[slot];
+				if (index == EMPTY_SLOT)
+				{
+					index = static_cast<index_t>(positions->size() / stride);
+					positions->insert(positions->end(), position, position + stride);
+					slots[slot] = index;
+					return index;
+				}
+				if (memcmp(positions->data() + index * stride, position, stride) == 0)
+				{
+					return index;
+				}
+			}
+		}
+
+	private:
+		std::vector<index_t> slots;
+		size_t stride;
+
+		// positions are whole 32-bit words in every format
+		size_t hashPosition(const char* position) const
+		{
+			uint64_t hash = 0xcbf29ce484222325ull;
+			for (size_t offset = 0; offset < stride; offset += sizeof(uint32_t))
+			{
+				uint32_t word;
+				memcpy(&word, position + offset, sizeof(word));
+				hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+				hash ^= hash >> 32;
+			}
+			return static_cast<size_t>(hash);
+		}
+	};
+}
+
+void vertex_format::buildPositionStream(VertexFormat format, const util::Vertex* vertices, size_t vertex_count
+	, const util::Vertex::index_t* indices, size_t index_count, const VertexQuantization& quantization
+	, std::vector<char>* positions, std::vector<util::Vertex::index_t>* position_indices)
+{
+	auto stride = getPositionStride(format);
+	auto vertex_stride = getVertexStride(format);
+	positions->clear();
+	positions->reserve(vertex_count * stride);
+	position_indices->resize(index_count);
+
+	// encode every vertex once, then deduplicate the encoded position bytes
+	std::vector<char> encoded(vertex_count * vertex_stride);
+	encodeVertices(format, vertices, vertex_count, quantization, encoded.data());
+
+	PositionDedupTable unique_positions(vertex_count, stride);
+	std::vector<util::Vertex::index_t> remap(vertex_count, EMPTY_SLOT);
+	for (size_t i = 0; i < index_count; i++)
+	{
+		auto vertex = indices[i];
+		if (remap[vertex] == EMPTY_SLOT)
+		{
+			// position is the first member in all formats
+			remap[vertex] = unique_positions.findOrInsert(encoded.data() + vertex * vertex_stride, positions);
+		}
+		(*position_indices)[i] = remap[vertex];
+	}
+}
+
+uint32_t vertex_format::encodeNormal(const glm::vec3& normal)
+{
+	float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	if (length < util::SMALL_NUMBER)
+	{
+		return glm::packSnorm2x16(glm::vec2(0.0f));
+	}
+	glm::vec3 n = normal / length;
+	glm::vec2 encoded(n.x, n.y);
+	if (n.z < 0.0f)
+	{
+		// fold the lower hemisphere over the diagonals
+		encoded = glm::vec2(
+			(1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f)
+		);
+	}
+	return glm::packSnorm2x16(encoded);
+}
+
+glm::vec3 vertex_format::decodeNormal(uint32_t packed)
+{
+	glm::vec2 encoded = glm::unpackSnorm2x16(packed);
+	glm::vec3 n(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+	float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+void vertex_format::encodeVertices(VertexFormat format, const util::Vertex* vertices, size_t vertex_count, const VertexQuantization& quantization, void* dst)
+{
+	switch (format)
+	{
+	case VertexFormat::full:
+	{
+		memcpy(dst, vertices, sizeof(util::Vertex) * vertex_count);
+		break;
+	}
+	case VertexFormat::compact:
+	{
+		auto out = static_cast<CompactVertex*>(dst);
+		for (size_t i = 0; i < vertex_count; i++)
+		{
+			CompactVertex vertex;
+			vertex.pos = vertices[i].pos;
+			vertex.normal = encodeNormal(vertices[i].normal);
+			vertex.tex_coord = glm::packHalf2x16(vertices[i].tex_coord);
+			memcpy(&out[i], &vertex, sizeof(vertex)); // dst may be unaligned mapped memory
+		}
+		break;
+	}
+	case VertexFormat::quantized:
+	{
+		auto out = static_cast<QuantizedVertex*>(dst);
+		glm::vec3 inverse_scale = glm::vec3(
+			quantization.scale.x > 0.0f ? 1.0f / quantization.scale.x : 0.0f,
+			quantization.scale.y > 0.0f ? 1.0f / quantization.scale.y : 0.0f,
+			quantization.scale.z > 0.0f ? 1.0f / quantization.scale.z : 0.0f
+		);
+		for (size_t i = 0; i < vertex_count; i++)
+		{
+			QuantizedVertex vertex;
+			glm::vec3 normalized = glm::clamp((vertices[i].pos - quantization.bias) * inverse_scale, 0.0f, 65535.0f);
+			for (int c = 0; c < 3; c++)
+			{
+				vertex.pos[c] = static_cast<uint16_t>(normalized[c] + 0.5f);
+			}
+			vertex.pos[3] = 0;
+			vertex.normal = encodeNormal(vertices[i].normal);
+			vertex.tex_coord = glm::packHalf2x16(vertices[i].tex_coord);
+			memcpy(&out[i], &vertex, sizeof(vertex));
+		}
+		break;
+	}
+	}
+}
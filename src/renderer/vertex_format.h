@@ -0,0 +1,107 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "../util.h"
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+/**
+* Layout of vertices in GPU vertex buffers.
+* full: util::Vertex as is (44 bytes)
+* compact: float3 position, octahedral snorm16x2 normal, half2 tex coord (20 bytes)
+* quantized: unorm16x4 position dequantized with a per mesh part scale and bias, otherwise as compact (16 bytes)
+*/
+enum class VertexFormat
+{
+	full,
+	compact,
+	quantized,
+};
+
+struct CompactVertex
+{
+	glm::vec3 pos;
+	uint32_t normal;  // octahedral, snorm16x2
+	uint32_t tex_coord;  // half2
+};
+
+struct QuantizedVertex
+{
+	uint16_t pos[4];  // unorm16, w unused
+	uint32_t normal;  // octahedral, snorm16x2
+	uint32_t tex_coord;  // half2
+};
+
+/**
+* position = bias + scale * stored position, pushed to the vertex shader per mesh part.
+* Identity for full and compact formats
+*/
+struct VertexQuantization
+{
+	glm::vec3 scale = glm::vec3(1.0f);
+	glm::vec3 bias = glm::vec3(0.0f);
+};
+
+// vertex stage push constants, following the fragment stage PushConstantObject
+struct VertexPushConstantObject
+{
+	glm::vec4 position_scale;
+	glm::vec4 position_bias;
+
+	VertexPushConstantObject(const VertexQuantization& quantization)
+		: position_scale(quantization.scale, 0.0f)
+		, position_bias(quantization.bias, 0.0f)
+	{}
+};
+
+const uint32_t VERTEX_PUSH_CONSTANT_OFFSET = 32;
+
+namespace vertex_format
+{
+	size_t getVertexStride(VertexFormat format);
+
+	VkVertexInputBindingDescription getVertexBindingDescription(VertexFormat format);
+
+	std::vector<VkVertexInputAttributeDescription> getVertexAttributeDescriptions(VertexFormat format);
+
+	// shader file names for the format, in content folder
+	const char* getForwardPlusVertexShaderName(VertexFormat format);
+	const char* getDepthVertexShaderName(VertexFormat format);
+
+	/**
+	* Computes the position scale and bias of a mesh part for the format
+	*/
+	VertexQuantization computeQuantization(VertexFormat format, const util::Vertex* vertices, size_t vertex_count);
+
+	/**
+	* Writes vertex_count vertices in the format to dst, which must hold getVertexStride(format) * vertex_count bytes
+	*/
+	void encodeVertices(VertexFormat format, const util::Vertex* vertices, size_t vertex_count, const VertexQuantization& quantization, void* dst);
+
+	/**
+	* Positions for the depth prepass, encoded as in the format's vertices (float3, or unorm16x4 for quantized)
+	* but without the other attributes, on binding 0 location 0
+	*/
+	size_t getPositionStride(VertexFormat format);
+	VkVertexInputBindingDescription getPositionBindingDescription(VertexFormat format);
+	std::vector<VkVertexInputAttributeDescription> getPositionAttributeDescriptions(VertexFormat format);
+
+	/**
+	* Builds a position stream with one entry per distinct encoded position, ordered by first use,
+	* and an index buffer into it with the same triangles as indices
+	*/
+	void buildPositionStream(VertexFormat format, const util::Vertex* vertices, size_t vertex_count
+		, const util::Vertex::index_t* indices, size_t index_count, const VertexQuantization& quantization
+		, std::vector<char>* positions, std::vector<util::Vertex::index_t>* position_indices);
+
+	// octahedral normal encoding, packed as snorm16x2
+	uint32_t encodeNormal(const glm::vec3& normal);
+	glm::vec3 decodeNormal(uint32_t packed);
+}
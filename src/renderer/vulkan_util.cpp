@@ -53,24 +53,6 @@ void vulkan_util::checkResult(VkResult result, const char * what)
 
 }
 
-uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties, VkPhysicalDevice physical_device)
-{
-	VkPhysicalDeviceMemoryProperties memory_properties;
-	vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
-
-	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
-	{
-		bool type_supported = (type_filter & (1 << i)) != 0;
-		bool properties_supported = ((memory_properties.memoryTypes[i].propertyFlags & properties) == properties);
-		if (type_supported && properties_supported)
-		{
-			return i;
-		}
-	}
-
-	throw std::runtime_error("Failed to find suitable memory type!");
-}
-
 VUtility::VUtility(const VContext & context)
 	: context(&context)
 	, physical_device(context.getPhysicalDevice())
@@ -161,7 +143,7 @@ VkFormat VUtility::findSupportedFormat(const std::vector<VkFormat>& candidates
 	throw std::runtime_error("Failed to find supported format!");
 }
 
-std::tuple<VRaii<VkBuffer>, VRaii<VkDeviceMemory>> VUtility::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags property_bits
+std::tuple<VRaii<VkBuffer>, VMemoryAllocation> VUtility::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags property_bits
 	, int sharing_queue_family_index_a, int sharing_queue_family_index_b)
 {
 	VkBufferCreateInfo buffer_info = {};
@@ -191,26 +173,14 @@ std::tuple<VRaii<VkBuffer>, VRaii<VkDeviceMemory>> VUtility::createBuffer(VkDevi
 		throw std::runtime_error("Failed to create buffer!");
 	}
 
-	// allocate memory for buffer
+	// sub-allocate memory for buffer
 	VkMemoryRequirements memory_req;
 	vkGetBufferMemoryRequirements(graphics_device, buffer, &memory_req);
 
-	VkMemoryAllocateInfo memory_alloc_info = {};
-	memory_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memory_alloc_info.allocationSize = memory_req.size;
-	memory_alloc_info.memoryTypeIndex = findMemoryType(memory_req.memoryTypeBits
-		, property_bits
-		, physical_device);
-
-	VkDeviceMemory buffer_memory;
-	auto memory_result = vkAllocateMemory(graphics_device, &memory_alloc_info, nullptr, &buffer_memory);
-	if (memory_result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate buffer memory!");
-	}
+	auto buffer_memory = context->getMemoryAllocator().allocate(memory_req, property_bits, true);
 
 	// bind buffer with memory
-	auto bind_result = vkBindBufferMemory(graphics_device, buffer, buffer_memory, 0);
+	auto bind_result = vkBindBufferMemory(graphics_device, buffer, buffer_memory.getMemory(), buffer_memory.getOffset());
 	if (bind_result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to bind buffer memory!");
@@ -221,13 +191,7 @@ std::tuple<VRaii<VkBuffer>, VRaii<VkDeviceMemory>> VUtility::createBuffer(VkDevi
 		device.destroyBuffer(obj);
 	};
 
-	auto raii_memory_deleter = [device = this->device](auto& obj)
-	{
-		device.freeMemory(obj);
-	};
-
-	return std::make_tuple(VRaii<VkBuffer>(buffer, raii_buffer_deleter)
-		, VRaii<VkDeviceMemory>(buffer_memory, raii_memory_deleter));
+	return std::make_tuple(VRaii<VkBuffer>(buffer, raii_buffer_deleter), std::move(buffer_memory));
 }
 
 void VUtility::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size, VkDeviceSize src_offset, VkDeviceSize dst_offset)
@@ -239,9 +203,9 @@ void VUtility::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize
 	endSingleTimeCommands(copy_command_buffer);
 }
 
-std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>> VUtility::createImage(uint32_t image_width, uint32_t image_height
+std::tuple<VRaii<VkImage>, VMemoryAllocation> VUtility::createImage(uint32_t image_width, uint32_t image_height
 	, VkFormat format, VkImageTiling tiling
-	, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties)
+	, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties, uint32_t mip_levels)
 {
 	VkImageCreateInfo image_info = {};
 	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -249,7 +213,7 @@ std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>> VUtility::createImage(uint32_t
 	image_info.extent.width = image_width;
 	image_info.extent.height = image_height;
 	image_info.extent.depth = 1;
-	image_info.mipLevels = 1;
+	image_info.mipLevels = mip_levels;
 	image_info.arrayLayers = 1;
 
 	image_info.format = format; //VK_FORMAT_R8G8B8A8_UNORM;
@@ -269,36 +233,20 @@ std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>> VUtility::createImage(uint32_t
 		throw std::runtime_error("failed to create image!");
 	}
 
-	// allocate image memory
+	// sub-allocate image memory
 	VkMemoryRequirements memory_req;
 	vkGetImageMemoryRequirements(graphics_device, vkimage, &memory_req);
 
-	VkMemoryAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = memory_req.size;
-	alloc_info.memoryTypeIndex = findMemoryType(memory_req.memoryTypeBits
-		, memory_properties
-		, physical_device);
-
-	VkDeviceMemory memory;
-	if (vkAllocateMemory(graphics_device, &alloc_info, nullptr, &memory) != VK_SUCCESS)
-	{
-		throw std::runtime_error("failed to allocate image memory!");
-	}
+	auto memory = context->getMemoryAllocator().allocate(memory_req, memory_properties, tiling == VK_IMAGE_TILING_LINEAR);
 
-	vkBindImageMemory(graphics_device, vkimage, memory, 0);
+	vkBindImageMemory(graphics_device, vkimage, memory.getMemory(), memory.getOffset());
 
 	auto raii_image_deleter = [device = this->device](auto& obj)
 	{
 		device.destroyImage(obj);
 	};
 
-	auto raii_memory_deleter = [device = this->device](auto& obj)
-	{
-		device.freeMemory(obj);
-	};
-
-	return std::make_tuple(VRaii<VkImage>(vkimage, raii_image_deleter), VRaii<VkDeviceMemory>(memory, raii_memory_deleter));
+	return std::make_tuple(VRaii<VkImage>(vkimage, raii_image_deleter), std::move(memory));
 }
 
 void VUtility::copyImage(VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height)
@@ -320,7 +268,7 @@ void VUtility::transitImageLayout(VkImage image, VkImageLayout old_layout, VkIma
 
 }
 
-void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view)
+void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view, uint32_t mip_levels, uint32_t base_mip_level)
 {
 	VkImageViewCreateInfo viewInfo = {};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -335,8 +283,8 @@ void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlag
 	viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
 
 	viewInfo.subresourceRange.aspectMask = aspect_mask;
-	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseMipLevel = base_mip_level;
+	viewInfo.subresourceRange.levelCount = mip_levels;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 
@@ -347,14 +295,14 @@ void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlag
 }
 
 
-VRaii<VkImageView> VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask)
+VRaii<VkImageView> VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, uint32_t mip_levels, uint32_t base_mip_level)
 {
 	VkImageView img_view;
-	createImageView(image, format, aspect_mask, &img_view);
+	createImageView(image, format, aspect_mask, &img_view, mip_levels, base_mip_level);
 	return VRaii<VkImageView>(img_view, [device = this->device](auto& obj) {device.destroyImageView(obj); });
 }
 
-std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>, VRaii<VkImageView>> VUtility::loadImageFromFile(std::string path)
+std::tuple<VRaii<VkImage>, VMemoryAllocation, VRaii<VkImageView>> VUtility::loadImageFromFile(std::string path)
 {
 	// TODO: maybe move to vulkan_util or a VulkanDevice class
 
@@ -374,7 +322,7 @@ std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>, VRaii<VkImageView>> VUtility::
 
 	// create staging image memory
 	VRaii<VkImage> staging_image;
-	VRaii<VkDeviceMemory> staging_image_memory;
+	VMemoryAllocation staging_image_memory;
 	std::tie(staging_image, staging_image_memory) = createImage(
 		tex_width, tex_height
 		, VK_FORMAT_R8G8B8A8_UNORM
@@ -384,16 +332,13 @@ std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>, VRaii<VkImageView>> VUtility::
 	);
 
 	// copy image to staging memory
-	void* data;
-	vkMapMemory(graphics_device, staging_image_memory.get(), 0, image_size, 0, &data);
-	memcpy(data, pixels, (size_t)image_size);
-	vkUnmapMemory(graphics_device, staging_image_memory.get());
+	memcpy(staging_image_memory.getMappedData(), pixels, (size_t)image_size);
 
 	// free image in memory
 	stbi_image_free(pixels);
 
 	VRaii<VkImage> image;
-	VRaii<VkDeviceMemory> image_memory;
+	VMemoryAllocation image_memory;
 	// create texture image
 	std::tie(image, image_memory) = createImage(
 		tex_width, tex_height
@@ -493,7 +438,8 @@ void VUtility::recordCopyImage(VkCommandBuffer command_buffer, VkImage src_image
 	);
 }
 
-void VUtility::recordTransitImageLayout(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout)
+void VUtility::recordTransitImageLayout(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout
+	, uint32_t base_mip_level, uint32_t mip_levels)
 {
 	// barrier is used to ensure a buffer has finished writing before
 	// reading as weel as doing transition
@@ -514,8 +460,8 @@ void VUtility::recordTransitImageLayout(VkCommandBuffer command_buffer, VkImage
 		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	}
 
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseMipLevel = base_mip_level;
+	barrier.subresourceRange.levelCount = mip_levels;
 	barrier.subresourceRange.baseArrayLayer = 0;
 	barrier.subresourceRange.layerCount = 1;
 
@@ -558,6 +504,12 @@ void VUtility::recordTransitImageLayout(VkCommandBuffer command_buffer, VkImage
 		barrier.srcAccessMask = 0;
 		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 	}
+	else if (old_layout == VK_IMAGE_LAYOUT_UNDEFINED && new_layout == VK_IMAGE_LAYOUT_GENERAL)
+	{
+		// images written and read by compute shaders
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	}
 	else
 	{
 		throw std::invalid_argument("unsupported layout transition!");
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "raii.h"
+#include "memory_allocator.h"
 
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan.hpp>
@@ -50,20 +51,20 @@ public:
 		);
 	}
 
-	std::tuple<VRaii<VkBuffer>, VRaii<VkDeviceMemory>> createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags property_bits, int sharing_queue_family_index_a = -1, int sharing_queue_family_index_b = -1);
+	std::tuple<VRaii<VkBuffer>, VMemoryAllocation> createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags property_bits, int sharing_queue_family_index_a = -1, int sharing_queue_family_index_b = -1);
 	void copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size, VkDeviceSize src_offset = 0, VkDeviceSize dst_offset = 0);
 
-	std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>> createImage(uint32_t image_width, uint32_t image_height
+	std::tuple<VRaii<VkImage>, VMemoryAllocation> createImage(uint32_t image_width, uint32_t image_height
 		, VkFormat format, VkImageTiling tiling
-		, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties);
+		, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties, uint32_t mip_levels = 1);
 
 	void copyImage(VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height);
 	void transitImageLayout(VkImage image, VkImageLayout old_layout, VkImageLayout new_layout);
 
-	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view);
-	VRaii<VkImageView> createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask);
+	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view, uint32_t mip_levels = 1, uint32_t base_mip_level = 0);
+	VRaii<VkImageView> createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, uint32_t mip_levels = 1, uint32_t base_mip_level = 0);
 
-	std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>, VRaii<VkImageView>> loadImageFromFile(std::string path);
+	std::tuple<VRaii<VkImage>, VMemoryAllocation, VRaii<VkImageView>> loadImageFromFile(std::string path);
 
 	VkCommandBuffer beginSingleTimeCommands();
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
@@ -71,7 +72,8 @@ public:
 	// Called on vulcan command buffer recording
 	void recordCopyBuffer(VkCommandBuffer command_buffer, VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size, VkDeviceSize src_offset = 0, VkDeviceSize dst_offset = 0);
 	void recordCopyImage(VkCommandBuffer command_buffer, VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height);
-	void recordTransitImageLayout(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout);
+	void recordTransitImageLayout(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout
+		, uint32_t base_mip_level = 0, uint32_t mip_levels = 1);
 
 private:
 
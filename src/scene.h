@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include "renderer/vertex_format.h"
+
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
@@ -41,6 +43,19 @@ struct TestSceneConfiguration
 	int light_num;
 	glm::vec3 camera_position;
 	glm::quat camera_rotation;
+	unsigned loader_thread_count = 0; // threads used to parse models, 0 for one per hardware thread, 1 for the single-threaded baseline
+	VertexFormat vertex_format = VertexFormat::full;
+	bool optimize_meshes = true;
+	bool meshlet_culling = true; // cull mesh parts and meshlets by view frustum, and meshlets by normal cone, every frame
+	bool occlusion_culling = true; // also cull mesh parts and meshlets hidden in the depth prepass of the previous frame
+	bool software_occlusion = false; // also cull mesh parts hidden behind the largest parts, rasterized on the CPU, to save GPU time
+	unsigned occluder_triangle_budget = 32768; // triangles of the largest parts rasterized by software occlusion
+	bool generate_lods = true;
+	float lod_pixel_error = 1.0f; // screen-space error in pixels allowed when picking mesh LODs, 0 for full detail
+	bool generate_mipmaps = true; // full mip chains for material textures, built by GPU blits at load time
+	bool compress_textures = true; // BC1/BC3/BC5 material textures, transcoded once and cached next to the image files
+	unsigned texture_budget_mb = 256; // device memory for streamed mip levels of material textures, 0 to load every level up front
+	unsigned instance_count = 1; // copies of the model side by side along x, each drawn as an instance of the same draws
 };
 
 TestSceneConfiguration& getGlobalTestSceneConfiguration();
\ No newline at end of file
@@ -2,3 +2,7 @@ glslangValidator.exe -V forwardplus.vert -o ../../content/forwardplus_vert.spv
 glslangValidator.exe -V forwardplus.frag -o ../../content/forwardplus_frag.spv
 glslangValidator.exe -V light_culling.comp.glsl -o ../../content/light_culling_comp.spv -S comp
 glslangValidator.exe -V depth.vert -o ../../content/depth_vert.spv
+glslangValidator.exe -V forwardplus_compact.vert -o ../../content/forwardplus_compact_vert.spv
+glslangValidator.exe -V depth_compact.vert -o ../../content/depth_compact_vert.spv
+glslangValidator.exe -V meshlet_culling.comp.glsl -o ../../content/meshlet_culling_comp.spv -S comp
+glslangValidator.exe -V depth_pyramid.comp.glsl -o ../../content/depth_pyramid_comp.spv -S comp
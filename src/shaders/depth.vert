@@ -1,10 +1,8 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
 
-layout(std140, set = 0, binding = 0) uniform SceneObjectUbo
-{
-    mat4 model;
-} transform;
+#include "instances.glsl"
 
 layout(std140, set = 1, binding = 0) buffer readonly CameraUbo // FIXME: change back to uniform
 {
@@ -21,14 +19,11 @@ layout(location = 0) in vec3 in_position;
 
 out gl_PerVertex
 {
-    vec4 gl_Position;
+    invariant vec4 gl_Position; // must match between the depth prepass and the forward pass
 };
 
 // Vertex shader for depth prepass
 void main()
 {
-    //todo: calculate them in cpu...
-    mat4 mvp = camera.projview * transform.model;
-
-    gl_Position = mvp * vec4(in_position, 1.0);
+    gl_Position = instances[gl_InstanceIndex].mvp * vec4(in_position, 1.0);
 }
@@ -0,0 +1,33 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "instances.glsl"
+
+layout(std140, set = 1, binding = 0) buffer readonly CameraUbo // FIXME: change back to uniform
+{
+    mat4 view;
+    mat4 proj;
+    mat4 projview;
+    vec3 cam_pos;
+} camera;
+
+layout(push_constant) uniform VertexPushConstantObject
+{
+    layout(offset = 32) vec4 position_scale;
+    vec4 position_bias;
+} vertex_push_constants;
+
+layout(location = 0) in vec3 in_position; // float3, or unorm16 to be dequantized
+
+out gl_PerVertex
+{
+    invariant vec4 gl_Position; // must match between the depth prepass and the forward pass
+};
+
+// Vertex shader for depth prepass, compact and quantized vertex formats
+void main()
+{
+    vec3 position = vertex_push_constants.position_bias.xyz + vertex_push_constants.position_scale.xyz * in_position;
+    gl_Position = instances[gl_InstanceIndex].mvp * vec4(position, 1.0);
+}
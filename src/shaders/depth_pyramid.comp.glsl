@@ -0,0 +1,33 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Builds one level of the depth pyramid: each texel holds the farthest depth of the 2x2 texels below it,
+// clamped at the edges so levels of odd size still cover every texel of the level below
+
+layout(push_constant) uniform PushConstantObject
+{
+	ivec2 source_size;
+	ivec2 size;
+} push_constants;
+
+layout(set = 0, binding = 0) uniform sampler2D source; // the depth prepass output or the level below
+layout(set = 0, binding = 1, r32f) uniform writeonly image2D level;
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(texel, push_constants.size)))
+	{
+		return;
+	}
+
+	ivec2 source_max = push_constants.source_size - 1;
+	ivec2 source_texel = texel * 2;
+	float depth = texelFetch(source, min(source_texel, source_max), 0).r;
+	depth = max(depth, texelFetch(source, min(source_texel + ivec2(1, 0), source_max), 0).r);
+	depth = max(depth, texelFetch(source, min(source_texel + ivec2(0, 1), source_max), 0).r);
+	depth = max(depth, texelFetch(source, min(source_texel + ivec2(1, 1), source_max), 0).r);
+	imageStore(level, texel, vec4(depth));
+}
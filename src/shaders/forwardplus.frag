@@ -1,5 +1,6 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable // runtime sized texture array
 
 const int TILE_SIZE = 16;
 
@@ -21,13 +22,9 @@ layout(push_constant) uniform PushConstantObject
 	ivec2 viewport_size;
 	ivec2 tile_nums;
     int debugview_index;
+    int material_index; // the same for the whole draw
 } push_constants;
 
-layout(std140, set = 0, binding = 0) uniform SceneObjectUbo
-{
-    mat4 model;
-} transform;
-
 // layout(set = 0, binding = 1) uniform sampler2D tex_sampler;
 // layout(set = 0, binding = 2) uniform sampler2D normal_sampler;
 
@@ -52,14 +49,19 @@ layout(std140, set = 2, binding = 1) buffer readonly PointLights // FIXME: chang
 
 layout(set = 3, binding = 0) uniform sampler2D depth_sampler;
 
-layout(std140, set = 4, binding = 0) uniform MaterialUbo
+struct Material
+{
+    int albedo_texture; // into material_textures, -1 for none
+    int normal_texture;
+};
+
+layout(std430, set = 4, binding = 0) buffer readonly Materials
 {
-    int has_albedo_map;
-    int has_normal_map;
-} material;
+    Material materials[];
+};
 
-layout(set = 4, binding = 1) uniform sampler2D albedo_sampler;
-layout(set = 4, binding = 2) uniform sampler2D normal_sampler;
+// every texture of the model, only those indexed by materials are written
+layout(set = 4, binding = 1) uniform sampler2D material_textures[];
 
 layout(location = 0) in vec3 frag_color;
 layout(location = 1) in vec2 frag_tex_coord;
@@ -70,9 +72,11 @@ layout(location = 0) out vec4 out_color;
 
 layout(early_fragment_tests) in; // for early depth test
 
-vec3 applyNormalMap(vec3 geomnor, vec3 normap)
+// normal maps may be BC5 with only x and y stored, so z is always reconstructed
+vec3 applyNormalMap(vec3 geomnor, vec2 normap_xy)
 {
-    normap = normap * 2.0 - 1.0;
+    vec2 xy = normap_xy * 2.0 - 1.0;
+    vec3 normap = vec3(xy, sqrt(max(0.0, 1.0 - dot(xy, xy))));
     vec3 up = normalize(vec3(0.001, 1, 0.001));
     vec3 surftan = normalize(cross(geomnor, up));
     vec3 surfbinor = cross(geomnor, surftan);
@@ -81,11 +85,12 @@ vec3 applyNormalMap(vec3 geomnor, vec3 normap)
 
 void main()
 {
+    Material material = materials[push_constants.material_index];
 
     vec3 diffuse;
-    if (material.has_albedo_map > 0)
+    if (material.albedo_texture >= 0)
     {
-        diffuse = texture(albedo_sampler, frag_tex_coord).rgb;
+        diffuse = texture(material_textures[material.albedo_texture], frag_tex_coord).rgb;
     }
     else
     {
@@ -93,9 +98,9 @@ void main()
     }
 
     vec3 normal;
-    if (material.has_normal_map > 0)
+    if (material.normal_texture >= 0)
     {
-        normal = applyNormalMap(frag_normal, texture(normal_sampler, frag_tex_coord).rgb);
+        normal = applyNormalMap(frag_normal, texture(material_textures[material.normal_texture], frag_tex_coord).rg);
     }
     else
     {
@@ -1,10 +1,8 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
 
-layout(std140, set = 0, binding = 0) uniform SceneObjectUbo
-{
-    mat4 model;
-} transform;
+#include "instances.glsl"
 
 layout(std140, set = 1, binding = 0) buffer readonly CameraUbo // FIXME: change back to uniform
 {
@@ -26,20 +24,18 @@ layout(location = 3) out vec3 frag_pos_world;
 
 out gl_PerVertex
 {
-    vec4 gl_Position;
+    invariant vec4 gl_Position; // must match between the depth prepass and the forward pass
 };
 
 void main()
 {
-    // TODO: calculate them upfront, in CPU or something
-    mat4 invtransmodel =  transpose(inverse(transform.model));
-    mat4 mvp = camera.projview * transform.model;
+    InstanceData instance = instances[gl_InstanceIndex];
 
-    gl_Position = mvp * vec4(in_position, 1.0);
+    gl_Position = instance.mvp * vec4(in_position, 1.0);
     frag_color = in_color;
     frag_tex_coord = in_tex_coord;
 
     // TODO: do everything view or projection space
-    frag_normal = normalize((invtransmodel * vec4(in_normal, 0.0)).xyz);
-    frag_pos_world = vec3(transform.model * vec4(in_position, 1.0));
+    frag_normal = normalize((instance.normal * vec4(in_normal, 0.0)).xyz);
+    frag_pos_world = vec3(instance.model * vec4(in_position, 1.0));
 }
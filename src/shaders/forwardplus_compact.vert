@@ -0,0 +1,59 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "instances.glsl"
+
+layout(std140, set = 1, binding = 0) buffer readonly CameraUbo // FIXME: change back to uniform
+{
+    mat4 view;
+    mat4 proj;
+    mat4 projview;
+    vec3 cam_pos;
+} camera;
+
+// offset 0 is taken by fragment stage push constants
+layout(push_constant) uniform VertexPushConstantObject
+{
+    layout(offset = 32) vec4 position_scale;
+    vec4 position_bias;
+} vertex_push_constants;
+
+layout(location = 0) in vec3 in_position; // float3, or unorm16 to be dequantized
+layout(location = 2) in vec2 in_tex_coord; // half2
+layout(location = 3) in vec2 in_normal; // octahedral snorm16x2
+
+layout(location = 0) out vec3 frag_color;
+layout(location = 1) out vec2 frag_tex_coord;
+layout(location = 2) out vec3 frag_normal;
+layout(location = 3) out vec3 frag_pos_world;
+
+out gl_PerVertex
+{
+    invariant vec4 gl_Position; // must match between the depth prepass and the forward pass
+};
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// Vertex shader for the compact and quantized vertex formats
+void main()
+{
+    InstanceData instance = instances[gl_InstanceIndex];
+
+    vec3 position = vertex_push_constants.position_bias.xyz + vertex_push_constants.position_scale.xyz * in_position;
+
+    gl_Position = instance.mvp * vec4(position, 1.0);
+    frag_color = vec3(1.0);
+    frag_tex_coord = in_tex_coord;
+
+    // TODO: do everything view or projection space
+    frag_normal = normalize((instance.normal * vec4(decodeOctahedral(in_normal), 0.0)).xyz);
+    frag_pos_world = vec3(instance.model * vec4(position, 1.0));
+}
@@ -0,0 +1,14 @@
+// Included by the vertex shaders, matches InstanceData and the object descriptor set in VulkanRenderer.cpp
+
+struct InstanceData
+{
+    mat4 model;
+    mat4 normal; // transpose(inverse(model)), computed on the CPU
+    mat4 mvp;
+};
+
+// every copy of the model, one draw instance each
+layout(std430, set = 0, binding = 0) buffer readonly Instances
+{
+    InstanceData instances[];
+};
@@ -0,0 +1,236 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Culls the meshlets of the picked levels of detail against the view frustums of the copies of the model, their normal cones
+// and the depth pyramid of the previous frame, and writes the indirect draws of the depth prepass and the forward pass.
+// Runs twice: first over the mesh parts, to reject occluded parts as a whole, then over the meshlets
+
+struct MeshletRecord
+{
+	vec4 sphere; // model space center and radius
+	vec4 cone; // axis and cutoff, see Meshlet
+	vec4 box_min; // model space bounds of the vertices
+	vec4 box_max;
+	uint first_index; // in the index section of the part
+	uint index_count;
+	int vertex_offset; // in the geometry pool
+	int position_offset; // in the depth geometry pool
+	uint part;
+	uint meshlet; // in the part
+	uint padding0;
+	uint padding1;
+};
+
+// written by the CPU every frame
+struct PartState
+{
+	vec4 box_min; // model space
+	vec4 box_max;
+	uint first_meshlet; // of the picked level of detail
+	uint meshlet_count;
+	uint visibility; // 0: outside the frustum, 1: crossing it, 2: inside, 3: occluded, by software occlusion or the part pass
+	uint first_draw;
+};
+
+struct Frustum
+{
+	vec4 planes[6]; // model space, pointing inwards
+};
+
+struct DrawIndexedIndirectCommand
+{
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int vertex_offset;
+	uint first_instance;
+};
+
+layout(push_constant) uniform PushConstantObject
+{
+	uint count; // of mesh parts or meshlets
+	uint compact_draws; // visible draws packed at the first draw of each part and counted, or culled draws left with no instances
+	uint part_pass;
+} push_constants;
+
+layout(std430, set = 0, binding = 0) buffer readonly MeshletRecords
+{
+	MeshletRecord meshlets[];
+};
+
+// MAX_INSTANCE_COUNT in VulkanRenderer.cpp
+const uint MAX_INSTANCE_COUNT = 1024;
+
+layout(std430, set = 0, binding = 1) buffer Culling
+{
+	vec4 viewer_position; // model space of the only instance; w is 0 to skip cone culling
+	mat4 pyramid_projview; // model space to the clip space of the frame the depth pyramid was built from
+	ivec4 pyramid; // depth buffer width and height, pyramid level count, and 0 to skip occlusion culling
+	uvec4 instances; // x: copies of the model, each drawn as an instance of every draw; y: frustums to test against, 0 to draw every meshlet of the picked levels
+	Frustum frustums[MAX_INSTANCE_COUNT]; // of each copy
+	PartState parts[];
+};
+
+layout(std430, set = 0, binding = 2) buffer writeonly Draws
+{
+	DrawIndexedIndirectCommand draws[];
+};
+
+layout(std430, set = 0, binding = 3) buffer writeonly DepthDraws
+{
+	DrawIndexedIndirectCommand depth_draws[];
+};
+
+layout(std430, set = 0, binding = 4) buffer DrawCounts
+{
+	uint visible_meshlet_count;
+	uint visible_triangle_count;
+	uint occluded_part_count;
+	uint occluded_triangle_count;
+	uint draw_counts[]; // per part
+};
+
+// farthest depth of every depth buffer texel, level 0 at half the resolution of the depth buffer
+layout(set = 0, binding = 5) uniform sampler2D depth_pyramid;
+
+layout(local_size_x = 64) in;
+
+// whether a model space sphere is in the frustum of any copy of the model
+bool isInAnyFrustum(vec4 sphere)
+{
+	for (uint f = 0; f < instances.y; f++)
+	{
+		bool inside = true;
+		for (int i = 0; i < 6; i++)
+		{
+			inside = inside && dot(frustums[f].planes[i].xyz, sphere.xyz) + frustums[f].planes[i].w >= -sphere.w;
+		}
+		if (inside)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+* Whether a model space box lies behind the depth the pyramid holds over its screen rectangle.
+* Boxes crossing the near plane of the pyramid's frame are never occluded
+*/
+bool isOccluded(vec3 box_min, vec3 box_max)
+{
+	vec2 uv_min = vec2(1.0);
+	vec2 uv_max = vec2(0.0);
+	float nearest_depth = 1.0;
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = vec3((i & 1) != 0 ? box_max.x : box_min.x, (i & 2) != 0 ? box_max.y : box_min.y, (i & 4) != 0 ? box_max.z : box_min.z);
+		vec4 clip = pyramid_projview * vec4(corner, 1.0);
+		if (clip.w <= 0.0 || clip.z < 0.0)
+		{
+			return false;
+		}
+		vec3 ndc = clip.xyz / clip.w;
+		uv_min = min(uv_min, ndc.xy * 0.5 + 0.5);
+		uv_max = max(uv_max, ndc.xy * 0.5 + 0.5);
+		nearest_depth = min(nearest_depth, ndc.z);
+	}
+	if (any(greaterThan(uv_min, vec2(1.0))) || any(lessThan(uv_max, vec2(0.0))))
+	{
+		return false; // off screen in that frame, nothing is known about it
+	}
+
+	// depth buffer texels covered, then the finest level where they span at most 2x2 texels;
+	// texel t of level l covers the depth buffer texels t * 2^(l + 1) to (t + 1) * 2^(l + 1) - 1
+	ivec2 depth_max = pyramid.xy - 1;
+	ivec2 texel_min = clamp(ivec2(uv_min * vec2(pyramid.xy)), ivec2(0), depth_max);
+	ivec2 texel_max = clamp(ivec2(uv_max * vec2(pyramid.xy)), ivec2(0), depth_max);
+	ivec2 span = texel_max - texel_min;
+	int level = clamp(findMSB(max(span.x, span.y)), 0, pyramid.z - 1);
+	texel_min >>= level + 1;
+	texel_max >>= level + 1;
+
+	float farthest_depth = 0.0;
+	for (int y = texel_min.y; y <= texel_max.y; y++)
+	{
+		for (int x = texel_min.x; x <= texel_max.x; x++)
+		{
+			farthest_depth = max(farthest_depth, texelFetch(depth_pyramid, ivec2(x, y), level).r);
+		}
+	}
+	return nearest_depth > farthest_depth;
+}
+
+void main()
+{
+	uint id = gl_GlobalInvocationID.x;
+	if (id >= push_constants.count)
+	{
+		return;
+	}
+
+	if (push_constants.part_pass != 0)
+	{
+		PartState part = parts[id];
+		if ((part.visibility == 1 || part.visibility == 2) && pyramid.w != 0 && isOccluded(part.box_min.xyz, part.box_max.xyz))
+		{
+			parts[id].visibility = 3;
+			atomicAdd(occluded_part_count, 1);
+		}
+		return;
+	}
+
+	MeshletRecord meshlet = meshlets[id];
+	PartState part = parts[meshlet.part];
+
+	bool picked = meshlet.meshlet >= part.first_meshlet && meshlet.meshlet < part.first_meshlet + part.meshlet_count;
+	bool visible = picked && part.visibility != 0 && part.visibility != 3;
+	if (visible && instances.y != 0)
+	{
+		// parts inside the frustum of a copy have all their meshlets in it
+		if (part.visibility == 1)
+		{
+			visible = isInAnyFrustum(meshlet.sphere);
+		}
+		if (viewer_position.w != 0.0)
+		{
+			vec3 view_offset = meshlet.sphere.xyz - viewer_position.xyz;
+			visible = visible && dot(view_offset, meshlet.cone.xyz) < meshlet.cone.w * length(view_offset) + meshlet.sphere.w;
+		}
+
+		if (visible && pyramid.w != 0 && isOccluded(meshlet.box_min.xyz, meshlet.box_max.xyz))
+		{
+			visible = false;
+			atomicAdd(occluded_triangle_count, meshlet.index_count / 3);
+		}
+	}
+	else if (picked && part.visibility == 3)
+	{
+		atomicAdd(occluded_triangle_count, meshlet.index_count / 3);
+	}
+
+	uint slot = id;
+	if (push_constants.compact_draws != 0)
+	{
+		if (!visible)
+		{
+			return;
+		}
+		slot = part.first_draw + atomicAdd(draw_counts[meshlet.part], 1);
+	}
+	if (visible)
+	{
+		atomicAdd(visible_meshlet_count, 1);
+		atomicAdd(visible_triangle_count, meshlet.index_count / 3);
+	}
+
+	DrawIndexedIndirectCommand draw;
+	draw.index_count = meshlet.index_count;
+	draw.instance_count = visible ? instances.x : 0;
+	draw.first_index = meshlet.first_index;
+	draw.vertex_offset = meshlet.vertex_offset;
+	draw.first_instance = 0;
+	draws[slot] = draw;
+	draw.vertex_offset = meshlet.position_offset;
+	depth_draws[slot] = draw;
+}
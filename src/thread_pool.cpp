@@ -0,0 +1,59 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "thread_pool.h"
+
+util::ThreadPool::ThreadPool(unsigned thread_count)
+{
+	if (thread_count == 0)
+	{
+		thread_count = getDefaultThreadCount();
+	}
+
+	workers.reserve(thread_count);
+	for (unsigned i = 0; i < thread_count; i++)
+	{
+		workers.emplace_back([this]() { workerLoop(); });
+	}
+}
+
+util::ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	queue_condition.notify_all();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+unsigned util::ThreadPool::getDefaultThreadCount()
+{
+	auto count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+void util::ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			queue_condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+			if (tasks.empty())
+			{
+				return; // stopping and drained
+			}
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
@@ -0,0 +1,86 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace util
+{
+	/**
+	* A fixed-size pool of worker threads consuming a FIFO task queue.
+	* Workers are joined on destruction after the queue drains
+	*/
+	class ThreadPool
+	{
+	public:
+		// thread_count == 0 means one worker per hardware thread
+		explicit ThreadPool(unsigned thread_count = 0);
+		~ThreadPool();
+
+		ThreadPool(ThreadPool&&) = delete;
+		ThreadPool& operator= (ThreadPool&&) = delete;
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator= (const ThreadPool&) = delete;
+
+		unsigned getThreadCount() const
+		{
+			return static_cast<unsigned>(workers.size());
+		}
+
+		template <typename F>
+		auto submit(F&& task) -> std::future<decltype(task())>
+		{
+			using result_t = decltype(task());
+			auto packaged = std::make_shared<std::packaged_task<result_t()>>(std::forward<F>(task));
+			auto future = packaged->get_future();
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				tasks.emplace([packaged]() { (*packaged)(); });
+			}
+			queue_condition.notify_one();
+			return future;
+		}
+
+		/**
+		* Calls func(i) for every i in [0, count) on the workers and blocks until all calls return.
+		* Rethrows the first exception thrown by func
+		*/
+		template <typename F>
+		void parallelFor(size_t count, F&& func)
+		{
+			std::vector<std::future<void>> futures;
+			futures.reserve(count);
+			for (size_t i = 0; i < count; i++)
+			{
+				futures.push_back(submit([&func, i]() { func(i); }));
+			}
+			for (auto& future : futures)
+			{
+				future.wait();
+			}
+			for (auto& future : futures)
+			{
+				future.get();
+			}
+		}
+
+		static unsigned getDefaultThreadCount();
+
+	private:
+		std::vector<std::thread> workers;
+		std::queue<std::function<void()>> tasks;
+		std::mutex queue_mutex;
+		std::condition_variable queue_condition;
+		bool stopping = false;
+
+		void workerLoop();
+	};
+}
@@ -9,6 +9,19 @@
 #include <unordered_map>
 #include <tuple>
 #include <array>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 // TODO
 
@@ -32,3 +45,145 @@ std::vector<char> util::readFile(const std::string & filename)
 	return buffer;
 }
 
+
+bool util::getFileStat(const std::string& filename, FileStat* stat)
+{
+#ifdef _WIN32
+	struct _stat64 file_stat;
+	if (_stat64(filename.c_str(), &file_stat) != 0)
+	{
+		return false;
+	}
+#else
+	struct ::stat file_stat;
+	if (::stat(filename.c_str(), &file_stat) != 0)
+	{
+		return false;
+	}
+#endif
+	stat->size = static_cast<uint64_t>(file_stat.st_size);
+	stat->modified_time = static_cast<int64_t>(file_stat.st_mtime);
+	return true;
+}
+
+std::string util::getCanonicalPath(const std::string& filename)
+{
+	std::string canonical_path = filename;
+	std::replace(canonical_path.begin(), canonical_path.end(), '\\', '/');
+#ifdef _WIN32
+	char full_path[_MAX_PATH];
+	if (_fullpath(full_path, canonical_path.c_str(), _MAX_PATH))
+	{
+		canonical_path = full_path;
+		std::replace(canonical_path.begin(), canonical_path.end(), '\\', '/');
+	}
+	std::transform(canonical_path.begin(), canonical_path.end(), canonical_path.begin(), [](char c)
+	{
+		return static_cast<char>(::tolower(static_cast<unsigned char>(c)));
+	});
+#else
+	char* resolved_path = ::realpath(canonical_path.c_str(), nullptr);
+	if (resolved_path)
+	{
+		canonical_path = resolved_path;
+		free(resolved_path);
+	}
+#endif
+	return canonical_path;
+}
+
+util::MappedFile::~MappedFile()
+{
+	close();
+}
+
+util::MappedFile::MappedFile(MappedFile&& other)
+{
+	*this = std::move(other);
+}
+
+util::MappedFile& util::MappedFile::operator=(MappedFile&& other)
+{
+	using std::swap;
+	swap(mapped_data, other.mapped_data);
+	swap(mapped_size, other.mapped_size);
+#ifdef _WIN32
+	swap(file_handle, other.file_handle);
+	swap(mapping_handle, other.mapping_handle);
+#else
+	swap(file_descriptor, other.file_descriptor);
+#endif
+	return *this;
+}
+
+bool util::MappedFile::open(const std::string& filename)
+{
+	close();
+
+	FileStat stat;
+	if (!getFileStat(filename, &stat) || stat.size == 0)
+	{
+		return false;
+	}
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	mapping_handle = mapping;
+	mapped_data = view;
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	void* view = mmap(nullptr, static_cast<size_t>(stat.size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+	{
+		::close(fd);
+		return false;
+	}
+	file_descriptor = fd;
+	mapped_data = view;
+#endif
+	mapped_size = static_cast<size_t>(stat.size);
+	return true;
+}
+
+void util::MappedFile::close()
+{
+	if (!mapped_data)
+	{
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(mapped_data);
+	CloseHandle(mapping_handle);
+	CloseHandle(file_handle);
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+#else
+	munmap(mapped_data, mapped_size);
+	::close(file_descriptor);
+	file_descriptor = -1;
+#endif
+	mapped_data = nullptr;
+	mapped_size = 0;
+}
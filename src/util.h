@@ -10,6 +10,7 @@
 #include <vector>
 #include <tuple>
 #include <memory>
+#include <cstdint>
 
 namespace util
 {
@@ -62,6 +63,66 @@ namespace util
 
 	std::vector<char> readFile(const std::string& filename);
 
+	struct FileStat
+	{
+		uint64_t size = 0;
+		int64_t modified_time = 0;
+	};
+
+	// returns false if the file does not exist
+	bool getFileStat(const std::string& filename, FileStat* stat);
+
+	/**
+	* Absolute path with symbolic links and "." or ".." components resolved, and '/' as separator
+	* (lowercase on Windows), so that different spellings of a path to one file compare equal.
+	* Returns the path with only separators normalized if the file does not exist
+	*/
+	std::string getCanonicalPath(const std::string& filename);
+
+	/**
+	* A read-only memory mapping of a whole file, unmapped on destruction
+	*/
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(MappedFile&& other);
+		MappedFile& operator= (MappedFile&& other);
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator= (const MappedFile&) = delete;
+
+		// returns false if the file cannot be opened or mapped
+		bool open(const std::string& filename);
+		void close();
+
+		const char* data() const
+		{
+			return static_cast<const char*>(mapped_data);
+		}
+
+		size_t size() const
+		{
+			return mapped_size;
+		}
+
+		bool isOpen() const
+		{
+			return mapped_data != nullptr;
+		}
+
+	private:
+		void* mapped_data = nullptr;
+		size_t mapped_size = 0;
+#ifdef _WIN32
+		void* file_handle = nullptr;
+		void* mapping_handle = nullptr;
+#else
+		int file_descriptor = -1;
+#endif
+	};
+
 	constexpr glm::vec3 vec_up = glm::vec3(0.0f, 1.0f, 0.0f);
 	constexpr glm::vec3 vec_right = glm::vec3(1.0f, 0.0f, 0.0f);
 	constexpr glm::vec3 vec_forward = glm::vec3(0.0f, 0.0f, -1.0f);
@@ -0,0 +1,233 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+// CPU tests of SoftwareOcclusionBuffer, built once per SIMD path of software_occlusion.cpp
+
+#include "renderer/software_occlusion.h"
+#include "thread_pool.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <iostream>
+#include <cmath>
+
+namespace
+{
+	// exit code ctest reports as skipped
+	const int SKIP_RETURN_CODE = 77;
+
+	int failure_count = 0;
+
+	void check(bool condition, const char* what)
+	{
+		if (!condition)
+		{
+			std::cerr << "FAILED: " << what << std::endl;
+			failure_count++;
+		}
+	}
+
+	BoundingBox makeCube(const glm::vec3& center, float half_size)
+	{
+		BoundingBox box;
+		box.expand(center - half_size);
+		box.expand(center + half_size);
+		return box;
+	}
+
+	// an axis aligned rectangle of two triangles, in clip space with w = 1
+	void addClipRectangle(float min_x, float min_y, float max_x, float max_y, float depth, std::vector<glm::vec4>* positions, std::vector<uint32_t>* indices)
+	{
+		auto first = static_cast<uint32_t>(positions->size());
+		positions->insert(positions->end(), {
+			{ min_x, min_y, depth, 1.0f }, { max_x, min_y, depth, 1.0f }, { max_x, max_y, depth, 1.0f }, { min_x, max_y, depth, 1.0f }
+		});
+		indices->insert(indices->end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+	}
+
+	/**
+	* A rectangle over the whole buffer: the tiles along its diagonal are covered by neither triangle alone,
+	* so they only become full by merging the coverage masks of both
+	*/
+	void testFullScreenRectangle()
+	{
+		SoftwareOcclusionBuffer buffer(64, 32);
+		std::vector<glm::vec4> positions;
+		std::vector<uint32_t> indices;
+		addClipRectangle(-1.0f, -1.0f, 1.0f, 1.0f, 0.5f, &positions, &indices);
+		buffer.rasterize(positions, indices, 0, buffer.getTileRowCount());
+
+		bool all_covered = true;
+		for (float depth : buffer.getTileDepths())
+		{
+			all_covered = all_covered && std::abs(depth - 0.5f) < 1e-5f;
+		}
+		check(all_covered, "a full screen rectangle covers every tile at its depth");
+	}
+
+	// tiles are only written once fully covered, and only within the tile rows asked for
+	void testPartialCoverage()
+	{
+		SoftwareOcclusionBuffer buffer(64, 32);
+		std::vector<glm::vec4> positions;
+		std::vector<uint32_t> indices;
+		addClipRectangle(-1.0f, -1.0f, -0.25f, 1.0f, 0.25f, &positions, &indices); // 24 pixels wide, tile columns 0 to 2
+		addClipRectangle(-0.25f, -1.0f, -0.15f, 1.0f, 0.25f, &positions, &indices); // a strip of 3.2 pixels, in no tile fully
+		buffer.rasterize(positions, indices, 2, 6);
+
+		const auto& depths = buffer.getTileDepths();
+		bool left_covered = true;
+		bool rest_empty = true;
+		for (uint32_t row = 0; row < buffer.getTileRowCount(); row++)
+		{
+			for (uint32_t column = 0; column < buffer.getWidth() / SoftwareOcclusionBuffer::TILE_WIDTH; column++)
+			{
+				float depth = depths[row * (buffer.getWidth() / SoftwareOcclusionBuffer::TILE_WIDTH) + column];
+				if (column < 3 && row >= 2 && row < 6)
+				{
+					left_covered = left_covered && std::abs(depth - 0.25f) < 1e-5f;
+				}
+				else
+				{
+					rest_empty = rest_empty && depth == 1.0f;
+				}
+			}
+		}
+		check(left_covered, "fully covered tiles in the rasterized rows take the depth of the triangles");
+		check(rest_empty, "partly covered tiles and tiles outside the rasterized rows stay empty");
+	}
+
+	/**
+	* Rectangles leaving a gap over the center of one pixel in every tile, at a different column or row of the tile each time,
+	* so that a coverage bit computed for the wrong pixel would fill a tile
+	*/
+	void testPixelGaps()
+	{
+		const float gap = 0.1f; // pixels on each side of the pixel center
+		auto toNdc = [](float pixel, float size)
+		{
+			return pixel / size * 2.0f - 1.0f;
+		};
+
+		SoftwareOcclusionBuffer columns(64, 32);
+		std::vector<glm::vec4> positions;
+		std::vector<uint32_t> indices;
+		float start = 0.0f;
+		for (uint32_t tile = 0; tile < 8; tile++)
+		{
+			float center = tile * SoftwareOcclusionBuffer::TILE_WIDTH + tile + 0.5f;
+			addClipRectangle(toNdc(start, 64.0f), -1.0f, toNdc(center - gap, 64.0f), 1.0f, 0.5f, &positions, &indices);
+			start = center + gap;
+		}
+		addClipRectangle(toNdc(start, 64.0f), -1.0f, 1.0f, 1.0f, 0.5f, &positions, &indices);
+		columns.rasterize(positions, indices, 0, columns.getTileRowCount());
+
+		SoftwareOcclusionBuffer rows(8, 32);
+		positions.clear();
+		indices.clear();
+		start = 0.0f;
+		for (uint32_t tile = 0; tile < 8; tile++)
+		{
+			float center = tile * SoftwareOcclusionBuffer::TILE_HEIGHT + tile % SoftwareOcclusionBuffer::TILE_HEIGHT + 0.5f;
+			addClipRectangle(-1.0f, toNdc(start, 32.0f), 1.0f, toNdc(center - gap, 32.0f), 0.5f, &positions, &indices);
+			start = center + gap;
+		}
+		addClipRectangle(-1.0f, toNdc(start, 32.0f), 1.0f, 1.0f, 0.5f, &positions, &indices);
+		rows.rasterize(positions, indices, 0, rows.getTileRowCount());
+
+		bool all_empty = true;
+		for (const auto* buffer : { &columns, &rows })
+		{
+			for (float depth : buffer->getTileDepths())
+			{
+				all_empty = all_empty && depth == 1.0f;
+			}
+		}
+		check(all_empty, "a tile with one uncovered pixel stays empty, wherever the pixel is");
+	}
+
+	// a nearer triangle replaces the depth of a tile, a farther one leaves it
+	void testNearestDepthWins()
+	{
+		SoftwareOcclusionBuffer buffer(64, 32);
+		std::vector<glm::vec4> positions;
+		std::vector<uint32_t> indices;
+		addClipRectangle(-1.0f, -1.0f, 1.0f, 1.0f, 0.6f, &positions, &indices);
+		addClipRectangle(-1.0f, -1.0f, 1.0f, 1.0f, 0.3f, &positions, &indices);
+		addClipRectangle(-1.0f, -1.0f, 1.0f, 1.0f, 0.9f, &positions, &indices);
+		buffer.rasterize(positions, indices, 0, buffer.getTileRowCount());
+
+		bool nearest = true;
+		for (float depth : buffer.getTileDepths())
+		{
+			nearest = nearest && std::abs(depth - 0.3f) < 1e-5f;
+		}
+		check(nearest, "overlapping rectangles leave the nearest depth");
+	}
+
+	/**
+	* A wall in front of the camera and a floor crossing the near plane, rendered through a projection,
+	* on one thread and on a thread pool
+	*/
+	void testOcclusion(util::ThreadPool* thread_pool)
+	{
+		glm::mat4 projection = glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 100.0f);
+		projection[1][1] *= -1;
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::mat4 projview = projection * view;
+
+		OccluderMesh wall;
+		wall.positions = { { -10, -5, -10 }, { 10, -5, -10 }, { 10, 5, -10 }, { -10, 5, -10 } };
+		wall.indices = { 0, 1, 2, 0, 2, 3 };
+		OccluderMesh floor;
+		floor.part = 1;
+		floor.positions = { { -50, -1, 50 }, { 50, -1, 50 }, { 50, -1, -50 }, { -50, -1, -50 } };
+		floor.indices = { 0, 1, 2, 0, 2, 3 };
+
+		SoftwareOcclusionBuffer buffer(256, 128);
+		buffer.render({ wall, floor }, projview, thread_pool);
+
+		check(buffer.isOccluded(makeCube({ 0, 0, -20 }, 1.0f), projview), "a box behind the wall is occluded");
+		check(buffer.isOccluded(makeCube({ 0, -3, -5 }, 0.5f), projview), "a box under the floor is occluded");
+		check(!buffer.isOccluded(makeCube({ 0, 0, -5 }, 1.0f), projview), "a box in front of the wall is visible");
+		check(!buffer.isOccluded(makeCube({ 0, 8, -20 }, 1.0f), projview), "a box above the wall is visible");
+		check(!buffer.isOccluded(makeCube({ 0, 0, -10 }, 0.01f), projview), "a box on the wall is visible");
+		check(!buffer.isOccluded(makeCube({ 0, 0, 0 }, 1.0f), projview), "a box crossing the near plane is visible");
+		check(!buffer.isOccluded(makeCube({ 0, 0, 20 }, 1.0f), projview), "a box behind the camera is visible");
+		check(!buffer.isOccluded(BoundingBox(), projview), "an empty box is visible");
+	}
+}
+
+int main()
+{
+#if defined(__AVX2__)
+#if defined(__GNUC__) || defined(__clang__)
+	if (!__builtin_cpu_supports("avx2"))
+	{
+		std::cout << "Skipped, this CPU has no AVX2" << std::endl;
+		return SKIP_RETURN_CODE;
+	}
+#endif
+	std::cout << "Testing the AVX2 rasterizer" << std::endl;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	std::cout << "Testing the SSE2 rasterizer" << std::endl;
+#else
+	std::cout << "Testing the scalar rasterizer" << std::endl;
+#endif
+
+	testFullScreenRectangle();
+	testPartialCoverage();
+	testPixelGaps();
+	testNearestDepthWins();
+	testOcclusion(nullptr);
+	util::ThreadPool thread_pool(4);
+	testOcclusion(&thread_pool);
+
+	if (failure_count > 0)
+	{
+		std::cerr << failure_count << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+}